@@ -0,0 +1,179 @@
+/*
+ * Active speaker tracking for overlays. Talk edges from onTalkStatusChangeEvent decide who is speaking, the RMS level
+ * measured in onEditPlaybackVoiceDataEvent ranks them. The ranked top speakers are published through a seqlock, so
+ * render threads read a consistent snapshot every frame without locks or system calls, instead of polling
+ * CLIENT_FLAG_TALKING for every client.
+ */
+
+#ifndef TEAMSPEAK_EXT_ACTIVE_SPEAKERS_H
+#define TEAMSPEAK_EXT_ACTIVE_SPEAKERS_H
+
+//system
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak_ext/flat_hash_map.h"
+
+namespace ts3ext {
+
+static const unsigned int MAX_ACTIVE_SPEAKERS = 16;
+
+struct ActiveSpeaker {
+	uint64 serverConnectionHandlerID;
+	anyID  clientID;
+	float  level; ///< smoothed RMS level, 0 to 1
+};
+
+struct ActiveSpeakerSnapshot {
+	uint64        version;  ///< increases with every published change
+	unsigned int  count;
+	ActiveSpeaker speakers[MAX_ACTIVE_SPEAKERS]; ///< loudest first
+};
+
+struct ActiveSpeakerOptions {
+	unsigned int              topN = 4;       ///< published speakers, at most MAX_ACTIVE_SPEAKERS
+	float                     releaseSeconds = 0.3f; ///< level decay time constant, the rise is immediate
+	std::chrono::milliseconds publishInterval = std::chrono::milliseconds(10); ///< minimum time between level only updates
+};
+
+/**
+ * @brief ranks talking clients by voice level and publishes the top speakers
+ *
+ * Forward onTalkStatusChangeEvent, onEditPlaybackVoiceDataEvent and onConnectStatusChangeEvent. Talk edges are
+ * published immediately, level changes at most every publishInterval.
+*/
+class ActiveSpeakerTracker {
+public:
+	explicit ActiveSpeakerTracker(const ActiveSpeakerOptions& options = ActiveSpeakerOptions()) : m_options(options) {
+		if (m_options.topN > MAX_ACTIVE_SPEAKERS)
+			m_options.topN = MAX_ACTIVE_SPEAKERS;
+		for (std::atomic<uint64_t>& word : m_words)
+			word.store(0, std::memory_order_relaxed);
+	}
+
+	ActiveSpeakerTracker(const ActiveSpeakerTracker&) = delete;
+	ActiveSpeakerTracker& operator=(const ActiveSpeakerTracker&) = delete;
+
+	/** @brief copy the latest snapshot. Lock free, retries while a publish is in progress. */
+	void read(ActiveSpeakerSnapshot& snapshot) const {
+		uint64_t words[WORD_COUNT];
+		for (;;) {
+			const uint32_t before = m_sequence.load(std::memory_order_acquire);
+			if ((before & 1) != 0)
+				continue;
+			for (size_t i = 0; i < WORD_COUNT; ++i)
+				words[i] = m_words[i].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (m_sequence.load(std::memory_order_relaxed) == before)
+				break;
+		}
+		std::memcpy(&snapshot, words, sizeof(snapshot));
+	}
+
+	/** @brief cheap change check for readers, compare with the version of the last snapshot read */
+	uint64 version() const { return m_sequence.load(std::memory_order_acquire) / 2; }
+
+	void onTalkStatusChangeEvent(uint64 serverConnectionHandlerID, int status, int /*isReceivedWhisper*/, anyID clientID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const uint64 key = speakerKey(serverConnectionHandlerID, clientID);
+		if (status == STATUS_TALKING) {
+			if (m_speakers.contains(key))
+				return;
+			m_speakers[key] = 0.0f;
+		} else if (!m_speakers.erase(key)) {
+			return;
+		}
+		publish();
+	}
+
+	/** @brief called on the audio thread, only reads the samples */
+	void onEditPlaybackVoiceDataEvent(uint64 serverConnectionHandlerID, anyID clientID, short* samples, int sampleCount, int channels) {
+		const int values = sampleCount * channels;
+		if (values <= 0)
+			return;
+		double sum = 0;
+		for (int i = 0; i < values; ++i)
+			sum += static_cast<double>(samples[i]) * samples[i];
+		const float rms = static_cast<float>(std::sqrt(sum / values) / 32768.0);
+		const float decay = std::exp(-static_cast<float>(sampleCount) / (48000.0f * m_options.releaseSeconds));
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		float* level = m_speakers.find(speakerKey(serverConnectionHandlerID, clientID));
+		if (level == nullptr)
+			return;
+		*level = rms > *level ? rms : *level * decay;
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - m_lastPublish >= m_options.publishInterval)
+			publish();
+	}
+
+	void onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int /*errorNumber*/) {
+		if (newStatus != STATUS_DISCONNECTED)
+			return;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<uint64> gone;
+		m_speakers.forEach([&](uint64 key, float) {
+			if (key >> 16 == serverConnectionHandlerID)
+				gone.push_back(key);
+		});
+		for (uint64 key : gone)
+			m_speakers.erase(key);
+		if (!gone.empty())
+			publish();
+	}
+
+private:
+	static const size_t WORD_COUNT = (sizeof(ActiveSpeakerSnapshot) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+	static_assert(std::is_trivially_copyable<ActiveSpeakerSnapshot>::value, "snapshot is copied word by word");
+
+	static uint64 speakerKey(uint64 serverConnectionHandlerID, anyID clientID) { return serverConnectionHandlerID << 16 | clientID; }
+
+	/*called with the lock held. Only the talking clients are ranked, a handful even on large servers.*/
+	void publish() {
+		m_ranking.clear();
+		m_speakers.forEach([&](uint64 key, float level) {
+			m_ranking.push_back(ActiveSpeaker{key >> 16, static_cast<anyID>(key & 0xffff), level});
+		});
+		const size_t count = std::min<size_t>(m_ranking.size(), m_options.topN);
+		std::partial_sort(m_ranking.begin(), m_ranking.begin() + count, m_ranking.end(), [](const ActiveSpeaker& a, const ActiveSpeaker& b) {
+			return a.level != b.level ? a.level > b.level : a.clientID < b.clientID;
+		});
+
+		ActiveSpeakerSnapshot snapshot;
+		std::memset(&snapshot, 0, sizeof(snapshot));
+		const uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+		snapshot.version = sequence / 2 + 1;
+		snapshot.count = static_cast<unsigned int>(count);
+		std::copy(m_ranking.begin(), m_ranking.begin() + count, snapshot.speakers);
+		uint64_t words[WORD_COUNT] = {0};
+		std::memcpy(words, &snapshot, sizeof(snapshot));
+
+		//seqlock write: odd sequence while the words are inconsistent
+		m_sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < WORD_COUNT; ++i)
+			m_words[i].store(words[i], std::memory_order_relaxed);
+		m_sequence.store(sequence + 2, std::memory_order_release);
+		m_lastPublish = std::chrono::steady_clock::now();
+	}
+
+	ActiveSpeakerOptions                  m_options;
+	std::mutex                            m_mutex;    ///< serializes writers, readers never take it
+	FlatHashMap<uint64, float>            m_speakers; ///< talking clients by speakerKey() and their level
+	std::vector<ActiveSpeaker>            m_ranking;
+	std::chrono::steady_clock::time_point m_lastPublish;
+	std::atomic<uint32_t>                 m_sequence{0};
+	std::atomic<uint64_t>                 m_words[WORD_COUNT];
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_ACTIVE_SPEAKERS_H
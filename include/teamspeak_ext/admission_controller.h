@@ -0,0 +1,224 @@
+/*
+ * Connection admission control for reconnect storms. Joins per virtual server pass a token bucket, so a burst of
+ * thousands of reconnects is spread over time instead of stalling callbacks and voice of the clients already connected.
+ * Rejected identities get a retry slot, slots are handed out at the admission rate, and a client coming back at its slot
+ * is admitted first. Identities (and addresses, if the application can supply them) that reconnect in a loop are
+ * limited separately.
+ */
+
+#ifndef TEAMSPEAK_EXT_ADMISSION_CONTROLLER_H
+#define TEAMSPEAK_EXT_ADMISSION_CONTROLLER_H
+
+//system
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+
+namespace ts3ext {
+
+struct AdmissionOptions {
+	double                    joinsPerSecond = 50;   ///< sustained admissions per virtual server
+	double                    burst = 100;           ///< admissions possible at once after a quiet period
+	unsigned int              attemptsPerSource = 5; ///< connection attempts per identity or address within sourceWindow
+	std::chrono::milliseconds sourceWindow = std::chrono::seconds(30);
+	std::chrono::milliseconds minRetry = std::chrono::seconds(2);
+	std::chrono::milliseconds retryJitter = std::chrono::seconds(1); ///< random spread added to every retry slot
+	unsigned int              rejectError = ERROR_server_maxclients_reached; ///< what rejected clients see, clients back off on it
+	/** @brief optional address of a connecting client, the server library does not expose client IPs. Empty to skip. */
+	std::function<std::string(uint64 serverID, anyID clientID)> addressOf;
+};
+
+struct AdmissionStats {
+	uint64 admitted = 0;
+	uint64 rejected = 0;      ///< over the join rate, got a retry slot
+	uint64 flooding = 0;      ///< rejected because the identity or address tried too often
+	uint64 slotsHonored = 0;  ///< admitted at their retry slot although the bucket was empty
+};
+
+/**
+ * @brief rate limits joins per virtual server with retry slots for rejected clients
+ *
+ * Use permClientCanConnect, which decides before the client is assigned a channel and sees its welcome message, and/or
+ * onClientConnected, which rejects through removeClientError. A client admitted by the first is not counted again by
+ * the second.
+*/
+class AdmissionController {
+public:
+	/** @brief nanoseconds of a monotonic clock */
+	typedef int64_t (*Clock)();
+
+	explicit AdmissionController(const AdmissionOptions& options = AdmissionOptions(), Clock clock = &steadyNs)
+	    : m_options(options), m_clock(clock), m_random(std::random_device()()) {}
+
+	AdmissionController(const AdmissionController&) = delete;
+	AdmissionController& operator=(const AdmissionController&) = delete;
+
+	unsigned int permClientCanConnect(uint64 serverID, const struct ClientMiniExport* client) {
+		const std::string ident = client->ident != nullptr ? client->ident : "";
+		const std::string address = m_options.addressOf ? m_options.addressOf(serverID, client->ID) : std::string();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const unsigned int error = decide(serverID, ident, address);
+		if (error == ERROR_ok)
+			m_preAdmitted[sourceKey(serverID, 'i', ident)] = m_clock();
+		return error;
+	}
+
+	void onClientConnected(uint64 serverID, anyID clientID, uint64 /*channelID*/, unsigned int* removeClientError) {
+		std::string ident;
+		char* value = nullptr;
+		if (ts3server_getClientVariableAsString(serverID, clientID, CLIENT_UNIQUE_IDENTIFIER, &value) == ERROR_ok) {
+			ident = value;
+			ts3server_freeMemory(value);
+		}
+		const std::string address = m_options.addressOf ? m_options.addressOf(serverID, clientID) : std::string();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_preAdmitted.erase(sourceKey(serverID, 'i', ident)) != 0)
+			return;
+		const unsigned int error = decide(serverID, ident, address);
+		if (error != ERROR_ok)
+			*removeClientError = error;
+	}
+
+	/**
+	 * @brief time until a rejected identity should try again, 0 if it may connect now
+	 *
+	 * The error code cannot carry it, applications that have another way to reach their clients (a client plugin, a web
+	 * status page) can pass it on.
+	*/
+	std::chrono::milliseconds retryAfter(uint64 serverID, const std::string& ident) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto source = m_sources.find(sourceKey(serverID, 'i', ident));
+		if (source == m_sources.end() || source->second.retryAtNs == 0)
+			return std::chrono::milliseconds(0);
+		const int64_t wait = source->second.retryAtNs - m_clock();
+		return std::chrono::milliseconds(wait > 0 ? wait / 1000000 : 0);
+	}
+
+	void forgetServer(uint64 serverID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_servers.erase(serverID);
+		const std::string prefix = std::to_string(serverID) + ':';
+		for (auto it = m_sources.begin(); it != m_sources.end();)
+			it = it->first.compare(0, prefix.size(), prefix) == 0 ? m_sources.erase(it) : std::next(it);
+	}
+
+	AdmissionStats stats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+private:
+	struct ServerState {
+		double  tokens = 0;
+		int64_t updatedNs = 0;
+		int64_t nextSlotNs = 0; ///< retry slots are handed out from here, one per 1/joinsPerSecond
+	};
+
+	struct SourceState {
+		int64_t      windowStartNs = 0;
+		unsigned int attempts = 0;
+		int64_t      retryAtNs = 0; ///< 0 without a slot
+	};
+
+	static int64_t steadyNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static std::string sourceKey(uint64 serverID, char kind, const std::string& value) { return std::to_string(serverID) + ':' + kind + value; }
+
+	/*called with the lock held, true if the source stays within attemptsPerSource*/
+	bool countAttempt(SourceState& source, int64_t now) {
+		const int64_t window = std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.sourceWindow).count();
+		if (now - source.windowStartNs >= window) {
+			source.windowStartNs = now;
+			source.attempts = 0;
+		}
+		return ++source.attempts <= m_options.attemptsPerSource;
+	}
+
+	/*called with the lock held*/
+	unsigned int decide(uint64 serverID, const std::string& ident, const std::string& address) {
+		const int64_t now = m_clock();
+		sweep(now);
+		SourceState& identity = m_sources[sourceKey(serverID, 'i', ident)];
+		bool withinLimits = countAttempt(identity, now);
+		if (!address.empty())
+			withinLimits = countAttempt(m_sources[sourceKey(serverID, 'a', address)], now) && withinLimits;
+		if (!withinLimits) {
+			++m_stats.flooding;
+			return m_options.rejectError;
+		}
+
+		ServerState& server = serverFor(serverID, now);
+		const bool slotDue = identity.retryAtNs != 0 && now >= identity.retryAtNs;
+		if (server.tokens >= 1 || slotDue) {
+			//a due slot may take the bucket into debt, slots were handed out at the admission rate so the debt stays bounded
+			server.tokens -= 1;
+			if (slotDue && server.tokens < 0)
+				++m_stats.slotsHonored;
+			identity.retryAtNs = 0;
+			++m_stats.admitted;
+			return ERROR_ok;
+		}
+		if (identity.retryAtNs == 0) {
+			const int64_t earliest = now + std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.minRetry).count();
+			server.nextSlotNs = std::max(server.nextSlotNs, earliest) + static_cast<int64_t>(1e9 / std::max(m_options.joinsPerSecond, 0.001));
+			const int64_t jitter = std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.retryJitter).count();
+			identity.retryAtNs = server.nextSlotNs + (jitter > 0 ? std::uniform_int_distribution<int64_t>(0, jitter)(m_random) : 0);
+		}
+		++m_stats.rejected;
+		return m_options.rejectError;
+	}
+
+	/*called with the lock held*/
+	ServerState& serverFor(uint64 serverID, int64_t now) {
+		const auto inserted = m_servers.emplace(serverID, ServerState());
+		ServerState& server = inserted.first->second;
+		if (inserted.second) {
+			server.tokens = m_options.burst;
+			server.updatedNs = now;
+		} else if (now > server.updatedNs) {
+			server.tokens = std::min(server.tokens + (now - server.updatedNs) / 1e9 * m_options.joinsPerSecond, m_options.burst);
+			server.updatedNs = now;
+		}
+		return server;
+	}
+
+	/*called with the lock held: at most once per window, drops sources without attempts in the last window and without slot*/
+	void sweep(int64_t now) {
+		const int64_t window = std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.sourceWindow).count();
+		if (now - m_lastSweepNs < window)
+			return;
+		m_lastSweepNs = now;
+		for (auto it = m_sources.begin(); it != m_sources.end();) {
+			const bool stale = now - it->second.windowStartNs >= window && (it->second.retryAtNs == 0 || now - it->second.retryAtNs >= window);
+			it = stale ? m_sources.erase(it) : std::next(it);
+		}
+		for (auto it = m_preAdmitted.begin(); it != m_preAdmitted.end();)
+			it = now - it->second >= window ? m_preAdmitted.erase(it) : std::next(it);
+	}
+
+	const AdmissionOptions                       m_options;
+	const Clock                                  m_clock;
+	mutable std::mutex                           m_mutex;
+	std::mt19937_64                              m_random;
+	std::unordered_map<uint64, ServerState>      m_servers;
+	std::unordered_map<std::string, SourceState> m_sources;     ///< by sourceKey(), identities and addresses
+	std::unordered_map<std::string, int64_t>     m_preAdmitted; ///< admitted in permClientCanConnect, not yet seen in onClientConnected
+	int64_t                                      m_lastSweepNs = 0;
+	AdmissionStats                               m_stats;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_ADMISSION_CONTROLLER_H
@@ -0,0 +1,475 @@
+/*
+ * Asynchronous request layer on top of the TeamSpeak 3 Client SDK. Almost every ts3client_request* call
+ * accepts a returnCode string, and the outcome of the request is reported later through the
+ * ClientUIFunctions.onServerErrorEvent callback carrying the same returnCode. This header generates compact
+ * unique return codes, keeps the pending requests in a fixed size lock-free slot map and completes them
+ * through std::future, a C style completion callback or (when compiled as C++20) a co_await-able awaiter.
+ */
+
+#ifndef TEAMSPEAK_EXT_ASYNC_REQUEST_H
+#define TEAMSPEAK_EXT_ASYNC_REQUEST_H
+
+//system
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define TEAMSPEAK_EXT_HAS_COROUTINES 1
+#endif
+
+//own
+#include "teamspeak/clientlib.h"
+#include "teamspeak/public_errors.h"
+
+namespace ts3ext {
+
+/**
+ * @brief Outcome of an asynchronous request.
+*/
+struct RequestResult {
+	unsigned int             error;        ///< One of the values from the @ref Ts3ErrorType enum. ERROR_canceled if the request timed out or the connection went away.
+	bool                     timedOut;     ///< true if no onServerErrorEvent arrived before the request deadline
+	std::chrono::nanoseconds latency;      ///< time from issuing the request until its completion
+	std::string              extraMessage; ///< extraMessage of the onServerErrorEvent. Only copied if error is not ERROR_ok.
+};
+
+/**
+ * @brief Lock-free latency histogram with power of two microsecond buckets.
+ *
+ * Bucket i counts latencies in [2^(i-1), 2^i) microseconds, bucket 0 counts everything below one microsecond.
+*/
+class LatencyHistogram {
+public:
+	static const int BUCKET_COUNT = 32;
+
+	void record(std::chrono::nanoseconds latency) {
+		uint64 micros = static_cast<uint64>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+		int bucket = 0;
+		while (micros != 0 && bucket < BUCKET_COUNT - 1) {
+			micros >>= 1;
+			++bucket;
+		}
+		m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	uint64 count() const {
+		uint64 total = 0;
+		for (const auto& bucket : m_buckets)
+			total += bucket.load(std::memory_order_relaxed);
+		return total;
+	}
+
+	uint64 bucketCount(int bucket) const { return m_buckets[bucket].load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief upper bound in microseconds of the bucket containing the given quantile
+	 *
+	 * @param quantile value between 0 and 1, e.g. 0.99 for the 99th percentile
+	 * @return upper bucket bound in microseconds, 0 if nothing was recorded yet
+	*/
+	uint64 quantileMicros(double quantile) const {
+		const uint64 total = count();
+		if (total == 0)
+			return 0;
+		const uint64 rank = static_cast<uint64>(quantile * static_cast<double>(total - 1));
+		uint64 seen = 0;
+		for (int i = 0; i < BUCKET_COUNT; ++i) {
+			seen += m_buckets[i].load(std::memory_order_relaxed);
+			if (seen > rank)
+				return uint64(1) << i;
+		}
+		return uint64(1) << (BUCKET_COUNT - 1);
+	}
+
+	void reset() {
+		for (auto& bucket : m_buckets)
+			bucket.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64> m_buckets[BUCKET_COUNT] = {};
+};
+
+/**
+ * @brief Correlates ts3client_request* calls with their onServerErrorEvent by returnCode.
+ *
+ * Forward ClientUIFunctions.onServerErrorEvent and onConnectStatusChangeEvent to the methods of the same name and call
+ * expireTimedOut() periodically (e.g. every 50ms from a timer thread) to enforce request deadlines.
+ * All methods are thread safe. Submitting and completing requests does not take any locks.
+*/
+class AsyncRequests {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	/**
+	 * @brief completion callback for the callback based submit. Called exactly once, on the thread that completed the request.
+	 *
+	 * @param context the context pointer given to submit
+	 * @param result outcome of the request. Only valid for the duration of the call.
+	*/
+	typedef void (*CompletionCallback)(void* context, const RequestResult& result);
+
+	/**
+	 * @param capacity maximum number of requests in flight at the same time. At most 2^20.
+	 * @param prefix short string every generated return code starts with, used to tell our return codes apart from others. At most 7 characters.
+	 * @param defaultTimeout deadline for requests that do not specify one
+	*/
+	explicit AsyncRequests(unsigned int capacity = 1024, const char* prefix = "~a", std::chrono::milliseconds defaultTimeout = std::chrono::seconds(10))
+	    : m_capacity(capacity < 1 ? 1 : (capacity > MAX_CAPACITY ? MAX_CAPACITY : capacity))
+	    , m_slots(new Slot[m_capacity])
+	    , m_defaultTimeout(defaultTimeout) {
+		m_prefixLength = std::strlen(prefix);
+		if (m_prefixLength > sizeof(m_prefix) - 1)
+			m_prefixLength = sizeof(m_prefix) - 1;
+		std::memcpy(m_prefix, prefix, m_prefixLength);
+		m_prefix[m_prefixLength] = '\0';
+		for (unsigned int i = 0; i < m_capacity; ++i)
+			m_slots[i].nextFree.store(i + 1 < m_capacity ? i + 2 : 0, std::memory_order_relaxed);
+		m_freeHead.store(m_capacity > 0 ? 1 : 0);
+	}
+
+	AsyncRequests(const AsyncRequests&) = delete;
+	AsyncRequests& operator=(const AsyncRequests&) = delete;
+
+	/**
+	 * @brief issue a request and receive its outcome through a std::future
+	 *
+	 * @param serverConnectionHandlerID the connection handler the request is sent on
+	 * @param issue callable with the signature unsigned int(const char* returnCode) performing the actual ts3client_request* call,
+	 * e.g. [&](const char* rc) { return ts3client_requestChannelDelete(scHandlerID, channelID, 0, rc); }
+	 * @param timeout deadline for the request. Zero uses the default timeout.
+	 * @return future that becomes ready once the server answered, the request failed locally or the deadline passed
+	*/
+	template <typename Issue>
+	std::future<RequestResult> submit(uint64 serverConnectionHandlerID, Issue&& issue, std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) {
+		unsigned int index;
+		if (!acquire(index)) {
+			std::promise<RequestResult> failed;
+			failed.set_value(RequestResult{ERROR_out_of_memory, false, std::chrono::nanoseconds::zero(), std::string()});
+			return failed.get_future();
+		}
+		Slot& slot = m_slots[index];
+		slot.promise = std::promise<RequestResult>();
+		slot.callback = nullptr;
+		slot.context = nullptr;
+		std::future<RequestResult> future = slot.promise.get_future();
+		dispatch(index, serverConnectionHandlerID, std::forward<Issue>(issue), timeout);
+		return future;
+	}
+
+	/**
+	 * @brief issue a request and receive its outcome through a callback
+	 *
+	 * @return ERROR_ok if the request was registered, ERROR_out_of_memory if too many requests are in flight.
+	 * Failures of the issue callable itself are reported through the callback.
+	*/
+	template <typename Issue>
+	unsigned int submit(uint64 serverConnectionHandlerID, Issue&& issue, CompletionCallback callback, void* context, std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) {
+		unsigned int index;
+		if (!acquire(index))
+			return ERROR_out_of_memory;
+		Slot& slot = m_slots[index];
+		slot.callback = callback;
+		slot.context = context;
+		dispatch(index, serverConnectionHandlerID, std::forward<Issue>(issue), timeout);
+		return ERROR_ok;
+	}
+
+#ifdef TEAMSPEAK_EXT_HAS_COROUTINES
+	template <typename Issue>
+	class Awaiter {
+	public:
+		Awaiter(AsyncRequests& owner, uint64 serverConnectionHandlerID, Issue issue, std::chrono::milliseconds timeout)
+		    : m_owner(owner), m_serverConnectionHandlerID(serverConnectionHandlerID), m_issue(std::move(issue)), m_timeout(timeout) {}
+
+		bool await_ready() const noexcept { return false; }
+
+		bool await_suspend(std::coroutine_handle<> handle) {
+			m_handle = handle;
+			const unsigned int error = m_owner.submit(m_serverConnectionHandlerID, m_issue, &Awaiter::onComplete, this, m_timeout);
+			if (error != ERROR_ok) {
+				m_result = RequestResult{error, false, std::chrono::nanoseconds::zero(), std::string()};
+				return false;
+			}
+			//if the request already completed while we were submitting, continue without suspending
+			return !m_suspendRace.exchange(true, std::memory_order_acq_rel);
+		}
+
+		RequestResult await_resume() { return std::move(m_result); }
+
+	private:
+		static void onComplete(void* context, const RequestResult& result) {
+			Awaiter* self = static_cast<Awaiter*>(context);
+			self->m_result = result;
+			if (self->m_suspendRace.exchange(true, std::memory_order_acq_rel))
+				self->m_handle.resume();
+		}
+
+		AsyncRequests&            m_owner;
+		uint64                    m_serverConnectionHandlerID;
+		Issue                     m_issue;
+		std::chrono::milliseconds m_timeout;
+		std::coroutine_handle<>   m_handle;
+		std::atomic<bool>         m_suspendRace{false};
+		RequestResult             m_result{};
+	};
+
+	/**
+	 * @brief C++20 awaitable variant of submit: co_await requests.request(scHandlerID, issue)
+	 *
+	 * The coroutine is resumed on the thread completing the request, usually the client library callback thread.
+	 * Resume onto your own executor if the continuation does more than trivial work.
+	*/
+	template <typename Issue>
+	Awaiter<typename std::decay<Issue>::type> request(uint64 serverConnectionHandlerID, Issue&& issue, std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) {
+		return Awaiter<typename std::decay<Issue>::type>(*this, serverConnectionHandlerID, std::forward<Issue>(issue), timeout);
+	}
+#endif
+
+	/**
+	 * @brief forward ClientUIFunctions.onServerErrorEvent here
+	 *
+	 * @return true if the returnCode belonged to a request of this instance, false if the event should be handled elsewhere
+	*/
+	bool onServerErrorEvent(uint64 serverConnectionHandlerID, const char* errorMessage, unsigned int error, const char* returnCode, const char* extraMessage) {
+		(void)errorMessage;
+		unsigned int index;
+		uint64 generation;
+		if (!parseReturnCode(returnCode, index, generation))
+			return false;
+		Slot& slot = m_slots[index];
+		if (slot.serverConnectionHandlerID.load(std::memory_order_relaxed) != serverConnectionHandlerID)
+			return false;
+		complete(index, generation, error, false, error != ERROR_ok && extraMessage != nullptr ? extraMessage : "");
+		return true;
+	}
+
+	/**
+	 * @brief forward ClientUIFunctions.onConnectStatusChangeEvent here. Fails all pending requests of a connection that was lost.
+	*/
+	void onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int errorNumber) {
+		if (newStatus != STATUS_DISCONNECTED)
+			return;
+		const unsigned int error = errorNumber != ERROR_ok ? errorNumber : static_cast<unsigned int>(ERROR_canceled);
+		for (unsigned int i = 0; i < m_capacity; ++i) {
+			Slot& slot = m_slots[i];
+			const uint64 tag = slot.tag.load(std::memory_order_acquire);
+			if ((tag & STATE_MASK) == STATE_PENDING && slot.serverConnectionHandlerID.load(std::memory_order_relaxed) == serverConnectionHandlerID)
+				complete(i, tag >> STATE_BITS, error, false, "");
+		}
+	}
+
+	/**
+	 * @brief complete all requests whose deadline has passed with ERROR_canceled
+	 *
+	 * Cheap to call often: returns immediately unless the earliest known deadline has passed.
+	 * @return number of requests that timed out
+	*/
+	unsigned int expireTimedOut(Clock::time_point now = Clock::now()) {
+		const Clock::rep nowTicks = now.time_since_epoch().count();
+		if (nowTicks < m_earliestDeadline.load(std::memory_order_relaxed))
+			return 0;
+		m_earliestDeadline.store(NO_DEADLINE, std::memory_order_relaxed);
+		unsigned int expired = 0;
+		for (unsigned int i = 0; i < m_capacity; ++i) {
+			Slot& slot = m_slots[i];
+			const uint64 tag = slot.tag.load(std::memory_order_acquire);
+			if ((tag & STATE_MASK) != STATE_PENDING)
+				continue;
+			const Clock::rep deadline = slot.deadline.load(std::memory_order_relaxed);
+			if (deadline <= nowTicks) {
+				if (complete(i, tag >> STATE_BITS, ERROR_canceled, true, ""))
+					++expired;
+			} else {
+				lowerEarliestDeadline(deadline);
+			}
+		}
+		return expired;
+	}
+
+	/** @brief number of requests currently waiting for an answer */
+	unsigned int pendingCount() const { return m_pending.load(std::memory_order_relaxed); }
+
+	/** @brief round trip latency of all completed requests, timeouts excluded */
+	const LatencyHistogram& latencies() const { return m_latencies; }
+	LatencyHistogram& latencies() { return m_latencies; }
+
+	/** @brief number of requests that hit their deadline */
+	uint64 timeoutCount() const { return m_timeouts.load(std::memory_order_relaxed); }
+
+private:
+	enum SlotState {
+		STATE_FREE = 0,    ///< slot is on the free list
+		STATE_ARMING,      ///< slot is being filled by submit
+		STATE_PENDING,     ///< request is in flight
+		STATE_COMPLETING,  ///< a completer won the race and is delivering the result
+	};
+
+	static const unsigned int STATE_BITS   = 2;
+	static const uint64       STATE_MASK   = (uint64(1) << STATE_BITS) - 1;
+	static const unsigned int INDEX_BITS   = 20;
+	static const unsigned int MAX_CAPACITY = 1u << INDEX_BITS;
+	static const uint64       TOKEN_GEN_MASK = (uint64(1) << (64 - INDEX_BITS)) - 1;
+	static const Clock::rep   NO_DEADLINE  = INT64_MAX;
+
+	struct Slot {
+		std::atomic<uint64>          tag{0}; ///< generation << STATE_BITS | SlotState
+		std::atomic<Clock::rep>      deadline{0};
+		std::atomic<unsigned int>    nextFree{0}; ///< 1 based index of the next free slot, 0 terminates the list
+		std::atomic<uint64>          serverConnectionHandlerID{0};
+		Clock::time_point            started;
+		std::promise<RequestResult>  promise;
+		CompletionCallback           callback = nullptr;
+		void*                        context = nullptr;
+	};
+
+	template <typename Issue>
+	void dispatch(unsigned int index, uint64 serverConnectionHandlerID, Issue&& issue, std::chrono::milliseconds timeout) {
+		Slot& slot = m_slots[index];
+		slot.serverConnectionHandlerID.store(serverConnectionHandlerID, std::memory_order_relaxed);
+		slot.started = Clock::now();
+		const Clock::rep deadline = (slot.started + (timeout.count() > 0 ? timeout : m_defaultTimeout)).time_since_epoch().count();
+		slot.deadline.store(deadline, std::memory_order_relaxed);
+
+		const uint64 generation = slot.tag.load(std::memory_order_relaxed) >> STATE_BITS;
+		char returnCode[32];
+		formatReturnCode(index, generation, returnCode);
+
+		//publish before issuing, the answer may arrive on the library thread before issue() returns
+		m_pending.fetch_add(1, std::memory_order_relaxed);
+		slot.tag.store(generation << STATE_BITS | STATE_PENDING, std::memory_order_release);
+		lowerEarliestDeadline(deadline);
+
+		const unsigned int error = issue(static_cast<const char*>(returnCode));
+		if (error != ERROR_ok)
+			complete(index, generation, error, false, "");
+	}
+
+	bool acquire(unsigned int& index) {
+		uint64 head = m_freeHead.load(std::memory_order_acquire);
+		for (;;) {
+			const unsigned int top = static_cast<unsigned int>(head & 0xFFFFFFFFu);
+			if (top == 0)
+				return false;
+			const uint64 next = ((head >> 32) + 1) << 32 | m_slots[top - 1].nextFree.load(std::memory_order_relaxed);
+			if (m_freeHead.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+				break;
+		}
+		index = static_cast<unsigned int>(head & 0xFFFFFFFFu) - 1;
+		Slot& slot = m_slots[index];
+		const uint64 generation = (slot.tag.load(std::memory_order_relaxed) >> STATE_BITS) + 1;
+		slot.tag.store(generation << STATE_BITS | STATE_ARMING, std::memory_order_relaxed);
+		return true;
+	}
+
+	void release(unsigned int index) {
+		Slot& slot = m_slots[index];
+		const uint64 generation = slot.tag.load(std::memory_order_relaxed) >> STATE_BITS;
+		slot.tag.store(generation << STATE_BITS | STATE_FREE, std::memory_order_release);
+		uint64 head = m_freeHead.load(std::memory_order_acquire);
+		for (;;) {
+			slot.nextFree.store(static_cast<unsigned int>(head & 0xFFFFFFFFu), std::memory_order_relaxed);
+			const uint64 next = ((head >> 32) + 1) << 32 | (index + 1);
+			if (m_freeHead.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+				return;
+		}
+	}
+
+	bool complete(unsigned int index, uint64 generation, unsigned int error, bool timedOut, const char* extraMessage) {
+		Slot& slot = m_slots[index];
+		uint64 tag = slot.tag.load(std::memory_order_acquire);
+		for (;;) {
+			if ((tag & STATE_MASK) != STATE_PENDING || ((tag >> STATE_BITS) & TOKEN_GEN_MASK) != (generation & TOKEN_GEN_MASK))
+				return false; //stale or duplicate completion
+			if (slot.tag.compare_exchange_weak(tag, (tag & ~STATE_MASK) | STATE_COMPLETING, std::memory_order_acq_rel, std::memory_order_acquire))
+				break;
+		}
+		RequestResult result{error, timedOut, Clock::now() - slot.started, std::string(extraMessage)};
+		if (timedOut)
+			m_timeouts.fetch_add(1, std::memory_order_relaxed);
+		else
+			m_latencies.record(result.latency);
+		m_pending.fetch_sub(1, std::memory_order_relaxed);
+
+		CompletionCallback callback = slot.callback;
+		void* context = slot.context;
+		if (callback == nullptr) {
+			std::promise<RequestResult> promise(std::move(slot.promise));
+			release(index);
+			promise.set_value(std::move(result));
+		} else {
+			release(index);
+			callback(context, result);
+		}
+		return true;
+	}
+
+	void lowerEarliestDeadline(Clock::rep deadline) {
+		Clock::rep current = m_earliestDeadline.load(std::memory_order_relaxed);
+		while (deadline < current && !m_earliestDeadline.compare_exchange_weak(current, deadline, std::memory_order_relaxed)) {
+		}
+	}
+
+	//return code layout: prefix followed by the base 36 encoding of (generation << INDEX_BITS | index)
+	void formatReturnCode(unsigned int index, uint64 generation, char* out) const {
+		static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+		uint64 token = (generation & TOKEN_GEN_MASK) << INDEX_BITS | index;
+		char reversed[16];
+		int length = 0;
+		do {
+			reversed[length++] = digits[token % 36];
+			token /= 36;
+		} while (token != 0);
+		std::memcpy(out, m_prefix, m_prefixLength);
+		for (int i = 0; i < length; ++i)
+			out[m_prefixLength + i] = reversed[length - 1 - i];
+		out[m_prefixLength + length] = '\0';
+	}
+
+	bool parseReturnCode(const char* returnCode, unsigned int& index, uint64& generation) const {
+		if (returnCode == nullptr || std::strncmp(returnCode, m_prefix, m_prefixLength) != 0)
+			return false;
+		const char* p = returnCode + m_prefixLength;
+		if (*p == '\0')
+			return false;
+		uint64 token = 0;
+		for (int length = 0; *p != '\0'; ++p, ++length) {
+			int digit;
+			if (*p >= '0' && *p <= '9')
+				digit = *p - '0';
+			else if (*p >= 'a' && *p <= 'z')
+				digit = *p - 'a' + 10;
+			else
+				return false;
+			if (length >= 13)
+				return false;
+			token = token * 36 + static_cast<uint64>(digit);
+		}
+		index = static_cast<unsigned int>(token & (MAX_CAPACITY - 1));
+		generation = token >> INDEX_BITS;
+		return index < m_capacity;
+	}
+
+	const unsigned int       m_capacity;
+	std::unique_ptr<Slot[]>  m_slots;
+	std::chrono::milliseconds m_defaultTimeout;
+	char                     m_prefix[8];
+	size_t                   m_prefixLength;
+	std::atomic<uint64>      m_freeHead{0}; ///< ABA counter << 32 | 1 based index of the first free slot
+	std::atomic<unsigned int> m_pending{0};
+	std::atomic<Clock::rep>  m_earliestDeadline{NO_DEADLINE};
+	std::atomic<uint64>      m_timeouts{0};
+	LatencyHistogram         m_latencies;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_ASYNC_REQUEST_H
@@ -0,0 +1,671 @@
+/*
+ * Audit log for moderation actions: client moves and kicks, channel edits and deletions, both the permission requests
+ * and the resulting events. Records are encoded on the calling thread into an in memory batch and a writer thread
+ * writes and syncs whole batches (group commit), so the callbacks never wait for the disk and one fsync covers every
+ * record that arrived while the previous one ran. Every record is framed with its length and a CRC32C and carries a
+ * BLAKE3 hash chained over all records before it, optionally keyed, so a torn tail is told apart from an edited log.
+ */
+
+#ifndef TEAMSPEAK_EXT_AUDIT_LOG_H
+#define TEAMSPEAK_EXT_AUDIT_LOG_H
+
+//system
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak_ext/blake3.h"
+#include "teamspeak_ext/client_mini_export.h"
+
+namespace ts3ext {
+
+enum AuditAction {
+	AUDIT_PERM_CLIENT_MOVE = 1,
+	AUDIT_PERM_CLIENT_KICK_FROM_CHANNEL,
+	AUDIT_PERM_CLIENT_KICK_FROM_SERVER,
+	AUDIT_PERM_CHANNEL_EDIT,
+	AUDIT_PERM_CHANNEL_DELETE,
+	AUDIT_CLIENT_MOVED,
+	AUDIT_CHANNEL_EDITED,
+	AUDIT_CHANNEL_DELETED
+};
+
+struct AuditTarget {
+	anyID       clientID = 0;
+	uint64      channelID = 0;
+	std::string identity;
+	std::string nickname;
+};
+
+/** @brief a decoded record, as handed out by AuditLog::replay */
+struct AuditRecord {
+	uint64                                  sequence = 0;    ///< starts at 1, without gaps
+	int64_t                                 timestampMs = 0; ///< system clock, milliseconds since the epoch
+	AuditAction                             action = AUDIT_PERM_CLIENT_MOVE;
+	uint64                                  serverID = 0;
+	anyID                                   invokerClientID = 0;
+	std::string                             invokerIdentity;
+	std::string                             invokerNickname;
+	uint64                                  channelID = 0;       ///< edited or deleted channel, old channel of a move event
+	uint64                                  targetChannelID = 0; ///< destination of a move
+	unsigned int                            decision = ERROR_ok; ///< what the permission callback answered
+	std::string                             reason;
+	std::vector<AuditTarget>                targets;             ///< moved or kicked clients
+	std::vector<std::pair<int, std::string>> changes;            ///< ChannelProperties and their proposed values of an edit
+};
+
+struct AuditLogOptions {
+	std::string file;
+	std::string key;                          ///< secret for a keyed hash chain, empty for plain BLAKE3
+	size_t      maxPendingBytes = 64 << 20;   ///< producers wait for the writer beyond this
+	bool        sync = true;                  ///< fdatasync after every batch, false leaves it to the OS
+};
+
+struct AuditLogStats {
+	uint64 records = 0;
+	uint64 batches = 0;          ///< writes followed by one sync
+	uint64 largestBatch = 0;     ///< records
+	uint64 bytes = 0;
+	uint64 writeErrors = 0;
+	int64_t longestSyncUs = 0;
+};
+
+/** @brief outcome of AuditLog::replay */
+struct AuditLogCheck {
+	uint64        records = 0;
+	uint64        validBytes = 0;    ///< end of the last intact record
+	bool          tornTail = false;  ///< the last frame is cut off or bad and only zeros follow it, as after a crash during a write
+	bool          corrupted = false; ///< a record fails its CRC or does not decode and data follows it, or its length hides intact records
+	bool          chainBroken = false; ///< a record is intact but its hash or sequence does not follow, i.e. edited, removed or reordered
+	uint64        lastSequence = 0;
+	unsigned char lastHash[Blake3::DIGEST_SIZE] = {0};
+};
+
+struct AuditLogBenchmark {
+	double eventsPerSecond = 0;
+	double recordsPerBatch = 0;
+	double syncsPerSecond = 0;
+};
+
+/**
+ * @brief append only, tamper evident log of moderation actions with group commit
+ *
+ * The permission forwarders only log and return ERROR_ok; call them after the real checks and pass their verdict as
+ * decision. A record is durable once durableSequence() reaches its sequence, which is at most two syncs after it was
+ * appended; waitDurable() blocks for it. A failed write or sync stops the log, see failed().
+*/
+class AuditLog {
+public:
+	/** @brief milliseconds since the epoch */
+	typedef int64_t (*Clock)();
+
+	explicit AuditLog(const AuditLogOptions& options, Clock clock = &systemMs) : m_options(options), m_clock(clock) {
+		m_keyed = deriveKey(options.key, m_chainKey);
+	}
+
+	~AuditLog() { close(); }
+
+	AuditLog(const AuditLog&) = delete;
+	AuditLog& operator=(const AuditLog&) = delete;
+
+	/**
+	 * @brief check the existing log, cut a torn tail and continue its chain
+	 *
+	 * @return ERROR_file_io_error if the log cannot be opened, is corrupted or its chain is broken; such a log is left
+	 * untouched for inspection and has to be moved away before a new one is started.
+	*/
+	unsigned int open() {
+		AuditLogCheck check;
+		if (std::filesystem::exists(m_options.file)) {
+			if (replay(m_options.file, m_options.key, [](const AuditRecord&) {}, &check) != ERROR_ok && !check.tornTail)
+				return ERROR_file_io_error;
+			std::error_code error;
+			if (check.tornTail)
+				std::filesystem::resize_file(m_options.file, check.validBytes, error);
+			if (error)
+				return ERROR_file_io_error;
+		}
+		m_file = std::fopen(m_options.file.c_str(), "ab");
+		if (m_file == nullptr)
+			return ERROR_file_io_error;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_sequence = check.lastSequence;
+		m_durable = check.lastSequence;
+		std::memcpy(m_lastHash, check.lastHash, sizeof(m_lastHash));
+		m_stopping = false;
+		m_failed = false;
+		m_writer = std::thread([this] { writeLoop(); });
+		return ERROR_ok;
+	}
+
+	/** @brief write and sync what is pending */
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_writer.joinable())
+				return;
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		m_writer.join();
+		std::fclose(m_file);
+		m_file = nullptr;
+	}
+
+	unsigned int permClientMove(uint64 serverID, const ClientMiniExport* client, int toMoveCount, const ClientMiniExport* toMoveClients, uint64 newChannel,
+	                            const char* reasonText, unsigned int decision = ERROR_ok) {
+		Encoder record = begin(AUDIT_PERM_CLIENT_MOVE, serverID, client, 0, newChannel, decision, reasonText);
+		record.targets(ClientMiniSpan(toMoveClients, toMoveCount));
+		commit(record);
+		return ERROR_ok;
+	}
+
+	unsigned int permClientKickFromChannel(uint64 serverID, const ClientMiniExport* client, int toKickCount, const ClientMiniExport* toKickClients,
+	                                       const char* reasonText, unsigned int decision = ERROR_ok) {
+		Encoder record = begin(AUDIT_PERM_CLIENT_KICK_FROM_CHANNEL, serverID, client, 0, 0, decision, reasonText);
+		record.targets(ClientMiniSpan(toKickClients, toKickCount));
+		commit(record);
+		return ERROR_ok;
+	}
+
+	unsigned int permClientKickFromServer(uint64 serverID, const ClientMiniExport* client, int toKickCount, const ClientMiniExport* toKickClients,
+	                                      const char* reasonText, unsigned int decision = ERROR_ok) {
+		Encoder record = begin(AUDIT_PERM_CLIENT_KICK_FROM_SERVER, serverID, client, 0, 0, decision, reasonText);
+		record.targets(ClientMiniSpan(toKickClients, toKickCount));
+		commit(record);
+		return ERROR_ok;
+	}
+
+	/** @brief logs every proposed property of the edit */
+	unsigned int permChannelEdit(uint64 serverID, const ClientMiniExport* client, uint64 channelID, const VariablesExport* variables,
+	                             unsigned int decision = ERROR_ok) {
+		Encoder record = begin(AUDIT_PERM_CHANNEL_EDIT, serverID, client, channelID, 0, decision, nullptr);
+		record.changes(variables);
+		commit(record);
+		return ERROR_ok;
+	}
+
+	unsigned int permChannelDelete(uint64 serverID, const ClientMiniExport* client, uint64 channelID, unsigned int decision = ERROR_ok) {
+		commit(begin(AUDIT_PERM_CHANNEL_DELETE, serverID, client, channelID, 0, decision, nullptr));
+		return ERROR_ok;
+	}
+
+	void onClientMoved(uint64 serverID, anyID clientID, uint64 oldChannelID, uint64 newChannelID) {
+		const ClientMiniExport moved = {clientID, oldChannelID, nullptr, nullptr};
+		Encoder record = begin(AUDIT_CLIENT_MOVED, serverID, nullptr, oldChannelID, newChannelID, ERROR_ok, nullptr);
+		record.targets(ClientMiniSpan(&moved, 1));
+		commit(record);
+	}
+
+	void onChannelEdited(uint64 serverID, anyID invokerClientID, uint64 channelID) {
+		const ClientMiniExport invoker = {invokerClientID, 0, nullptr, nullptr};
+		commit(begin(AUDIT_CHANNEL_EDITED, serverID, &invoker, channelID, 0, ERROR_ok, nullptr));
+	}
+
+	void onChannelDeleted(uint64 serverID, anyID invokerClientID, uint64 channelID) {
+		const ClientMiniExport invoker = {invokerClientID, 0, nullptr, nullptr};
+		commit(begin(AUDIT_CHANNEL_DELETED, serverID, &invoker, channelID, 0, ERROR_ok, nullptr));
+	}
+
+	/** @brief sequence of the last appended record */
+	uint64 lastSequence() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_sequence;
+	}
+
+	/** @brief every record up to this sequence is on disk */
+	uint64 durableSequence() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_durable;
+	}
+
+	/** @return false if the log was closed or failed() before the record became durable */
+	bool waitDurable(uint64 sequence) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_synced.wait(lock, [&] { return m_durable >= sequence || m_stopping || m_failed; });
+		return m_durable >= sequence;
+	}
+
+	/** @brief head of the chain, keep it elsewhere to also notice a truncated log */
+	void head(uint64& sequence, unsigned char* hash) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		sequence = m_sequence;
+		std::memcpy(hash, m_lastHash, sizeof(m_lastHash));
+	}
+
+	/** @brief a write or sync failed, nothing is logged anymore; close() and open() again to continue after the last durable record */
+	bool failed() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_failed;
+	}
+
+	AuditLogStats stats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	/**
+	 * @brief decode and verify a log, calling visit(const AuditRecord&) for every intact record in order
+	 *
+	 * Stops at the first record that is torn, corrupted or does not continue the chain.
+	 * @return ERROR_ok if the whole file verified
+	*/
+	template <typename Visit>
+	static unsigned int replay(const std::string& file, const std::string& key, Visit&& visit, AuditLogCheck* result = nullptr) {
+		AuditLogCheck check;
+		std::ifstream in(file, std::ios::binary);
+		if (!in)
+			return ERROR_file_io_error;
+		const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		unsigned char chainKey[Blake3::KEY_SIZE];
+		const bool keyed = deriveKey(key, chainKey);
+		size_t at = 0;
+		while (at < data.size()) {
+			uint32_t length = 0, crc = 0;
+			if (data.size() - at < FRAME_HEADER) {
+				check.tornTail = true;
+				break;
+			}
+			std::memcpy(&length, data.data() + at, 4);
+			if (length > MAX_RECORD_SIZE || data.size() - at - FRAME_HEADER < length) {
+				//a frame cut by a crash is the last one; a damaged length must not make open() cut the intact records behind it
+				check.tornTail = !intactFrameAfter(data, at + 1, check.lastSequence);
+				check.corrupted = !check.tornTail;
+				break;
+			}
+			std::memcpy(&crc, data.data() + at + 4, 4);
+			const char* payload = data.data() + at + FRAME_HEADER;
+			AuditRecord record;
+			if (length < Blake3::DIGEST_SIZE || crc32c(payload, length) != crc || !decode(payload, length - Blake3::DIGEST_SIZE, record)) {
+				//a power loss can leave the grown file zero filled or the last frame half written; anything followed by data is corruption
+				const bool torn = zeroFrom(data, at) || zeroFrom(data, at + FRAME_HEADER + length);
+				check.tornTail = torn;
+				check.corrupted = !torn;
+				break;
+			}
+			unsigned char hash[Blake3::DIGEST_SIZE];
+			chain(keyed ? chainKey : nullptr, check.lastHash, payload, length - Blake3::DIGEST_SIZE, hash);
+			if (record.sequence != check.lastSequence + 1 || std::memcmp(hash, payload + length - Blake3::DIGEST_SIZE, sizeof(hash)) != 0) {
+				check.chainBroken = true;
+				break;
+			}
+			visit(static_cast<const AuditRecord&>(record));
+			++check.records;
+			check.lastSequence = record.sequence;
+			std::memcpy(check.lastHash, hash, sizeof(hash));
+			at += FRAME_HEADER + length;
+			check.validBytes = at;
+		}
+		if (result != nullptr)
+			*result = check;
+		return check.tornTail || check.corrupted || check.chainBroken ? static_cast<unsigned int>(ERROR_file_io_error) : static_cast<unsigned int>(ERROR_ok);
+	}
+
+	/**
+	 * @brief measure sustained appends per second of a single producer, logging a three client move to file
+	 *
+	 * @param measureFor minimum measuring time, the file is removed afterwards
+	*/
+	static AuditLogBenchmark benchmark(const std::string& file, std::chrono::milliseconds measureFor = std::chrono::milliseconds(1000)) {
+		std::remove(file.c_str());
+		AuditLogOptions options;
+		options.file = file;
+		AuditLog log(options);
+		AuditLogBenchmark result;
+		if (log.open() != ERROR_ok)
+			return result;
+		const ClientMiniExport invoker = {1, 1, "moderatorIdentityXXXXXXXXXXX=", "moderator"};
+		const ClientMiniExport targets[3] = {{2, 1, "firstTargetIdentityXXXXXXXXX=", "first"}, {3, 1, "secondTargetIdentityXXXXXXXX=", "second"},
+		                                     {4, 1, "thirdTargetIdentityXXXXXXXXX=", "third"}};
+		const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		unsigned long long count = 0;
+		std::chrono::steady_clock::duration elapsed;
+		do {
+			log.permClientMove(1, &invoker, 3, targets, 2, "benchmark");
+			++count;
+			elapsed = std::chrono::steady_clock::now() - started;
+		} while (elapsed < measureFor);
+		log.waitDurable(count);
+		elapsed = std::chrono::steady_clock::now() - started;
+		const AuditLogStats stats = log.stats();
+		log.close();
+		std::remove(file.c_str());
+		const double seconds = std::chrono::duration<double>(elapsed).count();
+		result.eventsPerSecond = count / seconds;
+		result.recordsPerBatch = stats.batches != 0 ? static_cast<double>(stats.records) / stats.batches : 0;
+		result.syncsPerSecond = stats.batches / seconds;
+		return result;
+	}
+
+private:
+	static const size_t   FRAME_HEADER = 8;           ///< uint32 payload length, uint32 CRC32C of the payload
+	static const uint32_t MAX_RECORD_SIZE = 16 << 20; ///< payload limit, larger lengths in a frame header are damage
+	static const uint8_t  FORMAT = 1;
+
+	/*payload fields in order, strings are uint32 length prefixed*/
+	class Encoder {
+	public:
+		explicit Encoder(std::string& out) : m_out(out) {}
+
+		template <typename T>
+		void put(T value) { m_out.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+
+		void string(const char* text) {
+			const uint32_t length = text != nullptr ? static_cast<uint32_t>(std::strlen(text)) : 0;
+			put(length);
+			m_out.append(text != nullptr ? text : "", length);
+		}
+
+		void targets(ClientMiniSpan clients) {
+			put(static_cast<uint32_t>(clients.size()));
+			for (const ClientMiniExport& client : clients) {
+				put(client.ID);
+				put(client.channel);
+				string(client.ident);
+				string(client.nickname);
+			}
+		}
+
+		void changes(const VariablesExport* variables) {
+			const size_t countAt = m_out.size();
+			uint32_t count = 0;
+			put(count);
+			for (int flag = 0; variables != nullptr && flag < MAX_VARIABLES_EXPORT_COUNT; ++flag) {
+				const VariablesExportItem& item = variables->items[flag];
+				if (!item.itemIsValid || !item.proposedIsSet)
+					continue;
+				put(static_cast<uint32_t>(flag));
+				string(item.proposed);
+				++count;
+			}
+			std::memcpy(&m_out[countAt], &count, sizeof(count));
+		}
+
+		std::string& out() { return m_out; }
+
+	private:
+		std::string& m_out;
+	};
+
+	/*bounds checked counterpart of Encoder*/
+	class Decoder {
+	public:
+		Decoder(const char* data, size_t size) : m_data(data), m_size(size) {}
+
+		template <typename T>
+		bool get(T& value) {
+			if (m_size - m_at < sizeof(value))
+				return false;
+			std::memcpy(&value, m_data + m_at, sizeof(value));
+			m_at += sizeof(value);
+			return true;
+		}
+
+		bool string(std::string& value) {
+			uint32_t length = 0;
+			if (!get(length) || m_size - m_at < length)
+				return false;
+			value.assign(m_data + m_at, length);
+			m_at += length;
+			return true;
+		}
+
+		bool done() const { return m_at == m_size; }
+
+	private:
+		const char* m_data;
+		size_t      m_size;
+		size_t      m_at = 0;
+	};
+
+	static int64_t systemMs() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	static uint32_t crc32c(const char* data, size_t size) {
+		static const CrcTable table;
+		uint32_t crc = 0xFFFFFFFFu;
+		for (size_t i = 0; i < size; ++i)
+			crc = table.entries[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	struct CrcTable {
+		uint32_t entries[256];
+
+		CrcTable() {
+			for (uint32_t i = 0; i < 256; ++i) {
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; ++bit)
+					crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78u : crc >> 1; //Castagnoli, reflected
+				entries[i] = crc;
+			}
+		}
+	};
+
+	/*BLAKE3 of the secret as chain key, false for an empty secret*/
+	static bool deriveKey(const std::string& secret, unsigned char* key) {
+		if (secret.empty())
+			return false;
+		Blake3 keyHash;
+		keyHash.update(secret);
+		keyHash.finish(key);
+		return true;
+	}
+
+	/*hash of the previous record and this payload, key is nullptr for the plain chain*/
+	static void chain(const unsigned char* key, const unsigned char* previous, const char* payload, size_t size, unsigned char* hash) {
+		Blake3 hasher = key != nullptr ? Blake3(key) : Blake3();
+		hasher.update(previous, Blake3::DIGEST_SIZE);
+		hasher.update(payload, size);
+		hasher.finish(hash);
+	}
+
+	/*true if nothing but zero bytes follow offset, also for an offset at the end*/
+	static bool zeroFrom(const std::string& data, size_t offset) {
+		return offset >= data.size() || std::all_of(data.begin() + offset, data.end(), [](char c) { return c == 0; });
+	}
+
+	/*true if a frame with a valid CRC and a later sequence starts anywhere from offset on*/
+	static bool intactFrameAfter(const std::string& data, size_t offset, uint64 lastSequence) {
+		const size_t minimum = 2 + sizeof(uint64) + Blake3::DIGEST_SIZE; //format, action, sequence, hash
+		for (size_t at = offset; at + FRAME_HEADER + minimum <= data.size(); ++at) {
+			uint32_t length = 0, crc = 0;
+			std::memcpy(&length, data.data() + at, 4);
+			if (length < minimum || length > MAX_RECORD_SIZE || data.size() - at - FRAME_HEADER < length)
+				continue;
+			const char* payload = data.data() + at + FRAME_HEADER;
+			uint64 sequence = 0;
+			std::memcpy(&sequence, payload + 2, sizeof(sequence));
+			if (static_cast<uint8_t>(payload[0]) != FORMAT || sequence <= lastSequence)
+				continue;
+			std::memcpy(&crc, data.data() + at + 4, 4);
+			if (crc32c(payload, length) == crc)
+				return true;
+		}
+		return false;
+	}
+
+	static bool decode(const char* payload, size_t size, AuditRecord& record) {
+		Decoder in(payload, size);
+		uint8_t format = 0, action = 0;
+		uint32_t count = 0;
+		if (!in.get(format) || format != FORMAT || !in.get(action) || action < AUDIT_PERM_CLIENT_MOVE || action > AUDIT_CHANNEL_DELETED)
+			return false;
+		record.action = static_cast<AuditAction>(action);
+		if (!in.get(record.sequence) || !in.get(record.timestampMs) || !in.get(record.serverID) || !in.get(record.channelID) ||
+		    !in.get(record.targetChannelID) || !in.get(record.decision) || !in.get(record.invokerClientID) || !in.string(record.invokerIdentity) ||
+		    !in.string(record.invokerNickname) || !in.string(record.reason))
+			return false;
+		const bool hasTargets = record.action == AUDIT_PERM_CLIENT_MOVE || record.action == AUDIT_PERM_CLIENT_KICK_FROM_CHANNEL ||
+		                        record.action == AUDIT_PERM_CLIENT_KICK_FROM_SERVER || record.action == AUDIT_CLIENT_MOVED;
+		if (hasTargets) {
+			if (!in.get(count) || count > size)
+				return false;
+			record.targets.resize(count);
+			for (AuditTarget& target : record.targets) {
+				if (!in.get(target.clientID) || !in.get(target.channelID) || !in.string(target.identity) || !in.string(target.nickname))
+					return false;
+			}
+		}
+		if (record.action == AUDIT_PERM_CHANNEL_EDIT) {
+			if (!in.get(count) || count > MAX_VARIABLES_EXPORT_COUNT)
+				return false;
+			record.changes.resize(count);
+			for (auto& change : record.changes) {
+				uint32_t flag = 0;
+				if (!in.get(flag) || !in.string(change.second))
+					return false;
+				change.first = static_cast<int>(flag);
+			}
+		}
+		return in.done();
+	}
+
+	/*the common fields into the per thread scratch buffer, the record is sequenced in commit()*/
+	Encoder begin(AuditAction action, uint64 serverID, const ClientMiniExport* invoker, uint64 channelID, uint64 targetChannelID, unsigned int decision,
+	              const char* reason) {
+		thread_local std::string scratch;
+		scratch.clear();
+		Encoder record(scratch);
+		record.put(FORMAT);
+		record.put(static_cast<uint8_t>(action));
+		record.put(uint64(0)); //sequence
+		record.put(m_clock());
+		record.put(serverID);
+		record.put(channelID);
+		record.put(targetChannelID);
+		record.put(decision);
+		record.put(invoker != nullptr ? invoker->ID : anyID(0));
+		record.string(invoker != nullptr ? invoker->ident : nullptr);
+		record.string(invoker != nullptr ? invoker->nickname : nullptr);
+		record.string(reason);
+		return record;
+	}
+
+	/*sequence, chain hash and frame under the lock, so the order in the file is the chain order*/
+	void commit(Encoder record) {
+		std::string& payload = record.out();
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!m_writer.joinable() || m_stopping || m_failed)
+			return;
+		m_space.wait(lock, [&] { return m_pending.size() < m_options.maxPendingBytes || m_stopping || m_failed; });
+		if (m_stopping || m_failed)
+			return;
+		if (payload.size() + Blake3::DIGEST_SIZE > MAX_RECORD_SIZE) {
+			//out of reach for the SDK's string and client limits, replay() would take such a frame for damage
+			++m_stats.writeErrors;
+			return;
+		}
+		const uint64 sequence = ++m_sequence;
+		std::memcpy(&payload[2], &sequence, sizeof(sequence));
+		unsigned char hash[Blake3::DIGEST_SIZE];
+		chain(m_keyed ? m_chainKey : nullptr, m_lastHash, payload.data(), payload.size(), hash);
+		std::memcpy(m_lastHash, hash, sizeof(hash));
+		payload.append(reinterpret_cast<const char*>(hash), sizeof(hash));
+		const uint32_t length = static_cast<uint32_t>(payload.size());
+		const uint32_t crc = crc32c(payload.data(), payload.size());
+		m_pending.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		m_pending.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+		m_pending += payload;
+		++m_pendingRecords;
+		if (m_pendingRecords == 1)
+			m_wake.notify_one();
+	}
+
+	/*takes everything pending while the previous batch syncs. A failed write, flush or sync stops the log for good: after a
+	  failed fsync the kernel may have dropped the pages and marked them clean, so a retry that succeeds proves nothing.*/
+	void writeLoop() {
+		std::string batch;
+		uint64 batchRecords = 0, batchLast = 0;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;) {
+			m_wake.wait(lock, [&] { return m_pendingRecords != 0 || !batch.empty() || m_stopping; });
+			if (batch.empty()) {
+				if (m_pendingRecords == 0)
+					break; //stopping with nothing left
+				batch.swap(m_pending);
+				batchRecords = m_pendingRecords;
+				batchLast = m_sequence;
+				m_pendingRecords = 0;
+				m_space.notify_all();
+			}
+			lock.unlock();
+			const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+			const size_t written = std::fwrite(batch.data(), 1, batch.size(), m_file);
+			const bool ok = written == batch.size() && std::fflush(m_file) == 0 && (!m_options.sync || syncFile(m_file));
+			const int64_t syncUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+			lock.lock();
+			if (!ok) {
+				//m_durable stays before the batch; what reached the file is checked by open() on the next start
+				++m_stats.writeErrors;
+				m_failed = true;
+				m_pending.clear();
+				m_pendingRecords = 0;
+				m_space.notify_all();
+				break;
+			}
+			m_durable = batchLast;
+			m_stats.records += batchRecords;
+			m_stats.batches += 1;
+			m_stats.largestBatch = std::max(m_stats.largestBatch, batchRecords);
+			m_stats.bytes += batch.size();
+			m_stats.longestSyncUs = std::max(m_stats.longestSyncUs, syncUs);
+			batch.clear();
+			m_synced.notify_all();
+		}
+		m_synced.notify_all();
+	}
+
+	static bool syncFile(FILE* file) {
+#ifdef _WIN32
+		return _commit(_fileno(file)) == 0;
+#elif defined(__APPLE__)
+		return fsync(fileno(file)) == 0;
+#else
+		return fdatasync(fileno(file)) == 0;
+#endif
+	}
+
+	const AuditLogOptions   m_options;
+	const Clock             m_clock;
+	unsigned char           m_chainKey[Blake3::KEY_SIZE];
+	bool                    m_keyed;
+	mutable std::mutex      m_mutex;
+	std::condition_variable m_wake;   ///< records pending or stopping, for the writer
+	std::condition_variable m_space;  ///< pending bytes below the limit, for producers
+	std::condition_variable m_synced; ///< m_durable advanced or writing failed
+	std::thread             m_writer;
+	FILE*                   m_file = nullptr;
+	std::string             m_pending;            ///< framed records not yet handed to the writer
+	uint64                  m_pendingRecords = 0;
+	uint64                  m_sequence = 0;       ///< last sequence handed out
+	uint64                  m_durable = 0;        ///< last sequence synced
+	unsigned char           m_lastHash[Blake3::DIGEST_SIZE] = {0};
+	bool                    m_stopping = false;
+	bool                    m_failed = false; ///< set for good by a failed write or sync
+	AuditLogStats           m_stats;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_AUDIT_LOG_H
@@ -0,0 +1,250 @@
+/*
+ * Portable BLAKE3 (hash and keyed hash modes, 32 byte output). Straightforward port of the reference implementation,
+ * processes one chunk at a time.
+ */
+
+#ifndef TEAMSPEAK_EXT_BLAKE3_H
+#define TEAMSPEAK_EXT_BLAKE3_H
+
+//system
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace ts3ext {
+
+class Blake3 {
+public:
+	static const size_t DIGEST_SIZE = 32;
+	static const size_t KEY_SIZE = 32;
+	static const size_t BLOCK_SIZE = 64;
+	static const size_t CHUNK_SIZE = 1024;
+
+	Blake3() { init(IV, 0); }
+
+	/** @brief keyed hash mode, key must be KEY_SIZE bytes */
+	explicit Blake3(const unsigned char* key) {
+		uint32_t words[8];
+		for (int i = 0; i < 8; ++i)
+			words[i] = load32(key + 4 * i);
+		init(words, KEYED_HASH);
+	}
+
+	void update(const void* data, size_t size) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		while (size > 0) {
+			if (m_chunk.length() == CHUNK_SIZE) {
+				//the chunk is complete and more input follows, so it is not the root
+				uint32_t chunkOutput[8];
+				m_chunk.output().chainingValue(chunkOutput);
+				addChunkChainingValue(chunkOutput, m_chunk.counter + 1);
+				m_chunk.reset(m_key, m_chunk.counter + 1, m_flags);
+			}
+			const size_t take = size < CHUNK_SIZE - m_chunk.length() ? size : CHUNK_SIZE - m_chunk.length();
+			m_chunk.update(bytes, take);
+			bytes += take;
+			size -= take;
+		}
+	}
+
+	void update(const std::string& data) { update(data.data(), data.size()); }
+
+	/** @brief writes DIGEST_SIZE bytes, does not modify the state */
+	void finish(unsigned char* digest) const {
+		Output output = m_chunk.output();
+		for (size_t i = m_stackSize; i > 0; --i)
+			output = parentOutput(m_stack[i - 1], output, m_key, m_flags);
+		output.root(digest);
+	}
+
+	static std::string digest(const std::string& data) {
+		Blake3 hash;
+		hash.update(data);
+		unsigned char result[DIGEST_SIZE];
+		hash.finish(result);
+		return std::string(reinterpret_cast<const char*>(result), DIGEST_SIZE);
+	}
+
+private:
+	enum Flags {
+		CHUNK_START = 1 << 0,
+		CHUNK_END = 1 << 1,
+		PARENT = 1 << 2,
+		ROOT = 1 << 3,
+		KEYED_HASH = 1 << 4,
+	};
+
+	static constexpr uint32_t IV[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+	static uint32_t load32(const unsigned char* bytes) {
+		return uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+	}
+
+	static uint32_t rotr(uint32_t value, int bits) { return (value >> bits) | (value << (32 - bits)); }
+
+	static void g(uint32_t* state, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+		state[a] = state[a] + state[b] + x;
+		state[d] = rotr(state[d] ^ state[a], 16);
+		state[c] = state[c] + state[d];
+		state[b] = rotr(state[b] ^ state[c], 12);
+		state[a] = state[a] + state[b] + y;
+		state[d] = rotr(state[d] ^ state[a], 8);
+		state[c] = state[c] + state[d];
+		state[b] = rotr(state[b] ^ state[c], 7);
+	}
+
+	static void compress(const uint32_t* chainingValue, const uint32_t* blockWords, uint64_t counter, uint32_t blockLength, uint32_t flags,
+	                     uint32_t* out) {
+		static const int permutation[16] = {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8};
+		uint32_t state[16] = {chainingValue[0], chainingValue[1], chainingValue[2], chainingValue[3], chainingValue[4], chainingValue[5],
+		                      chainingValue[6], chainingValue[7], IV[0],            IV[1],            IV[2],            IV[3],
+		                      static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), blockLength, flags};
+		uint32_t m[16];
+		std::memcpy(m, blockWords, sizeof(m));
+		for (int round = 0; round < 7; ++round) {
+			g(state, 0, 4, 8, 12, m[0], m[1]);
+			g(state, 1, 5, 9, 13, m[2], m[3]);
+			g(state, 2, 6, 10, 14, m[4], m[5]);
+			g(state, 3, 7, 11, 15, m[6], m[7]);
+			g(state, 0, 5, 10, 15, m[8], m[9]);
+			g(state, 1, 6, 11, 12, m[10], m[11]);
+			g(state, 2, 7, 8, 13, m[12], m[13]);
+			g(state, 3, 4, 9, 14, m[14], m[15]);
+			uint32_t permuted[16];
+			for (int i = 0; i < 16; ++i)
+				permuted[i] = m[permutation[i]];
+			std::memcpy(m, permuted, sizeof(m));
+		}
+		for (int i = 0; i < 8; ++i) {
+			out[i] = state[i] ^ state[i + 8];
+			out[i + 8] = state[i + 8] ^ chainingValue[i];
+		}
+	}
+
+	static void words(const unsigned char* block, uint32_t* blockWords) {
+		for (int i = 0; i < 16; ++i)
+			blockWords[i] = load32(block + 4 * i);
+	}
+
+	/*input of the final compression of a chunk or parent, kept so the root flag can be added later*/
+	struct Output {
+		uint32_t chainingValue_[8];
+		uint32_t blockWords[16];
+		uint64_t counter;
+		uint32_t blockLength;
+		uint32_t flags;
+
+		void chainingValue(uint32_t* out) const {
+			uint32_t full[16];
+			compress(chainingValue_, blockWords, counter, blockLength, flags, full);
+			std::memcpy(out, full, 8 * sizeof(uint32_t));
+		}
+
+		void root(unsigned char* digest) const {
+			uint32_t full[16];
+			compress(chainingValue_, blockWords, 0, blockLength, flags | ROOT, full);
+			for (size_t i = 0; i < DIGEST_SIZE / 4; ++i) {
+				digest[4 * i] = static_cast<unsigned char>(full[i]);
+				digest[4 * i + 1] = static_cast<unsigned char>(full[i] >> 8);
+				digest[4 * i + 2] = static_cast<unsigned char>(full[i] >> 16);
+				digest[4 * i + 3] = static_cast<unsigned char>(full[i] >> 24);
+			}
+		}
+	};
+
+	struct ChunkState {
+		uint32_t      chainingValue[8];
+		uint64_t      counter;
+		unsigned char block[BLOCK_SIZE];
+		size_t        blockLength;
+		size_t        blocksCompressed;
+		uint32_t      flags;
+
+		void reset(const uint32_t* key, uint64_t chunkCounter, uint32_t baseFlags) {
+			std::memcpy(chainingValue, key, sizeof(chainingValue));
+			counter = chunkCounter;
+			std::memset(block, 0, sizeof(block));
+			blockLength = 0;
+			blocksCompressed = 0;
+			flags = baseFlags;
+		}
+
+		size_t length() const { return BLOCK_SIZE * blocksCompressed + blockLength; }
+
+		uint32_t startFlag() const { return blocksCompressed == 0 ? CHUNK_START : 0; }
+
+		void update(const unsigned char* bytes, size_t size) {
+			while (size > 0) {
+				if (blockLength == BLOCK_SIZE) {
+					uint32_t blockWords[16], full[16];
+					words(block, blockWords);
+					compress(chainingValue, blockWords, counter, BLOCK_SIZE, flags | startFlag(), full);
+					std::memcpy(chainingValue, full, sizeof(chainingValue));
+					++blocksCompressed;
+					std::memset(block, 0, sizeof(block));
+					blockLength = 0;
+				}
+				const size_t take = size < BLOCK_SIZE - blockLength ? size : BLOCK_SIZE - blockLength;
+				std::memcpy(block + blockLength, bytes, take);
+				blockLength += take;
+				bytes += take;
+				size -= take;
+			}
+		}
+
+		Output output() const {
+			Output result;
+			std::memcpy(result.chainingValue_, chainingValue, sizeof(chainingValue));
+			words(block, result.blockWords);
+			result.counter = counter;
+			result.blockLength = static_cast<uint32_t>(blockLength);
+			result.flags = flags | startFlag() | CHUNK_END;
+			return result;
+		}
+	};
+
+	static Output parentOutput(const uint32_t* left, const Output& right, const uint32_t* key, uint32_t flags) {
+		uint32_t rightChainingValue[8];
+		right.chainingValue(rightChainingValue);
+		return parentOutput(left, rightChainingValue, key, flags);
+	}
+
+	static Output parentOutput(const uint32_t* left, const uint32_t* right, const uint32_t* key, uint32_t flags) {
+		Output result;
+		std::memcpy(result.chainingValue_, key, 8 * sizeof(uint32_t));
+		std::memcpy(result.blockWords, left, 8 * sizeof(uint32_t));
+		std::memcpy(result.blockWords + 8, right, 8 * sizeof(uint32_t));
+		result.counter = 0;
+		result.blockLength = BLOCK_SIZE;
+		result.flags = PARENT | flags;
+		return result;
+	}
+
+	void init(const uint32_t* key, uint32_t flags) {
+		std::memcpy(m_key, key, sizeof(m_key));
+		m_flags = flags;
+		m_stackSize = 0;
+		m_chunk.reset(key, 0, flags);
+	}
+
+	/*merge completed subtrees: one merge per trailing zero bit of the new total chunk count*/
+	void addChunkChainingValue(uint32_t* chainingValue, uint64_t totalChunks) {
+		for (; (totalChunks & 1) == 0; totalChunks >>= 1) {
+			parentOutput(m_stack[--m_stackSize], chainingValue, m_key, m_flags).chainingValue(chainingValue);
+		}
+		std::memcpy(m_stack[m_stackSize++], chainingValue, 8 * sizeof(uint32_t));
+	}
+
+	uint32_t   m_key[8];
+	uint32_t   m_flags;
+	ChunkState m_chunk;
+	uint32_t   m_stack[54][8]; ///< chaining values of completed subtrees, enough for 2^64 bytes
+	size_t     m_stackSize;
+};
+
+constexpr uint32_t Blake3::IV[8];
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_BLAKE3_H
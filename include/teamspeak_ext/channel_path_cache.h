@@ -0,0 +1,330 @@
+/*
+ * Channel path lookup cache, an in-memory replacement for ts3client_getChannelIDFromChannelNames. Channel names are
+ * kept as a trie of CHANNEL_NAME path segments per server connection handler. Resolving "Lobby/Events/Stage" costs
+ * one hash lookup per segment and does not allocate. The children of every channel are additionally kept sorted by
+ * name, which allows listing completions for a partially typed path.
+ */
+
+#ifndef TEAMSPEAK_EXT_CHANNEL_PATH_CACHE_H
+#define TEAMSPEAK_EXT_CHANNEL_PATH_CACHE_H
+
+//system
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+//own
+#include "teamspeak/clientlib.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak_ext/flat_hash_map.h"
+
+namespace ts3ext {
+
+/**
+ * @brief Maps channel paths to channel ids for every server connection handler.
+ *
+ * Forward onNewChannelEvent, onNewChannelCreatedEvent, onUpdateChannelEditedEvent, onChannelMoveEvent, onDelChannelEvent
+ * and onConnectStatusChangeEvent to the methods of the same name. Lookups are safe from any thread.
+*/
+class ChannelPathCache {
+public:
+	/**
+	 * @brief resolve a separator delimited path, e.g. "Lobby/Events/Stage"
+	 *
+	 * @param serverConnectionHandlerID the connection on which to look up the channel
+	 * @param path utf8 encoded c string of channel names from the root down to the wanted channel
+	 * @param result address of a variable receiving the channel id
+	 * @param separator character between path segments
+	 * @return ERROR_ok on success, ERROR_channel_invalid_id if no channel with that path is known
+	*/
+	unsigned int resolve(uint64 serverConnectionHandlerID, const char* path, uint64* result, char separator = '/') const {
+		std::shared_ptr<Entry> entry = lookup(serverConnectionHandlerID);
+		if (!entry)
+			return ERROR_channel_invalid_id;
+		std::shared_lock<std::shared_mutex> lock(entry->mutex);
+		uint64 channelID = 0;
+		const char* segment = path;
+		for (;;) {
+			const char* end = std::strchr(segment, separator);
+			const size_t length = end != nullptr ? static_cast<size_t>(end - segment) : std::strlen(segment);
+			if (length != 0) {
+				channelID = entry->child(channelID, segment, length);
+				if (channelID == 0)
+					return ERROR_channel_invalid_id;
+			}
+			if (end == nullptr)
+				break;
+			segment = end + 1;
+		}
+		if (channelID == 0)
+			return ERROR_channel_invalid_id;
+		*result = channelID;
+		return ERROR_ok;
+	}
+
+	/**
+	 * @brief drop-in for ts3client_getChannelIDFromChannelNames
+	 *
+	 * @param channelNameArray NULL terminated array of channel names, from the root down to the wanted channel
+	*/
+	unsigned int resolve(uint64 serverConnectionHandlerID, char** channelNameArray, uint64* result) const {
+		std::shared_ptr<Entry> entry = lookup(serverConnectionHandlerID);
+		if (!entry || channelNameArray == nullptr || channelNameArray[0] == nullptr)
+			return ERROR_channel_invalid_id;
+		std::shared_lock<std::shared_mutex> lock(entry->mutex);
+		uint64 channelID = 0;
+		for (char** name = channelNameArray; *name != nullptr; ++name) {
+			channelID = entry->child(channelID, *name, std::strlen(*name));
+			if (channelID == 0)
+				return ERROR_channel_invalid_id;
+		}
+		*result = channelID;
+		return ERROR_ok;
+	}
+
+	/**
+	 * @brief list completions of a partially typed path
+	 *
+	 * Everything up to the last separator must name an existing channel, the remainder is matched as name prefix
+	 * against its sub channels. "Lobby/Ev" lists all sub channels of "Lobby" starting with "Ev", in name order.
+	 *
+	 * @param visit called as visit(uint64 channelID, const std::string& name) for each match
+	 * @param maxResults stop after this many matches
+	 * @return number of matches reported
+	*/
+	template <typename Visit>
+	size_t complete(uint64 serverConnectionHandlerID, const char* partialPath, Visit&& visit, size_t maxResults = 32, char separator = '/') const {
+		std::shared_ptr<Entry> entry = lookup(serverConnectionHandlerID);
+		if (!entry)
+			return 0;
+		std::shared_lock<std::shared_mutex> lock(entry->mutex);
+		uint64 parentID = 0;
+		const char* segment = partialPath;
+		const char* end;
+		while ((end = std::strchr(segment, separator)) != nullptr) {
+			if (end != segment) {
+				parentID = entry->child(parentID, segment, static_cast<size_t>(end - segment));
+				if (parentID == 0)
+					return 0;
+			}
+			segment = end + 1;
+		}
+		const std::vector<Child>& children = entry->childrenOf(parentID);
+		const size_t prefixLength = std::strlen(segment);
+		auto it = std::lower_bound(children.begin(), children.end(), segment,
+		                           [](const Child& child, const char* prefix) { return child.name.compare(prefix) < 0; });
+		size_t reported = 0;
+		for (; it != children.end() && reported < maxResults; ++it) {
+			if (it->name.compare(0, prefixLength, segment) != 0)
+				break;
+			visit(it->channelID, it->name);
+			++reported;
+		}
+		return reported;
+	}
+
+	/**
+	 * @brief fill the cache for a connection from the client library, e.g. when attaching to an already established connection
+	 *
+	 * @return An Error code from the @ref Ts3ErrorType enum indicating either success or the failure reason
+	*/
+	unsigned int rebuild(uint64 serverConnectionHandlerID) {
+		uint64* channels;
+		const unsigned int error = ts3client_getChannelList(serverConnectionHandlerID, &channels);
+		if (error != ERROR_ok)
+			return error;
+		std::shared_ptr<Entry> entry = lookupOrCreate(serverConnectionHandlerID);
+		std::unique_lock<std::shared_mutex> lock(entry->mutex);
+		entry->clear();
+		for (uint64* channel = channels; *channel != 0; ++channel) {
+			uint64 parentID = 0;
+			ts3client_getParentChannelOfChannel(serverConnectionHandlerID, *channel, &parentID);
+			entry->insert(*channel, parentID, readName(serverConnectionHandlerID, *channel));
+		}
+		ts3client_freeMemory(channels);
+		return ERROR_ok;
+	}
+
+	void onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int /*errorNumber*/) {
+		if (newStatus == STATUS_DISCONNECTED) {
+			std::lock_guard<std::mutex> lock(m_entriesMutex);
+			m_entries.erase(serverConnectionHandlerID);
+		}
+	}
+
+	void onNewChannelEvent(uint64 serverConnectionHandlerID, uint64 channelID, uint64 channelParentID) {
+		std::string name = readName(serverConnectionHandlerID, channelID);
+		std::shared_ptr<Entry> entry = lookupOrCreate(serverConnectionHandlerID);
+		std::unique_lock<std::shared_mutex> lock(entry->mutex);
+		entry->insert(channelID, channelParentID, std::move(name));
+	}
+
+	void onNewChannelCreatedEvent(uint64 serverConnectionHandlerID, uint64 channelID, uint64 channelParentID, anyID, const char*, const char*) {
+		onNewChannelEvent(serverConnectionHandlerID, channelID, channelParentID);
+	}
+
+	void onUpdateChannelEditedEvent(uint64 serverConnectionHandlerID, uint64 channelID, anyID, const char*, const char*) {
+		std::string name = readName(serverConnectionHandlerID, channelID);
+		std::shared_ptr<Entry> entry = lookupOrCreate(serverConnectionHandlerID);
+		std::unique_lock<std::shared_mutex> lock(entry->mutex);
+		const Node* node = entry->nodes.find(channelID);
+		if (node == nullptr || node->name == name)
+			return;
+		const uint64 parentID = node->parentID;
+		entry->unlink(channelID);
+		entry->insert(channelID, parentID, std::move(name));
+	}
+
+	void onChannelMoveEvent(uint64 serverConnectionHandlerID, uint64 channelID, uint64 newChannelParentID, anyID, const char*, const char*) {
+		std::shared_ptr<Entry> entry = lookupOrCreate(serverConnectionHandlerID);
+		std::unique_lock<std::shared_mutex> lock(entry->mutex);
+		const Node* node = entry->nodes.find(channelID);
+		if (node == nullptr)
+			return;
+		std::string name = node->name;
+		entry->unlink(channelID);
+		entry->insert(channelID, newChannelParentID, std::move(name));
+	}
+
+	void onDelChannelEvent(uint64 serverConnectionHandlerID, uint64 channelID, anyID, const char*, const char*) {
+		std::shared_ptr<Entry> entry = lookup(serverConnectionHandlerID);
+		if (!entry)
+			return;
+		std::unique_lock<std::shared_mutex> lock(entry->mutex);
+		entry->removeSubtree(channelID);
+	}
+
+private:
+	struct Child {
+		std::string name;
+		uint64      channelID;
+	};
+
+	struct Node {
+		uint64             parentID = 0;
+		std::string        name;
+		std::vector<Child> children; ///< sorted by name
+	};
+
+	struct Entry {
+		std::shared_mutex          mutex;
+		FlatHashMap<uint64, Node>  nodes;
+		FlatHashMap<uint64, uint64> index; ///< segmentKey(parent, name) -> channel id
+		std::vector<Child>         roots;  ///< sorted by name
+
+		const std::vector<Child>& childrenOf(uint64 parentID) const {
+			static const std::vector<Child> none;
+			if (parentID == 0)
+				return roots;
+			const Node* parent = nodes.find(parentID);
+			return parent != nullptr ? parent->children : none;
+		}
+
+		std::vector<Child>& mutableChildrenOf(uint64 parentID) {
+			return parentID == 0 ? roots : nodes[parentID].children;
+		}
+
+		/*channel id of the sub channel called name, 0 if there is none*/
+		uint64 child(uint64 parentID, const char* name, size_t length) const {
+			if (const uint64* hit = index.find(segmentKey(parentID, name, length))) {
+				const Node* node = nodes.find(*hit);
+				if (node != nullptr && node->parentID == parentID && node->name.size() == length && node->name.compare(0, length, name, length) == 0)
+					return *hit;
+			}
+			//64 bit key collision between siblings, fall back to the sorted child list
+			const std::vector<Child>& children = childrenOf(parentID);
+			auto it = std::lower_bound(children.begin(), children.end(), 0, [&](const Child& c, int) { return c.name.compare(0, std::string::npos, name, length) < 0; });
+			if (it != children.end() && it->name.size() == length && it->name.compare(0, length, name, length) == 0)
+				return it->channelID;
+			return 0;
+		}
+
+		void clear() {
+			nodes.clear();
+			index.clear();
+			roots.clear();
+		}
+
+		void insert(uint64 channelID, uint64 parentID, std::string name) {
+			if (nodes.contains(channelID))
+				unlink(channelID);
+			index[segmentKey(parentID, name.data(), name.size())] = channelID;
+			std::vector<Child>& siblings = mutableChildrenOf(parentID);
+			auto it = std::lower_bound(siblings.begin(), siblings.end(), name, [](const Child& c, const std::string& n) { return c.name < n; });
+			siblings.insert(it, Child{name, channelID});
+			Node& node = nodes[channelID];
+			node.parentID = parentID;
+			node.name = std::move(name);
+		}
+
+		/*detach a channel from its parent but keep its own sub channels*/
+		void unlink(uint64 channelID) {
+			Node* node = nodes.find(channelID);
+			if (node == nullptr)
+				return;
+			const uint64 key = segmentKey(node->parentID, node->name.data(), node->name.size());
+			const uint64* indexed = index.find(key);
+			if (indexed != nullptr && *indexed == channelID)
+				index.erase(key);
+			std::vector<Child>& siblings = mutableChildrenOf(node->parentID);
+			siblings.erase(std::remove_if(siblings.begin(), siblings.end(), [&](const Child& c) { return c.channelID == channelID; }), siblings.end());
+		}
+
+		void removeSubtree(uint64 channelID) {
+			Node* node = nodes.find(channelID);
+			if (node == nullptr)
+				return;
+			std::vector<Child> children;
+			children.swap(node->children);
+			for (const Child& child : children)
+				removeSubtree(child.channelID);
+			unlink(channelID);
+			nodes.erase(channelID);
+		}
+	};
+
+	/*FNV-1a of the name, mixed with the parent id*/
+	static uint64 segmentKey(uint64 parentID, const char* name, size_t length) {
+		uint64 hash = 0xcbf29ce484222325ULL;
+		for (size_t i = 0; i < length; ++i) {
+			hash ^= static_cast<unsigned char>(name[i]);
+			hash *= 0x100000001b3ULL;
+		}
+		return hash ^ (parentID * 0x9E3779B97F4A7C15ULL);
+	}
+
+	static std::string readName(uint64 serverConnectionHandlerID, uint64 channelID) {
+		std::string name;
+		char* value = nullptr;
+		if (ts3client_getChannelVariableAsString(serverConnectionHandlerID, channelID, CHANNEL_NAME, &value) == ERROR_ok) {
+			name.assign(value);
+			ts3client_freeMemory(value);
+		}
+		return name;
+	}
+
+	std::shared_ptr<Entry> lookup(uint64 serverConnectionHandlerID) const {
+		std::lock_guard<std::mutex> lock(m_entriesMutex);
+		const std::shared_ptr<Entry>* entry = m_entries.find(serverConnectionHandlerID);
+		return entry != nullptr ? *entry : std::shared_ptr<Entry>();
+	}
+
+	std::shared_ptr<Entry> lookupOrCreate(uint64 serverConnectionHandlerID) {
+		std::lock_guard<std::mutex> lock(m_entriesMutex);
+		std::shared_ptr<Entry>& entry = m_entries[serverConnectionHandlerID];
+		if (!entry)
+			entry = std::make_shared<Entry>();
+		return entry;
+	}
+
+	mutable std::mutex                          m_entriesMutex;
+	FlatHashMap<uint64, std::shared_ptr<Entry>> m_entries;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_CHANNEL_PATH_CACHE_H
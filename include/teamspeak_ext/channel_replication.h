@@ -0,0 +1,197 @@
+/*
+ * Channel change replication between two copies of a virtual server. The recorder runs next to the source server and
+ * turns onChannelCreated, onChannelEdited and onChannelDeleted into coalesced deltas carrying the channel's current
+ * properties. The deltas are applied to the copy with the server library setters, keeping channel IDs.
+ */
+
+#ifndef TEAMSPEAK_EXT_CHANNEL_REPLICATION_H
+#define TEAMSPEAK_EXT_CHANNEL_REPLICATION_H
+
+//system
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+#include "teamspeak_ext/virtual_server_snapshot.h"
+
+namespace ts3ext {
+
+enum ChannelDeltaType {
+	CHANNEL_DELTA_CREATED = 0,
+	CHANNEL_DELTA_EDITED,
+	CHANNEL_DELTA_DELETED,
+};
+
+struct ChannelDelta {
+	ChannelDeltaType type = CHANNEL_DELTA_EDITED;
+	ChannelSnapshot  channel; ///< only channelID for deletions
+};
+
+/**
+ * @brief records channel changes of selected servers
+ *
+ * Forward onChannelCreated, onChannelEdited and onChannelDeleted. Repeated edits of a channel are merged into one delta,
+ * a channel created and deleted between two take() calls produces none.
+*/
+class ChannelReplicator {
+public:
+	ChannelReplicator() = default;
+
+	ChannelReplicator(const ChannelReplicator&) = delete;
+	ChannelReplicator& operator=(const ChannelReplicator&) = delete;
+
+	void start(uint64 serverID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending[serverID];
+	}
+
+	void stop(uint64 serverID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending.erase(serverID);
+	}
+
+	/** @brief hand out the recorded deltas in order, false if the server is not replicated */
+	bool take(uint64 serverID, std::vector<ChannelDelta>& deltas) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto pending = m_pending.find(serverID);
+		if (pending == m_pending.end())
+			return false;
+		deltas.swap(pending->second);
+		pending->second.clear();
+		return true;
+	}
+
+	void onChannelCreated(uint64 serverID, anyID /*invokerClientID*/, uint64 channelID) { record(serverID, channelID, CHANNEL_DELTA_CREATED); }
+	void onChannelEdited(uint64 serverID, anyID /*invokerClientID*/, uint64 channelID) { record(serverID, channelID, CHANNEL_DELTA_EDITED); }
+	void onChannelDeleted(uint64 serverID, anyID /*invokerClientID*/, uint64 channelID) { record(serverID, channelID, CHANNEL_DELTA_DELETED); }
+
+	/** @brief apply deltas to a server of this process, stops at the first failure */
+	static unsigned int apply(uint64 serverID, const std::vector<ChannelDelta>& deltas) {
+		for (const ChannelDelta& delta : deltas) {
+			const unsigned int error = applyOne(serverID, delta);
+			if (error != ERROR_ok && error != ERROR_ok_no_update)
+				return error;
+		}
+		return ERROR_ok;
+	}
+
+	/** @brief set server properties, e.g. the variables of a fresh snapshot of the source */
+	static unsigned int applyServerVariables(uint64 serverID, const std::vector<SnapshotVariable>& variables) {
+		for (const SnapshotVariable& variable : variables) {
+			const VirtualServerProperties flag = static_cast<VirtualServerProperties>(variable.flag);
+			unsigned int error;
+			if (variable.type == SNAPSHOT_INT)
+				error = ts3server_setVirtualServerVariableAsInt(serverID, flag, static_cast<int>(std::strtol(variable.value.c_str(), nullptr, 10)));
+			else if (variable.type == SNAPSHOT_UINT64)
+				error = ts3server_setVirtualServerVariableAsUInt64(serverID, flag, std::strtoull(variable.value.c_str(), nullptr, 10));
+			else
+				error = ts3server_setVirtualServerVariableAsString(serverID, flag, variable.value.c_str());
+			if (error != ERROR_ok)
+				return error;
+		}
+		const unsigned int error = ts3server_flushVirtualServerVariable(serverID);
+		return error == ERROR_ok_no_update ? static_cast<unsigned int>(ERROR_ok) : error;
+	}
+
+private:
+	/*the channel state is read right away, the callback is the last moment it is known to exist*/
+	void record(uint64 serverID, uint64 channelID, ChannelDeltaType type) {
+		ChannelDelta delta;
+		delta.type = type;
+		delta.channel.channelID = channelID;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_pending.find(serverID) == m_pending.end())
+				return;
+		}
+		if (type != CHANNEL_DELTA_DELETED) {
+			if (ts3server_getParentChannelOfChannel(serverID, channelID, &delta.channel.parentChannelID) != ERROR_ok)
+				return;
+			for (const SnapshotVariable& wanted : VirtualServerSnapshot::channelVariables()) {
+				SnapshotVariable variable = wanted;
+				if (VirtualServerSnapshot::readChannelVariable(serverID, channelID, variable))
+					delta.channel.variables.push_back(variable);
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto pending = m_pending.find(serverID);
+		if (pending == m_pending.end())
+			return;
+		std::vector<ChannelDelta>& deltas = pending->second;
+		const auto earlier = std::find_if(deltas.begin(), deltas.end(), [&](const ChannelDelta& other) {
+			return other.channel.channelID == channelID && other.type != CHANNEL_DELTA_DELETED;
+		});
+		if (earlier == deltas.end()) {
+			deltas.push_back(std::move(delta));
+		} else if (type == CHANNEL_DELTA_DELETED) {
+			const bool createdHere = earlier->type == CHANNEL_DELTA_CREATED;
+			deltas.erase(earlier);
+			if (!createdHere)
+				deltas.push_back(std::move(delta));
+		} else {
+			//keep the position of a creation, sub channels created later depend on it
+			earlier->channel = std::move(delta.channel);
+		}
+	}
+
+	static unsigned int applyOne(uint64 serverID, const ChannelDelta& delta) {
+		const ChannelSnapshot& channel = delta.channel;
+		if (delta.type == CHANNEL_DELTA_DELETED)
+			return ts3server_channelDelete(serverID, channel.channelID, 1);
+		if (delta.type == CHANNEL_DELTA_CREATED) {
+			TS3ChannelCreationParams* params = nullptr;
+			unsigned int error = ts3server_makeChannelCreationParams(&params);
+			if (error != ERROR_ok)
+				return error;
+			if ((error = ts3server_setChannelCreationParams(params, channel.parentChannelID, channel.channelID)) != ERROR_ok)
+				return error;
+			TS3Variables* variables = nullptr;
+			if ((error = ts3server_getChannelCreationParamsVariables(params, &variables)) != ERROR_ok)
+				return error;
+			for (const SnapshotVariable& variable : channel.variables) {
+				if ((error = VirtualServerSnapshot::writeVariable(variables, variable)) != ERROR_ok)
+					return error;
+			}
+			uint64 created = 0;
+			return ts3server_createChannel(serverID, params, CHANNEL_CREATE_FLAG_PASSWORDS_ENCRYPTED, &created);
+		}
+
+		uint64 parent = 0;
+		unsigned int error = ts3server_getParentChannelOfChannel(serverID, channel.channelID, &parent);
+		if (error != ERROR_ok)
+			return error;
+		uint64 order = 0;
+		for (const SnapshotVariable& variable : channel.variables) {
+			const ChannelProperties flag = static_cast<ChannelProperties>(variable.flag);
+			if (flag == CHANNEL_ORDER)
+				order = std::strtoull(variable.value.c_str(), nullptr, 10);
+			if (variable.type == SNAPSHOT_INT)
+				error = ts3server_setChannelVariableAsInt(serverID, channel.channelID, flag, static_cast<int>(std::strtol(variable.value.c_str(), nullptr, 10)));
+			else if (variable.type == SNAPSHOT_UINT64)
+				error = ts3server_setChannelVariableAsUInt64(serverID, channel.channelID, flag, std::strtoull(variable.value.c_str(), nullptr, 10));
+			else
+				error = ts3server_setChannelVariableAsString(serverID, channel.channelID, flag, variable.value.c_str());
+			if (error != ERROR_ok)
+				return error;
+		}
+		if ((error = ts3server_flushChannelVariable(serverID, channel.channelID)) != ERROR_ok && error != ERROR_ok_no_update)
+			return error;
+		if (parent != channel.parentChannelID)
+			return ts3server_channelMove(serverID, channel.channelID, channel.parentChannelID, order);
+		return ERROR_ok;
+	}
+
+	std::mutex                                            m_mutex;
+	std::unordered_map<uint64, std::vector<ChannelDelta>> m_pending; ///< deltas not yet taken, by replicated server
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_CHANNEL_REPLICATION_H
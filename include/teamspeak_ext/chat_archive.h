@@ -0,0 +1,834 @@
+/*
+ * Append only chat archive for server and channel text messages. Messages go to an in memory active segment backed by
+ * a sequential append log; full segments are sealed into immutable files with columnar metadata (timestamp, server,
+ * channel, invoker, identity), the texts and an inverted index from folded terms to message numbers. Sealed segments are
+ * memory mapped and searched in place, newest first; a segment is skipped by its time range, its (server, channel) list,
+ * its identity dictionary or a missing query term before a single message is looked at.
+ */
+
+#ifndef TEAMSPEAK_EXT_CHAT_ARCHIVE_H
+#define TEAMSPEAK_EXT_CHAT_ARCHIVE_H
+
+//system
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+#include "teamspeak_ext/text_message_pipeline.h"
+#include "teamspeak_ext/text_moderation.h"
+
+namespace ts3ext {
+
+struct ChatArchiveOptions {
+	std::string          directory;                             ///< created if missing
+	size_t               segmentMessages = 100000;              ///< the active segment is sealed at this many messages
+	std::chrono::minutes segmentAge = std::chrono::minutes(60); ///< ... or when its first message is this old
+	std::chrono::hours   retention = std::chrono::hours(24 * 366); ///< sealed segments entirely older than this are deleted
+	bool                 resolveIdentity = true;                ///< read CLIENT_UNIQUE_IDENTIFIER of the invoker when archiving from the callbacks
+};
+
+struct ArchivedMessage {
+	int64_t     timestampMs = 0; ///< system clock, milliseconds since the epoch
+	uint64      serverID = 0;
+	uint64      channelID = 0;   ///< 0 for server messages
+	anyID       invokerClientID = 0;
+	std::string identity;        ///< unique identifier of the invoker, empty if unknown
+	std::string text;
+};
+
+struct ArchiveQuery {
+	static const uint64 ANY_CHANNEL = ~uint64(0);
+
+	uint64      serverID = 0;                ///< 0 for all servers
+	uint64      channelID = ANY_CHANNEL;     ///< 0 for server messages only
+	std::string identity;                    ///< empty for all senders
+	std::string keywords;                    ///< every term has to occur in the message, empty for all messages
+	int64_t     fromMs = std::numeric_limits<int64_t>::min();
+	int64_t     toMs = std::numeric_limits<int64_t>::max(); ///< inclusive
+	size_t      limit = 100;
+};
+
+struct ArchiveQueryStats {
+	size_t segments = 0;       ///< sealed segments considered
+	size_t segmentsSkipped = 0; ///< ruled out by time, scope, identity or terms without reading messages
+	size_t candidates = 0;     ///< messages whose columns were checked
+};
+
+/**
+ * @brief archive of text messages searchable by server, channel, sender, time and keywords
+ *
+ * Either forward the two text message callbacks, or feed append() from a TextMessagePipeline sink so the disk writes
+ * happen off the callback thread. Segment files use the byte order of the machine that wrote them.
+*/
+class ChatArchive {
+public:
+	explicit ChatArchive(const ChatArchiveOptions& options) : m_options(options) {}
+
+	~ChatArchive() { close(); }
+
+	ChatArchive(const ChatArchive&) = delete;
+	ChatArchive& operator=(const ChatArchive&) = delete;
+
+	/** @brief map the sealed segments and replay the append log of the active one */
+	unsigned int open() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::error_code error;
+		std::filesystem::create_directories(m_options.directory, error);
+		if (error)
+			return ERROR_file_io_error;
+		std::vector<std::string> files;
+		for (const auto& entry : std::filesystem::directory_iterator(m_options.directory, error)) {
+			const std::string name = entry.path().filename().string();
+			if (name.size() > 8 && name.compare(0, 4, "seg-") == 0 && name.compare(name.size() - 4, 4, ".tsa") == 0)
+				files.push_back(entry.path().string());
+			else if (name.size() > 8 && name.compare(0, 4, "seg-") == 0 && name.compare(name.size() - 8, 8, ".tsa.tmp") == 0)
+				files.push_back(entry.path().string()); //an interrupted seal, its messages are still in the log
+		}
+		if (error)
+			return ERROR_file_io_error;
+		std::sort(files.begin(), files.end()); //zero padded sequence numbers, oldest first
+		for (const std::string& file : files) {
+			if (file.compare(file.size() - 4, 4, ".tmp") == 0) {
+				std::filesystem::remove(file, error);
+				continue;
+			}
+			std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+			if (!segment->open(file)) {
+				//moved aside for inspection, its messages are replayed if the log still has them
+				std::filesystem::rename(file, file + ".bad", error);
+				if (error) {
+					//never seal over it
+					const std::string name = std::filesystem::path(file).filename().string();
+					m_nextSequence = std::max<uint64>(m_nextSequence, std::strtoull(name.c_str() + 4, nullptr, 10) + 1);
+				}
+				continue;
+			}
+			m_nextSequence = std::max(m_nextSequence, segment->header().firstSequence + segment->header().count);
+			m_segments.push_back(std::move(segment));
+		}
+		replayLog();
+		m_log.open(logFile(), std::ios::binary | std::ios::app);
+		return m_log.is_open() ? static_cast<unsigned int>(ERROR_ok) : static_cast<unsigned int>(ERROR_file_io_error);
+	}
+
+	/** @brief seal what is pending */
+	void close() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_log.is_open())
+			return;
+		if (m_active.count() != 0)
+			seal();
+		m_log.close();
+	}
+
+	void onServerTextMessageEvent(uint64 serverID, anyID invokerClientID, const char* textMessage) {
+		record(serverID, 0, invokerClientID, textMessage);
+	}
+
+	void onChannelTextMessageEvent(uint64 serverID, anyID invokerClientID, uint64 targetChannelID, const char* textMessage) {
+		record(serverID, targetChannelID, invokerClientID, textMessage);
+	}
+
+	/** @brief for a TextMessagePipeline sink, the identity is resolved if enabled */
+	void append(const TextMessage& message) {
+		ArchivedMessage archived;
+		archived.timestampMs = message.receivedMs;
+		archived.serverID = message.serverID;
+		archived.channelID = message.channelID;
+		archived.invokerClientID = message.invokerClientID;
+		if (m_options.resolveIdentity)
+			archived.identity = identityOf(message.serverID, message.invokerClientID);
+		archived.text.assign(message.text, message.length);
+		append(archived);
+	}
+
+	void append(const ArchivedMessage& message) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_log.is_open())
+			return;
+		writeLog(message);
+		m_active.add(message);
+		const int64_t ageMs = nowMs() - m_active.minTime;
+		if (m_active.count() >= m_options.segmentMessages || ageMs >= std::chrono::duration_cast<std::chrono::milliseconds>(m_options.segmentAge).count())
+			seal();
+	}
+
+	/** @brief matching messages, newest first */
+	std::vector<ArchivedMessage> search(const ArchiveQuery& query, ArchiveQueryStats* stats = nullptr) const {
+		std::vector<std::string> terms;
+		tokenize(query.keywords.data(), query.keywords.size(), terms);
+		std::sort(terms.begin(), terms.end());
+		terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+		std::vector<ArchivedMessage> results;
+		ArchiveQueryStats local;
+		std::vector<std::shared_ptr<const Segment>> segments;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_active.search(query, terms, results);
+			segments.assign(m_segments.begin(), m_segments.end());
+		}
+		for (auto segment = segments.rbegin(); segment != segments.rend() && results.size() < query.limit; ++segment) {
+			++local.segments;
+			if (!(*segment)->search(query, terms, results, local.candidates))
+				++local.segmentsSkipped;
+		}
+		if (stats != nullptr)
+			*stats = local;
+		return results;
+	}
+
+	/** @brief delete sealed segments older than the retention, also done after every seal */
+	void expire() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		expireLocked();
+	}
+
+	size_t segmentCount() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_segments.size();
+	}
+
+	/**
+	 * @brief lower cased terms as indexed, letters and digits of any script form a term
+	 *
+	 * Non-ASCII text is decoded as UTF-8; Latin-1 punctuation (U+0080-U+00BF), general punctuation (U+2000-U+206F,
+	 * e.g. typographic quotes) and CJK punctuation (U+3000-U+303F) separate terms like ASCII punctuation does.
+	 * Malformed sequences are kept as term bytes.
+	*/
+	static void tokenize(const char* text, size_t length, std::vector<std::string>& terms) {
+		std::string term;
+		bool truncated = false;
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text);
+		for (size_t i = 0; i <= length;) {
+			const unsigned char c = i < length ? bytes[i] : ' ';
+			size_t size = 1;
+			const bool word = c >= 0x80 ? !separator(bytes, i, length, size)
+			                            : (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+			if (word) {
+				//never cut a code point, a cut term would not fold like the query
+				truncated = truncated || term.size() + size > MAX_TERM_BYTES;
+				if (!truncated)
+					term.append(text + i, size);
+				i += size;
+				continue;
+			}
+			if (!term.empty())
+				terms.push_back(PatternSet::fold(term));
+			term.clear();
+			truncated = false;
+			i += size;
+		}
+	}
+
+private:
+	static const size_t   MAX_TERM_BYTES = 64;
+	static const uint32_t MAGIC = 0x31415354; ///< "TSA1"
+
+	/*true if the UTF-8 sequence at text[i] is a punctuation or space code point, size is set to its length*/
+	static bool separator(const unsigned char* text, size_t i, size_t length, size_t& size) {
+		const unsigned char lead = text[i];
+		const size_t expected = lead >= 0xF8 ? 0 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 0;
+		size = 1;
+		if (expected == 0 || i + expected > length)
+			return false;
+		uint32_t cp = lead & (0x7F >> expected);
+		for (size_t k = 1; k < expected; ++k) {
+			if ((text[i + k] & 0xC0) != 0x80)
+				return false;
+			cp = cp << 6 | (text[i + k] & 0x3F);
+		}
+		size = expected;
+		return (cp >= 0x80 && cp <= 0xBF) || (cp >= 0x2000 && cp <= 0x206F) || (cp >= 0x3000 && cp <= 0x303F);
+	}
+
+	enum Section {
+		SECTION_TIMESTAMPS = 0,  ///< int64 per message
+		SECTION_SERVERS,         ///< uint64 per message
+		SECTION_CHANNELS,        ///< uint64 per message
+		SECTION_INVOKERS,        ///< anyID per message
+		SECTION_IDENTITIES,      ///< uint32 per message, index into the identity dictionary
+		SECTION_TEXT_OFFSETS,    ///< uint32 per message + 1
+		SECTION_TEXT,
+		SECTION_SCOPES,          ///< sorted distinct (server, channel) pairs
+		SECTION_IDENTITY_OFFSETS, ///< uint32 per identity + 1, identities are sorted
+		SECTION_IDENTITY_BLOB,
+		SECTION_TERM_OFFSETS,    ///< uint32 per term + 1, terms are sorted
+		SECTION_TERM_BLOB,
+		SECTION_POSTING_OFFSETS, ///< uint32 per term + 1
+		SECTION_POSTINGS,        ///< ascending uint32 message numbers per term
+		SECTION_COUNT
+	};
+
+	struct SegmentHeader {
+		uint32_t magic;
+		uint32_t count;
+		int64_t  minTime;
+		int64_t  maxTime;
+		uint64_t firstSequence;
+		uint32_t identityCount;
+		uint32_t termCount;
+		uint32_t scopeCount;
+		uint32_t reserved;
+		uint64_t offsets[SECTION_COUNT + 1]; ///< the last one is the file size
+	};
+
+	struct Scope {
+		uint64 serverID;
+		uint64 channelID;
+
+		bool operator<(const Scope& other) const { return serverID != other.serverID ? serverID < other.serverID : channelID < other.channelID; }
+		bool operator==(const Scope& other) const { return serverID == other.serverID && channelID == other.channelID; }
+	};
+
+	/*read only view of a file, memory mapped where available*/
+	class MappedFile {
+	public:
+		MappedFile() = default;
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		~MappedFile() {
+#ifndef _WIN32
+			if (m_data != nullptr)
+				munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+		}
+
+		bool open(const std::string& path) {
+#ifndef _WIN32
+			const int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat info;
+			if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+				::close(fd);
+				return false;
+			}
+			void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (address == MAP_FAILED)
+				return false;
+			m_data = static_cast<const unsigned char*>(address);
+			m_size = static_cast<size_t>(info.st_size);
+#else
+			std::ifstream in(path, std::ios::binary);
+			if (!in)
+				return false;
+			m_buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+			m_data = reinterpret_cast<const unsigned char*>(m_buffer.data());
+			m_size = m_buffer.size();
+#endif
+			return true;
+		}
+
+		const unsigned char* data() const { return m_data; }
+		size_t               size() const { return m_size; }
+
+	private:
+		const unsigned char* m_data = nullptr;
+		size_t               m_size = 0;
+#ifdef _WIN32
+		std::vector<char> m_buffer;
+#endif
+	};
+
+	/*sealed segment, searched in place*/
+	class Segment {
+	public:
+		bool open(const std::string& path) {
+			m_path = path;
+			if (!m_file.open(path) || m_file.size() < sizeof(SegmentHeader))
+				return false;
+			std::memcpy(&m_header, m_file.data(), sizeof(m_header));
+			if (m_header.magic != MAGIC || m_header.offsets[SECTION_COUNT] != m_file.size())
+				return false;
+			for (int section = 0; section < SECTION_COUNT; ++section) {
+				if (m_header.offsets[section] > m_header.offsets[section + 1] || m_header.offsets[section] % 8 != 0)
+					return false;
+			}
+			const uint64_t n = m_header.count;
+			return size(SECTION_TIMESTAMPS) >= n * 8 && size(SECTION_SERVERS) >= n * 8 && size(SECTION_CHANNELS) >= n * 8 &&
+			       size(SECTION_INVOKERS) >= n * sizeof(anyID) && size(SECTION_IDENTITIES) >= n * 4 && size(SECTION_TEXT_OFFSETS) >= (n + 1) * 4 &&
+			       size(SECTION_SCOPES) >= m_header.scopeCount * sizeof(Scope) && size(SECTION_IDENTITY_OFFSETS) >= (m_header.identityCount + 1) * 4 &&
+			       size(SECTION_TERM_OFFSETS) >= (m_header.termCount + 1) * 4 && size(SECTION_POSTING_OFFSETS) >= (m_header.termCount + 1) * 4 &&
+			       offsetsWithin(SECTION_TEXT_OFFSETS, n, SECTION_TEXT) && offsetsWithin(SECTION_IDENTITY_OFFSETS, m_header.identityCount, SECTION_IDENTITY_BLOB) &&
+			       offsetsWithin(SECTION_TERM_OFFSETS, m_header.termCount, SECTION_TERM_BLOB) &&
+			       offsetsWithin(SECTION_POSTING_OFFSETS, m_header.termCount, SECTION_POSTINGS, 4) &&
+			       below(SECTION_IDENTITIES, n, m_header.identityCount) &&
+			       below(SECTION_POSTINGS, section<uint32_t>(SECTION_POSTING_OFFSETS)[m_header.termCount], m_header.count);
+		}
+
+		const SegmentHeader& header() const { return m_header; }
+		const std::string&   path() const { return m_path; }
+
+		/*appends matches newest first until the limit, false if the segment was skipped as a whole*/
+		bool search(const ArchiveQuery& query, const std::vector<std::string>& terms, std::vector<ArchivedMessage>& results, size_t& candidates) const {
+			if (m_header.count == 0 || m_header.maxTime < query.fromMs || m_header.minTime > query.toMs || !inScope(query))
+				return false;
+			uint32_t identity = 0;
+			if (!query.identity.empty() && !find(SECTION_IDENTITY_OFFSETS, SECTION_IDENTITY_BLOB, m_header.identityCount, query.identity, identity))
+				return false;
+			std::vector<std::pair<const uint32_t*, const uint32_t*>> postings;
+			for (const std::string& term : terms) {
+				uint32_t index = 0;
+				if (!find(SECTION_TERM_OFFSETS, SECTION_TERM_BLOB, m_header.termCount, term, index))
+					return false;
+				const uint32_t* offsets = section<uint32_t>(SECTION_POSTING_OFFSETS);
+				const uint32_t* all = section<uint32_t>(SECTION_POSTINGS);
+				postings.emplace_back(all + offsets[index], all + offsets[index + 1]);
+			}
+			std::sort(postings.begin(), postings.end(), [](const std::pair<const uint32_t*, const uint32_t*>& a, const std::pair<const uint32_t*, const uint32_t*>& b) {
+				return a.second - a.first < b.second - b.first;
+			});
+
+			const int64_t* timestamps = section<int64_t>(SECTION_TIMESTAMPS);
+			const uint64* servers = section<uint64>(SECTION_SERVERS);
+			const uint64* channels = section<uint64>(SECTION_CHANNELS);
+			const uint32_t* identities = section<uint32_t>(SECTION_IDENTITIES);
+			auto check = [&](uint32_t row) {
+				++candidates;
+				if (timestamps[row] < query.fromMs || timestamps[row] > query.toMs)
+					return;
+				if ((query.serverID != 0 && servers[row] != query.serverID) || (query.channelID != ArchiveQuery::ANY_CHANNEL && channels[row] != query.channelID))
+					return;
+				if (!query.identity.empty() && identities[row] != identity)
+					return;
+				for (size_t t = 1; t < postings.size(); ++t) {
+					if (!std::binary_search(postings[t].first, postings[t].second, row))
+						return;
+				}
+				results.push_back(message(row));
+			};
+			if (postings.empty()) {
+				for (uint32_t row = m_header.count; row-- > 0 && results.size() < query.limit;)
+					check(row);
+			} else {
+				for (const uint32_t* row = postings[0].second; row-- != postings[0].first && results.size() < query.limit;)
+					check(*row);
+			}
+			return true;
+		}
+
+	private:
+		uint64_t size(int section) const { return m_header.offsets[section + 1] - m_header.offsets[section]; }
+
+		template <typename T>
+		const T* section(int index) const { return reinterpret_cast<const T*>(m_file.data() + m_header.offsets[index]); }
+
+		/*offset tables have to be ascending and end inside their data section*/
+		bool offsetsWithin(int offsetsSection, uint64_t count, int dataSection, uint64_t unit = 1) const {
+			const uint32_t* offsets = section<uint32_t>(offsetsSection);
+			for (uint64_t i = 0; i < count; ++i) {
+				if (offsets[i] > offsets[i + 1])
+					return false;
+			}
+			return offsets[count] * unit <= size(dataSection);
+		}
+
+		/*message numbers and identity indexes are used without further checks*/
+		bool below(int index, uint64_t count, uint32_t limit) const {
+			const uint32_t* values = section<uint32_t>(index);
+			return std::all_of(values, values + count, [limit](uint32_t value) { return value < limit; });
+		}
+
+		std::string_view string(int offsetsSection, int blobSection, uint32_t index) const {
+			const uint32_t* offsets = section<uint32_t>(offsetsSection);
+			return std::string_view(section<char>(blobSection) + offsets[index], offsets[index + 1] - offsets[index]);
+		}
+
+		/*binary search in a sorted string table*/
+		bool find(int offsetsSection, int blobSection, uint32_t count, const std::string& wanted, uint32_t& index) const {
+			uint32_t low = 0, high = count;
+			while (low < high) {
+				const uint32_t middle = low + (high - low) / 2;
+				if (string(offsetsSection, blobSection, middle) < wanted)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+			if (low == count || string(offsetsSection, blobSection, low) != wanted)
+				return false;
+			index = low;
+			return true;
+		}
+
+		bool inScope(const ArchiveQuery& query) const {
+			if (query.serverID == 0)
+				return true;
+			const Scope* begin = section<Scope>(SECTION_SCOPES);
+			const Scope* end = begin + m_header.scopeCount;
+			const Scope* first = std::lower_bound(begin, end, Scope{query.serverID, query.channelID == ArchiveQuery::ANY_CHANNEL ? 0 : query.channelID});
+			if (first == end || first->serverID != query.serverID)
+				return false;
+			return query.channelID == ArchiveQuery::ANY_CHANNEL || first->channelID == query.channelID;
+		}
+
+		ArchivedMessage message(uint32_t row) const {
+			ArchivedMessage message;
+			message.timestampMs = section<int64_t>(SECTION_TIMESTAMPS)[row];
+			message.serverID = section<uint64>(SECTION_SERVERS)[row];
+			message.channelID = section<uint64>(SECTION_CHANNELS)[row];
+			message.invokerClientID = section<anyID>(SECTION_INVOKERS)[row];
+			message.identity = std::string(string(SECTION_IDENTITY_OFFSETS, SECTION_IDENTITY_BLOB, section<uint32_t>(SECTION_IDENTITIES)[row]));
+			message.text = std::string(string(SECTION_TEXT_OFFSETS, SECTION_TEXT, row));
+			return message;
+		}
+
+		std::string   m_path;
+		MappedFile    m_file;
+		SegmentHeader m_header;
+	};
+
+	/*the segment being filled, the same columns in memory*/
+	struct ActiveSegment {
+		std::vector<int64_t>                          timestamps;
+		std::vector<uint64>                           servers;
+		std::vector<uint64>                           channels;
+		std::vector<anyID>                            invokers;
+		std::vector<uint32_t>                         identities;
+		std::vector<std::string>                      texts;
+		std::vector<std::string>                      identityNames;
+		std::map<std::string, uint32_t>               identityIndex;
+		std::map<std::string, std::vector<uint32_t>>  postings;
+		int64_t                                       minTime = std::numeric_limits<int64_t>::max();
+		int64_t                                       maxTime = std::numeric_limits<int64_t>::min();
+
+		size_t count() const { return texts.size(); }
+
+		void add(const ArchivedMessage& message) {
+			const uint32_t row = static_cast<uint32_t>(texts.size());
+			timestamps.push_back(message.timestampMs);
+			servers.push_back(message.serverID);
+			channels.push_back(message.channelID);
+			invokers.push_back(message.invokerClientID);
+			const auto identity = identityIndex.emplace(message.identity, static_cast<uint32_t>(identityNames.size()));
+			if (identity.second)
+				identityNames.push_back(message.identity);
+			identities.push_back(identity.first->second);
+			texts.push_back(message.text);
+			minTime = std::min(minTime, message.timestampMs);
+			maxTime = std::max(maxTime, message.timestampMs);
+			std::vector<std::string> terms;
+			tokenize(message.text.data(), message.text.size(), terms);
+			for (const std::string& term : terms) {
+				std::vector<uint32_t>& rows = postings[term];
+				if (rows.empty() || rows.back() != row)
+					rows.push_back(row);
+			}
+		}
+
+		void search(const ArchiveQuery& query, const std::vector<std::string>& terms, std::vector<ArchivedMessage>& results) const {
+			const std::vector<uint32_t>* narrowest = nullptr;
+			for (const std::string& term : terms) {
+				const auto rows = postings.find(term);
+				if (rows == postings.end())
+					return;
+				if (narrowest == nullptr || rows->second.size() < narrowest->size())
+					narrowest = &rows->second;
+			}
+			auto check = [&](uint32_t row) {
+				if (timestamps[row] < query.fromMs || timestamps[row] > query.toMs)
+					return;
+				if ((query.serverID != 0 && servers[row] != query.serverID) || (query.channelID != ArchiveQuery::ANY_CHANNEL && channels[row] != query.channelID))
+					return;
+				if (!query.identity.empty() && identityNames[identities[row]] != query.identity)
+					return;
+				for (const std::string& term : terms) {
+					const std::vector<uint32_t>& rows = postings.find(term)->second;
+					if (!std::binary_search(rows.begin(), rows.end(), row))
+						return;
+				}
+				ArchivedMessage message;
+				message.timestampMs = timestamps[row];
+				message.serverID = servers[row];
+				message.channelID = channels[row];
+				message.invokerClientID = invokers[row];
+				message.identity = identityNames[identities[row]];
+				message.text = texts[row];
+				results.push_back(std::move(message));
+			};
+			if (narrowest == nullptr) {
+				for (size_t row = count(); row-- > 0 && results.size() < query.limit;)
+					check(static_cast<uint32_t>(row));
+			} else {
+				for (auto row = narrowest->rbegin(); row != narrowest->rend() && results.size() < query.limit; ++row)
+					check(*row);
+			}
+		}
+	};
+
+	static int64_t nowMs() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	static std::string identityOf(uint64 serverID, anyID clientID) {
+		char* value = nullptr;
+		if (clientID == 0 || ts3server_getClientVariableAsString(serverID, clientID, CLIENT_UNIQUE_IDENTIFIER, &value) != ERROR_ok)
+			return std::string();
+		std::string identity(value);
+		ts3server_freeMemory(value);
+		return identity;
+	}
+
+	std::string logFile() const { return (std::filesystem::path(m_options.directory) / "active.log").string(); }
+
+	void record(uint64 serverID, uint64 channelID, anyID invokerClientID, const char* text) {
+		ArchivedMessage message;
+		message.timestampMs = nowMs();
+		message.serverID = serverID;
+		message.channelID = channelID;
+		message.invokerClientID = invokerClientID;
+		if (m_options.resolveIdentity)
+			message.identity = identityOf(serverID, invokerClientID);
+		message.text = text != nullptr ? text : "";
+		append(message);
+	}
+
+	/*called with the lock held: one length prefixed record per message, numbered like the segments count messages*/
+	void writeLog(const ArchivedMessage& message) {
+		std::string record(sizeof(uint32_t), '\0');
+		put(record, static_cast<uint64>(m_nextSequence + m_active.count()));
+		put(record, message.timestampMs);
+		put(record, message.serverID);
+		put(record, message.channelID);
+		put(record, message.invokerClientID);
+		put(record, static_cast<uint32_t>(message.identity.size()));
+		put(record, static_cast<uint32_t>(message.text.size()));
+		record += message.identity;
+		record += message.text;
+		const uint32_t size = static_cast<uint32_t>(record.size() - sizeof(uint32_t));
+		std::memcpy(&record[0], &size, sizeof(size));
+		m_log.write(record.data(), static_cast<std::streamsize>(record.size()));
+		m_log.flush();
+	}
+
+	/*called with the lock held: a torn last record is dropped, as are records a sealed segment already holds*/
+	void replayLog() {
+		std::ifstream in(logFile(), std::ios::binary);
+		uint32_t size = 0;
+		while (in.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+			std::string record(size, '\0');
+			if (!in.read(&record[0], size))
+				break;
+			ArchivedMessage message;
+			size_t at = 0;
+			uint64 sequence = 0;
+			uint32_t identityLength = 0, textLength = 0;
+			if (!get(record, at, sequence) || !get(record, at, message.timestampMs) || !get(record, at, message.serverID) || !get(record, at, message.channelID) ||
+			    !get(record, at, message.invokerClientID) || !get(record, at, identityLength) || !get(record, at, textLength) ||
+			    record.size() - at != static_cast<size_t>(identityLength) + textLength)
+				break;
+			if (sequence < m_nextSequence)
+				continue; //sealed, the log was not truncated before a crash
+			if (sequence != m_nextSequence + m_active.count())
+				break;
+			message.identity = record.substr(at, identityLength);
+			message.text = record.substr(at + identityLength);
+			m_active.add(message);
+		}
+	}
+
+	template <typename T>
+	static void put(std::string& out, const T& value) {
+		out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	template <typename T>
+	static bool get(const std::string& in, size_t& at, T& value) {
+		if (in.size() - at < sizeof(value))
+			return false;
+		std::memcpy(&value, in.data() + at, sizeof(value));
+		at += sizeof(value);
+		return true;
+	}
+
+	template <typename T>
+	static void putArray(std::string& out, const T* values, size_t count) {
+		out.append(reinterpret_cast<const char*>(values), count * sizeof(T));
+	}
+
+	static void align(std::string& out) { out.resize((out.size() + 7) / 8 * 8, '\0'); }
+
+	/*called with the lock held: write the active segment as an immutable file and start a new one*/
+	void seal() {
+		const ActiveSegment& active = m_active;
+		SegmentHeader header;
+		std::memset(&header, 0, sizeof(header));
+		header.magic = MAGIC;
+		header.count = static_cast<uint32_t>(active.count());
+		header.minTime = active.minTime;
+		header.maxTime = active.maxTime;
+		header.firstSequence = m_nextSequence;
+
+		//identities sorted for binary search, rows refer to the sorted position
+		std::vector<uint32_t> identityRank(active.identityNames.size());
+		uint32_t rank = 0;
+		for (const auto& identity : active.identityIndex)
+			identityRank[identity.second] = rank++;
+		header.identityCount = rank;
+		header.termCount = static_cast<uint32_t>(active.postings.size());
+
+		std::vector<Scope> scopes;
+		for (size_t row = 0; row < active.count(); ++row)
+			scopes.push_back(Scope{active.servers[row], active.channels[row]});
+		std::sort(scopes.begin(), scopes.end());
+		scopes.erase(std::unique(scopes.begin(), scopes.end()), scopes.end());
+		header.scopeCount = static_cast<uint32_t>(scopes.size());
+
+		std::string file(sizeof(SegmentHeader), '\0');
+		auto begin = [&](Section section) {
+			align(file);
+			header.offsets[section] = file.size();
+		};
+		begin(SECTION_TIMESTAMPS);
+		putArray(file, active.timestamps.data(), active.count());
+		begin(SECTION_SERVERS);
+		putArray(file, active.servers.data(), active.count());
+		begin(SECTION_CHANNELS);
+		putArray(file, active.channels.data(), active.count());
+		begin(SECTION_INVOKERS);
+		putArray(file, active.invokers.data(), active.count());
+		begin(SECTION_IDENTITIES);
+		for (uint32_t identity : active.identities)
+			put(file, identityRank[identity]);
+		begin(SECTION_TEXT_OFFSETS);
+		uint32_t offset = 0;
+		for (const std::string& text : active.texts) {
+			put(file, offset);
+			offset += static_cast<uint32_t>(text.size());
+		}
+		put(file, offset);
+		begin(SECTION_TEXT);
+		for (const std::string& text : active.texts)
+			file += text;
+		begin(SECTION_SCOPES);
+		putArray(file, scopes.data(), scopes.size());
+		begin(SECTION_IDENTITY_OFFSETS);
+		offset = 0;
+		for (const auto& identity : active.identityIndex) {
+			put(file, offset);
+			offset += static_cast<uint32_t>(identity.first.size());
+		}
+		put(file, offset);
+		begin(SECTION_IDENTITY_BLOB);
+		for (const auto& identity : active.identityIndex)
+			file += identity.first;
+		begin(SECTION_TERM_OFFSETS);
+		offset = 0;
+		for (const auto& term : active.postings) {
+			put(file, offset);
+			offset += static_cast<uint32_t>(term.first.size());
+		}
+		put(file, offset);
+		begin(SECTION_TERM_BLOB);
+		for (const auto& term : active.postings)
+			file += term.first;
+		begin(SECTION_POSTING_OFFSETS);
+		offset = 0;
+		for (const auto& term : active.postings) {
+			put(file, offset);
+			offset += static_cast<uint32_t>(term.second.size());
+		}
+		put(file, offset);
+		begin(SECTION_POSTINGS);
+		for (const auto& term : active.postings)
+			putArray(file, term.second.data(), term.second.size());
+		align(file);
+		header.offsets[SECTION_COUNT] = file.size();
+		std::memcpy(&file[0], &header, sizeof(header));
+
+		char name[32];
+		std::snprintf(name, sizeof(name), "seg-%020llu.tsa", static_cast<unsigned long long>(m_nextSequence));
+		const std::string path = (std::filesystem::path(m_options.directory) / name).string();
+		const std::string temporary = path + ".tmp";
+		//the segment and its directory entry are on disk before the log that also holds the messages is truncated
+		if (!writeDurably(temporary, file))
+			return; //the messages stay in the active segment and its log, sealing is retried with the next message
+		std::error_code error;
+		std::filesystem::rename(temporary, path, error);
+		std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+		if (error || !syncDirectory() || !segment->open(path))
+			return;
+		m_segments.push_back(std::move(segment));
+		m_nextSequence += header.count;
+		m_active = ActiveSegment();
+		m_log.close();
+		m_log.open(logFile(), std::ios::binary | std::ios::trunc);
+		expireLocked();
+	}
+
+	static bool writeDurably(const std::string& path, const std::string& data) {
+		FILE* out = std::fopen(path.c_str(), "wb");
+		if (out == nullptr)
+			return false;
+		bool ok = std::fwrite(data.data(), 1, data.size(), out) == data.size() && std::fflush(out) == 0;
+#ifdef _WIN32
+		ok = ok && _commit(_fileno(out)) == 0;
+#else
+		ok = ok && fsync(fileno(out)) == 0;
+#endif
+		return std::fclose(out) == 0 && ok;
+	}
+
+	/*makes the rename of a sealed segment durable, Windows has no directory handles for this*/
+	bool syncDirectory() const {
+#ifdef _WIN32
+		return true;
+#else
+		const int fd = ::open(m_options.directory.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		const bool ok = fsync(fd) == 0;
+		::close(fd);
+		return ok;
+#endif
+	}
+
+	/*called with the lock held, searches holding a segment keep it mapped*/
+	void expireLocked() {
+		const int64_t cutoff = nowMs() - std::chrono::duration_cast<std::chrono::milliseconds>(m_options.retention).count();
+		while (!m_segments.empty() && m_segments.front()->header().maxTime < cutoff) {
+			std::error_code error;
+			std::filesystem::remove(m_segments.front()->path(), error);
+			m_segments.erase(m_segments.begin());
+		}
+	}
+
+	const ChatArchiveOptions                    m_options;
+	mutable std::mutex                          m_mutex;
+	std::vector<std::shared_ptr<const Segment>> m_segments; ///< oldest first
+	ActiveSegment                               m_active;
+	std::ofstream                               m_log;
+	uint64                                      m_nextSequence = 0; ///< number of the next message over all segments
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_CHAT_ARCHIVE_H
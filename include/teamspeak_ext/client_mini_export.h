@@ -0,0 +1,145 @@
+/*
+ * Non owning views of the ClientMiniExport arrays the kick and move permission callbacks receive, and a reusable
+ * column layout of such an array. ClientMiniSpan iterates the array in place and ClientMiniView reads one entry as
+ * string_views; ClientBatch splits an array into contiguous id, channel, identity and nickname columns that point into
+ * the callback's strings. Batches come from a per thread pool, so a check over a thousand targets copies no strings
+ * and, once the pool is warm, allocates nothing.
+ */
+
+#ifndef TEAMSPEAK_EXT_CLIENT_MINI_EXPORT_H
+#define TEAMSPEAK_EXT_CLIENT_MINI_EXPORT_H
+
+//system
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak_ext/thread_local_pool.h"
+
+namespace ts3ext {
+
+/** @brief one entry, null strings read as empty */
+class ClientMiniView {
+public:
+	explicit ClientMiniView(const struct ClientMiniExport& client) : m_client(&client) {}
+
+	anyID            id() const { return m_client->ID; }
+	uint64           channel() const { return m_client->channel; }
+	std::string_view identity() const { return view(m_client->ident); }
+	std::string_view nickname() const { return view(m_client->nickname); }
+
+	const struct ClientMiniExport& raw() const { return *m_client; }
+
+private:
+	static std::string_view view(const char* text) { return text != nullptr ? std::string_view(text) : std::string_view(); }
+
+	const struct ClientMiniExport* m_client;
+};
+
+/** @brief the array with its count as passed to the callbacks, valid for the duration of the callback */
+class ClientMiniSpan {
+public:
+	typedef const struct ClientMiniExport* iterator;
+
+	ClientMiniSpan() = default;
+
+	/** @brief a null array or a negative count is an empty span */
+	ClientMiniSpan(const struct ClientMiniExport* clients, int count)
+	    : m_clients(clients), m_size(clients != nullptr && count > 0 ? static_cast<size_t>(count) : 0) {}
+
+	iterator begin() const { return m_clients; }
+	iterator end() const { return m_clients + m_size; }
+	size_t   size() const { return m_size; }
+	bool     empty() const { return m_size == 0; }
+
+	ClientMiniView operator[](size_t index) const { return ClientMiniView(m_clients[index]); }
+
+private:
+	const struct ClientMiniExport* m_clients = nullptr;
+	size_t                         m_size = 0;
+};
+
+/**
+ * @brief column layout of a ClientMiniExport array, pooled per thread
+ *
+ * The string_views point into the callback's array and must not outlive it.
+ * @code
+ * ClientBatch::Lease batch = ClientBatch::from(ClientMiniSpan(toMoveClients, toMoveCount));
+ * for (uint64 channelID : batch->distinctChannels()) ...
+ * @endcode
+*/
+class ClientBatch {
+public:
+	typedef ThreadLocalPool<ClientBatch>::Lease Lease;
+
+	/** @brief a cleared batch from the pool of the calling thread, filled from clients */
+	static Lease from(ClientMiniSpan clients) {
+		Lease batch = ThreadLocalPool<ClientBatch>::acquire();
+		batch->assign(clients);
+		return batch;
+	}
+
+	void assign(ClientMiniSpan clients) {
+		clear();
+		m_ids.reserve(clients.size() + 1);
+		m_channels.reserve(clients.size());
+		m_identities.reserve(clients.size());
+		m_nicknames.reserve(clients.size());
+		m_ids.pop_back();
+		for (const struct ClientMiniExport& client : clients) {
+			const ClientMiniView view(client);
+			m_ids.push_back(view.id());
+			m_channels.push_back(view.channel());
+			m_identities.push_back(view.identity());
+			m_nicknames.push_back(view.nickname());
+		}
+		m_ids.push_back(0);
+	}
+
+	/** @brief keeps the capacity */
+	void clear() {
+		m_ids.assign(1, 0);
+		m_channels.clear();
+		m_identities.clear();
+		m_nicknames.clear();
+		m_distinct.clear();
+		m_distinctValid = false;
+	}
+
+	size_t size() const { return m_channels.size(); }
+	bool   empty() const { return m_channels.empty(); }
+
+	/** @brief the ids followed by 0, as ts3server_clientMove and ts3server_clientsKickFromServer take them */
+	const anyID* terminatedIds() const { return m_ids.data(); }
+
+	anyID                                id(size_t index) const { return m_ids[index]; }
+	const std::vector<uint64>&           channels() const { return m_channels; }
+	const std::vector<std::string_view>& identities() const { return m_identities; }
+	const std::vector<std::string_view>& nicknames() const { return m_nicknames; }
+
+	/** @brief sorted channels the clients are in, computed on first use */
+	const std::vector<uint64>& distinctChannels() {
+		if (!m_distinctValid) {
+			m_distinct.assign(m_channels.begin(), m_channels.end());
+			std::sort(m_distinct.begin(), m_distinct.end());
+			m_distinct.erase(std::unique(m_distinct.begin(), m_distinct.end()), m_distinct.end());
+			m_distinctValid = true;
+		}
+		return m_distinct;
+	}
+
+private:
+	std::vector<anyID>            m_ids = std::vector<anyID>(1, 0); ///< always 0 terminated
+	std::vector<uint64>           m_channels;
+	std::vector<std::string_view> m_identities;
+	std::vector<std::string_view> m_nicknames;
+	std::vector<uint64>           m_distinct;
+	bool                          m_distinctValid = false;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_CLIENT_MINI_EXPORT_H
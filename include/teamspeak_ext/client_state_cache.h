@@ -0,0 +1,444 @@
+/*
+ * Client side replica of the channel tree and the visible clients of every server connection handler. The cache
+ * is maintained from the ClientUIFunctions callbacks: it reads the changed variables from the client library once,
+ * when the change is announced, and afterwards answers all lookups from memory. Rendering a channel tree does not
+ * call into the client library and does not allocate memory that has to be released with ts3client_freeMemory.
+ */
+
+#ifndef TEAMSPEAK_EXT_CLIENT_STATE_CACHE_H
+#define TEAMSPEAK_EXT_CLIENT_STATE_CACHE_H
+
+//system
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+//own
+#include "teamspeak/clientlib.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak_ext/flat_hash_map.h"
+
+namespace ts3ext {
+
+struct CachedChannel {
+	uint64              channelID = 0;
+	uint64              parentID = 0;      ///< 0 for root channels
+	uint64              order = 0;         ///< CHANNEL_ORDER, id of the channel sorted directly above this one
+	std::string         name;              ///< CHANNEL_NAME
+	std::string         topic;             ///< CHANNEL_TOPIC
+	int                 maxClients = -1;   ///< CHANNEL_MAXCLIENTS
+	int                 codec = 0;         ///< CHANNEL_CODEC
+	bool                hasPassword = false; ///< CHANNEL_FLAG_PASSWORD
+	bool                isDefault = false; ///< CHANNEL_FLAG_DEFAULT
+	bool                isPermanent = false; ///< CHANNEL_FLAG_PERMANENT
+	std::vector<uint64> children;          ///< sub channels sorted by CHANNEL_ORDER
+	std::vector<anyID>  clients;           ///< visible clients in this channel, sorted by client id
+	bool                childrenDirty = false;
+};
+
+struct CachedClient {
+	anyID       clientID = 0;
+	uint64      channelID = 0;
+	std::string nickname;          ///< CLIENT_NICKNAME
+	std::string uniqueIdentifier;  ///< CLIENT_UNIQUE_IDENTIFIER
+	int         talkStatus = STATUS_NOT_TALKING; ///< one of the values from the TalkStatus enum
+	bool        isWhispering = false;
+	bool        inputMuted = false;  ///< CLIENT_INPUT_MUTED
+	bool        outputMuted = false; ///< CLIENT_OUTPUT_MUTED
+	bool        inputHardware = true; ///< CLIENT_INPUT_HARDWARE
+	bool        isRecording = false; ///< CLIENT_IS_RECORDING
+};
+
+/**
+ * @brief Replicated state of one server connection handler.
+ *
+ * Reading requires the lock returned by ClientStateCache::read() to be held.
+*/
+class ConnectionState {
+public:
+	const CachedChannel* channel(uint64 channelID) const { return m_channels.find(channelID); }
+	const CachedClient* client(anyID clientID) const { return m_clients.find(clientID); }
+
+	size_t channelCount() const { return m_channels.size(); }
+	size_t clientCount() const { return m_clients.size(); }
+
+	/** @brief root channels sorted by CHANNEL_ORDER */
+	const std::vector<uint64>& rootChannels() const { return m_roots; }
+
+	/**
+	 * @brief depth first walk of the channel tree in display order
+	 *
+	 * @param visitChannel called as visitChannel(const CachedChannel&, int depth) for every channel
+	 * @param visitClient called as visitClient(const CachedClient&, int depth) for every client, right after its channel
+	*/
+	template <typename VisitChannel, typename VisitClient>
+	void forEachInTree(VisitChannel&& visitChannel, VisitClient&& visitClient) const {
+		for (uint64 root : m_roots)
+			walk(root, 0, visitChannel, visitClient);
+	}
+
+private:
+	friend class ClientStateCache;
+
+	template <typename VisitChannel, typename VisitClient>
+	void walk(uint64 channelID, int depth, VisitChannel& visitChannel, VisitClient& visitClient) const {
+		const CachedChannel* channel = m_channels.find(channelID);
+		if (channel == nullptr)
+			return;
+		visitChannel(*channel, depth);
+		for (anyID clientID : channel->clients) {
+			if (const CachedClient* client = m_clients.find(clientID))
+				visitClient(*client, depth + 1);
+		}
+		for (uint64 child : channel->children)
+			walk(child, depth + 1, visitChannel, visitClient);
+	}
+
+	std::vector<uint64>& childList(uint64 parentID) {
+		if (parentID == 0)
+			return m_roots;
+		return m_channels[parentID].children;
+	}
+
+	void markDirty(uint64 parentID) {
+		if (parentID == 0) {
+			m_rootsDirty = true;
+		} else if (CachedChannel* parent = m_channels.find(parentID)) {
+			if (!parent->childrenDirty) {
+				parent->childrenDirty = true;
+				m_dirtyParents.push_back(parentID);
+			}
+		}
+	}
+
+	/*CHANNEL_ORDER forms a linked list per level: each channel names its predecessor, 0 is the first one*/
+	void sortLevel(std::vector<uint64>& level) {
+		if (level.size() < 2)
+			return;
+		m_scratchOrder.clear();
+		for (uint64 id : level) {
+			if (const CachedChannel* channel = m_channels.find(id))
+				m_scratchOrder[channel->order] = id;
+		}
+		std::vector<uint64> sorted;
+		sorted.reserve(level.size());
+		uint64 previous = 0;
+		while (sorted.size() < level.size()) {
+			const uint64* found = m_scratchOrder.find(previous);
+			if (found == nullptr)
+				break;
+			const uint64 next = *found;
+			sorted.push_back(next);
+			m_scratchOrder.erase(previous);
+			previous = next;
+		}
+		if (sorted.size() < level.size()) {
+			//inconsistent order while an update is in flight, keep the remaining channels stable by id
+			std::vector<uint64> rest;
+			for (uint64 id : level) {
+				if (std::find(sorted.begin(), sorted.end(), id) == sorted.end())
+					rest.push_back(id);
+			}
+			std::sort(rest.begin(), rest.end());
+			sorted.insert(sorted.end(), rest.begin(), rest.end());
+		}
+		level.swap(sorted);
+	}
+
+	void resortDirty() {
+		if (m_rootsDirty) {
+			sortLevel(m_roots);
+			m_rootsDirty = false;
+		}
+		for (uint64 parentID : m_dirtyParents) {
+			if (CachedChannel* parent = m_channels.find(parentID)) {
+				sortLevel(parent->children);
+				parent->childrenDirty = false;
+			}
+		}
+		m_dirtyParents.clear();
+	}
+
+	FlatHashMap<uint64, CachedChannel> m_channels;
+	FlatHashMap<anyID, CachedClient>   m_clients;
+	FlatHashMap<uint64, uint64>        m_scratchOrder;
+	std::vector<uint64>                m_roots;
+	std::vector<uint64>                m_dirtyParents;
+	bool                               m_rootsDirty = false;
+};
+
+/**
+ * @brief keeps a ConnectionState per server connection handler up to date.
+ *
+ * Forward the ClientUIFunctions callbacks to the methods of the same name. Updates are applied on the client library
+ * thread under an exclusive lock, readers use read() from any thread.
+*/
+class ClientStateCache {
+	struct Entry {
+		std::shared_mutex mutex;
+		ConnectionState   state;
+	};
+
+public:
+	/**
+	 * @brief shared access to the state of a connection. Holds a reader lock while alive.
+	*/
+	class ReadLock {
+	public:
+		const ConnectionState* operator->() const { return m_state; }
+		const ConnectionState& operator*() const { return *m_state; }
+		explicit operator bool() const { return m_state != nullptr; }
+
+	private:
+		friend class ClientStateCache;
+		ReadLock(std::shared_ptr<Entry> entry) : m_entry(std::move(entry)) {
+			if (m_entry) {
+				m_lock = std::shared_lock<std::shared_mutex>(m_entry->mutex);
+				m_state = &m_entry->state;
+			}
+		}
+
+		std::shared_ptr<Entry>              m_entry;
+		std::shared_lock<std::shared_mutex> m_lock;
+		const ConnectionState*              m_state = nullptr;
+	};
+
+	/** @brief state of a connection. Evaluates to false if the connection is not known. */
+	ReadLock read(uint64 serverConnectionHandlerID) const { return ReadLock(lookup(serverConnectionHandlerID)); }
+
+	void onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int /*errorNumber*/) {
+		if (newStatus == STATUS_DISCONNECTED) {
+			std::lock_guard<std::mutex> lock(m_entriesMutex);
+			m_entries.erase(serverConnectionHandlerID);
+		} else if (newStatus == STATUS_CONNECTION_ESTABLISHED) {
+			Writer writer(*this, serverConnectionHandlerID);
+			//clients of the initial channel were announced before the channel list was complete, refresh all of them
+			writer.state.m_clients.forEach([&](anyID clientID, CachedClient& client) { readClient(serverConnectionHandlerID, clientID, client); });
+		}
+	}
+
+	void onNewChannelEvent(uint64 serverConnectionHandlerID, uint64 channelID, uint64 channelParentID) {
+		Writer writer(*this, serverConnectionHandlerID);
+		addChannel(writer.state, serverConnectionHandlerID, channelID, channelParentID);
+	}
+
+	void onNewChannelCreatedEvent(uint64 serverConnectionHandlerID, uint64 channelID, uint64 channelParentID, anyID, const char*, const char*) {
+		Writer writer(*this, serverConnectionHandlerID);
+		addChannel(writer.state, serverConnectionHandlerID, channelID, channelParentID);
+	}
+
+	void onDelChannelEvent(uint64 serverConnectionHandlerID, uint64 channelID, anyID, const char*, const char*) {
+		Writer writer(*this, serverConnectionHandlerID);
+		ConnectionState& state = writer.state;
+		CachedChannel* channel = state.m_channels.find(channelID);
+		if (channel == nullptr)
+			return;
+		const uint64 parentID = channel->parentID;
+		for (anyID clientID : channel->clients)
+			state.m_clients.erase(clientID);
+		state.m_channels.erase(channelID);
+		std::vector<uint64>& siblings = state.childList(parentID);
+		siblings.erase(std::remove(siblings.begin(), siblings.end(), channelID), siblings.end());
+		//the channel sorted below the deleted one now follows its predecessor, re-read the level
+		for (uint64 sibling : siblings)
+			readChannelOrder(state, serverConnectionHandlerID, sibling);
+		state.markDirty(parentID);
+	}
+
+	void onChannelMoveEvent(uint64 serverConnectionHandlerID, uint64 channelID, uint64 newChannelParentID, anyID, const char*, const char*) {
+		Writer writer(*this, serverConnectionHandlerID);
+		ConnectionState& state = writer.state;
+		CachedChannel* channel = state.m_channels.find(channelID);
+		if (channel == nullptr)
+			return;
+		const uint64 oldParentID = channel->parentID;
+		std::vector<uint64>& oldSiblings = state.childList(oldParentID);
+		oldSiblings.erase(std::remove(oldSiblings.begin(), oldSiblings.end(), channelID), oldSiblings.end());
+		for (uint64 sibling : oldSiblings)
+			readChannelOrder(state, serverConnectionHandlerID, sibling);
+		state.markDirty(oldParentID);
+
+		state.m_channels[channelID].parentID = newChannelParentID;
+		std::vector<uint64>& newSiblings = state.childList(newChannelParentID);
+		newSiblings.push_back(channelID);
+		for (uint64 sibling : newSiblings)
+			readChannelOrder(state, serverConnectionHandlerID, sibling);
+		state.markDirty(newChannelParentID);
+	}
+
+	void onUpdateChannelEvent(uint64 serverConnectionHandlerID, uint64 channelID) {
+		Writer writer(*this, serverConnectionHandlerID);
+		if (CachedChannel* channel = writer.state.m_channels.find(channelID))
+			readChannel(writer.state, serverConnectionHandlerID, *channel);
+	}
+
+	void onUpdateChannelEditedEvent(uint64 serverConnectionHandlerID, uint64 channelID, anyID, const char*, const char*) {
+		onUpdateChannelEvent(serverConnectionHandlerID, channelID);
+	}
+
+	void onUpdateClientEvent(uint64 serverConnectionHandlerID, anyID clientID, anyID, const char*, const char*) {
+		Writer writer(*this, serverConnectionHandlerID);
+		if (CachedClient* client = writer.state.m_clients.find(clientID))
+			readClient(serverConnectionHandlerID, clientID, *client);
+	}
+
+	void onClientMoveEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, const char*) {
+		moveClient(serverConnectionHandlerID, clientID, oldChannelID, newChannelID, visibility);
+	}
+
+	void onClientMoveSubscriptionEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility) {
+		moveClient(serverConnectionHandlerID, clientID, oldChannelID, newChannelID, visibility);
+	}
+
+	void onClientMoveTimeoutEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, const char*) {
+		moveClient(serverConnectionHandlerID, clientID, oldChannelID, newChannelID, visibility);
+	}
+
+	void onClientMoveMovedEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID, const char*, const char*, const char*) {
+		moveClient(serverConnectionHandlerID, clientID, oldChannelID, newChannelID, visibility);
+	}
+
+	void onClientKickFromChannelEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID, const char*, const char*, const char*) {
+		moveClient(serverConnectionHandlerID, clientID, oldChannelID, newChannelID, visibility);
+	}
+
+	void onClientKickFromServerEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID, const char*, const char*, const char*) {
+		moveClient(serverConnectionHandlerID, clientID, oldChannelID, newChannelID, visibility);
+	}
+
+	void onTalkStatusChangeEvent(uint64 serverConnectionHandlerID, int status, int isReceivedWhisper, anyID clientID) {
+		Writer writer(*this, serverConnectionHandlerID);
+		if (CachedClient* client = writer.state.m_clients.find(clientID)) {
+			client->talkStatus = status;
+			client->isWhispering = status != STATUS_NOT_TALKING && isReceivedWhisper != 0;
+		}
+	}
+
+private:
+	/*exclusive access to the state of a connection, re-sorts modified channel levels on release*/
+	struct Writer {
+		Writer(ClientStateCache& cache, uint64 serverConnectionHandlerID)
+		    : entry(cache.lookupOrCreate(serverConnectionHandlerID)), lock(entry->mutex), state(entry->state) {}
+		~Writer() { state.resortDirty(); }
+
+		std::shared_ptr<Entry>              entry;
+		std::unique_lock<std::shared_mutex> lock;
+		ConnectionState&                    state;
+	};
+
+	std::shared_ptr<Entry> lookup(uint64 serverConnectionHandlerID) const {
+		std::lock_guard<std::mutex> lock(m_entriesMutex);
+		const std::shared_ptr<Entry>* entry = m_entries.find(serverConnectionHandlerID);
+		return entry != nullptr ? *entry : std::shared_ptr<Entry>();
+	}
+
+	std::shared_ptr<Entry> lookupOrCreate(uint64 serverConnectionHandlerID) {
+		std::lock_guard<std::mutex> lock(m_entriesMutex);
+		std::shared_ptr<Entry>& entry = m_entries[serverConnectionHandlerID];
+		if (!entry)
+			entry = std::make_shared<Entry>();
+		return entry;
+	}
+
+	void addChannel(ConnectionState& state, uint64 serverConnectionHandlerID, uint64 channelID, uint64 parentID) {
+		CachedChannel& channel = state.m_channels[channelID];
+		channel.channelID = channelID;
+		channel.parentID = parentID;
+		readChannel(state, serverConnectionHandlerID, channel);
+		std::vector<uint64>& siblings = state.childList(parentID);
+		if (std::find(siblings.begin(), siblings.end(), channelID) == siblings.end())
+			siblings.push_back(channelID);
+		state.markDirty(parentID);
+	}
+
+	void moveClient(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility) {
+		Writer writer(*this, serverConnectionHandlerID);
+		ConnectionState& state = writer.state;
+		if (CachedChannel* oldChannel = state.m_channels.find(oldChannelID)) {
+			auto it = std::lower_bound(oldChannel->clients.begin(), oldChannel->clients.end(), clientID);
+			if (it != oldChannel->clients.end() && *it == clientID)
+				oldChannel->clients.erase(it);
+		}
+		if (visibility == LEAVE_VISIBILITY || newChannelID == 0) {
+			state.m_clients.erase(clientID);
+			return;
+		}
+		CachedClient& client = state.m_clients[clientID];
+		const bool isNew = client.clientID == 0;
+		client.clientID = clientID;
+		client.channelID = newChannelID;
+		if (isNew || visibility == ENTER_VISIBILITY)
+			readClient(serverConnectionHandlerID, clientID, client);
+		CachedChannel& newChannel = state.m_channels[newChannelID];
+		newChannel.channelID = newChannelID;
+		auto it = std::lower_bound(newChannel.clients.begin(), newChannel.clients.end(), clientID);
+		if (it == newChannel.clients.end() || *it != clientID)
+			newChannel.clients.insert(it, clientID);
+	}
+
+	//value is taken by reference, it is only written by the call producing the error argument
+	static void readString(unsigned int error, char* const& value, std::string& out) {
+		if (error == ERROR_ok) {
+			out.assign(value);
+			ts3client_freeMemory(value);
+		}
+	}
+
+	static bool readFlag(uint64 serverConnectionHandlerID, uint64 channelID, ChannelProperties flag, bool current) {
+		int value;
+		return ts3client_getChannelVariableAsInt(serverConnectionHandlerID, channelID, flag, &value) == ERROR_ok ? value != 0 : current;
+	}
+
+	static void readChannelOrder(ConnectionState& state, uint64 serverConnectionHandlerID, uint64 channelID) {
+		if (CachedChannel* channel = state.m_channels.find(channelID)) {
+			uint64 order;
+			if (ts3client_getChannelVariableAsUInt64(serverConnectionHandlerID, channelID, CHANNEL_ORDER, &order) == ERROR_ok)
+				channel->order = order;
+		}
+	}
+
+	static void readChannel(ConnectionState& state, uint64 serverConnectionHandlerID, CachedChannel& channel) {
+		const uint64 channelID = channel.channelID;
+		char* value = nullptr;
+		readString(ts3client_getChannelVariableAsString(serverConnectionHandlerID, channelID, CHANNEL_NAME, &value), value, channel.name);
+		readString(ts3client_getChannelVariableAsString(serverConnectionHandlerID, channelID, CHANNEL_TOPIC, &value), value, channel.topic);
+		int intValue;
+		if (ts3client_getChannelVariableAsInt(serverConnectionHandlerID, channelID, CHANNEL_MAXCLIENTS, &intValue) == ERROR_ok)
+			channel.maxClients = intValue;
+		if (ts3client_getChannelVariableAsInt(serverConnectionHandlerID, channelID, CHANNEL_CODEC, &intValue) == ERROR_ok)
+			channel.codec = intValue;
+		channel.hasPassword = readFlag(serverConnectionHandlerID, channelID, CHANNEL_FLAG_PASSWORD, channel.hasPassword);
+		channel.isDefault = readFlag(serverConnectionHandlerID, channelID, CHANNEL_FLAG_DEFAULT, channel.isDefault);
+		channel.isPermanent = readFlag(serverConnectionHandlerID, channelID, CHANNEL_FLAG_PERMANENT, channel.isPermanent);
+		uint64 order;
+		if (ts3client_getChannelVariableAsUInt64(serverConnectionHandlerID, channelID, CHANNEL_ORDER, &order) == ERROR_ok && order != channel.order) {
+			channel.order = order;
+			state.markDirty(channel.parentID);
+		}
+	}
+
+	static void readClient(uint64 serverConnectionHandlerID, anyID clientID, CachedClient& client) {
+		char* value = nullptr;
+		readString(ts3client_getClientVariableAsString(serverConnectionHandlerID, clientID, CLIENT_NICKNAME, &value), value, client.nickname);
+		readString(ts3client_getClientVariableAsString(serverConnectionHandlerID, clientID, CLIENT_UNIQUE_IDENTIFIER, &value), value, client.uniqueIdentifier);
+		int intValue;
+		if (ts3client_getClientVariableAsInt(serverConnectionHandlerID, clientID, CLIENT_INPUT_MUTED, &intValue) == ERROR_ok)
+			client.inputMuted = intValue == MUTEINPUT_MUTED;
+		if (ts3client_getClientVariableAsInt(serverConnectionHandlerID, clientID, CLIENT_OUTPUT_MUTED, &intValue) == ERROR_ok)
+			client.outputMuted = intValue == MUTEOUTPUT_MUTED;
+		if (ts3client_getClientVariableAsInt(serverConnectionHandlerID, clientID, CLIENT_INPUT_HARDWARE, &intValue) == ERROR_ok)
+			client.inputHardware = intValue == HARDWAREINPUT_ENABLED;
+		if (ts3client_getClientVariableAsInt(serverConnectionHandlerID, clientID, CLIENT_IS_RECORDING, &intValue) == ERROR_ok)
+			client.isRecording = intValue != 0;
+	}
+
+	mutable std::mutex                               m_entriesMutex;
+	FlatHashMap<uint64, std::shared_ptr<Entry>>      m_entries;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_CLIENT_STATE_CACHE_H
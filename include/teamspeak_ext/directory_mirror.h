@@ -0,0 +1,490 @@
+/*
+ * Incremental mirror between a local directory and the file area of a channel. The remote tree is listed with
+ * ts3client_requestFileList, many directories at a time, and cached between syncs. Files are compared against a
+ * local manifest that remembers size and modification times of the last successful transfer, so a sync without
+ * changes lists the remote tree once, touches no file contents and transfers nothing.
+ */
+
+#ifndef TEAMSPEAK_EXT_DIRECTORY_MIRROR_H
+#define TEAMSPEAK_EXT_DIRECTORY_MIRROR_H
+
+//system
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//own
+#include "teamspeak/clientlib.h"
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak_ext/async_request.h"
+#include "teamspeak_ext/transfer_manager.h"
+
+namespace ts3ext {
+
+/** @brief server answer to a file list request on an empty directory (database empty result) */
+static const unsigned int FILE_LIST_EMPTY_RESULT = 0x0501;
+
+struct RemoteFileEntry {
+	std::string name;
+	uint64      size = 0;
+	uint64      datetime = 0;       ///< unix timestamp of the last modification
+	int         type = FileListType_File; ///< one of the values from the FileTransferType enum
+	uint64      incompleteSize = 0; ///< differs from size while the file is being uploaded
+};
+
+struct ManifestEntry {
+	uint64 size = 0;
+	uint64 remoteDatetime = 0; ///< datetime of the remote file after the last transfer
+	int64_t localMtime = 0;    ///< modification time of the local file after the last transfer, in seconds
+};
+
+/**
+ * @brief state of the last successful transfer of every mirrored file, keyed by path relative to the mirror root
+ *
+ * Stored as a text file with one "size remoteDatetime localMtime path" line per file.
+*/
+class SyncManifest {
+public:
+	bool load(const std::string& fileName) {
+		m_entries.clear();
+		std::ifstream in(fileName);
+		if (!in)
+			return false;
+		std::string line;
+		while (std::getline(in, line)) {
+			unsigned long long size, remoteDatetime;
+			long long localMtime;
+			int pathOffset = 0;
+			if (std::sscanf(line.c_str(), "%llu %llu %lld %n", &size, &remoteDatetime, &localMtime, &pathOffset) != 3 || pathOffset == 0)
+				continue;
+			ManifestEntry& entry = m_entries[line.substr(pathOffset)];
+			entry.size = size;
+			entry.remoteDatetime = remoteDatetime;
+			entry.localMtime = localMtime;
+		}
+		return true;
+	}
+
+	/** @brief writes to a temporary file first, so an interrupted save keeps the previous manifest */
+	bool save(const std::string& fileName) const {
+		const std::string temporary = fileName + ".tmp";
+		{
+			std::ofstream out(temporary, std::ios::trunc);
+			if (!out)
+				return false;
+			for (const auto& entry : m_entries)
+				out << entry.second.size << ' ' << entry.second.remoteDatetime << ' ' << entry.second.localMtime << ' ' << entry.first << '\n';
+			if (!out.flush())
+				return false;
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary, fileName, error);
+		return !error;
+	}
+
+	const ManifestEntry* find(const std::string& path) const {
+		const auto it = m_entries.find(path);
+		return it == m_entries.end() ? nullptr : &it->second;
+	}
+
+	void set(const std::string& path, const ManifestEntry& entry) { m_entries[path] = entry; }
+	void erase(const std::string& path) { m_entries.erase(path); }
+	size_t size() const { return m_entries.size(); }
+
+private:
+	std::unordered_map<std::string, ManifestEntry> m_entries;
+};
+
+enum SyncDirection {
+	SYNC_DOWNLOAD = 0, ///< make the local directory match the channel
+	SYNC_UPLOAD,       ///< make the channel match the local directory
+};
+
+struct SyncSpec {
+	uint64        serverConnectionHandlerID = 0;
+	uint64        channelID = 0;
+	std::string   channelPassword;
+	std::string   remoteRoot = "/";  ///< directory in the channel file area
+	std::string   localRoot;         ///< absolute local directory
+	std::string   manifestFile;      ///< empty to keep the manifest in memory only
+	SyncDirection direction = SYNC_DOWNLOAD;
+	int           priority = 0;      ///< priority of the resulting transfers
+};
+
+struct SyncResult {
+	unsigned int             error = ERROR_ok;  ///< first listing or transfer error, ERROR_ok if everything succeeded
+	size_t                   directoriesListed = 0;
+	size_t                   filesCompared = 0;
+	size_t                   filesTransferred = 0;
+	size_t                   filesFailed = 0;
+	std::chrono::nanoseconds duration = std::chrono::nanoseconds::zero();
+};
+
+struct MirrorOptions {
+	unsigned int              maxListingsInFlight = 16;
+	std::chrono::milliseconds listingTimeout = std::chrono::milliseconds(15000);
+};
+
+/**
+ * @brief keeps local directories and channel file areas in sync
+ *
+ * Forward onFileListEvent and onFileListFinishedEvent, onServerErrorEvent goes to the AsyncRequests instance and
+ * onFileTransferStatusEvent to the TransferManager. sync() blocks, call it from a worker thread, never from a client
+ * library callback. Listings only time out if AsyncRequests::expireTimedOut() is called periodically.
+*/
+class DirectoryMirror {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	DirectoryMirror(AsyncRequests& requests, TransferManager& transfers, const MirrorOptions& options = MirrorOptions())
+	    : m_requests(requests), m_transfers(transfers), m_options(options) {}
+
+	DirectoryMirror(const DirectoryMirror&) = delete;
+	DirectoryMirror& operator=(const DirectoryMirror&) = delete;
+
+	SyncResult sync(const SyncSpec& spec) {
+		std::lock_guard<std::mutex> syncLock(m_syncMutex);
+		const Clock::time_point started = Clock::now();
+		SyncResult result;
+		SyncManifest manifest;
+		if (!spec.manifestFile.empty())
+			manifest.load(spec.manifestFile);
+		else
+			manifest = m_manifests[manifestKey(spec)];
+
+		std::vector<std::pair<std::string, RemoteFileEntry>> remoteFiles;
+		std::vector<std::string> remoteDirectories;
+		result.error = listTree(spec, remoteFiles, remoteDirectories, result);
+		if (result.error == ERROR_ok) {
+			std::vector<Planned> planned;
+			if (spec.direction == SYNC_DOWNLOAD)
+				planDownloads(spec, manifest, remoteFiles, planned, result);
+			else
+				planUploads(spec, manifest, remoteFiles, remoteDirectories, planned, result);
+			runTransfers(spec, planned, manifest, result);
+		}
+
+		if (!spec.manifestFile.empty())
+			manifest.save(spec.manifestFile);
+		else
+			m_manifests[manifestKey(spec)] = std::move(manifest);
+		result.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started);
+		return result;
+	}
+
+	/**
+	 * @brief entries of a remote directory as seen by the last sync
+	 *
+	 * @return false if the directory was not listed yet
+	*/
+	bool cachedListing(uint64 serverConnectionHandlerID, uint64 channelID, const std::string& path, std::vector<RemoteFileEntry>& entries) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto it = m_remote.find(directoryKey(serverConnectionHandlerID, channelID, normalize(path)));
+		if (it == m_remote.end())
+			return false;
+		entries = it->second;
+		return true;
+	}
+
+	void onFileListEvent(uint64 serverConnectionHandlerID, uint64 channelID, const char* path, const char* name, uint64 size, uint64 datetime, int type,
+	                     uint64 incompletesize, const char* /*returnCode*/) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto it = m_listings.find(directoryKey(serverConnectionHandlerID, channelID, normalize(path)));
+		if (it == m_listings.end())
+			return;
+		RemoteFileEntry entry;
+		entry.name = name;
+		entry.size = size;
+		entry.datetime = datetime;
+		entry.type = type;
+		entry.incompleteSize = incompletesize;
+		it->second.entries.push_back(std::move(entry));
+	}
+
+	void onFileListFinishedEvent(uint64 serverConnectionHandlerID, uint64 channelID, const char* path) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto it = m_listings.find(directoryKey(serverConnectionHandlerID, channelID, normalize(path)));
+		if (it == m_listings.end() || it->second.finished)
+			return;
+		it->second.finished = true;
+		it->second.error = ERROR_ok;
+		m_listingDone.notify_all();
+	}
+
+private:
+	struct Listing {
+		std::vector<RemoteFileEntry> entries;
+		bool                         finished = false;
+		unsigned int                 error = ERROR_ok;
+	};
+
+	struct ListingContext {
+		DirectoryMirror* owner;
+		std::string      key;
+	};
+
+	static std::string normalize(const std::string& path) {
+		std::string result = path.empty() || path[0] != '/' ? "/" + path : path;
+		while (result.size() > 1 && result.back() == '/')
+			result.pop_back();
+		return result;
+	}
+
+	static std::string join(const std::string& directory, const std::string& name) { return directory == "/" ? "/" + name : directory + "/" + name; }
+
+	static std::string directoryKey(uint64 serverConnectionHandlerID, uint64 channelID, const std::string& path) {
+		return std::to_string(serverConnectionHandlerID) + ':' + std::to_string(channelID) + ':' + path;
+	}
+
+	static std::string manifestKey(const SyncSpec& spec) {
+		return directoryKey(spec.serverConnectionHandlerID, spec.channelID, normalize(spec.remoteRoot)) + '|' + spec.localRoot;
+	}
+
+	/*path relative to the mirror root, without leading slash*/
+	static std::string relative(const std::string& root, const std::string& path) {
+		if (root == "/")
+			return path.substr(1);
+		return path.size() > root.size() ? path.substr(root.size() + 1) : std::string();
+	}
+
+	/*breadth first walk with up to maxListingsInFlight outstanding requests*/
+	unsigned int listTree(const SyncSpec& spec, std::vector<std::pair<std::string, RemoteFileEntry>>& files, std::vector<std::string>& directories,
+	                      SyncResult& result) {
+		std::deque<std::string> pending;
+		pending.push_back(normalize(spec.remoteRoot));
+		std::vector<std::string> inFlight;
+		unsigned int error = ERROR_ok;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while ((!pending.empty() || !inFlight.empty()) && error == ERROR_ok) {
+			while (!pending.empty() && inFlight.size() < m_options.maxListingsInFlight) {
+				const std::string path = pending.front();
+				pending.pop_front();
+				const std::string key = directoryKey(spec.serverConnectionHandlerID, spec.channelID, path);
+				m_listings[key] = Listing();
+				inFlight.push_back(path);
+				lock.unlock();
+				requestListing(spec, path, key);
+				lock.lock();
+			}
+			m_listingDone.wait(lock, [&] {
+				for (const std::string& path : inFlight) {
+					const auto it = m_listings.find(directoryKey(spec.serverConnectionHandlerID, spec.channelID, path));
+					if (it != m_listings.end() && it->second.finished)
+						return true;
+				}
+				return false;
+			});
+			for (size_t i = 0; i < inFlight.size();) {
+				const std::string path = inFlight[i];
+				const std::string key = directoryKey(spec.serverConnectionHandlerID, spec.channelID, path);
+				const auto it = m_listings.find(key);
+				if (!it->second.finished) {
+					++i;
+					continue;
+				}
+				inFlight[i] = inFlight.back();
+				inFlight.pop_back();
+				if (it->second.error != ERROR_ok && error == ERROR_ok)
+					error = it->second.error;
+				++result.directoriesListed;
+				directories.push_back(path);
+				for (const RemoteFileEntry& entry : it->second.entries) {
+					if (entry.type == FileListType_Directory)
+						pending.push_back(join(path, entry.name));
+					else
+						files.emplace_back(path, entry);
+				}
+				m_remote[key] = std::move(it->second.entries);
+				m_listings.erase(it);
+			}
+		}
+		//answers still outstanding after an error are dropped by the event handlers
+		for (const std::string& path : inFlight)
+			m_listings.erase(directoryKey(spec.serverConnectionHandlerID, spec.channelID, path));
+		return error;
+	}
+
+	void requestListing(const SyncSpec& spec, const std::string& path, const std::string& key) {
+		ListingContext* context = new ListingContext{this, key};
+		const unsigned int error = m_requests.submit(spec.serverConnectionHandlerID, [&](const char* returnCode) {
+			return ts3client_requestFileList(spec.serverConnectionHandlerID, spec.channelID, spec.channelPassword.c_str(), path.c_str(), returnCode);
+		}, &DirectoryMirror::onListingAnswered, context, m_options.listingTimeout);
+		if (error != ERROR_ok) {
+			delete context;
+			finishListing(key, error);
+		}
+	}
+
+	/*the answer to the request only matters if it reports an error, the listing itself ends with onFileListFinishedEvent*/
+	static void onListingAnswered(void* context, const RequestResult& result) {
+		ListingContext* listing = static_cast<ListingContext*>(context);
+		DirectoryMirror& self = *listing->owner;
+		const std::string key = std::move(listing->key);
+		delete listing;
+		if (result.error == FILE_LIST_EMPTY_RESULT)
+			self.finishListing(key, ERROR_ok);
+		else if (result.error != ERROR_ok)
+			self.finishListing(key, result.error);
+	}
+
+	void finishListing(const std::string& key, unsigned int error) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto it = m_listings.find(key);
+		if (it == m_listings.end() || it->second.finished)
+			return;
+		it->second.finished = true;
+		it->second.error = error;
+		m_listingDone.notify_all();
+	}
+
+	static int64_t localMtime(const std::filesystem::path& path, std::error_code& error) {
+		const auto time = std::filesystem::last_write_time(path, error);
+		return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+	}
+
+	struct Planned {
+		std::string relativePath;
+		std::string remotePath;
+		std::string localDirectory;
+		uint64      size;
+		uint64      remoteDatetime; ///< 0 for uploads, learned from the next listing
+	};
+
+	void planDownloads(const SyncSpec& spec, const SyncManifest& manifest, const std::vector<std::pair<std::string, RemoteFileEntry>>& remoteFiles,
+	                   std::vector<Planned>& planned, SyncResult& result) {
+		const std::string root = normalize(spec.remoteRoot);
+		for (const auto& file : remoteFiles) {
+			const RemoteFileEntry& entry = file.second;
+			if (entry.incompleteSize != entry.size)
+				continue; //upload in progress on the server
+			++result.filesCompared;
+			const std::string path = join(file.first, entry.name);
+			const std::string relativePath = relative(root, path);
+			const std::filesystem::path localPath = std::filesystem::path(spec.localRoot) / relativePath;
+			const ManifestEntry* known = manifest.find(relativePath);
+			std::error_code error;
+			if (known != nullptr && known->size == entry.size && known->remoteDatetime == entry.datetime &&
+			    std::filesystem::file_size(localPath, error) == entry.size && !error && localMtime(localPath, error) == known->localMtime && !error)
+				continue;
+			std::filesystem::create_directories(localPath.parent_path(), error);
+			planned.push_back(Planned{relativePath, path, localPath.parent_path().string(), entry.size, entry.datetime});
+		}
+	}
+
+	void planUploads(const SyncSpec& spec, SyncManifest& manifest, const std::vector<std::pair<std::string, RemoteFileEntry>>& remoteFiles,
+	                 const std::vector<std::string>& remoteDirectories, std::vector<Planned>& planned, SyncResult& result) {
+		const std::string root = normalize(spec.remoteRoot);
+		std::unordered_map<std::string, const RemoteFileEntry*> remoteByPath;
+		for (const auto& file : remoteFiles)
+			remoteByPath[relative(root, join(file.first, file.second.name))] = &file.second;
+		std::unordered_map<std::string, bool> existingDirectories;
+		for (const std::string& directory : remoteDirectories)
+			existingDirectories[directory] = true;
+
+		std::error_code error;
+		for (std::filesystem::recursive_directory_iterator it(spec.localRoot, error), end; !error && it != end; it.increment(error)) {
+			if (!it->is_regular_file(error))
+				continue;
+			++result.filesCompared;
+			const std::string relativePath = std::filesystem::relative(it->path(), spec.localRoot, error).generic_string();
+			const uint64 size = it->file_size(error);
+			const int64_t mtime = localMtime(it->path(), error);
+			const ManifestEntry* known = manifest.find(relativePath);
+			const auto remote = remoteByPath.find(relativePath);
+			if (known != nullptr && remote != remoteByPath.end() && known->size == size && known->localMtime == mtime && remote->second->size == size &&
+			    (known->remoteDatetime == 0 || known->remoteDatetime == remote->second->datetime)) {
+				if (known->remoteDatetime == 0)
+					manifest.set(relativePath, ManifestEntry{size, remote->second->datetime, mtime});
+				continue;
+			}
+			const std::string remotePath = join(root, relativePath);
+			const std::string remoteDirectory = remotePath.substr(0, remotePath.rfind('/'));
+			if (!createRemoteDirectories(spec, remoteDirectory.empty() ? "/" : remoteDirectory, existingDirectories)) {
+				++result.filesFailed;
+				continue;
+			}
+			planned.push_back(Planned{relativePath, remotePath, it->path().parent_path().string(), size, 0});
+		}
+	}
+
+	/*parents first, the server does not create intermediate directories*/
+	bool createRemoteDirectories(const SyncSpec& spec, const std::string& directory, std::unordered_map<std::string, bool>& existing) {
+		if (existing.count(directory) != 0)
+			return existing[directory];
+		const size_t slash = directory.rfind('/');
+		if (slash != std::string::npos && !createRemoteDirectories(spec, slash == 0 ? "/" : directory.substr(0, slash), existing))
+			return false;
+		const RequestResult created = m_requests.submit(spec.serverConnectionHandlerID, [&](const char* returnCode) {
+			return ts3client_requestCreateDirectory(spec.serverConnectionHandlerID, spec.channelID, spec.channelPassword.c_str(), directory.c_str(), returnCode);
+		}, m_options.listingTimeout).get();
+		const bool ok = created.error == ERROR_ok || created.error == ERROR_file_already_exists;
+		existing[directory] = ok;
+		return ok;
+	}
+
+	/*hand the planned transfers to the transfer manager and wait for all of them*/
+	void runTransfers(const SyncSpec& spec, const std::vector<Planned>& planned, SyncManifest& manifest, SyncResult& result) {
+		if (planned.empty())
+			return;
+		size_t remaining = planned.size();
+		std::mutex doneMutex;
+		std::condition_variable done;
+		for (const Planned& transfer : planned) {
+			TransferJob job;
+			job.serverConnectionHandlerID = spec.serverConnectionHandlerID;
+			job.channelID = spec.channelID;
+			job.channelPassword = spec.channelPassword;
+			job.file = transfer.remotePath;
+			job.localDirectory = transfer.localDirectory;
+			job.direction = spec.direction == SYNC_DOWNLOAD ? TRANSFER_DOWNLOAD : TRANSFER_UPLOAD;
+			job.priority = spec.priority;
+			job.onComplete = [&, transfer](const TransferResult& outcome) {
+				std::error_code error;
+				const int64_t mtime = localMtime(std::filesystem::path(spec.localRoot) / transfer.relativePath, error);
+				std::lock_guard<std::mutex> lock(doneMutex);
+				if (outcome.error == ERROR_file_transfer_complete && !error) {
+					++result.filesTransferred;
+					//uploads learn the remote datetime on the next listing, until then the local time identifies the state
+					manifest.set(transfer.relativePath, ManifestEntry{transfer.size, transfer.remoteDatetime, mtime});
+				} else {
+					++result.filesFailed;
+					manifest.erase(transfer.relativePath);
+					if (result.error == ERROR_ok)
+						result.error = outcome.error;
+				}
+				--remaining;
+				done.notify_all();
+			};
+			m_transfers.enqueue(std::move(job));
+		}
+		for (;;) {
+			m_transfers.pump();
+			std::unique_lock<std::mutex> lock(doneMutex);
+			if (done.wait_for(lock, std::chrono::milliseconds(100), [&] { return remaining == 0; }))
+				return;
+		}
+	}
+
+	AsyncRequests&                                            m_requests;
+	TransferManager&                                          m_transfers;
+	const MirrorOptions                                       m_options;
+	std::mutex                                                m_syncMutex; ///< one sync at a time, guards the members below it
+	std::unordered_map<std::string, SyncManifest>             m_manifests; ///< manifests of syncs without manifestFile
+	mutable std::mutex                                        m_mutex;     ///< guards the listing state below
+	std::condition_variable                                   m_listingDone;
+	std::unordered_map<std::string, Listing>                  m_listings;  ///< listings in flight, by directoryKey()
+	std::unordered_map<std::string, std::vector<RemoteFileEntry>> m_remote; ///< remote tree cache, by directoryKey()
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_DIRECTORY_MIRROR_H
@@ -0,0 +1,505 @@
+/*
+ * Typed event bus for the TeamSpeak 3 Client SDK callbacks. The ClientUIFunctions callbacks run on the client
+ * library thread with raw C arguments. This header turns the state related callbacks into compact typed events,
+ * pushes them through a bounded lock-free MPSC queue, coalesces redundant updates of the same client / channel
+ * within one tick and hands the resulting batches to subscribers on their own executors.
+ */
+
+#ifndef TEAMSPEAK_EXT_EVENT_BUS_H
+#define TEAMSPEAK_EXT_EVENT_BUS_H
+
+//system
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+//own
+#include "teamspeak/clientlib.h"
+
+namespace ts3ext {
+
+enum ClientEventType {
+	CLIENT_EVENT_CONNECT_STATUS = 0,        ///< onConnectStatusChangeEvent. status = newStatus, error = errorNumber
+	CLIENT_EVENT_NEW_CHANNEL,               ///< onNewChannelEvent. channelID, parentChannelID
+	CLIENT_EVENT_NEW_CHANNEL_CREATED,       ///< onNewChannelCreatedEvent. channelID, parentChannelID, invokerID
+	CLIENT_EVENT_DEL_CHANNEL,               ///< onDelChannelEvent. channelID, invokerID
+	CLIENT_EVENT_CHANNEL_MOVE,              ///< onChannelMoveEvent. channelID, parentChannelID = new parent, invokerID
+	CLIENT_EVENT_UPDATE_CHANNEL,            ///< onUpdateChannelEvent. channelID. Coalesced.
+	CLIENT_EVENT_UPDATE_CHANNEL_EDITED,     ///< onUpdateChannelEditedEvent. channelID, invokerID. Coalesced.
+	CLIENT_EVENT_UPDATE_CLIENT,             ///< onUpdateClientEvent. clientID, invokerID. Coalesced.
+	CLIENT_EVENT_CLIENT_MOVE,               ///< onClientMoveEvent. clientID, oldChannelID, newChannelID, status = visibility
+	CLIENT_EVENT_CLIENT_MOVE_SUBSCRIPTION,  ///< onClientMoveSubscriptionEvent. clientID, oldChannelID, newChannelID, status = visibility
+	CLIENT_EVENT_CLIENT_MOVE_TIMEOUT,       ///< onClientMoveTimeoutEvent. clientID, oldChannelID, newChannelID, status = visibility
+	CLIENT_EVENT_CLIENT_MOVE_MOVED,         ///< onClientMoveMovedEvent. clientID, oldChannelID, newChannelID, status = visibility, invokerID = moverID
+	CLIENT_EVENT_CLIENT_KICK_FROM_CHANNEL,  ///< onClientKickFromChannelEvent. clientID, oldChannelID, newChannelID, status = visibility, invokerID = kickerID
+	CLIENT_EVENT_CLIENT_KICK_FROM_SERVER,   ///< onClientKickFromServerEvent. clientID, oldChannelID, newChannelID, status = visibility, invokerID = kickerID
+	CLIENT_EVENT_TALK_STATUS_CHANGE,        ///< onTalkStatusChangeEvent. clientID, status, error = isReceivedWhisper. Coalesced.
+	CLIENT_EVENT_CHANNEL_SUBSCRIBE,         ///< onChannelSubscribeEvent. channelID
+	CLIENT_EVENT_CHANNEL_SUBSCRIBE_FINISHED,   ///< onChannelSubscribeFinishedEvent
+	CLIENT_EVENT_CHANNEL_UNSUBSCRIBE,       ///< onChannelUnsubscribeEvent. channelID
+	CLIENT_EVENT_CHANNEL_UNSUBSCRIBE_FINISHED, ///< onChannelUnsubscribeFinishedEvent
+	CLIENT_EVENT_SERVER_UPDATED,            ///< onServerUpdatedEvent. Coalesced.
+	CLIENT_EVENT_OVERFLOW,                  ///< Synthetic. The queue overflowed and events were lost, subscribers should resynchronize their state.
+	CLIENT_EVENT_ENDMARKER
+};
+
+/**
+ * @brief compact, trivially copyable representation of a client library callback.
+ *
+ * String arguments (invoker names, move / kick messages) are not carried, query them from the client library if needed.
+*/
+struct ClientEvent {
+	uint64       serverConnectionHandlerID;
+	uint64       channelID;       ///< subject channel, or 0
+	uint64       oldChannelID;    ///< previous channel for client moves, parent channel for channel events
+	uint64       newChannelID;    ///< new channel for client moves
+	anyID        clientID;        ///< subject client, or 0
+	anyID        invokerID;       ///< client causing the event, 0 if the server or unknown
+	unsigned short type;          ///< one of the values from the ClientEventType enum
+	int          status;          ///< visibility, talk status or connect status depending on type
+	unsigned int error;           ///< errorNumber / isReceivedWhisper depending on type
+};
+
+/** @brief bit mask helper for ClientEventType values, used to filter subscriptions */
+inline uint64 clientEventMask(ClientEventType type) { return uint64(1) << type; }
+static const uint64 CLIENT_EVENT_MASK_ALL = (uint64(1) << CLIENT_EVENT_ENDMARKER) - 1;
+
+/**
+ * @brief executes work items on behalf of a subscriber, e.g. by posting them to a UI thread.
+*/
+class Executor {
+public:
+	virtual ~Executor() {}
+	virtual void post(std::function<void()> work) = 0;
+};
+
+/** @brief executor running work items immediately on the dispatching thread */
+class InlineExecutor : public Executor {
+public:
+	void post(std::function<void()> work) override { work(); }
+};
+
+/**
+ * @brief Bounded lock-free multi producer single consumer queue (Vyukov style ring with sequence numbers).
+*/
+template <typename T>
+class MpscRing {
+public:
+	explicit MpscRing(size_t capacityPow2) {
+		size_t capacity = 2;
+		while (capacity < capacityPow2)
+			capacity <<= 1;
+		m_mask = capacity - 1;
+		m_cells.reset(new Cell[capacity]);
+		for (size_t i = 0; i < capacity; ++i)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	/** @return false if the queue is full */
+	bool push(const T& value) {
+		size_t position = m_enqueue.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell& cell = m_cells[position & m_mask];
+			const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			const ptrdiff_t diff = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(position);
+			if (diff == 0) {
+				if (m_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					cell.value = value;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				position = m_enqueue.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/** @brief consumer side, must only be called from one thread at a time */
+	bool pop(T& value) {
+		Cell& cell = m_cells[m_dequeue & m_mask];
+		const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		if (static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(m_dequeue + 1) < 0)
+			return false;
+		value = cell.value;
+		cell.sequence.store(m_dequeue + m_mask + 1, std::memory_order_release);
+		++m_dequeue;
+		return true;
+	}
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T                   value;
+	};
+
+	std::unique_ptr<Cell[]> m_cells;
+	size_t                  m_mask = 0;
+	alignas(64) std::atomic<size_t> m_enqueue{0};
+	alignas(64) size_t      m_dequeue = 0;
+};
+
+/**
+ * @brief converts client library callbacks into ClientEvents and delivers them in coalesced batches.
+ *
+ * Forward the ClientUIFunctions callbacks to the methods of the same name (they only enqueue and never block),
+ * then call dispatch() once per tick from a thread of your choice, e.g. a 16ms timer. Within one tick,
+ * coalesced event types keep a single entry per (type, connection, client / channel): the position of the first
+ * occurrence with the data of the last one. A structural event about the same subject ends the entry and later updates
+ * start a new one: client moves and kicks for a client, channel creation, deletion, moves and subscriptions for a
+ * channel, and a connect status change for everything of the connection. No update is delivered before a structural
+ * event it followed, even when a client ID is reused.
+*/
+class EventBus {
+public:
+	typedef std::shared_ptr<const std::vector<ClientEvent>> Batch;
+	typedef std::function<void(const Batch& batch)> Handler;
+
+	explicit EventBus(size_t queueCapacity = 65536) : m_queue(queueCapacity) {}
+
+	EventBus(const EventBus&) = delete;
+	EventBus& operator=(const EventBus&) = delete;
+
+	/**
+	 * @brief register a subscriber
+	 *
+	 * @param mask combination of clientEventMask() values selecting the event types to receive
+	 * @param executor executor the handler is posted to. Must outlive the subscription.
+	 * @param handler called with every non empty batch containing at least one matching event
+	 * @return subscription id to pass to unsubscribe
+	*/
+	unsigned int subscribe(uint64 mask, Executor* executor, Handler handler) {
+		std::lock_guard<std::mutex> lock(m_subscribersMutex);
+		m_subscribers.push_back(Subscriber{++m_lastSubscriptionID, mask, executor, std::move(handler)});
+		return m_lastSubscriptionID;
+	}
+
+	void unsubscribe(unsigned int subscriptionID) {
+		std::lock_guard<std::mutex> lock(m_subscribersMutex);
+		for (auto it = m_subscribers.begin(); it != m_subscribers.end(); ++it) {
+			if (it->id == subscriptionID) {
+				m_subscribers.erase(it);
+				return;
+			}
+		}
+	}
+
+	/**
+	 * @brief drain the queue, coalesce and deliver the batch to all subscribers
+	 *
+	 * Must not be called concurrently from multiple threads. Delivers to the subscribers registered when it starts
+	 * delivering, a handler unsubscribed meanwhile may still get this batch.
+	 * @return number of events delivered after coalescing
+	*/
+	size_t dispatch() {
+		std::vector<ClientEvent>& events = m_scratch;
+		events.clear();
+		m_coalesceIndex.clear();
+		m_barriers.clear();
+		if (m_dropped.exchange(0, std::memory_order_acq_rel) != 0) {
+			ClientEvent overflow = {};
+			overflow.type = CLIENT_EVENT_OVERFLOW;
+			events.push_back(overflow);
+		}
+		ClientEvent event;
+		while (m_queue.pop(event)) {
+			if (!isCoalesced(event.type)) {
+				markBarrier(event, events.size());
+				events.push_back(event);
+				continue;
+			}
+			size_t& position = m_coalesceIndex.findOrInsert(coalesceKey(event), events.size());
+			if (position == events.size()) {
+				events.push_back(event);
+			} else if (position < lastBarrier(event)) {
+				position = events.size();
+				events.push_back(event);
+			} else {
+				events[position] = event;
+				++m_coalesced;
+			}
+		}
+		if (events.empty())
+			return 0;
+
+		Batch all = std::make_shared<const std::vector<ClientEvent>>(events);
+		//posted outside the lock, an inline handler may subscribe or unsubscribe
+		std::vector<Subscriber> subscribers;
+		{
+			std::lock_guard<std::mutex> lock(m_subscribersMutex);
+			subscribers = m_subscribers;
+		}
+		for (const Subscriber& subscriber : subscribers) {
+			Batch batch = all;
+			if ((subscriber.mask & CLIENT_EVENT_MASK_ALL) != CLIENT_EVENT_MASK_ALL) {
+				auto filtered = std::make_shared<std::vector<ClientEvent>>();
+				for (const ClientEvent& e : *all) {
+					if (subscriber.mask & (uint64(1) << e.type))
+						filtered->push_back(e);
+				}
+				if (filtered->empty())
+					continue;
+				batch = std::move(filtered);
+			}
+			Handler handler = subscriber.handler;
+			subscriber.executor->post([handler, batch]() { handler(batch); });
+		}
+		return all->size();
+	}
+
+	/** @brief number of events removed by coalescing since construction */
+	uint64 coalescedCount() const { return m_coalesced; }
+
+	/*callback entry points, safe to call from the client library thread*/
+
+	void onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int errorNumber) {
+		push(make(CLIENT_EVENT_CONNECT_STATUS, serverConnectionHandlerID, 0, 0, 0, 0, 0, newStatus, errorNumber));
+	}
+	void onNewChannelEvent(uint64 serverConnectionHandlerID, uint64 channelID, uint64 channelParentID) {
+		push(make(CLIENT_EVENT_NEW_CHANNEL, serverConnectionHandlerID, channelID, channelParentID, 0, 0, 0, 0, 0));
+	}
+	void onNewChannelCreatedEvent(uint64 serverConnectionHandlerID, uint64 channelID, uint64 channelParentID, anyID invokerID, const char* /*invokerName*/, const char* /*invokerUniqueIdentifier*/) {
+		push(make(CLIENT_EVENT_NEW_CHANNEL_CREATED, serverConnectionHandlerID, channelID, channelParentID, 0, 0, invokerID, 0, 0));
+	}
+	void onDelChannelEvent(uint64 serverConnectionHandlerID, uint64 channelID, anyID invokerID, const char* /*invokerName*/, const char* /*invokerUniqueIdentifier*/) {
+		push(make(CLIENT_EVENT_DEL_CHANNEL, serverConnectionHandlerID, channelID, 0, 0, 0, invokerID, 0, 0));
+	}
+	void onChannelMoveEvent(uint64 serverConnectionHandlerID, uint64 channelID, uint64 newChannelParentID, anyID invokerID, const char* /*invokerName*/, const char* /*invokerUniqueIdentifier*/) {
+		push(make(CLIENT_EVENT_CHANNEL_MOVE, serverConnectionHandlerID, channelID, newChannelParentID, 0, 0, invokerID, 0, 0));
+	}
+	void onUpdateChannelEvent(uint64 serverConnectionHandlerID, uint64 channelID) {
+		push(make(CLIENT_EVENT_UPDATE_CHANNEL, serverConnectionHandlerID, channelID, 0, 0, 0, 0, 0, 0));
+	}
+	void onUpdateChannelEditedEvent(uint64 serverConnectionHandlerID, uint64 channelID, anyID invokerID, const char* /*invokerName*/, const char* /*invokerUniqueIdentifier*/) {
+		push(make(CLIENT_EVENT_UPDATE_CHANNEL_EDITED, serverConnectionHandlerID, channelID, 0, 0, 0, invokerID, 0, 0));
+	}
+	void onUpdateClientEvent(uint64 serverConnectionHandlerID, anyID clientID, anyID invokerID, const char* /*invokerName*/, const char* /*invokerUniqueIdentifier*/) {
+		push(make(CLIENT_EVENT_UPDATE_CLIENT, serverConnectionHandlerID, 0, 0, 0, clientID, invokerID, 0, 0));
+	}
+	void onClientMoveEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, const char* /*moveMessage*/) {
+		push(make(CLIENT_EVENT_CLIENT_MOVE, serverConnectionHandlerID, newChannelID, oldChannelID, newChannelID, clientID, 0, visibility, 0));
+	}
+	void onClientMoveSubscriptionEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility) {
+		push(make(CLIENT_EVENT_CLIENT_MOVE_SUBSCRIPTION, serverConnectionHandlerID, newChannelID, oldChannelID, newChannelID, clientID, 0, visibility, 0));
+	}
+	void onClientMoveTimeoutEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, const char* /*timeoutMessage*/) {
+		push(make(CLIENT_EVENT_CLIENT_MOVE_TIMEOUT, serverConnectionHandlerID, newChannelID, oldChannelID, newChannelID, clientID, 0, visibility, 0));
+	}
+	void onClientMoveMovedEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID moverID, const char* /*moverName*/, const char* /*moverUniqueIdentifier*/, const char* /*moveMessage*/) {
+		push(make(CLIENT_EVENT_CLIENT_MOVE_MOVED, serverConnectionHandlerID, newChannelID, oldChannelID, newChannelID, clientID, moverID, visibility, 0));
+	}
+	void onClientKickFromChannelEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID kickerID, const char* /*kickerName*/, const char* /*kickerUniqueIdentifier*/, const char* /*kickMessage*/) {
+		push(make(CLIENT_EVENT_CLIENT_KICK_FROM_CHANNEL, serverConnectionHandlerID, newChannelID, oldChannelID, newChannelID, clientID, kickerID, visibility, 0));
+	}
+	void onClientKickFromServerEvent(uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID, uint64 newChannelID, int visibility, anyID kickerID, const char* /*kickerName*/, const char* /*kickerUniqueIdentifier*/, const char* /*kickMessage*/) {
+		push(make(CLIENT_EVENT_CLIENT_KICK_FROM_SERVER, serverConnectionHandlerID, newChannelID, oldChannelID, newChannelID, clientID, kickerID, visibility, 0));
+	}
+	void onTalkStatusChangeEvent(uint64 serverConnectionHandlerID, int status, int isReceivedWhisper, anyID clientID) {
+		push(make(CLIENT_EVENT_TALK_STATUS_CHANGE, serverConnectionHandlerID, 0, 0, 0, clientID, 0, status, static_cast<unsigned int>(isReceivedWhisper)));
+	}
+	void onChannelSubscribeEvent(uint64 serverConnectionHandlerID, uint64 channelID) {
+		push(make(CLIENT_EVENT_CHANNEL_SUBSCRIBE, serverConnectionHandlerID, channelID, 0, 0, 0, 0, 0, 0));
+	}
+	void onChannelSubscribeFinishedEvent(uint64 serverConnectionHandlerID) {
+		push(make(CLIENT_EVENT_CHANNEL_SUBSCRIBE_FINISHED, serverConnectionHandlerID, 0, 0, 0, 0, 0, 0, 0));
+	}
+	void onChannelUnsubscribeEvent(uint64 serverConnectionHandlerID, uint64 channelID) {
+		push(make(CLIENT_EVENT_CHANNEL_UNSUBSCRIBE, serverConnectionHandlerID, channelID, 0, 0, 0, 0, 0, 0));
+	}
+	void onChannelUnsubscribeFinishedEvent(uint64 serverConnectionHandlerID) {
+		push(make(CLIENT_EVENT_CHANNEL_UNSUBSCRIBE_FINISHED, serverConnectionHandlerID, 0, 0, 0, 0, 0, 0, 0));
+	}
+	void onServerUpdatedEvent(uint64 serverConnectionHandlerID) {
+		push(make(CLIENT_EVENT_SERVER_UPDATED, serverConnectionHandlerID, 0, 0, 0, 0, 0, 0, 0));
+	}
+
+private:
+	struct Subscriber {
+		unsigned int id;
+		uint64       mask;
+		Executor*    executor;
+		Handler      handler;
+	};
+
+	/*identifies the entity an update is about: one entry per (type, connection, client / channel) and tick*/
+	struct CoalesceKey {
+		uint64         serverConnectionHandlerID;
+		uint64         subject;
+		unsigned short type;
+
+		bool operator==(const CoalesceKey& other) const {
+			return subject == other.subject && serverConnectionHandlerID == other.serverConnectionHandlerID && type == other.type;
+		}
+	};
+
+	/*open addressing map from coalesce key to batch position, reused across ticks without reallocating*/
+	class CoalesceIndex {
+	public:
+		void clear() {
+			if (m_used != 0) {
+				for (Entry& entry : m_entries)
+					entry.used = false;
+				m_used = 0;
+			}
+		}
+
+		/** @brief nullptr if the key is unknown */
+		const size_t* find(const CoalesceKey& key) const {
+			if (m_used == 0)
+				return nullptr;
+			const size_t mask = m_entries.size() - 1;
+			for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+				const Entry& entry = m_entries[i];
+				if (!entry.used)
+					return nullptr;
+				if (entry.key == key)
+					return &entry.position;
+			}
+		}
+
+		size_t& findOrInsert(const CoalesceKey& key, size_t position) {
+			if ((m_used + 1) * 2 > m_entries.size())
+				grow();
+			const size_t mask = m_entries.size() - 1;
+			for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+				Entry& entry = m_entries[i];
+				if (!entry.used) {
+					entry.key = key;
+					entry.position = position;
+					entry.used = true;
+					++m_used;
+					return entry.position;
+				}
+				if (entry.key == key)
+					return entry.position;
+			}
+		}
+
+	private:
+		struct Entry {
+			CoalesceKey key;
+			size_t      position = 0;
+			bool        used = false;
+		};
+
+		static size_t hash(const CoalesceKey& key) {
+			uint64 h = (key.subject * 0x9E3779B97F4A7C15ULL) ^ (key.serverConnectionHandlerID << 8) ^ key.type;
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			return static_cast<size_t>(h);
+		}
+
+		void grow() {
+			std::vector<Entry> old;
+			old.swap(m_entries);
+			m_entries.resize(old.empty() ? 256 : old.size() * 2);
+			m_used = 0;
+			for (const Entry& entry : old) {
+				if (entry.used)
+					findOrInsert(entry.key, entry.position);
+			}
+		}
+
+		std::vector<Entry> m_entries;
+		size_t             m_used = 0;
+	};
+
+	static bool isCoalesced(unsigned short type) {
+		return type == CLIENT_EVENT_UPDATE_CHANNEL || type == CLIENT_EVENT_UPDATE_CHANNEL_EDITED || type == CLIENT_EVENT_UPDATE_CLIENT ||
+		       type == CLIENT_EVENT_TALK_STATUS_CHANGE || type == CLIENT_EVENT_SERVER_UPDATED;
+	}
+
+	static CoalesceKey coalesceKey(const ClientEvent& event) {
+		return CoalesceKey{event.serverConnectionHandlerID, event.clientID != 0 ? event.clientID : event.channelID, event.type};
+	}
+
+	/*subjects of the barrier index, in the type field of its keys*/
+	enum BarrierKind : unsigned short {
+		BARRIER_CLIENT = 0,
+		BARRIER_CHANNEL,
+		BARRIER_CONNECTION,
+	};
+
+	/*remember the position of a structural event for the client, channel or connection it is about*/
+	void markBarrier(const ClientEvent& event, size_t position) {
+		switch (event.type) {
+			case CLIENT_EVENT_CONNECT_STATUS:
+				m_barriers.findOrInsert(CoalesceKey{event.serverConnectionHandlerID, 0, BARRIER_CONNECTION}, position) = position;
+				break;
+			case CLIENT_EVENT_NEW_CHANNEL:
+			case CLIENT_EVENT_NEW_CHANNEL_CREATED:
+			case CLIENT_EVENT_DEL_CHANNEL:
+			case CLIENT_EVENT_CHANNEL_MOVE:
+			case CLIENT_EVENT_CHANNEL_SUBSCRIBE:
+			case CLIENT_EVENT_CHANNEL_UNSUBSCRIBE:
+				m_barriers.findOrInsert(CoalesceKey{event.serverConnectionHandlerID, event.channelID, BARRIER_CHANNEL}, position) = position;
+				break;
+			case CLIENT_EVENT_CLIENT_MOVE:
+			case CLIENT_EVENT_CLIENT_MOVE_SUBSCRIPTION:
+			case CLIENT_EVENT_CLIENT_MOVE_TIMEOUT:
+			case CLIENT_EVENT_CLIENT_MOVE_MOVED:
+			case CLIENT_EVENT_CLIENT_KICK_FROM_CHANNEL:
+			case CLIENT_EVENT_CLIENT_KICK_FROM_SERVER:
+				m_barriers.findOrInsert(CoalesceKey{event.serverConnectionHandlerID, event.clientID, BARRIER_CLIENT}, position) = position;
+				break;
+			default:
+				break;
+		}
+	}
+
+	/*position of the last structural event a coalesced event must not be moved before, 0 if there is none*/
+	size_t lastBarrier(const ClientEvent& event) const {
+		size_t last = 0;
+		if (const size_t* connection = m_barriers.find(CoalesceKey{event.serverConnectionHandlerID, 0, BARRIER_CONNECTION}))
+			last = *connection;
+		const bool client = event.type == CLIENT_EVENT_UPDATE_CLIENT || event.type == CLIENT_EVENT_TALK_STATUS_CHANGE;
+		const bool channel = event.type == CLIENT_EVENT_UPDATE_CHANNEL || event.type == CLIENT_EVENT_UPDATE_CHANNEL_EDITED;
+		if (client || channel) {
+			const CoalesceKey key{event.serverConnectionHandlerID, client ? event.clientID : event.channelID, client ? BARRIER_CLIENT : BARRIER_CHANNEL};
+			if (const size_t* subject = m_barriers.find(key))
+				last = std::max(last, *subject);
+		}
+		return last;
+	}
+
+	static ClientEvent make(ClientEventType type, uint64 serverConnectionHandlerID, uint64 channelID, uint64 oldChannelID, uint64 newChannelID,
+	                        anyID clientID, anyID invokerID, int status, unsigned int error) {
+		ClientEvent event;
+		event.serverConnectionHandlerID = serverConnectionHandlerID;
+		event.channelID = channelID;
+		event.oldChannelID = oldChannelID;
+		event.newChannelID = newChannelID;
+		event.clientID = clientID;
+		event.invokerID = invokerID;
+		event.type = static_cast<unsigned short>(type);
+		event.status = status;
+		event.error = error;
+		return event;
+	}
+
+	void push(const ClientEvent& event) {
+		if (!m_queue.push(event))
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	MpscRing<ClientEvent>    m_queue;
+	std::atomic<uint64>      m_dropped{0};
+	uint64                   m_coalesced = 0;
+	std::vector<ClientEvent> m_scratch;
+	CoalesceIndex            m_coalesceIndex;
+	CoalesceIndex            m_barriers; ///< last structural event per client, channel and connection in this tick
+	std::mutex               m_subscribersMutex;
+	std::vector<Subscriber>  m_subscribers;
+	unsigned int             m_lastSubscriptionID = 0;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_EVENT_BUS_H
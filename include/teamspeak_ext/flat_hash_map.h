@@ -0,0 +1,163 @@
+/*
+ * Open addressing hash map for integer keys such as channel ids (uint64) and client ids (anyID). Entries are
+ * stored inline in a single power of two sized array with linear probing and backward shift deletion, so lookups
+ * touch one or two cache lines and erasing does not leave tombstones behind.
+ */
+
+#ifndef TEAMSPEAK_EXT_FLAT_HASH_MAP_H
+#define TEAMSPEAK_EXT_FLAT_HASH_MAP_H
+
+//system
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace ts3ext {
+
+/** @brief 64 bit finalizer (murmur3 fmix64), spreads sequential ids across the table */
+inline size_t hashInteger(uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return static_cast<size_t>(key);
+}
+
+template <typename Key, typename Value>
+class FlatHashMap {
+public:
+	FlatHashMap() {}
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	void clear() {
+		for (Slot& slot : m_slots) {
+			if (slot.used) {
+				slot.used = false;
+				slot.value = Value();
+			}
+		}
+		m_size = 0;
+	}
+
+	/** @brief make room for count entries without rehashing */
+	void reserve(size_t count) {
+		size_t capacity = 16;
+		while (capacity * 3 < count * 4)
+			capacity <<= 1;
+		if (capacity > m_slots.size())
+			rehash(capacity);
+	}
+
+	Value* find(const Key& key) {
+		const size_t index = locate(key);
+		return index == NOT_FOUND ? nullptr : &m_slots[index].value;
+	}
+
+	const Value* find(const Key& key) const {
+		const size_t index = locate(key);
+		return index == NOT_FOUND ? nullptr : &m_slots[index].value;
+	}
+
+	bool contains(const Key& key) const { return locate(key) != NOT_FOUND; }
+
+	/** @brief value for key, default constructed and inserted if not present */
+	Value& operator[](const Key& key) {
+		if ((m_size + 1) * 4 > m_slots.size() * 3)
+			rehash(m_slots.empty() ? 16 : m_slots.size() * 2);
+		const size_t mask = m_slots.size() - 1;
+		for (size_t i = hashInteger(static_cast<uint64_t>(key)) & mask;; i = (i + 1) & mask) {
+			Slot& slot = m_slots[i];
+			if (!slot.used) {
+				slot.used = true;
+				slot.key = key;
+				++m_size;
+				return slot.value;
+			}
+			if (slot.key == key)
+				return slot.value;
+		}
+	}
+
+	/** @return true if the key was present */
+	bool erase(const Key& key) {
+		size_t hole = locate(key);
+		if (hole == NOT_FOUND)
+			return false;
+		const size_t mask = m_slots.size() - 1;
+		//backward shift: pull following entries of the probe sequence into the hole
+		for (size_t i = (hole + 1) & mask; m_slots[i].used; i = (i + 1) & mask) {
+			const size_t home = hashInteger(static_cast<uint64_t>(m_slots[i].key)) & mask;
+			const bool movable = hole <= i ? (home <= hole || home > i) : (home <= hole && home > i);
+			if (movable) {
+				m_slots[hole].key = m_slots[i].key;
+				m_slots[hole].value = std::move(m_slots[i].value);
+				hole = i;
+			}
+		}
+		m_slots[hole].used = false;
+		m_slots[hole].value = Value();
+		--m_size;
+		return true;
+	}
+
+	/** @brief calls visit(key, value) for every entry, in unspecified order */
+	template <typename Visit>
+	void forEach(Visit&& visit) const {
+		for (const Slot& slot : m_slots) {
+			if (slot.used)
+				visit(slot.key, slot.value);
+		}
+	}
+
+	template <typename Visit>
+	void forEach(Visit&& visit) {
+		for (Slot& slot : m_slots) {
+			if (slot.used)
+				visit(slot.key, slot.value);
+		}
+	}
+
+private:
+	static const size_t NOT_FOUND = static_cast<size_t>(-1);
+
+	struct Slot {
+		Key   key = Key();
+		Value value = Value();
+		bool  used = false;
+	};
+
+	size_t locate(const Key& key) const {
+		if (m_size == 0)
+			return NOT_FOUND;
+		const size_t mask = m_slots.size() - 1;
+		for (size_t i = hashInteger(static_cast<uint64_t>(key)) & mask;; i = (i + 1) & mask) {
+			const Slot& slot = m_slots[i];
+			if (!slot.used)
+				return NOT_FOUND;
+			if (slot.key == key)
+				return i;
+		}
+	}
+
+	void rehash(size_t capacity) {
+		std::vector<Slot> old;
+		old.swap(m_slots);
+		m_slots.resize(capacity);
+		m_size = 0;
+		for (Slot& slot : old) {
+			if (slot.used)
+				(*this)[slot.key] = std::move(slot.value);
+		}
+	}
+
+	std::vector<Slot> m_slots;
+	size_t            m_size = 0;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_FLAT_HASH_MAP_H
@@ -0,0 +1,257 @@
+/*
+ * Pool of pregenerated identities. ts3client_createIdentity spends a lot of CPU time, so spawning many clients at once
+ * (load tests, bots) stalls on identity creation. The pool keeps a stock of identities created in the background on
+ * all cores, together with their unique identifier, and persists them so the stock survives restarts.
+ */
+
+#ifndef TEAMSPEAK_EXT_IDENTITY_POOL_H
+#define TEAMSPEAK_EXT_IDENTITY_POOL_H
+
+//system
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//own
+#include "teamspeak/clientlib.h"
+#include "teamspeak/public_errors.h"
+
+namespace ts3ext {
+
+struct PooledIdentity {
+	std::string identity;         ///< as returned by ts3client_createIdentity
+	std::string uniqueIdentifier; ///< ts3client_identityStringToUniqueIdentifier of identity
+};
+
+struct IdentityPoolOptions {
+	std::string  storeFile;           ///< empty to keep the pool in memory only
+	size_t       lowWatermark = 256;  ///< background generation starts when the stock drops below this
+	size_t       highWatermark = 1024; ///< and stops when the stock reaches this
+	unsigned int threads = 0;         ///< generator threads, 0 for one per core
+};
+
+/**
+ * @brief hands out pregenerated identities
+ *
+ * The store is an append only text file: "+uniqueIdentifier identity" for every generated and "-uniqueIdentifier"
+ * for every handed out identity, so an identity is never handed out twice, even after a crash. It is compacted when
+ * the pool is opened, dropping lines whose identity does not match its unique identifier (a torn write). The store
+ * holds credentials and is created readable by the owner only. If it cannot be compacted the pool keeps its stock in
+ * memory only, so nothing stored is handed out unrecorded, and lastError() reports ERROR_file_io_error.
+*/
+class IdentityPool {
+public:
+	explicit IdentityPool(const IdentityPoolOptions& options = IdentityPoolOptions()) : m_options(options) {
+		if (!m_options.storeFile.empty())
+			loadStore();
+		unsigned int threads = m_options.threads != 0 ? m_options.threads : std::thread::hardware_concurrency();
+		if (threads == 0)
+			threads = 1;
+		for (unsigned int i = 0; i < threads; ++i)
+			m_workers.emplace_back([this] { generateLoop(); });
+	}
+
+	~IdentityPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		for (std::thread& worker : m_workers)
+			worker.join();
+	}
+
+	IdentityPool(const IdentityPool&) = delete;
+	IdentityPool& operator=(const IdentityPool&) = delete;
+
+	/**
+	 * @brief take an identity out of the pool
+	 *
+	 * If the pool is empty the identity is created on the calling thread.
+	 * @return An Error code from the @ref Ts3ErrorType enum indicating either success or the failure reason
+	*/
+	unsigned int acquire(PooledIdentity& identity) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_stock.empty()) {
+				identity = std::move(m_stock.front());
+				m_stock.pop_front();
+				appendToStore("-" + identity.uniqueIdentifier);
+				if (m_stock.size() + m_generating < m_options.lowWatermark)
+					m_refilling = true;
+				m_wake.notify_all();
+				return ERROR_ok;
+			}
+			m_refilling = true;
+			m_wake.notify_all();
+		}
+		return generate(identity);
+	}
+
+	/** @brief block until the stock reached the high watermark, e.g. before starting a load test */
+	void waitUntilFull() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_refilling = m_stock.size() < m_options.highWatermark;
+		m_wake.notify_all();
+		m_filled.wait(lock, [&] { return m_stopping || m_stock.size() >= m_options.highWatermark || m_failed; });
+	}
+
+	size_t available() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stock.size();
+	}
+
+	/** @return error of the last failed background generation or store compaction, ERROR_ok if none failed */
+	unsigned int lastError() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_lastError;
+	}
+
+private:
+	static unsigned int generate(PooledIdentity& identity) {
+		char* created = nullptr;
+		unsigned int error = ts3client_createIdentity(&created);
+		if (error != ERROR_ok)
+			return error;
+		char* uniqueIdentifier = nullptr;
+		error = ts3client_identityStringToUniqueIdentifier(created, &uniqueIdentifier);
+		if (error == ERROR_ok) {
+			identity.identity = created;
+			identity.uniqueIdentifier = uniqueIdentifier;
+			ts3client_freeMemory(uniqueIdentifier);
+		}
+		ts3client_freeMemory(created);
+		return error;
+	}
+
+	void generateLoop() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;) {
+			m_wake.wait(lock, [&] { return m_stopping || (m_refilling && m_stock.size() + m_generating < m_options.highWatermark); });
+			if (m_stopping)
+				return;
+			++m_generating;
+			lock.unlock();
+			PooledIdentity identity;
+			const unsigned int error = generate(identity);
+			lock.lock();
+			--m_generating;
+			if (error != ERROR_ok) {
+				//do not spin on a persistent failure, the next acquire() retries
+				m_lastError = error;
+				m_failed = true;
+				m_refilling = false;
+				m_filled.notify_all();
+				continue;
+			}
+			m_failed = false;
+			appendToStore("+" + identity.uniqueIdentifier + " " + identity.identity);
+			m_stock.push_back(std::move(identity));
+			if (m_stock.size() >= m_options.highWatermark) {
+				m_refilling = false;
+				m_filled.notify_all();
+			}
+		}
+	}
+
+	/*replays the store and rewrites it with only the identities still available*/
+	void loadStore() {
+		std::unordered_map<std::string, std::string> available;
+		std::vector<std::string> order;
+		{
+			std::ifstream in(m_options.storeFile);
+			std::string line;
+			while (std::getline(in, line)) {
+				if (line.size() < 2)
+					continue;
+				if (line[0] == '+') {
+					const size_t space = line.find(' ');
+					if (space == std::string::npos)
+						continue; //torn write at the end of the file
+					const std::string uniqueIdentifier = line.substr(1, space - 1);
+					if (available.emplace(uniqueIdentifier, line.substr(space + 1)).second)
+						order.push_back(uniqueIdentifier);
+				} else if (line[0] == '-') {
+					available.erase(line.substr(1));
+				}
+			}
+		}
+		const std::string temporary = m_options.storeFile + ".tmp";
+		bool written = createPrivate(temporary);
+		if (written) {
+			std::ofstream out(temporary, std::ios::trunc);
+			for (const std::string& uniqueIdentifier : order) {
+				const auto it = available.find(uniqueIdentifier);
+				if (it == available.end() || !matches(it->second, uniqueIdentifier))
+					continue;
+				out << '+' << uniqueIdentifier << ' ' << it->second << '\n';
+				m_stock.push_back(PooledIdentity{it->second, uniqueIdentifier});
+			}
+			out.close();
+			written = !out.fail();
+		}
+		if (written && std::rename(temporary.c_str(), m_options.storeFile.c_str()) == 0)
+			m_store.open(m_options.storeFile, std::ios::app);
+		if (!m_store.is_open()) {
+			//the stored identities stay in the file for the next run, handing them out unrecorded would reuse them
+			std::remove(temporary.c_str());
+			m_stock.clear();
+			m_lastError = ERROR_file_io_error;
+		}
+		m_refilling = m_stock.size() < m_options.lowWatermark;
+	}
+
+	/*true if identity hashes to uniqueIdentifier, which rejects a line cut short by a crash*/
+	static bool matches(const std::string& identity, const std::string& uniqueIdentifier) {
+		char* computed = nullptr;
+		if (ts3client_identityStringToUniqueIdentifier(identity.c_str(), &computed) != ERROR_ok)
+			return false;
+		const bool equal = uniqueIdentifier == computed;
+		ts3client_freeMemory(computed);
+		return equal;
+	}
+
+	/*creates an empty file only the owner can read, the mode also tightens a leftover file*/
+	static bool createPrivate(const std::string& path) {
+		const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+		if (fd < 0)
+			return false;
+		const bool tightened = ::fchmod(fd, S_IRUSR | S_IWUSR) == 0;
+		::close(fd);
+		return tightened;
+	}
+
+	/*called with the lock held*/
+	void appendToStore(const std::string& line) {
+		if (!m_store.is_open())
+			return;
+		m_store << line << '\n';
+		m_store.flush();
+	}
+
+	const IdentityPoolOptions   m_options;
+	mutable std::mutex          m_mutex;
+	std::condition_variable     m_wake;   ///< generator threads wait for work
+	std::condition_variable     m_filled; ///< waitUntilFull() waits for the high watermark
+	std::deque<PooledIdentity>  m_stock;
+	std::ofstream               m_store;
+	size_t                      m_generating = 0;
+	bool                        m_refilling = true;
+	bool                        m_failed = false;
+	bool                        m_stopping = false;
+	unsigned int                m_lastError = ERROR_ok;
+	std::vector<std::thread>    m_workers;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_IDENTITY_POOL_H
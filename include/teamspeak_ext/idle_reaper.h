@@ -0,0 +1,273 @@
+/*
+ * Idle client reaper that moves inactive clients to an AFK channel. Activity is taken from talk events, text messages
+ * and channel moves and only updates a timestamp; each client has one timer in a hierarchical timer wheel that is
+ * re-armed lazily when it fires early. Only clients whose timer runs out get a confirming CLIENT_IDLE_TIME read, and
+ * they are moved with one ts3server_clientMove per server, so the cost of a poll follows the expirations instead of the
+ * number of connected clients.
+ */
+
+#ifndef TEAMSPEAK_EXT_IDLE_REAPER_H
+#define TEAMSPEAK_EXT_IDLE_REAPER_H
+
+//system
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+#include "teamspeak_ext/flat_hash_map.h"
+#include "teamspeak_ext/timer_wheel.h"
+
+namespace ts3ext {
+
+struct IdleReaperOptions {
+	std::chrono::seconds      idleAfter = std::chrono::minutes(30);
+	std::chrono::milliseconds resolution = std::chrono::seconds(1); ///< timer wheel tick, clients are moved at most this late
+	bool                      confirmIdleTime = true;               ///< read CLIENT_IDLE_TIME before moving, it also sees activity not forwarded here
+};
+
+struct IdleReaperStats {
+	uint64 expired = 0;         ///< timers that ran out without activity since they were armed
+	uint64 rearmed = 0;         ///< timers that fired early because of activity and were armed again
+	uint64 confirmedActive = 0; ///< expired, but CLIENT_IDLE_TIME showed activity
+	uint64 moved = 0;
+	uint64 moveFailures = 0;
+	uint64 confirmFailures = 0; ///< CLIENT_IDLE_TIME could not be read, the client gets another idle period
+};
+
+/**
+ * @brief moves clients without activity for idleAfter to the AFK channel of their server
+ *
+ * Forward onClientConnected, onClientDisconnected, onClientMoved, the talk events and the text message events, set an
+ * AFK channel per server and call poll() periodically, e.g. once per resolution. poll() calls into the server library
+ * and must not be called with a lock held that the callbacks take.
+*/
+class IdleReaper {
+public:
+	/** @brief milliseconds of a monotonic clock */
+	typedef int64_t (*Clock)();
+
+	explicit IdleReaper(const IdleReaperOptions& options = IdleReaperOptions(), Clock clock = &steadyMs)
+	    : m_options(options), m_clock(clock), m_tickMs(options.resolution.count() > 0 ? options.resolution.count() : 1),
+	      m_wheel(static_cast<uint64_t>(clock() / m_tickMs)) {}
+
+	IdleReaper(const IdleReaper&) = delete;
+	IdleReaper& operator=(const IdleReaper&) = delete;
+
+	/** @brief 0 disables the reaper for the server. Clients outside the channel are armed. */
+	void setAfkChannel(uint64 serverID, uint64 channelID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (channelID == 0) {
+			m_afkChannels.erase(serverID);
+			return;
+		}
+		m_afkChannels[serverID] = channelID;
+		const int64_t now = m_clock();
+		m_clients.forEach([&](const uint64& key, ClientRecord& client) {
+			if (key >> 16 == serverID && client.armedTick == 0 && client.channelID != channelID)
+				arm(key, client, now);
+		});
+	}
+
+	void onClientConnected(uint64 serverID, anyID clientID, uint64 channelID, unsigned int* /*removeClientError*/) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		ClientRecord& client = m_clients[clientKey(serverID, clientID)];
+		client = ClientRecord();
+		client.channelID = channelID;
+		activity(clientKey(serverID, clientID), client, m_clock());
+	}
+
+	void onClientDisconnected(uint64 serverID, anyID clientID, uint64 /*channelID*/) {
+		//a pending timer finds no record, or one armed for another deadline after a reconnect
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_clients.erase(clientKey(serverID, clientID));
+	}
+
+	void onClientMoved(uint64 serverID, anyID clientID, uint64 /*oldChannelID*/, uint64 newChannelID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const uint64 key = clientKey(serverID, clientID);
+		if (ClientRecord* client = m_clients.find(key)) {
+			client->channelID = newChannelID;
+			activity(key, *client, m_clock());
+		}
+	}
+
+	void onClientStartTalkingEvent(uint64 serverID, anyID clientID) { touch(serverID, clientID); }
+	void onClientStopTalkingEvent(uint64 serverID, anyID clientID) { touch(serverID, clientID); }
+	void onServerTextMessageEvent(uint64 serverID, anyID invokerClientID, const char* /*textMessage*/) { touch(serverID, invokerClientID); }
+	void onChannelTextMessageEvent(uint64 serverID, anyID invokerClientID, uint64 /*targetChannelID*/, const char* /*textMessage*/) {
+		touch(serverID, invokerClientID);
+	}
+
+	/** @brief activity the callbacks above do not see, e.g. from a plugin command */
+	void touch(uint64 serverID, anyID clientID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const uint64 key = clientKey(serverID, clientID);
+		if (ClientRecord* client = m_clients.find(key))
+			activity(key, *client, m_clock());
+	}
+
+	/**
+	 * @brief run the timers due, confirm and move the idle clients
+	 *
+	 * @return number of clients moved
+	*/
+	size_t poll() {
+		std::unordered_map<uint64, std::vector<anyID>> idle; //by server
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const int64_t now = m_clock();
+			m_wheel.advance(static_cast<uint64_t>(now / m_tickMs), [&](uint64_t key, uint64_t deadline) {
+				ClientRecord* client = m_clients.find(key);
+				if (client == nullptr || client->armedTick != deadline)
+					return;
+				client->armedTick = 0;
+				if (client->lastActivityMs + idleMs() > now) {
+					arm(key, *client, now);
+					++m_stats.rearmed;
+				} else if (afkChannelOf(key >> 16) != 0 && client->channelID != afkChannelOf(key >> 16)) {
+					++m_stats.expired;
+					idle[key >> 16].push_back(static_cast<anyID>(key & 0xFFFF));
+				}
+			});
+		}
+
+		size_t moved = 0;
+		for (auto& server : idle) {
+			if (m_options.confirmIdleTime)
+				confirm(server.first, server.second);
+			moved += move(server.first, server.second);
+		}
+		return moved;
+	}
+
+	IdleReaperStats stats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+private:
+	struct ClientRecord {
+		int64_t lastActivityMs = 0;
+		uint64  channelID = 0;
+		uint64  armedTick = 0; ///< deadline of the timer that counts, older timers of the client are ignored. 0 if none is armed
+	};
+
+	static int64_t steadyMs() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static uint64 clientKey(uint64 serverID, anyID clientID) { return serverID << 16 | clientID; }
+
+	int64_t idleMs() const { return std::chrono::duration_cast<std::chrono::milliseconds>(m_options.idleAfter).count(); }
+
+	/*called with the lock held*/
+	uint64 afkChannelOf(uint64 serverID) const {
+		const auto afk = m_afkChannels.find(serverID);
+		return afk != m_afkChannels.end() ? afk->second : 0;
+	}
+
+	/*called with the lock held: only a timestamp, unless the client has no timer*/
+	void activity(uint64 key, ClientRecord& client, int64_t now) {
+		client.lastActivityMs = now;
+		if (client.armedTick == 0 && afkChannelOf(key >> 16) != 0 && client.channelID != afkChannelOf(key >> 16))
+			arm(key, client, now);
+	}
+
+	/*called with the lock held*/
+	void arm(uint64 key, ClientRecord& client, int64_t now) {
+		const int64_t dueMs = std::max(client.lastActivityMs, now - idleMs()) + idleMs();
+		//rounded up, a timer never fires before the client is idle
+		client.armedTick = static_cast<uint64>((dueMs + m_tickMs - 1) / m_tickMs);
+		if (client.armedTick <= m_wheel.now())
+			client.armedTick = m_wheel.now() + 1;
+		m_wheel.schedule(client.armedTick, key);
+	}
+
+	/*drops clients whose CLIENT_IDLE_TIME shows activity, their timer is armed from the reported time. Clients whose idle
+	  time cannot be read are dropped too and checked again after another idle period.*/
+	void confirm(uint64 serverID, std::vector<anyID>& clients) {
+		std::vector<anyID> confirmed;
+		for (anyID clientID : clients) {
+			uint64 idleSeconds = 0;
+			if (ts3server_getClientVariableAsUInt64(serverID, clientID, CLIENT_IDLE_TIME, &idleSeconds) != ERROR_ok) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				++m_stats.confirmFailures;
+				const uint64 key = clientKey(serverID, clientID);
+				ClientRecord* client = m_clients.find(key);
+				if (client != nullptr && client->armedTick == 0)
+					arm(key, *client, m_clock());
+				continue;
+			}
+			if (static_cast<int64_t>(idleSeconds) * 1000 >= idleMs()) {
+				confirmed.push_back(clientID);
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_stats.confirmedActive;
+			const uint64 key = clientKey(serverID, clientID);
+			if (ClientRecord* client = m_clients.find(key)) {
+				const int64_t now = m_clock();
+				client->lastActivityMs = std::max(client->lastActivityMs, now - static_cast<int64_t>(idleSeconds) * 1000);
+				if (client->armedTick == 0)
+					arm(key, *client, now);
+			}
+		}
+		clients.swap(confirmed);
+	}
+
+	/*one move for the whole batch, clients that left meanwhile make it fail and are retried one by one*/
+	size_t move(uint64 serverID, const std::vector<anyID>& clients) {
+		uint64 afkChannel;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			afkChannel = afkChannelOf(serverID);
+		}
+		if (clients.empty() || afkChannel == 0)
+			return 0;
+		std::vector<anyID> batch(clients);
+		batch.push_back(0);
+		size_t moved = 0;
+		if (ts3server_clientMove(serverID, afkChannel, batch.data()) == ERROR_ok) {
+			moved = clients.size();
+		} else {
+			for (anyID clientID : clients) {
+				const anyID single[2] = {clientID, 0};
+				if (ts3server_clientMove(serverID, afkChannel, single) == ERROR_ok)
+					++moved;
+			}
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.moved += moved;
+		m_stats.moveFailures += clients.size() - moved;
+		//the move itself arrives as onClientMoved; clients that could not be moved get another idle period
+		const int64_t now = m_clock();
+		for (anyID clientID : clients) {
+			const uint64 key = clientKey(serverID, clientID);
+			ClientRecord* client = m_clients.find(key);
+			if (client != nullptr && client->channelID != afkChannel && client->armedTick == 0) {
+				client->lastActivityMs = now;
+				arm(key, *client, now);
+			}
+		}
+		return moved;
+	}
+
+	const IdleReaperOptions            m_options;
+	const Clock                        m_clock;
+	const int64_t                      m_tickMs;
+	mutable std::mutex                 m_mutex;
+	TimerWheel                         m_wheel;       ///< client keys by idle deadline in ticks
+	FlatHashMap<uint64, ClientRecord>  m_clients;     ///< by clientKey()
+	std::unordered_map<uint64, uint64> m_afkChannels; ///< by server
+	IdleReaperStats                    m_stats;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_IDLE_REAPER_H
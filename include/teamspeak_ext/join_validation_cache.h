@@ -0,0 +1,362 @@
+/*
+ * Join validation cache for salted and password protected channels. Expected CLIENT_SECURITY_HASH values are kept per
+ * (channel salt, identity) and can be precomputed in bulk, channel passwords are compared against a cached copy of the
+ * stored (encrypted) password, and results are remembered per client and channel. permChannelSubscribe and
+ * onCustomChannelPasswordCheck are answered with hash table lookups, only CHANNEL_SECURITY_SALT or CHANNEL_PASSWORD edits
+ * seen in onChannelEdited and client changes seen in permClientUpdate force a recomputation.
+ */
+
+#ifndef TEAMSPEAK_EXT_JOIN_VALIDATION_CACHE_H
+#define TEAMSPEAK_EXT_JOIN_VALIDATION_CACHE_H
+
+//system
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+#include "teamspeak_ext/security_hash_batch.h"
+#include "teamspeak_ext/sha256.h"
+
+namespace ts3ext {
+
+struct JoinValidationOptions {
+	bool                guardSubscribe = true;           ///< salted channels can only be subscribed with a matching security hash
+	unsigned int        rejectError = ERROR_permissions; ///< returned by permChannelSubscribe on a mismatch
+	size_t              passwordCacheCapacity = 65536;   ///< password results over all channels, the cache is cleared when full
+	SecurityHashOptions hashes;                          ///< for the expected hash table and precompute()
+};
+
+struct JoinValidationStats {
+	uint64 decisionHits = 0;   ///< permChannelSubscribe answered from a remembered decision
+	uint64 hashesComputed = 0; ///< ts3server_calculateSecurityHash calls on the callback path
+	uint64 passwordHits = 0;
+	uint64 passwordChecks = 0; ///< encrypt calls on the callback path
+	uint64 invalidations = 0;  ///< salt or password changes seen
+};
+
+/**
+ * @brief caches the outcome of the security hash and custom channel password checks
+ *
+ * Assign permChannelSubscribe, permClientUpdate and onCustomChannelPasswordCheck from the ServerLibFunctions callbacks
+ * and forward onChannelEdited, onChannelDeleted and onClientDisconnected. Values set with the server library setters
+ * bypass the callbacks, call invalidateChannel() or invalidateClient() after changing them.
+*/
+class JoinValidationCache {
+public:
+	/**
+	 * @brief turns the password a client supplied into the stored form, the same as onClientPasswordEncrypt does
+	 *
+	 * Without one the supplied password is compared as is.
+	*/
+	typedef std::function<std::string(const std::string& password)> Encrypt;
+
+	explicit JoinValidationCache(Encrypt encrypt = Encrypt(), const JoinValidationOptions& options = JoinValidationOptions())
+	    : m_encrypt(std::move(encrypt)), m_options(options), m_hashes(options.hashes) {
+		std::random_device random;
+		for (int i = 0; i < 4; ++i)
+			m_secret += std::to_string(random());
+	}
+
+	JoinValidationCache(const JoinValidationCache&) = delete;
+	JoinValidationCache& operator=(const JoinValidationCache&) = delete;
+
+	unsigned int permChannelSubscribe(uint64 serverID, const struct ClientMiniExport* client, uint64 channelID) {
+		if (!m_options.guardSubscribe)
+			return ERROR_ok;
+		return authorized(serverID, client, channelID) ? static_cast<unsigned int>(ERROR_ok) : m_options.rejectError;
+	}
+
+	/** @brief picks up nickname, meta data and security hash changes of a client, never rejects */
+	unsigned int permClientUpdate(uint64 serverID, anyID clientID, const struct VariablesExport* variables) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		ClientState* state = findClient(serverID, clientID);
+		if (state == nullptr)
+			return ERROR_ok;
+		const ClientProperties watched[] = {CLIENT_NICKNAME, CLIENT_META_DATA, CLIENT_SECURITY_HASH};
+		std::string* fields[] = {&state->nickname, &state->metaData, &state->securityHash};
+		for (size_t i = 0; i < sizeof(watched) / sizeof(watched[0]); ++i) {
+			const VariablesExportItem& item = variables->items[watched[i]];
+			if (item.itemIsValid && item.proposedIsSet) {
+				*fields[i] = item.proposed != nullptr ? item.proposed : "";
+				state->decisions.clear();
+			}
+		}
+		return ERROR_ok;
+	}
+
+	unsigned int onCustomChannelPasswordCheck(uint64 serverID, const struct ClientMiniExport* /*client*/, uint64 channelID, const char* password) {
+		const ChannelState channel = channelState(serverID, channelID);
+		if (channel.password.empty())
+			return ERROR_ok;
+		const std::string supplied = password != nullptr ? password : "";
+		const std::string key = passwordKey(serverID, channelID, supplied);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const auto known = m_passwords.find(key);
+			if (known != m_passwords.end() && known->second.epoch == channel.epoch) {
+				++m_stats.passwordHits;
+				return known->second.matches ? static_cast<unsigned int>(ERROR_ok) : static_cast<unsigned int>(ERROR_channel_invalid_password);
+			}
+		}
+
+		const bool matches = constantTimeEqual(m_encrypt ? m_encrypt(supplied) : supplied, channel.password);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_stats.passwordChecks;
+		if (m_passwords.size() >= m_options.passwordCacheCapacity)
+			m_passwords.clear();
+		m_passwords[key] = PasswordResult{channel.epoch, matches};
+		return matches ? static_cast<unsigned int>(ERROR_ok) : static_cast<unsigned int>(ERROR_channel_invalid_password);
+	}
+
+	void onChannelEdited(uint64 serverID, anyID /*invokerClientID*/, uint64 channelID) { invalidateChannel(serverID, channelID); }
+
+	void onChannelDeleted(uint64 serverID, anyID /*invokerClientID*/, uint64 channelID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto server = m_servers.find(serverID);
+		if (server != m_servers.end())
+			server->second.channels.erase(channelID);
+	}
+
+	void onClientDisconnected(uint64 serverID, anyID clientID, uint64 /*channelID*/) { invalidateClient(serverID, clientID); }
+
+	/** @brief re-read salt and password of a channel, results of the channel are dropped if either changed */
+	void invalidateChannel(uint64 serverID, uint64 channelID) {
+		ChannelState fresh;
+		if (!readChannel(serverID, channelID, fresh))
+			return;
+		std::string retiredSalt;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const auto inserted = m_servers[serverID].channels.emplace(channelID, ChannelState());
+			ChannelState& channel = inserted.first->second;
+			fresh.epoch = channel.epoch;
+			if (inserted.second) {
+				fresh.epoch = ++m_lastEpoch;
+			} else if (fresh.salt != channel.salt || fresh.password != channel.password) {
+				fresh.epoch = ++m_lastEpoch;
+				++m_stats.invalidations;
+				if (fresh.salt != channel.salt)
+					retiredSalt = channel.salt;
+			}
+			channel = fresh;
+		}
+		//other channels may share the old salt, their expected hashes are recomputed on the next miss
+		if (!retiredSalt.empty())
+			m_hashes.forgetSalt(retiredSalt);
+	}
+
+	/** @brief forget what is known about a client, it is re-read on its next check */
+	void invalidateClient(uint64 serverID, anyID clientID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto server = m_servers.find(serverID);
+		if (server != m_servers.end())
+			server->second.clients.erase(clientID);
+	}
+
+	void forgetServer(uint64 serverID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_servers.erase(serverID);
+	}
+
+	/**
+	 * @brief fill the expected hash table for identities expected to join a channel, e.g. after a salt rotation
+	 *
+	 * Runs on the calling thread and the batch workers. Nickname and meta data have to be the values the clients will
+	 * present.
+	*/
+	SecurityHashStats precompute(uint64 serverID, uint64 channelID, const std::vector<SecurityHashInput>& inputs) {
+		const ChannelState channel = channelState(serverID, channelID);
+		if (channel.salt.empty())
+			return SecurityHashStats();
+		std::vector<SecurityHashOutput> outputs;
+		return m_hashes.compute(channel.salt, inputs, outputs);
+	}
+
+	/** @brief true if the client may see and join the channel as far as its security hash goes */
+	bool authorized(uint64 serverID, const struct ClientMiniExport* client, uint64 channelID) {
+		const ChannelState channel = channelState(serverID, channelID);
+		if (channel.salt.empty())
+			return true;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (ClientState* state = findClient(serverID, client->ID)) {
+				const auto decision = state->decisions.find(channelID);
+				if (decision != state->decisions.end() && decision->second.epoch == channel.epoch) {
+					++m_stats.decisionHits;
+					return decision->second.allowed;
+				}
+			}
+		}
+
+		ClientState state;
+		if (!clientState(serverID, client, state))
+			return false;
+		SecurityHashInput input;
+		input.uniqueIdentifier = state.ident;
+		input.nickName = state.nickname;
+		input.metaData = state.metaData;
+		std::vector<SecurityHashOutput> outputs;
+		const SecurityHashStats hashed = m_hashes.compute(channel.salt, std::vector<SecurityHashInput>(1, input), outputs);
+		const bool allowed = outputs[0].error == ERROR_ok && !state.securityHash.empty() && constantTimeEqual(outputs[0].securityHash, state.securityHash);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.hashesComputed += hashed.computed;
+		//a client update that raced with the hash computation cleared the entry, the decision would be stale
+		if (ClientState* current = findClient(serverID, client->ID)) {
+			if (current->securityHash == state.securityHash && current->metaData == state.metaData && current->nickname == state.nickname)
+				current->decisions[channelID] = Decision{channel.epoch, allowed};
+		}
+		return allowed;
+	}
+
+	JoinValidationStats stats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+private:
+	struct ChannelState {
+		std::string salt;     ///< CHANNEL_SECURITY_SALT, empty for channels without
+		std::string password; ///< CHANNEL_PASSWORD as stored, empty for channels without
+		uint64      epoch = 0; ///< unique over all channels, a re-used channel ID does not revive old results
+	};
+
+	struct Decision {
+		uint64 epoch = 0; ///< channel epoch it was made in
+		bool   allowed = false;
+	};
+
+	struct ClientState {
+		std::string                          ident;
+		std::string                          nickname;
+		std::string                          metaData;
+		std::string                          securityHash;
+		std::unordered_map<uint64, Decision> decisions; ///< by channel
+	};
+
+	struct ServerState {
+		std::unordered_map<uint64, ChannelState> channels;
+		std::unordered_map<anyID, ClientState>   clients;
+	};
+
+	struct PasswordResult {
+		uint64 epoch = 0;
+		bool   matches = false;
+	};
+
+	static bool readChannelString(uint64 serverID, uint64 channelID, ChannelProperties flag, std::string& out) {
+		char* value = nullptr;
+		if (ts3server_getChannelVariableAsString(serverID, channelID, flag, &value) != ERROR_ok)
+			return false;
+		out = value;
+		ts3server_freeMemory(value);
+		return true;
+	}
+
+	static bool readClientString(uint64 serverID, anyID clientID, ClientProperties flag, std::string& out) {
+		char* value = nullptr;
+		if (ts3server_getClientVariableAsString(serverID, clientID, flag, &value) != ERROR_ok)
+			return false;
+		out = value;
+		ts3server_freeMemory(value);
+		return true;
+	}
+
+	static bool readChannel(uint64 serverID, uint64 channelID, ChannelState& channel) {
+		return readChannelString(serverID, channelID, CHANNEL_SECURITY_SALT, channel.salt) &&
+		       readChannelString(serverID, channelID, CHANNEL_PASSWORD, channel.password);
+	}
+
+	static bool constantTimeEqual(const std::string& a, const std::string& b) {
+		if (a.size() != b.size())
+			return false;
+		unsigned char difference = 0;
+		for (size_t i = 0; i < a.size(); ++i)
+			difference |= static_cast<unsigned char>(a[i] ^ b[i]);
+		return difference == 0;
+	}
+
+	/*copy of the cached channel, read from the server library on first use*/
+	ChannelState channelState(uint64 serverID, uint64 channelID) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const auto server = m_servers.find(serverID);
+			if (server != m_servers.end()) {
+				const auto channel = server->second.channels.find(channelID);
+				if (channel != server->second.channels.end())
+					return channel->second;
+			}
+		}
+		ChannelState fresh;
+		if (!readChannel(serverID, channelID, fresh))
+			return fresh;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		fresh.epoch = ++m_lastEpoch;
+		//an onChannelEdited that came in meanwhile has the newer values
+		return m_servers[serverID].channels.emplace(channelID, fresh).first->second;
+	}
+
+	/*copy of the cached client without decisions, meta data and security hash are read on first use*/
+	bool clientState(uint64 serverID, const struct ClientMiniExport* client, ClientState& state) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (const ClientState* known = findClient(serverID, client->ID)) {
+				state.ident = known->ident;
+				state.nickname = known->nickname;
+				state.metaData = known->metaData;
+				state.securityHash = known->securityHash;
+				return true;
+			}
+		}
+		state.ident = client->ident != nullptr ? client->ident : "";
+		state.nickname = client->nickname != nullptr ? client->nickname : "";
+		if (!readClientString(serverID, client->ID, CLIENT_META_DATA, state.metaData) ||
+		    !readClientString(serverID, client->ID, CLIENT_SECURITY_HASH, state.securityHash))
+			return false;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_servers[serverID].clients.emplace(client->ID, state);
+		return true;
+	}
+
+	/*called with the lock held*/
+	ClientState* findClient(uint64 serverID, anyID clientID) {
+		const auto server = m_servers.find(serverID);
+		if (server == m_servers.end())
+			return nullptr;
+		const auto client = server->second.clients.find(clientID);
+		return client != server->second.clients.end() ? &client->second : nullptr;
+	}
+
+	/*keyed with a per process secret, so the cache does not hold digests that can be attacked offline*/
+	std::string passwordKey(uint64 serverID, uint64 channelID, const std::string& password) const {
+		Sha256 hash;
+		hash.update(m_secret);
+		const uint64 ids[2] = {serverID, channelID};
+		hash.update(ids, sizeof(ids));
+		hash.update(password);
+		unsigned char digest[Sha256::DIGEST_SIZE];
+		hash.finish(digest);
+		return std::string(reinterpret_cast<const char*>(digest), sizeof(digest));
+	}
+
+	const Encrypt                                   m_encrypt;
+	const JoinValidationOptions                     m_options;
+	SecurityHashBatch                               m_hashes; ///< expected hashes by (salt, identity tuple)
+	std::string                                     m_secret;
+	mutable std::mutex                              m_mutex;
+	std::unordered_map<uint64, ServerState>         m_servers;
+	std::unordered_map<std::string, PasswordResult> m_passwords; ///< by passwordKey()
+	uint64                                          m_lastEpoch = 0;
+	JoinValidationStats                             m_stats;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_JOIN_VALIDATION_CACHE_H
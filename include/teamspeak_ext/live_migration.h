@@ -0,0 +1,257 @@
+/*
+ * Live migration of a virtual server between two shards. The target is pre-created from a snapshot while the source
+ * keeps serving, channel changes on the source are replicated to it until the cutover, and the cutover only stops the
+ * source and brings the pre-warmed copy to its final address. The outage shrinks to a client reconnect, and is measured
+ * from the source stop until the clients are back on the target.
+ */
+
+#ifndef TEAMSPEAK_EXT_LIVE_MIGRATION_H
+#define TEAMSPEAK_EXT_LIVE_MIGRATION_H
+
+//system
+#include <chrono>
+#include <functional>
+#include <unordered_set>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak_ext/channel_replication.h"
+#include "teamspeak_ext/shard_coordinator.h"
+#include "teamspeak_ext/virtual_server_snapshot.h"
+
+namespace ts3ext {
+
+enum MigrationPhase {
+	MIGRATION_IDLE = 0,
+	MIGRATION_REPLICATING, ///< target pre-created, channel changes are replicated
+	MIGRATION_CUT_OVER,    ///< source stopped, target serving
+	MIGRATION_FAILED,      ///< nothing changed for the clients, the target copy was removed
+	MIGRATION_SOURCE_LOST, ///< the target could not take over and the source did not restart, the server runs nowhere; see rollbackSnapshot()
+};
+
+struct LiveMigrationOptions {
+	unsigned int stagingPort = 0;           ///< port of the pre-warmed copy while the source serves, 0 keeps the source's port for a target on another host
+	bool         rehostOnSourcePort = true; ///< with a staging port: restart the copy on the source's port after the source stopped, clients reconnect to the old address. Needs a target that canRehost()
+	std::function<void(uint64 serverID, unsigned int port)> redirect; ///< called once the target serves on a final port that differs from the source's, e.g. to tell client applications
+	double               reconnectedFraction = 0.9; ///< share of the clients that has to be back before the migration counts as complete
+	std::chrono::seconds reconnectTimeout = std::chrono::seconds(60);
+};
+
+struct MigrationReport {
+	std::chrono::microseconds prepare{0};   ///< snapshot and pre-creation, clients are not affected
+	size_t                    deltasReplicated = 0;
+	std::chrono::microseconds outage{0};    ///< source stopped until the target accepts connections on its final port
+	std::chrono::microseconds reconnect{0}; ///< source stopped until reconnectedFraction of the clients are back, end to end
+	uint64                    clientsBefore = 0;
+	uint64                    clientsReconnected = 0;
+	unsigned int              finalPort = 0;
+	bool                      complete = false; ///< reconnect measurement finished, by reaching the fraction or by timeout
+};
+
+/**
+ * @brief moves one server between shards with a short outage
+ *
+ * Call prepare(), then replicate() periodically while the copy catches up, then cutover() and pollReconnect() until it
+ * returns true. Both nodes have to support channel replication, for LocalShardNode the source process forwards the
+ * onChannel* callbacks. Drive it from one control thread. With a ShardCoordinator, take the staging port from
+ * reservePort() and call relocate() after the cutover.
+ *
+ * A LocalShardNode cannot host a server again once it stopped it, the server library takes IDs only once. As target it
+ * only works without rehostOnSourcePort, prepare() refuses that combination. As source it cannot be rolled back to: a
+ * cutover that fails after the source stopped ends in MIGRATION_SOURCE_LOST.
+*/
+class LiveMigration {
+public:
+	LiveMigration(ShardNode& source, ShardNode& target, uint64 serverID, const LiveMigrationOptions& options = LiveMigrationOptions())
+	    : m_source(source), m_target(target), m_serverID(serverID), m_options(options) {}
+
+	~LiveMigration() {
+		if (m_phase == MIGRATION_REPLICATING)
+			abort();
+	}
+
+	LiveMigration(const LiveMigration&) = delete;
+	LiveMigration& operator=(const LiveMigration&) = delete;
+
+	/** @brief pre-create the target from a snapshot of the source */
+	unsigned int prepare() {
+		if (m_phase != MIGRATION_IDLE)
+			return ERROR_ok_no_update;
+		const Clock::time_point started = Clock::now();
+		//recording starts before the snapshot so no change falls in between, replicate() drops what the snapshot already has
+		unsigned int error = m_source.startChannelReplication(m_serverID);
+		if (error != ERROR_ok)
+			return error;
+		VirtualServerSnapshot snapshot;
+		if ((error = m_source.exportVirtualServer(m_serverID, snapshot)) != ERROR_ok) {
+			m_source.stopChannelReplication(m_serverID);
+			return error;
+		}
+		m_sourcePort = snapshot.port;
+		if (rehost() && !m_target.canRehost()) {
+			m_source.stopChannelReplication(m_serverID);
+			return ERROR_parameter_invalid;
+		}
+		if (m_options.stagingPort != 0)
+			snapshot.port = m_options.stagingPort;
+		if ((error = m_target.hostVirtualServer(snapshot)) != ERROR_ok) {
+			m_source.stopChannelReplication(m_serverID);
+			return error;
+		}
+		for (const ChannelSnapshot& channel : snapshot.channels)
+			m_snapshotChannels.insert(channel.channelID);
+		m_firstBatch = true;
+		m_phase = MIGRATION_REPLICATING;
+		m_report.prepare = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started);
+		return ERROR_ok;
+	}
+
+	/** @brief copy the channel changes recorded since the last call to the target */
+	unsigned int replicate() {
+		if (m_phase != MIGRATION_REPLICATING)
+			return ERROR_ok_no_update;
+		std::vector<ChannelDelta> deltas;
+		unsigned int error = m_source.takeChannelDeltas(m_serverID, deltas);
+		if (error != ERROR_ok || deltas.empty())
+			return error;
+		if (m_firstBatch) {
+			settleAgainstSnapshot(deltas);
+			m_firstBatch = false;
+		}
+		if ((error = m_target.applyChannelDeltas(m_serverID, deltas)) != ERROR_ok)
+			return error;
+		m_report.deltasReplicated += deltas.size();
+		return ERROR_ok;
+	}
+
+	/**
+	 * @brief stop the source and make the target the serving copy
+	 *
+	 * The last snapshot of the source is taken after the final replication, right before the stop, so it holds
+	 * everything the target has. Server properties are synced from it before the source stops. If that or the stop
+	 * fails the migration stays in MIGRATION_REPLICATING and clients are not redirected. If the target cannot take over
+	 * on its final port the source is restarted from the snapshot and the copy removed.
+	*/
+	unsigned int cutover() {
+		if (m_phase != MIGRATION_REPLICATING)
+			return ERROR_ok_no_update;
+		unsigned int error = replicate();
+		if (error != ERROR_ok && error != ERROR_ok_no_update)
+			return error;
+		ShardLoad load;
+		if (m_source.measureLoad(m_serverID, load) == ERROR_ok)
+			m_report.clientsBefore = load.clientsOnline;
+		if ((error = replicate()) != ERROR_ok && error != ERROR_ok_no_update)
+			return error;
+		if ((error = m_source.exportVirtualServer(m_serverID, m_last)) != ERROR_ok)
+			return error;
+		//nothing is restarted if this fails, a rollback is not possible on every node
+		if ((error = m_target.applyServerVariables(m_serverID, m_last.variables)) != ERROR_ok)
+			return error;
+
+		const unsigned int finalPort = m_options.stagingPort == 0 || rehost() ? m_sourcePort : m_options.stagingPort;
+
+		m_cutoverAt = Clock::now();
+		if ((error = m_source.stopVirtualServer(m_serverID)) != ERROR_ok)
+			return error;
+		//deltas caused by the stop itself are not replicated
+		m_source.stopChannelReplication(m_serverID);
+		if (rehost())
+			error = moveTarget(finalPort);
+		if (error != ERROR_ok) {
+			m_target.stopVirtualServer(m_serverID);
+			m_phase = m_source.hostVirtualServer(m_last) == ERROR_ok ? MIGRATION_FAILED : MIGRATION_SOURCE_LOST;
+			return error;
+		}
+		if (finalPort != m_sourcePort && m_options.redirect)
+			m_options.redirect(m_serverID, finalPort);
+		m_report.outage = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - m_cutoverAt);
+		m_report.finalPort = finalPort;
+		m_phase = MIGRATION_CUT_OVER;
+		return ERROR_ok;
+	}
+
+	/** @brief measure returning clients on the target, true once the migration is complete */
+	bool pollReconnect() {
+		if (m_phase != MIGRATION_CUT_OVER || m_report.complete)
+			return m_phase != MIGRATION_REPLICATING;
+		ShardLoad load;
+		if (m_target.measureLoad(m_serverID, load) == ERROR_ok)
+			m_report.clientsReconnected = load.clientsOnline;
+		const Clock::duration elapsed = Clock::now() - m_cutoverAt;
+		if (m_report.clientsReconnected >= m_report.clientsBefore * m_options.reconnectedFraction || elapsed >= m_options.reconnectTimeout) {
+			m_report.reconnect = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
+			m_report.complete = true;
+		}
+		return m_report.complete;
+	}
+
+	/** @brief give up before the cutover, the source keeps serving */
+	void abort() {
+		if (m_phase != MIGRATION_REPLICATING)
+			return;
+		m_source.stopChannelReplication(m_serverID);
+		m_target.stopVirtualServer(m_serverID);
+		m_phase = MIGRATION_FAILED;
+	}
+
+	MigrationPhase         phase() const { return m_phase; }
+	const MigrationReport& report() const { return m_report; }
+
+	/** @brief state of the source when it was stopped, to host it elsewhere after MIGRATION_SOURCE_LOST */
+	const VirtualServerSnapshot& rollbackSnapshot() const { return m_last; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	/*the copy is staged on its own port and moves to the source's port after the cutover*/
+	bool rehost() const { return m_options.stagingPort != 0 && m_options.stagingPort != m_sourcePort && m_options.rehostOnSourcePort; }
+
+	/*changes recorded between starting the recorder and taking the snapshot are already part of the copy*/
+	void settleAgainstSnapshot(std::vector<ChannelDelta>& deltas) const {
+		std::vector<ChannelDelta> settled;
+		for (ChannelDelta& delta : deltas) {
+			const bool inSnapshot = m_snapshotChannels.count(delta.channel.channelID) != 0;
+			if (delta.type == CHANNEL_DELTA_CREATED && inSnapshot)
+				delta.type = CHANNEL_DELTA_EDITED;
+			else if (delta.type == CHANNEL_DELTA_DELETED && !inSnapshot)
+				continue;
+			settled.push_back(std::move(delta));
+		}
+		deltas.swap(settled);
+	}
+
+	/*restart the copy on its final port, it has no clients yet*/
+	unsigned int moveTarget(unsigned int port) {
+		VirtualServerSnapshot copy;
+		unsigned int error = m_target.exportVirtualServer(m_serverID, copy);
+		if (error != ERROR_ok)
+			return error;
+		if ((error = m_target.stopVirtualServer(m_serverID)) != ERROR_ok)
+			return error;
+		copy.port = port;
+		if ((error = m_target.hostVirtualServer(copy)) != ERROR_ok) {
+			copy.port = m_options.stagingPort;
+			m_target.hostVirtualServer(copy);
+		}
+		return error;
+	}
+
+	ShardNode&                 m_source;
+	ShardNode&                 m_target;
+	const uint64               m_serverID;
+	const LiveMigrationOptions m_options;
+	MigrationPhase             m_phase = MIGRATION_IDLE;
+	MigrationReport            m_report;
+	unsigned int               m_sourcePort = 0;
+	std::unordered_set<uint64> m_snapshotChannels;
+	bool                       m_firstBatch = false;
+	Clock::time_point          m_cutoverAt;
+	VirtualServerSnapshot      m_last; ///< taken right before the source stops
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_LIVE_MIGRATION_H
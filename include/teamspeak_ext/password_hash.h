@@ -0,0 +1,222 @@
+/*
+ * Replacement password encryption for the onClientPasswordEncrypt callback of the client and the server library.
+ * Passwords are stretched with PBKDF2 over a pluggable pseudo random function (HMAC-SHA-256 or keyed BLAKE3) with a
+ * tunable iteration count, and the result is written straight into the buffer provided by the library without any
+ * heap allocation. Includes a throughput measurement to pick iteration counts that keep channel joins fast.
+ */
+
+#ifndef TEAMSPEAK_EXT_PASSWORD_HASH_H
+#define TEAMSPEAK_EXT_PASSWORD_HASH_H
+
+//system
+#include <chrono>
+#include <cstring>
+#include <string>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak_ext/blake3.h"
+#include "teamspeak_ext/sha256.h"
+
+namespace ts3ext {
+
+enum PasswordHashAlgorithm {
+	PASSWORD_HASH_SHA256 = 0, ///< PBKDF2-HMAC-SHA-256
+	PASSWORD_HASH_BLAKE3,     ///< PBKDF2 with keyed BLAKE3 as pseudo random function
+};
+
+/**
+ * @brief must be identical on every client and server of a deployment, the encrypted texts are compared as strings
+*/
+struct PasswordHashSettings {
+	PasswordHashAlgorithm algorithm = PASSWORD_HASH_SHA256;
+	unsigned int          iterations = 20000;
+	std::string           salt = "ts3ext"; ///< deployment wide, the output has to be deterministic
+};
+
+class PasswordHasher {
+public:
+	static const size_t KEY_SIZE = 32;
+
+	explicit PasswordHasher(const PasswordHashSettings& settings = PasswordHashSettings()) : m_settings(settings) {
+		if (m_settings.iterations == 0)
+			m_settings.iterations = 1;
+		static const char firstBlock[4] = {0, 0, 0, 1};
+		m_saltBlock = m_settings.salt;
+		m_saltBlock.append(firstBlock, sizeof(firstBlock));
+	}
+
+	const PasswordHashSettings& settings() const { return m_settings; }
+
+	/** @brief PBKDF2 with a single output block of KEY_SIZE bytes */
+	void derive(const char* password, size_t passwordLength, unsigned char* key) const {
+		if (m_settings.algorithm == PASSWORD_HASH_BLAKE3)
+			pbkdf2(Blake3Prf(password, passwordLength), key);
+		else
+			pbkdf2(HmacSha256Prf(password, passwordLength), key);
+	}
+
+	/**
+	 * @brief for ClientUIFunctions::onClientPasswordEncrypt and ServerLibFunctions::onClientPasswordEncrypt
+	 *
+	 * Writes "$<algorithm>$<iterations>$<base64 key>". An empty password stays empty, so channels without a password
+	 * keep working. If the buffer is too small the output is truncated, which is still deterministic.
+	*/
+	void onClientPasswordEncrypt(uint64 /*serverConnectionHandlerIDOrServerID*/, const char* plaintext, char* encryptedText, int encryptedTextByteSize) const {
+		if (encryptedTextByteSize <= 0)
+			return;
+		const size_t capacity = static_cast<size_t>(encryptedTextByteSize) - 1;
+		if (plaintext == nullptr || *plaintext == '\0') {
+			encryptedText[0] = '\0';
+			return;
+		}
+		unsigned char key[KEY_SIZE];
+		derive(plaintext, std::strlen(plaintext), key);
+
+		char prefix[32];
+		size_t prefixLength = 0;
+		const char* name = m_settings.algorithm == PASSWORD_HASH_BLAKE3 ? "$b3$" : "$s256$";
+		while (*name != '\0')
+			prefix[prefixLength++] = *name++;
+		prefixLength += formatUnsigned(m_settings.iterations, prefix + prefixLength);
+		prefix[prefixLength++] = '$';
+
+		size_t written = prefixLength < capacity ? prefixLength : capacity;
+		std::memcpy(encryptedText, prefix, written);
+		written += encodeBase64(key, KEY_SIZE, encryptedText + written, capacity - written);
+		encryptedText[written] = '\0';
+	}
+
+	/**
+	 * @brief measure derivations per second of the given settings on the calling thread
+	 *
+	 * @param measureFor minimum measuring time, at least one derivation is always done
+	*/
+	static double hashesPerSecond(const PasswordHashSettings& settings, std::chrono::milliseconds measureFor = std::chrono::milliseconds(200)) {
+		const PasswordHasher hasher(settings);
+		unsigned char key[KEY_SIZE];
+		const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		unsigned long long count = 0;
+		std::chrono::steady_clock::duration elapsed;
+		do {
+			hasher.derive("benchmark password", 18, key);
+			++count;
+			elapsed = std::chrono::steady_clock::now() - started;
+		} while (elapsed < measureFor);
+		return count / std::chrono::duration<double>(elapsed).count();
+	}
+
+	/** @brief largest iteration count whose derivation stays below targetLatency on this machine */
+	static unsigned int calibrate(PasswordHashAlgorithm algorithm, std::chrono::microseconds targetLatency) {
+		PasswordHashSettings settings;
+		settings.algorithm = algorithm;
+		settings.iterations = 1000;
+		const double seconds = 1.0 / hashesPerSecond(settings);
+		const double iterations = settings.iterations * std::chrono::duration<double>(targetLatency).count() / seconds;
+		return iterations < 1 ? 1u : iterations > 4e9 ? 4000000000u : static_cast<unsigned int>(iterations);
+	}
+
+private:
+	/*HMAC with the padded key absorbed once, every call only copies the two prepared states*/
+	class HmacSha256Prf {
+	public:
+		HmacSha256Prf(const char* password, size_t length) {
+			unsigned char block[Sha256::BLOCK_SIZE] = {0};
+			if (length > Sha256::BLOCK_SIZE) {
+				Sha256 keyHash;
+				keyHash.update(password, length);
+				keyHash.finish(block);
+			} else {
+				std::memcpy(block, password, length);
+			}
+			unsigned char pad[Sha256::BLOCK_SIZE];
+			for (size_t i = 0; i < Sha256::BLOCK_SIZE; ++i)
+				pad[i] = block[i] ^ 0x36;
+			m_inner.update(pad, sizeof(pad));
+			for (size_t i = 0; i < Sha256::BLOCK_SIZE; ++i)
+				pad[i] = block[i] ^ 0x5c;
+			m_outer.update(pad, sizeof(pad));
+		}
+
+		void operator()(const void* data, size_t size, unsigned char* out) const {
+			Sha256 inner = m_inner;
+			inner.update(data, size);
+			unsigned char innerDigest[Sha256::DIGEST_SIZE];
+			inner.finish(innerDigest);
+			Sha256 outer = m_outer;
+			outer.update(innerDigest, sizeof(innerDigest));
+			outer.finish(out);
+		}
+
+	private:
+		Sha256 m_inner;
+		Sha256 m_outer;
+	};
+
+	/*keyed BLAKE3 with the BLAKE3 digest of the password as key*/
+	class Blake3Prf {
+	public:
+		Blake3Prf(const char* password, size_t length) {
+			Blake3 keyHash;
+			keyHash.update(password, length);
+			keyHash.finish(m_key);
+		}
+
+		void operator()(const void* data, size_t size, unsigned char* out) const {
+			Blake3 hash(m_key);
+			hash.update(data, size);
+			hash.finish(out);
+		}
+
+	private:
+		unsigned char m_key[Blake3::KEY_SIZE];
+	};
+
+	template <typename Prf>
+	void pbkdf2(const Prf& prf, unsigned char* key) const {
+		unsigned char u[KEY_SIZE];
+		prf(m_saltBlock.data(), m_saltBlock.size(), u);
+		std::memcpy(key, u, KEY_SIZE);
+		for (unsigned int i = 1; i < m_settings.iterations; ++i) {
+			prf(u, KEY_SIZE, u);
+			for (size_t j = 0; j < KEY_SIZE; ++j)
+				key[j] ^= u[j];
+		}
+	}
+
+	static size_t formatUnsigned(unsigned int value, char* out) {
+		char digits[10];
+		size_t count = 0;
+		do {
+			digits[count++] = static_cast<char>('0' + value % 10);
+			value /= 10;
+		} while (value != 0);
+		for (size_t i = 0; i < count; ++i)
+			out[i] = digits[count - 1 - i];
+		return count;
+	}
+
+	/*@return characters written, stops early when capacity is reached*/
+	static size_t encodeBase64(const unsigned char* data, size_t size, char* out, size_t capacity) {
+		static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		size_t written = 0;
+		for (size_t i = 0; i < size; i += 3) {
+			const unsigned int triple = data[i] << 16 | (i + 1 < size ? data[i + 1] << 8 : 0) | (i + 2 < size ? data[i + 2] : 0);
+			const char quad[4] = {alphabet[triple >> 18 & 63], alphabet[triple >> 12 & 63], i + 1 < size ? alphabet[triple >> 6 & 63] : '=',
+			                      i + 2 < size ? alphabet[triple & 63] : '='};
+			for (int j = 0; j < 4; ++j) {
+				if (written == capacity)
+					return written;
+				out[written++] = quad[j];
+			}
+		}
+		return written;
+	}
+
+	PasswordHashSettings m_settings;
+	std::string          m_saltBlock; ///< salt followed by the big endian block index 1, built once so a salt of any length is used whole
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_PASSWORD_HASH_H
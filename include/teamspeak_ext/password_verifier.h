@@ -0,0 +1,335 @@
+/*
+ * Password verification for onCustomServerPasswordCheck and onCustomChannelPasswordCheck against slow external
+ * credential stores. Checks run on a dedicated worker pool, identical checks that arrive at the same time share one
+ * verification, and results are cached for a short time keyed by a digest of (server, channel, identity, password),
+ * so reconnect storms are answered from the cache instead of queueing behind memory hard hashes. The SDK callbacks
+ * return their verdict, so a cache miss still holds the calling server thread until a worker answers.
+ */
+
+#ifndef TEAMSPEAK_EXT_PASSWORD_VERIFIER_H
+#define TEAMSPEAK_EXT_PASSWORD_VERIFIER_H
+
+//system
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+#include "teamspeak_ext/sha256.h"
+
+namespace ts3ext {
+
+struct CredentialCheck {
+	uint64      serverID = 0;
+	uint64      channelID = 0; ///< 0 for the server password
+	anyID       clientID = 0;  ///< 0 for prefetched checks
+	std::string ident;
+	std::string nickname;
+	std::string password;
+};
+
+struct PasswordVerifierOptions {
+	unsigned int              threads = 4;
+	size_t                    cacheCapacity = 65536;
+	std::chrono::milliseconds positiveTtl = std::chrono::seconds(60);
+	std::chrono::milliseconds negativeTtl = std::chrono::seconds(2);    ///< also slows down guessing
+	std::chrono::milliseconds reconnectTtl = std::chrono::minutes(5);   ///< positive entries of disconnected clients live this long
+	std::chrono::milliseconds callbackTimeout = std::chrono::seconds(10); ///< the check fails if the verifier takes longer
+	std::chrono::milliseconds connectTimeout = std::chrono::seconds(60);  ///< keys of a checked client that never shows up in onClientConnected are dropped after this
+};
+
+struct PasswordVerifierStats {
+	uint64 cacheHits = 0;
+	uint64 verified = 0;  ///< calls of the verify function
+	uint64 coalesced = 0; ///< checks that waited for an identical verification already running
+	uint64 timeouts = 0;
+};
+
+/**
+ * @brief cached, pooled password verification
+ *
+ * Assign the on*PasswordCheck methods from the ServerLibFunctions callbacks and forward onClientConnected and
+ * onClientDisconnected. The checks are synchronous: a cache hit returns at once, a miss blocks the calling server thread
+ * until a worker has verified the credentials or callbackTimeout passed. The pool bounds the concurrent calls into the
+ * credential store and lets identical checks share one verification, it does not free the caller.
+*/
+class PasswordVerifier {
+public:
+	/** @brief slow check against the credential store, returns ERROR_ok or ERROR_server_invalid_password. Called on a worker thread. */
+	typedef std::function<unsigned int(const CredentialCheck& check)> Verify;
+
+	explicit PasswordVerifier(Verify verify, const PasswordVerifierOptions& options = PasswordVerifierOptions())
+	    : m_verify(std::move(verify)), m_options(options) {
+		std::random_device random;
+		for (int i = 0; i < 4; ++i)
+			m_secret += std::to_string(random());
+		for (unsigned int i = 0; i < std::max(m_options.threads, 1u); ++i)
+			m_workers.emplace_back([this] { workLoop(); });
+	}
+
+	~PasswordVerifier() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_work.notify_all();
+		m_done.notify_all();
+		for (std::thread& worker : m_workers)
+			worker.join();
+	}
+
+	PasswordVerifier(const PasswordVerifier&) = delete;
+	PasswordVerifier& operator=(const PasswordVerifier&) = delete;
+
+	unsigned int onCustomServerPasswordCheck(uint64 serverID, const struct ClientMiniExport* client, const char* password) {
+		return check(serverID, 0, client, password);
+	}
+
+	unsigned int onCustomChannelPasswordCheck(uint64 serverID, const struct ClientMiniExport* client, uint64 channelID, const char* password) {
+		return check(serverID, channelID, client, password);
+	}
+
+	/**
+	 * @brief verify credentials of an identity expected to connect soon, e.g. known bots or a reconnect wave
+	 *
+	 * Returns immediately, the result lands in the cache.
+	*/
+	void prefetch(uint64 serverID, uint64 channelID, const std::string& ident, const std::string& password) {
+		CredentialCheck check;
+		check.serverID = serverID;
+		check.channelID = channelID;
+		check.ident = ident;
+		check.password = password;
+		const std::string key = cacheKey(check);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (lookup(key, Clock::now()) != nullptr || m_pending.count(key) != 0)
+			return;
+		m_pending[key] = std::make_shared<Pending>();
+		m_queue.push_back(Task{key, std::move(check)});
+		m_work.notify_one();
+	}
+
+	/** @brief the client passed its checks and is connected, its keys are kept until it disconnects */
+	void onClientConnected(uint64 serverID, anyID clientID, uint64 /*channelID*/, unsigned int* /*removeClientError*/) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto keys = m_keysByClient.find(clientKey(serverID, clientID));
+		if (keys != m_keysByClient.end())
+			keys->second.connected = true;
+	}
+
+	/** @brief keeps the positive results of a leaving client for reconnectTtl, so its reconnect is a cache hit */
+	void onClientDisconnected(uint64 serverID, anyID clientID, uint64 /*channelID*/) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto keys = m_keysByClient.find(clientKey(serverID, clientID));
+		if (keys == m_keysByClient.end())
+			return;
+		const Clock::time_point expires = Clock::now() + m_options.reconnectTtl;
+		for (const std::string& key : keys->second.keys) {
+			const auto it = m_cache.find(key);
+			if (it != m_cache.end() && it->second.error == ERROR_ok && it->second.expires < expires)
+				it->second.expires = expires;
+		}
+		m_keysByClient.erase(keys);
+	}
+
+	/** @brief drop all cached results, e.g. after passwords were changed */
+	void invalidate() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cache.clear();
+		m_keysByClient.clear();
+		++m_epoch;
+	}
+
+	PasswordVerifierStats stats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Entry {
+		unsigned int      error;
+		Clock::time_point expires;
+	};
+
+	struct Pending {
+		bool         done = false;
+		unsigned int error = ERROR_server_invalid_password;
+	};
+
+	struct Task {
+		std::string     key;
+		CredentialCheck check;
+	};
+
+	struct ClientKeys {
+		std::unordered_set<std::string> keys;
+		Clock::time_point               checked;           ///< last positive check, for connects that never complete
+		bool                            connected = false; ///< seen in onClientConnected
+	};
+
+	static uint64 clientKey(uint64 serverID, anyID clientID) { return serverID << 16 | clientID; }
+
+	/*keyed with a per process secret, so the cache does not hold digests that can be attacked offline*/
+	std::string cacheKey(const CredentialCheck& check) const {
+		Sha256 hash;
+		hash.update(m_secret);
+		const uint64 ids[2] = {check.serverID, check.channelID};
+		hash.update(ids, sizeof(ids));
+		hash.update(check.ident.c_str(), check.ident.size() + 1);
+		hash.update(check.password);
+		unsigned char digest[Sha256::DIGEST_SIZE];
+		hash.finish(digest);
+		return std::string(reinterpret_cast<const char*>(digest), sizeof(digest));
+	}
+
+	/*called with the lock held*/
+	const Entry* lookup(const std::string& key, Clock::time_point now) {
+		const auto it = m_cache.find(key);
+		if (it == m_cache.end())
+			return nullptr;
+		if (it->second.expires <= now) {
+			m_cache.erase(it);
+			return nullptr;
+		}
+		return &it->second;
+	}
+
+	unsigned int check(uint64 serverID, uint64 channelID, const struct ClientMiniExport* client, const char* password) {
+		CredentialCheck check;
+		check.serverID = serverID;
+		check.channelID = channelID;
+		check.clientID = client->ID;
+		check.ident = client->ident != nullptr ? client->ident : "";
+		check.nickname = client->nickname != nullptr ? client->nickname : "";
+		check.password = password != nullptr ? password : "";
+		const std::string key = cacheKey(check);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		const Clock::time_point now = Clock::now();
+		dropAbandonedClients(now);
+		if (const Entry* entry = lookup(key, now)) {
+			++m_stats.cacheHits;
+			if (entry->error == ERROR_ok)
+				rememberKey(serverID, check.clientID, key);
+			return entry->error;
+		}
+		std::shared_ptr<Pending> pending;
+		const auto running = m_pending.find(key);
+		if (running != m_pending.end()) {
+			pending = running->second;
+			++m_stats.coalesced;
+		} else {
+			pending = std::make_shared<Pending>();
+			m_pending[key] = pending;
+			//connecting clients go before prefetches
+			m_queue.push_front(Task{key, std::move(check)});
+			m_work.notify_one();
+		}
+		if (!m_done.wait_for(lock, m_options.callbackTimeout, [&] { return pending->done || m_stopping; })) {
+			++m_stats.timeouts;
+			return ERROR_server_invalid_password;
+		}
+		if (!pending->done)
+			return ERROR_server_invalid_password;
+		if (pending->error == ERROR_ok)
+			rememberKey(serverID, client->ID, key);
+		return pending->error;
+	}
+
+	/*called with the lock held*/
+	void rememberKey(uint64 serverID, anyID clientID, const std::string& key) {
+		ClientKeys& client = m_keysByClient[clientKey(serverID, clientID)];
+		client.keys.insert(key);
+		client.checked = Clock::now();
+	}
+
+	/*called with the lock held: clients that passed a check but were refused or gave up before onClientConnected get no
+	  onClientDisconnected, their ids are reused by later clients*/
+	void dropAbandonedClients(Clock::time_point now) {
+		if (now < m_nextAbandonedSweep)
+			return;
+		m_nextAbandonedSweep = now + m_options.connectTimeout;
+		for (auto it = m_keysByClient.begin(); it != m_keysByClient.end();) {
+			if (!it->second.connected && now - it->second.checked >= m_options.connectTimeout)
+				it = m_keysByClient.erase(it);
+			else
+				++it;
+		}
+	}
+
+	void workLoop() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;) {
+			m_work.wait(lock, [&] { return m_stopping || !m_queue.empty(); });
+			if (m_stopping)
+				return;
+			Task task = std::move(m_queue.front());
+			m_queue.pop_front();
+			const uint64 epoch = m_epoch;
+			++m_stats.verified;
+			lock.unlock();
+			const unsigned int error = m_verify(task.check);
+			lock.lock();
+			const Clock::time_point now = Clock::now();
+			if (epoch == m_epoch) {
+				if (m_cache.size() >= m_options.cacheCapacity)
+					evict(now);
+				m_cache[task.key] = Entry{error, now + (error == ERROR_ok ? m_options.positiveTtl : m_options.negativeTtl)};
+			}
+			const auto pending = m_pending.find(task.key);
+			if (pending != m_pending.end()) {
+				pending->second->done = true;
+				pending->second->error = error;
+				m_pending.erase(pending);
+			}
+			m_done.notify_all();
+		}
+	}
+
+	/*called with the lock held: expired entries first, then arbitrary ones until a quarter is free*/
+	void evict(Clock::time_point now) {
+		for (auto it = m_cache.begin(); it != m_cache.end();) {
+			if (it->second.expires <= now)
+				it = m_cache.erase(it);
+			else
+				++it;
+		}
+		while (!m_cache.empty() && m_cache.size() * 4 > m_options.cacheCapacity * 3)
+			m_cache.erase(m_cache.begin());
+	}
+
+	const Verify                                              m_verify;
+	const PasswordVerifierOptions                             m_options;
+	std::string                                               m_secret;
+	mutable std::mutex                                        m_mutex;
+	std::condition_variable                                   m_work;
+	std::condition_variable                                   m_done;
+	std::deque<Task>                                          m_queue;
+	std::unordered_map<std::string, std::shared_ptr<Pending>> m_pending; ///< verifications queued or running, by cache key
+	std::unordered_map<std::string, Entry>                    m_cache;
+	std::unordered_map<uint64, ClientKeys>                    m_keysByClient; ///< positive keys used by connecting and connected clients
+	Clock::time_point                                         m_nextAbandonedSweep;
+	PasswordVerifierStats                                     m_stats;
+	uint64                                                    m_epoch = 0; ///< bumped by invalidate(), drops results of checks started before
+	bool                                                      m_stopping = false;
+	std::vector<std::thread>                                  m_workers;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_PASSWORD_VERIFIER_H
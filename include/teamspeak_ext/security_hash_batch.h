@@ -0,0 +1,213 @@
+/*
+ * Batch computation of CLIENT_SECURITY_HASH values. After a CHANNEL_SECURITY_SALT rotation every authorized
+ * (unique identifier, nickname, meta data) tuple needs a new ts3server_calculateSecurityHash result. This header
+ * spreads a batch over all cores and caches the results per (salt, tuple), so recomputing a batch after a partial
+ * change only hashes the tuples that changed.
+ */
+
+#ifndef TEAMSPEAK_EXT_SECURITY_HASH_BATCH_H
+#define TEAMSPEAK_EXT_SECURITY_HASH_BATCH_H
+
+//system
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//own
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+
+namespace ts3ext {
+
+struct SecurityHashInput {
+	std::string uniqueIdentifier;
+	std::string nickName;  ///< only part of the hash if the salt was created with SECURITY_SALT_CHECK_NICKNAME
+	std::string metaData;  ///< only part of the hash if the salt was created with SECURITY_SALT_CHECK_META_DATA
+};
+
+struct SecurityHashOutput {
+	unsigned int error = ERROR_ok;
+	std::string  securityHash; ///< value for CLIENT_SECURITY_HASH, empty on error
+};
+
+struct SecurityHashStats {
+	size_t                   computed = 0;   ///< ts3server_calculateSecurityHash calls
+	size_t                   cacheHits = 0;
+	size_t                   failed = 0;
+	std::chrono::nanoseconds duration = std::chrono::nanoseconds::zero();
+
+	/** @brief throughput of the batch in tuples per second, cache hits included */
+	double perSecond() const {
+		const double seconds = std::chrono::duration<double>(duration).count();
+		return seconds > 0 ? (computed + cacheHits) / seconds : 0;
+	}
+};
+
+struct SecurityHashOptions {
+	unsigned int threads = 0;              ///< worker threads per batch, 0 for one per core
+	size_t       cacheCapacity = 1 << 20;  ///< cached results over all salts, oldest are evicted first
+	size_t       chunkSize = 256;          ///< tuples a worker claims at once
+};
+
+/**
+ * @brief computes security hashes for many tuples in parallel
+*/
+class SecurityHashBatch {
+public:
+	/** @brief called for every tuple of a batch as soon as its hash is known, from a worker thread */
+	typedef std::function<void(size_t index, const SecurityHashInput& input, const SecurityHashOutput& output)> Emit;
+
+	explicit SecurityHashBatch(const SecurityHashOptions& options = SecurityHashOptions()) : m_options(options) {}
+
+	SecurityHashBatch(const SecurityHashBatch&) = delete;
+	SecurityHashBatch& operator=(const SecurityHashBatch&) = delete;
+
+	/**
+	 * @brief hash every input with the given salt
+	 *
+	 * @param outputs resized to inputs.size(), outputs[i] belongs to inputs[i]
+	 * @param emit optional, see Emit
+	 * @return statistics of this batch
+	*/
+	SecurityHashStats compute(const std::string& securitySalt, const std::vector<SecurityHashInput>& inputs, std::vector<SecurityHashOutput>& outputs,
+	                          const Emit& emit = Emit()) {
+		const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		outputs.assign(inputs.size(), SecurityHashOutput());
+		std::atomic<size_t> cursor(0);
+		std::atomic<size_t> computed(0), cacheHits(0), failed(0);
+		auto work = [&] {
+			const size_t chunk = std::max<size_t>(m_options.chunkSize, 1);
+			for (size_t begin = cursor.fetch_add(chunk); begin < inputs.size(); begin = cursor.fetch_add(chunk)) {
+				const size_t end = std::min(begin + chunk, inputs.size());
+				for (size_t i = begin; i < end; ++i) {
+					const std::string key = cacheKey(securitySalt, inputs[i]);
+					SecurityHashOutput& output = outputs[i];
+					if (lookup(key, output.securityHash)) {
+						++cacheHits;
+					} else {
+						output.error = calculate(securitySalt, inputs[i], output.securityHash);
+						++computed;
+						if (output.error == ERROR_ok)
+							insert(key, output.securityHash);
+						else
+							++failed;
+					}
+					if (emit)
+						emit(i, inputs[i], output);
+				}
+			}
+		};
+
+		unsigned int threads = m_options.threads != 0 ? m_options.threads : std::thread::hardware_concurrency();
+		threads = std::max(1u, std::min<unsigned int>(threads, static_cast<unsigned int>(inputs.size() / std::max<size_t>(m_options.chunkSize, 1) + 1)));
+		std::vector<std::thread> workers;
+		for (unsigned int i = 1; i < threads; ++i)
+			workers.emplace_back(work);
+		work();
+		for (std::thread& worker : workers)
+			worker.join();
+
+		SecurityHashStats stats;
+		stats.computed = computed;
+		stats.cacheHits = cacheHits;
+		stats.failed = failed;
+		stats.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started);
+		return stats;
+	}
+
+	/** @brief drop every cached result of a salt that is no longer in use */
+	void forgetSalt(const std::string& securitySalt) {
+		const std::string prefix = securitySalt + '\0';
+		const auto salted = [&](const std::string& key) { return key.compare(0, prefix.size(), prefix) == 0; };
+		for (Shard& shard : m_shards) {
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			for (auto it = shard.hashes.begin(); it != shard.hashes.end();) {
+				if (salted(it->first))
+					it = shard.hashes.erase(it);
+				else
+					++it;
+			}
+			//a stale key left in the eviction order would evict the value if the salt is used again
+			shard.insertionOrder.erase(std::remove_if(shard.insertionOrder.begin(), shard.insertionOrder.end(), salted), shard.insertionOrder.end());
+		}
+	}
+
+	size_t cachedCount() const {
+		size_t count = 0;
+		for (const Shard& shard : m_shards) {
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			count += shard.hashes.size();
+		}
+		return count;
+	}
+
+private:
+	static const size_t SHARD_COUNT = 64;
+
+	struct Shard {
+		mutable std::mutex                           mutex;
+		std::unordered_map<std::string, std::string> hashes;
+		std::deque<std::string>                      insertionOrder; ///< FIFO eviction, holds exactly the keys of hashes
+	};
+
+	static unsigned int calculate(const std::string& securitySalt, const SecurityHashInput& input, std::string& securityHash) {
+		char* hash = nullptr;
+		const unsigned int error = ts3server_calculateSecurityHash(securitySalt.c_str(), input.uniqueIdentifier.c_str(), input.nickName.c_str(),
+		                                                           input.metaData.c_str(), &hash);
+		if (error != ERROR_ok)
+			return error;
+		securityHash = hash;
+		ts3server_freeMemory(hash);
+		return ERROR_ok;
+	}
+
+	/*fields cannot contain a nul character, so joining with it is unambiguous*/
+	static std::string cacheKey(const std::string& securitySalt, const SecurityHashInput& input) {
+		std::string key;
+		key.reserve(securitySalt.size() + input.uniqueIdentifier.size() + input.nickName.size() + input.metaData.size() + 3);
+		key.append(securitySalt).push_back('\0');
+		key.append(input.uniqueIdentifier).push_back('\0');
+		key.append(input.nickName).push_back('\0');
+		key.append(input.metaData);
+		return key;
+	}
+
+	Shard& shardFor(const std::string& key) { return m_shards[std::hash<std::string>()(key) % SHARD_COUNT]; }
+
+	bool lookup(const std::string& key, std::string& securityHash) {
+		Shard& shard = shardFor(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		const auto it = shard.hashes.find(key);
+		if (it == shard.hashes.end())
+			return false;
+		securityHash = it->second;
+		return true;
+	}
+
+	void insert(const std::string& key, const std::string& securityHash) {
+		Shard& shard = shardFor(key);
+		const size_t capacity = std::max<size_t>(m_options.cacheCapacity / SHARD_COUNT, 1);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		if (!shard.hashes.emplace(key, securityHash).second)
+			return;
+		shard.insertionOrder.push_back(key);
+		while (shard.hashes.size() > capacity) {
+			shard.hashes.erase(shard.insertionOrder.front());
+			shard.insertionOrder.pop_front();
+		}
+	}
+
+	const SecurityHashOptions m_options;
+	Shard                     m_shards[SHARD_COUNT];
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_SECURITY_HASH_BATCH_H
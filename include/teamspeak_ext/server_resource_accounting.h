@@ -0,0 +1,501 @@
+/*
+ * Per virtual server resource accounting for instances hosting many tenants. Callback CPU time, event counts and file
+ * transfer bytes are accounted per serverID against token bucket quotas. A server over its budget gets its sheddable
+ * permission checks denied and its deferred work queued until the budget refills, so one server's callback storm does
+ * not slow down all the others. ts3server_disableClientCommand acts on the whole instance and cannot be undone, so it is
+ * only used as an opt-in emergency brake when the instance itself stays overloaded.
+ */
+
+#ifndef TEAMSPEAK_EXT_SERVER_RESOURCE_ACCOUNTING_H
+#define TEAMSPEAK_EXT_SERVER_RESOURCE_ACCOUNTING_H
+
+//system
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+#include "teamspeak_ext/flat_hash_map.h"
+
+namespace ts3ext {
+
+/**
+ * @brief budget of one virtual server. A limit of 0 means unlimited.
+*/
+struct TenantQuota {
+	double cpuShare = 0.25;            ///< callback CPU seconds per second
+	double eventsPerSecond = 20000;
+	double transferBytesPerSecond = 0;
+	double burstSeconds = 2;           ///< bucket depth, how long a server may run at full speed from an idle start
+};
+
+struct ResourceAccountingOptions {
+	TenantQuota               defaultQuota;
+	size_t                    maxQueuedPerTenant = 1024; ///< deferred work beyond this is shed
+	std::chrono::milliseconds maxPumpTime = std::chrono::milliseconds(20); ///< per pump() call
+	double                    instanceCpuShare = 0;      ///< callback CPU budget of the whole instance, 0 disables the emergency brake
+	std::chrono::seconds      emergencyAfter = std::chrono::seconds(30);
+	std::vector<int>          emergencyCommands;         ///< ClientCommand values disabled for the rest of the process lifetime
+	std::chrono::minutes      transferMatchTimeout = std::chrono::hours(6); ///< admitted transfers without a completion event are forgotten after this
+};
+
+struct TenantReport {
+	uint64       serverID = 0;
+	uint64       cpuNanoseconds = 0;  ///< totals since the server was first seen
+	uint64       events = 0;
+	uint64       transferBytes = 0;
+	double       cpuShare = 0;        ///< decaying averages over about ten seconds
+	double       eventsPerSecond = 0;
+	double       transferBytesPerSecond = 0;
+	uint64       denied = 0;          ///< permission checks denied while over budget
+	uint64       deferred = 0;        ///< work queued while over budget
+	uint64       shed = 0;            ///< work dropped because the queue was full
+	size_t       queued = 0;          ///< work waiting right now
+	unsigned int throttled = 0;       ///< how often the server went over budget
+	bool         overBudget = false;
+};
+
+/**
+ * @brief accounts callback costs per virtual server and isolates servers that exceed their quota
+ *
+ * Wrap callback bodies in measure(), forward onVoiceDataEvent and onFileTransferEvent, and let permission callbacks
+ * that may be refused under load start with admit(). Call pump() periodically, e.g. every 50ms, to run deferred work.
+*/
+class ServerResourceAccounting {
+public:
+	/** @brief nanoseconds of a monotonic clock */
+	typedef int64_t (*Clock)();
+
+	/** @brief charges the CPU time of the calling thread between construction and destruction plus one event */
+	class CallbackTimer {
+	public:
+		CallbackTimer(CallbackTimer&& other) : m_owner(other.m_owner), m_serverID(other.m_serverID), m_startNs(other.m_startNs) {
+			other.m_owner = nullptr;
+		}
+
+		~CallbackTimer() {
+			if (m_owner != nullptr)
+				m_owner->charge(m_serverID, threadCpuNs() - m_startNs, 1, 0);
+		}
+
+		CallbackTimer(const CallbackTimer&) = delete;
+		CallbackTimer& operator=(const CallbackTimer&) = delete;
+
+	private:
+		friend class ServerResourceAccounting;
+
+		CallbackTimer(ServerResourceAccounting* owner, uint64 serverID) : m_owner(owner), m_serverID(serverID), m_startNs(threadCpuNs()) {}
+
+		ServerResourceAccounting* m_owner;
+		uint64                    m_serverID;
+		int64_t                   m_startNs;
+	};
+
+	explicit ServerResourceAccounting(const ResourceAccountingOptions& options = ResourceAccountingOptions(), Clock clock = &steadyNs)
+	    : m_options(options), m_clock(clock) {}
+
+	ServerResourceAccounting(const ServerResourceAccounting&) = delete;
+	ServerResourceAccounting& operator=(const ServerResourceAccounting&) = delete;
+
+	/** @brief usage: auto timer = accounting.measure(serverID); at the top of a callback */
+	CallbackTimer measure(uint64 serverID) { return CallbackTimer(this, serverID); }
+
+	/** @brief feed costs measured elsewhere */
+	void charge(uint64 serverID, int64_t cpuNanoseconds, uint64 events, uint64 transferBytes) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const int64_t now = m_clock();
+		Tenant& tenant = tenantFor(serverID, now);
+		advance(tenant, now);
+		if (cpuNanoseconds > 0)
+			tenant.cpu.charge(static_cast<double>(cpuNanoseconds));
+		tenant.events.charge(static_cast<double>(events));
+		tenant.transfer.charge(static_cast<double>(transferBytes));
+		updateState(tenant);
+		if (cpuNanoseconds > 0) {
+			m_instanceCpu.advance(now, 0, 0);
+			m_instanceCpu.charge(static_cast<double>(cpuNanoseconds));
+		}
+	}
+
+	/** @brief override the default quota of one server */
+	void setQuota(uint64 serverID, const TenantQuota& quota) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const int64_t now = m_clock();
+		Tenant& tenant = tenantFor(serverID, now);
+		advance(tenant, now);
+		tenant.quota = quota;
+		tenant.cpu.clamp(quota.cpuShare * 1e9 * quota.burstSeconds);
+		tenant.events.clamp(quota.eventsPerSecond * quota.burstSeconds);
+		tenant.transfer.clamp(quota.transferBytesPerSecond * quota.burstSeconds);
+		updateState(tenant);
+	}
+
+	/** @brief drop the accounting and the queued work of a server, e.g. after ts3server_stopVirtualServer */
+	void forgetServer(uint64 serverID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tenants.erase(serverID);
+		dropTransfers([&](const AdmittedTransfer& transfer) { return transfer.serverID == serverID; });
+	}
+
+	/**
+	 * @brief permission gate for work that may be refused under load
+	 *
+	 * Counts one event and returns ERROR_ok, or ERROR_permissions_client_insufficient while the server is over budget.
+	 * Start sheddable perm* callbacks (channel creation and edits, descriptions, connection info, ...) with
+	 * if (unsigned int error = accounting.admit(serverID)) return error;
+	*/
+	unsigned int admit(uint64 serverID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return admitLocked(serverID);
+	}
+
+	unsigned int permFileTransferInitUpload(uint64 serverID, const struct ClientMiniExport* client, const struct ts3sc_ftinitupload* params) {
+		return admitTransfer(serverID, client->ID, true, params != nullptr ? params->d.fileSize : 0);
+	}
+
+	unsigned int permFileTransferInitDownload(uint64 serverID, const struct ClientMiniExport* client, const struct ts3sc_ftinitdownload* /*params*/) {
+		return admitTransfer(serverID, client->ID, false, 0);
+	}
+
+	/**
+	 * @brief charges the transferred bytes to the server that admitted the transfer
+	 *
+	 * Neither the event nor the admission carry both the serverID and the transfer ID, so the event is matched to the
+	 * oldest admitted transfer of the same client ID and direction, for uploads also of the same file size. Client IDs
+	 * are per server, so two servers' clients with the same ID downloading at the same time can still be confused. Only
+	 * transfers admitted through the permFileTransferInit* methods above are accounted, admissions that never complete
+	 * are dropped by pump() after transferMatchTimeout.
+	*/
+	void onFileTransferEvent(const struct FileTransferCallbackExport* data) {
+		uint64 serverID;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			std::deque<AdmittedTransfer>* transfers = m_transferOwners.find(data->clientID);
+			if (transfers == nullptr)
+				return;
+			const bool upload = data->isSender == 0;
+			auto match = std::find_if(transfers->begin(), transfers->end(), [&](const AdmittedTransfer& transfer) {
+				return transfer.upload == upload && (!upload || transfer.fileSize == data->remotefileSize);
+			});
+			if (match == transfers->end())
+				match = std::find_if(transfers->begin(), transfers->end(), [&](const AdmittedTransfer& transfer) { return transfer.upload == upload; });
+			if (match == transfers->end())
+				return;
+			serverID = match->serverID;
+			transfers->erase(match);
+			if (transfers->empty())
+				m_transferOwners.erase(data->clientID);
+		}
+		charge(serverID, 0, 0, data->bytes);
+	}
+
+	/** @brief voice packets cannot be refused, they only count towards the event budget */
+	void onVoiceDataEvent(uint64 serverID, anyID /*clientID*/, unsigned char* /*voiceData*/, unsigned int /*voiceDataSize*/, unsigned int /*frequency*/) {
+		charge(serverID, 0, 1, 0);
+	}
+
+	/**
+	 * @brief run work on behalf of a server now, or queue it while the server is over budget
+	 *
+	 * Work runs measured on the calling thread or later inside pump(). When the queue of the server is full the work is
+	 * dropped and false is returned.
+	*/
+	bool defer(uint64 serverID, std::function<void()> work) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const int64_t now = m_clock();
+			Tenant& tenant = tenantFor(serverID, now);
+			advance(tenant, now);
+			updateState(tenant);
+			if (tenant.overBudget || !tenant.queue.empty()) {
+				if (tenant.queue.size() >= m_options.maxQueuedPerTenant) {
+					++tenant.shed;
+					return false;
+				}
+				++tenant.deferred;
+				tenant.queue.push_back(std::move(work));
+				return true;
+			}
+		}
+		CallbackTimer timer = measure(serverID);
+		work();
+		return true;
+	}
+
+	/**
+	 * @brief run queued work of servers back within budget and check the instance budget
+	 *
+	 * Servers take turns one item at a time, so a long queue does not starve the others. Stops after maxPumpTime.
+	 * @return number of work items run
+	*/
+	size_t pump() {
+		checkEmergency();
+		expireTransfers();
+		const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + m_options.maxPumpTime;
+		size_t ran = 0;
+		for (bool progress = true; progress && std::chrono::steady_clock::now() < deadline;) {
+			progress = false;
+			std::vector<std::pair<uint64, std::function<void()>>> round;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				const int64_t now = m_clock();
+				m_tenants.forEach([&](uint64 serverID, std::unique_ptr<Tenant>& tenant) {
+					if (tenant->queue.empty())
+						return;
+					advance(*tenant, now);
+					updateState(*tenant);
+					if (tenant->overBudget)
+						return;
+					round.emplace_back(serverID, std::move(tenant->queue.front()));
+					tenant->queue.pop_front();
+				});
+			}
+			for (std::pair<uint64, std::function<void()>>& work : round) {
+				CallbackTimer timer = measure(work.first);
+				work.second();
+				++ran;
+				progress = true;
+			}
+		}
+		return ran;
+	}
+
+	/** @brief true once the emergency commands were disabled */
+	bool emergencyActive() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_emergencyActive;
+	}
+
+	/** @brief one row per server, heaviest CPU user first */
+	std::vector<TenantReport> report() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const int64_t now = m_clock();
+		std::vector<TenantReport> rows;
+		m_tenants.forEach([&](uint64 serverID, const std::unique_ptr<Tenant>& tenant) {
+			TenantReport row;
+			row.serverID = serverID;
+			row.cpuNanoseconds = tenant->cpu.total;
+			row.events = tenant->events.total;
+			row.transferBytes = tenant->transfer.total;
+			row.cpuShare = tenant->cpu.rateAt(now) / 1e9;
+			row.eventsPerSecond = tenant->events.rateAt(now);
+			row.transferBytesPerSecond = tenant->transfer.rateAt(now);
+			row.denied = tenant->denied;
+			row.deferred = tenant->deferred;
+			row.shed = tenant->shed;
+			row.queued = tenant->queue.size();
+			row.throttled = tenant->throttled;
+			row.overBudget = tenant->overBudget;
+			rows.push_back(row);
+		});
+		std::sort(rows.begin(), rows.end(), [](const TenantReport& a, const TenantReport& b) {
+			return a.cpuShare != b.cpuShare ? a.cpuShare > b.cpuShare : a.serverID < b.serverID;
+		});
+		return rows;
+	}
+
+	/** @brief the report as a text table, e.g. for a log line or an admin query */
+	static std::string formatReport(const std::vector<TenantReport>& rows) {
+		std::string text = "server    cpu%   events/s   bytes/s    events     bytes      denied  deferred  shed  queued  throttled\n";
+		char line[256];
+		for (const TenantReport& row : rows) {
+			std::snprintf(line, sizeof(line), "%-8llu %6.2f %10.0f %9.0f %9llu %12llu %8llu %9llu %5llu %7zu %10u%s\n",
+			              static_cast<unsigned long long>(row.serverID), row.cpuShare * 100, row.eventsPerSecond, row.transferBytesPerSecond,
+			              static_cast<unsigned long long>(row.events), static_cast<unsigned long long>(row.transferBytes),
+			              static_cast<unsigned long long>(row.denied), static_cast<unsigned long long>(row.deferred),
+			              static_cast<unsigned long long>(row.shed), row.queued, row.throttled, row.overBudget ? "  OVER BUDGET" : "");
+			text += line;
+		}
+		return text;
+	}
+
+private:
+	static constexpr double RATE_SECONDS = 10; ///< time constant of the averages in the report
+
+	/*token bucket with debt plus a decaying average, amounts in nanoseconds, events or bytes*/
+	struct Meter {
+		double  tokens = 0;
+		double  rate = 0; ///< per second
+		uint64  total = 0;
+		int64_t updatedNs = 0;
+
+		void advance(int64_t now, double limit, double burstSeconds) {
+			if (now <= updatedNs)
+				return;
+			const double seconds = (now - updatedNs) / 1e9;
+			rate *= std::exp(-seconds / RATE_SECONDS);
+			if (limit > 0)
+				tokens = std::min(tokens + seconds * limit, limit * burstSeconds);
+			updatedNs = now;
+		}
+
+		void charge(double amount) {
+			tokens -= amount;
+			rate += amount / RATE_SECONDS;
+			total += static_cast<uint64>(amount);
+		}
+
+		void clamp(double capacity) { tokens = std::min(tokens, capacity); }
+
+		double rateAt(int64_t now) const { return now <= updatedNs ? rate : rate * std::exp(-(now - updatedNs) / 1e9 / RATE_SECONDS); }
+	};
+
+	struct AdmittedTransfer {
+		uint64  serverID;
+		int64_t admittedNs;
+		uint64  fileSize; ///< announced size of an upload
+		bool    upload;
+	};
+
+	struct Tenant {
+		TenantQuota                       quota;
+		Meter                             cpu;
+		Meter                             events;
+		Meter                             transfer;
+		std::deque<std::function<void()>> queue;
+		uint64                            denied = 0;
+		uint64                            deferred = 0;
+		uint64                            shed = 0;
+		unsigned int                      throttled = 0;
+		bool                              overBudget = false;
+	};
+
+	static int64_t steadyNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	/*CPU time of the calling thread. Windows thread times tick in scheduler quanta, too coarse for callbacks, so wall time is used there.*/
+	static int64_t threadCpuNs() {
+#ifdef _WIN32
+		return steadyNs();
+#else
+		timespec now;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+		return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+	}
+
+	/*called with the lock held, new servers start with full buckets*/
+	Tenant& tenantFor(uint64 serverID, int64_t now) {
+		std::unique_ptr<Tenant>& tenant = m_tenants[serverID];
+		if (!tenant) {
+			tenant.reset(new Tenant());
+			tenant->quota = m_options.defaultQuota;
+			const TenantQuota& quota = tenant->quota;
+			tenant->cpu.tokens = quota.cpuShare * 1e9 * quota.burstSeconds;
+			tenant->events.tokens = quota.eventsPerSecond * quota.burstSeconds;
+			tenant->transfer.tokens = quota.transferBytesPerSecond * quota.burstSeconds;
+			tenant->cpu.updatedNs = tenant->events.updatedNs = tenant->transfer.updatedNs = now;
+		}
+		return *tenant;
+	}
+
+	/*called with the lock held*/
+	static void advance(Tenant& tenant, int64_t now) {
+		const TenantQuota& quota = tenant.quota;
+		tenant.cpu.advance(now, quota.cpuShare * 1e9, quota.burstSeconds);
+		tenant.events.advance(now, quota.eventsPerSecond, quota.burstSeconds);
+		tenant.transfer.advance(now, quota.transferBytesPerSecond, quota.burstSeconds);
+	}
+
+	/*called with the lock held. A server in debt on any limited resource is over budget until the debt is paid off.*/
+	static void updateState(Tenant& tenant) {
+		const TenantQuota& quota = tenant.quota;
+		const bool over = (quota.cpuShare > 0 && tenant.cpu.tokens < 0) || (quota.eventsPerSecond > 0 && tenant.events.tokens < 0) ||
+		                  (quota.transferBytesPerSecond > 0 && tenant.transfer.tokens < 0);
+		if (over && !tenant.overBudget)
+			++tenant.throttled;
+		tenant.overBudget = over;
+	}
+
+	/*called with the lock held*/
+	unsigned int admitLocked(uint64 serverID) {
+		const int64_t now = m_clock();
+		Tenant& tenant = tenantFor(serverID, now);
+		advance(tenant, now);
+		tenant.events.charge(1);
+		updateState(tenant);
+		if (!tenant.overBudget)
+			return ERROR_ok;
+		++tenant.denied;
+		return ERROR_permissions_client_insufficient;
+	}
+
+	unsigned int admitTransfer(uint64 serverID, anyID clientID, bool upload, uint64 fileSize) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const unsigned int error = admitLocked(serverID);
+		if (error == ERROR_ok)
+			m_transferOwners[clientID].push_back(AdmittedTransfer{serverID, m_clock(), fileSize, upload});
+		return error;
+	}
+
+	/*called with the lock held*/
+	template <typename Drop>
+	void dropTransfers(Drop&& drop) {
+		std::vector<anyID> emptied;
+		m_transferOwners.forEach([&](anyID clientID, std::deque<AdmittedTransfer>& transfers) {
+			transfers.erase(std::remove_if(transfers.begin(), transfers.end(), drop), transfers.end());
+			if (transfers.empty())
+				emptied.push_back(clientID);
+		});
+		for (anyID clientID : emptied)
+			m_transferOwners.erase(clientID);
+	}
+
+	/*admissions refused later by other checks or aborted before the first byte never see a completion event*/
+	void expireTransfers() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const int64_t cutoff = m_clock() - std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.transferMatchTimeout).count();
+		dropTransfers([&](const AdmittedTransfer& transfer) { return transfer.admittedNs < cutoff; });
+	}
+
+	/*disables the emergency commands once the whole instance stayed above instanceCpuShare for emergencyAfter*/
+	void checkEmergency() {
+		std::vector<int> commands;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_options.instanceCpuShare <= 0 || m_emergencyActive)
+				return;
+			const int64_t now = m_clock();
+			m_instanceCpu.advance(now, 0, 0);
+			if (m_instanceCpu.rate / 1e9 <= m_options.instanceCpuShare) {
+				m_overloadedSinceNs = 0;
+				return;
+			}
+			if (m_overloadedSinceNs == 0)
+				m_overloadedSinceNs = now;
+			if (now - m_overloadedSinceNs < std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.emergencyAfter).count())
+				return;
+			m_emergencyActive = true;
+			commands = m_options.emergencyCommands;
+		}
+		for (int command : commands)
+			ts3server_disableClientCommand(command);
+	}
+
+	const ResourceAccountingOptions                  m_options;
+	const Clock                                      m_clock;
+	mutable std::mutex                               m_mutex;
+	FlatHashMap<uint64, std::unique_ptr<Tenant>>     m_tenants;
+	FlatHashMap<anyID, std::deque<AdmittedTransfer>> m_transferOwners; ///< admitted transfers by client ID, oldest first
+	Meter                                            m_instanceCpu;    ///< only the average is used
+	int64_t                                          m_overloadedSinceNs = 0;
+	bool                                             m_emergencyActive = false;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_SERVER_RESOURCE_ACCOUNTING_H
@@ -0,0 +1,128 @@
+/*
+ * Portable SHA-256 (FIPS 180-4). Used to keep digests instead of plaintext credentials in memory.
+ */
+
+#ifndef TEAMSPEAK_EXT_SHA256_H
+#define TEAMSPEAK_EXT_SHA256_H
+
+//system
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace ts3ext {
+
+class Sha256 {
+public:
+	static const size_t DIGEST_SIZE = 32;
+	static const size_t BLOCK_SIZE = 64;
+
+	Sha256() { reset(); }
+
+	void reset() {
+		static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+		std::memcpy(m_state, initial, sizeof(m_state));
+		m_length = 0;
+		m_buffered = 0;
+	}
+
+	void update(const void* data, size_t size) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		m_length += size;
+		if (m_buffered != 0) {
+			const size_t take = size < BLOCK_SIZE - m_buffered ? size : BLOCK_SIZE - m_buffered;
+			std::memcpy(m_buffer + m_buffered, bytes, take);
+			m_buffered += take;
+			bytes += take;
+			size -= take;
+			if (m_buffered < BLOCK_SIZE)
+				return;
+			compress(m_buffer);
+			m_buffered = 0;
+		}
+		for (; size >= BLOCK_SIZE; bytes += BLOCK_SIZE, size -= BLOCK_SIZE)
+			compress(bytes);
+		std::memcpy(m_buffer, bytes, size);
+		m_buffered = size;
+	}
+
+	void update(const std::string& data) { update(data.data(), data.size()); }
+
+	/** @brief writes DIGEST_SIZE bytes, the object must be reset() before reuse */
+	void finish(unsigned char* digest) {
+		const uint64_t bits = m_length * 8;
+		static const unsigned char padding[BLOCK_SIZE] = {0x80};
+		update(padding, m_buffered < 56 ? 56 - m_buffered : 120 - m_buffered);
+		unsigned char length[8];
+		for (int i = 0; i < 8; ++i)
+			length[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+		update(length, sizeof(length));
+		for (int i = 0; i < 8; ++i) {
+			digest[4 * i] = static_cast<unsigned char>(m_state[i] >> 24);
+			digest[4 * i + 1] = static_cast<unsigned char>(m_state[i] >> 16);
+			digest[4 * i + 2] = static_cast<unsigned char>(m_state[i] >> 8);
+			digest[4 * i + 3] = static_cast<unsigned char>(m_state[i]);
+		}
+	}
+
+	/** @brief digest of data as raw bytes */
+	static std::string digest(const std::string& data) {
+		Sha256 hash;
+		hash.update(data);
+		unsigned char result[DIGEST_SIZE];
+		hash.finish(result);
+		return std::string(reinterpret_cast<const char*>(result), DIGEST_SIZE);
+	}
+
+private:
+	static uint32_t rotr(uint32_t value, int bits) { return (value >> bits) | (value << (32 - bits)); }
+
+	void compress(const unsigned char* block) {
+		static const uint32_t k[64] = {
+		    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be,
+		    0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa,
+		    0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85,
+		    0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+		    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+		    0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+		uint32_t w[64];
+		for (int i = 0; i < 16; ++i)
+			w[i] = uint32_t(block[4 * i]) << 24 | uint32_t(block[4 * i + 1]) << 16 | uint32_t(block[4 * i + 2]) << 8 | uint32_t(block[4 * i + 3]);
+		for (int i = 16; i < 64; ++i) {
+			const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+		uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3], e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+		for (int i = 0; i < 64; ++i) {
+			const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+			const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		m_state[0] += a;
+		m_state[1] += b;
+		m_state[2] += c;
+		m_state[3] += d;
+		m_state[4] += e;
+		m_state[5] += f;
+		m_state[6] += g;
+		m_state[7] += h;
+	}
+
+	uint32_t      m_state[8];
+	uint64_t      m_length;   ///< bytes hashed so far
+	unsigned char m_buffer[BLOCK_SIZE];
+	size_t        m_buffered;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_SHA256_H
@@ -0,0 +1,686 @@
+/*
+ * Spreads virtual servers over several ts3server processes on one host. Every process is a shard behind the ShardNode
+ * interface, the coordinator owns the host's port range and a placement table seeded by consistent hashing, so adding a
+ * shard only claims the servers that hash to it. Load is balanced by measured clients online and bandwidth, a server is
+ * moved by snapshot: export, stop on the source, recreate with ts3server_createVirtualServer2 on the target. The server
+ * library takes server and channel IDs only once per process lifetime, so a server can not return to a process it left.
+ */
+
+#ifndef TEAMSPEAK_EXT_SHARD_COORDINATOR_H
+#define TEAMSPEAK_EXT_SHARD_COORDINATOR_H
+
+//system
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+#include "teamspeak_ext/channel_replication.h"
+#include "teamspeak_ext/virtual_server_snapshot.h"
+
+namespace ts3ext {
+
+struct ShardLoad {
+	uint64 clientsOnline = 0;
+	uint64 bandwidth = 0; ///< bytes per second sent and received, averaged over the last minute
+};
+
+/**
+ * @brief one ts3server process
+ *
+ * LocalShardNode drives the server library of the calling process. The coordinator talks to other processes through an
+ * implementation that forwards these calls over the application's IPC to a LocalShardNode there. MemoryShardNode only
+ * keeps the snapshots in memory and runs a whole fleet inside one process for local testing.
+*/
+class ShardNode {
+public:
+	virtual ~ShardNode() {}
+
+	/** @brief start the server described by snapshot, keeping its serverID and port */
+	virtual unsigned int hostVirtualServer(const VirtualServerSnapshot& snapshot) = 0;
+
+	/** @brief ERROR_ok unless hostVirtualServer(snapshot) would be refused for IDs this node cannot take (again) */
+	virtual unsigned int canHost(const VirtualServerSnapshot& /*snapshot*/) const { return ERROR_ok; }
+
+	/** @brief false if a server stopped on this node can not be hosted on it again, see LocalShardNode */
+	virtual bool canRehost() const { return true; }
+
+	virtual unsigned int exportVirtualServer(uint64 serverID, VirtualServerSnapshot& snapshot) = 0;
+	virtual unsigned int stopVirtualServer(uint64 serverID) = 0;
+	virtual unsigned int measureLoad(uint64 serverID, ShardLoad& load) = 0;
+
+	/** @brief live migration support, see LiveMigration. Nodes without it can only take part in snapshot moves. */
+	virtual unsigned int startChannelReplication(uint64 /*serverID*/) { return ERROR_not_implemented; }
+	virtual unsigned int stopChannelReplication(uint64 /*serverID*/) { return ERROR_not_implemented; }
+	virtual unsigned int takeChannelDeltas(uint64 /*serverID*/, std::vector<ChannelDelta>& /*deltas*/) { return ERROR_not_implemented; }
+	virtual unsigned int applyChannelDeltas(uint64 /*serverID*/, const std::vector<ChannelDelta>& /*deltas*/) { return ERROR_not_implemented; }
+	virtual unsigned int applyServerVariables(uint64 /*serverID*/, const std::vector<SnapshotVariable>& /*variables*/) { return ERROR_not_implemented; }
+};
+
+/**
+ * @brief shard backed by the server library of this process
+ *
+ * Forward onChannelCreated, onChannelEdited and onChannelDeleted when servers of this process may be live migrated.
+ * The server library requires server and channel IDs to be unique for its whole lifetime, so the node refuses to host
+ * a snapshot with an ID it has hosted before: a stopped server cannot be restarted here, neither by a rollback nor by
+ * moving it back. Restarting it on the same shard takes a fresh process.
+*/
+class LocalShardNode : public ShardNode {
+public:
+	unsigned int hostVirtualServer(const VirtualServerSnapshot& snapshot) override {
+		unsigned int error = canHost(snapshot);
+		if (error != ERROR_ok)
+			return error;
+		uint64 serverID = 0;
+		if ((error = snapshot.restore(&serverID)) != ERROR_ok)
+			return error;
+		m_addresses[serverID] = Address{snapshot.port, snapshot.ip};
+		m_usedServerIDs.insert(serverID);
+		for (const ChannelSnapshot& channel : snapshot.channels)
+			m_usedChannelIDs.insert(channel.channelID);
+		return ERROR_ok;
+	}
+
+	unsigned int canHost(const VirtualServerSnapshot& snapshot) const override {
+		if (snapshot.serverID != 0 && m_usedServerIDs.count(snapshot.serverID) != 0)
+			return ERROR_server_duplicate_running;
+		for (const ChannelSnapshot& channel : snapshot.channels) {
+			if (channel.channelID != 0 && m_usedChannelIDs.count(channel.channelID) != 0)
+				return ERROR_server_duplicate_running;
+		}
+		return ERROR_ok;
+	}
+
+	bool canRehost() const override { return false; }
+
+	unsigned int exportVirtualServer(uint64 serverID, VirtualServerSnapshot& snapshot) override {
+		const auto address = m_addresses.find(serverID);
+		if (address == m_addresses.end())
+			return ERROR_server_invalid_id;
+		return snapshot.capture(serverID, address->second.port, address->second.ip);
+	}
+
+	unsigned int stopVirtualServer(uint64 serverID) override {
+		//channels created while the server ran are taken for the library's lifetime as well
+		uint64* channels = nullptr;
+		if (ts3server_getChannelList(serverID, &channels) == ERROR_ok) {
+			for (size_t i = 0; channels[i] != 0; ++i)
+				m_usedChannelIDs.insert(channels[i]);
+			ts3server_freeMemory(channels);
+		}
+		const unsigned int error = ts3server_stopVirtualServer(serverID);
+		if (error == ERROR_ok)
+			m_addresses.erase(serverID);
+		return error;
+	}
+
+	unsigned int measureLoad(uint64 serverID, ShardLoad& load) override {
+		unsigned int error = ts3server_getVirtualServerVariableAsUInt64(serverID, VIRTUALSERVER_CLIENTS_ONLINE, &load.clientsOnline);
+		if (error != ERROR_ok)
+			return error;
+		uint64 sent = 0, received = 0;
+		if ((error = ts3server_getVirtualServerConnectionVariableAsUInt64(serverID, CONNECTION_BANDWIDTH_SENT_LAST_MINUTE_TOTAL, &sent)) != ERROR_ok)
+			return error;
+		if ((error = ts3server_getVirtualServerConnectionVariableAsUInt64(serverID, CONNECTION_BANDWIDTH_RECEIVED_LAST_MINUTE_TOTAL, &received)) != ERROR_ok)
+			return error;
+		load.bandwidth = sent + received;
+		return ERROR_ok;
+	}
+
+	unsigned int startChannelReplication(uint64 serverID) override {
+		if (m_addresses.count(serverID) == 0)
+			return ERROR_server_invalid_id;
+		m_replicator.start(serverID);
+		return ERROR_ok;
+	}
+
+	unsigned int stopChannelReplication(uint64 serverID) override {
+		m_replicator.stop(serverID);
+		return ERROR_ok;
+	}
+
+	unsigned int takeChannelDeltas(uint64 serverID, std::vector<ChannelDelta>& deltas) override {
+		return m_replicator.take(serverID, deltas) ? static_cast<unsigned int>(ERROR_ok) : static_cast<unsigned int>(ERROR_server_invalid_id);
+	}
+
+	unsigned int applyChannelDeltas(uint64 serverID, const std::vector<ChannelDelta>& deltas) override {
+		return ChannelReplicator::apply(serverID, deltas);
+	}
+
+	unsigned int applyServerVariables(uint64 serverID, const std::vector<SnapshotVariable>& variables) override {
+		return ChannelReplicator::applyServerVariables(serverID, variables);
+	}
+
+	void onChannelCreated(uint64 serverID, anyID invokerClientID, uint64 channelID) { m_replicator.onChannelCreated(serverID, invokerClientID, channelID); }
+	void onChannelEdited(uint64 serverID, anyID invokerClientID, uint64 channelID) { m_replicator.onChannelEdited(serverID, invokerClientID, channelID); }
+	void onChannelDeleted(uint64 serverID, anyID invokerClientID, uint64 channelID) { m_replicator.onChannelDeleted(serverID, invokerClientID, channelID); }
+
+private:
+	struct Address {
+		unsigned int port;
+		std::string  ip;
+	};
+
+	std::unordered_map<uint64, Address> m_addresses;      ///< servers hosted through this node
+	std::unordered_set<uint64>          m_usedServerIDs;  ///< hosted at some point, the library does not take them again
+	std::unordered_set<uint64>          m_usedChannelIDs;
+	ChannelReplicator                   m_replicator;
+};
+
+/**
+ * @brief stand-in shard that keeps its servers as snapshots in memory
+ *
+ * Every hosted snapshot goes through serialize() and parse(), as it would on its way to another process. Loads are set
+ * with setLoad(), channel changes made with setChannel() and removeChannel() are recorded for live migration. Not thread
+ * safe, like the coordinator.
+*/
+class MemoryShardNode : public ShardNode {
+public:
+	unsigned int hostVirtualServer(const VirtualServerSnapshot& snapshot) override {
+		if (m_hostError != ERROR_ok)
+			return m_hostError;
+		if (m_servers.count(snapshot.serverID) != 0)
+			return ERROR_server_duplicate_running;
+		for (const auto& server : m_servers) {
+			if (server.second.port == snapshot.port)
+				return ERROR_port_already_in_use;
+		}
+		VirtualServerSnapshot copy;
+		if (!copy.parse(snapshot.serialize()))
+			return ERROR_parameter_invalid;
+		m_servers[snapshot.serverID] = std::move(copy);
+		return ERROR_ok;
+	}
+
+	unsigned int exportVirtualServer(uint64 serverID, VirtualServerSnapshot& snapshot) override {
+		const auto server = m_servers.find(serverID);
+		if (server == m_servers.end())
+			return ERROR_server_invalid_id;
+		snapshot = server->second;
+		return ERROR_ok;
+	}
+
+	unsigned int stopVirtualServer(uint64 serverID) override {
+		if (m_servers.erase(serverID) == 0)
+			return ERROR_server_invalid_id;
+		m_deltas.erase(serverID);
+		m_loads.erase(serverID);
+		return ERROR_ok;
+	}
+
+	unsigned int measureLoad(uint64 serverID, ShardLoad& load) override {
+		if (m_servers.count(serverID) == 0)
+			return ERROR_server_invalid_id;
+		const auto known = m_loads.find(serverID);
+		load = known == m_loads.end() ? ShardLoad() : known->second;
+		return ERROR_ok;
+	}
+
+	unsigned int startChannelReplication(uint64 serverID) override {
+		if (m_servers.count(serverID) == 0)
+			return ERROR_server_invalid_id;
+		m_deltas[serverID];
+		return ERROR_ok;
+	}
+
+	unsigned int stopChannelReplication(uint64 serverID) override {
+		m_deltas.erase(serverID);
+		return ERROR_ok;
+	}
+
+	unsigned int takeChannelDeltas(uint64 serverID, std::vector<ChannelDelta>& deltas) override {
+		const auto pending = m_deltas.find(serverID);
+		if (pending == m_deltas.end())
+			return ERROR_server_invalid_id;
+		deltas.swap(pending->second);
+		pending->second.clear();
+		return ERROR_ok;
+	}
+
+	/** @brief stops at the first failure, like ChannelReplicator::apply() */
+	unsigned int applyChannelDeltas(uint64 serverID, const std::vector<ChannelDelta>& deltas) override {
+		const auto server = m_servers.find(serverID);
+		if (server == m_servers.end())
+			return ERROR_server_invalid_id;
+		for (const ChannelDelta& delta : deltas) {
+			if (delta.type == CHANNEL_DELTA_DELETED) {
+				eraseChannel(server->second, delta.channel.channelID, nullptr);
+				continue;
+			}
+			if (delta.type == CHANNEL_DELTA_EDITED && findChannel(server->second, delta.channel.channelID) == nullptr)
+				return ERROR_channel_invalid_id;
+			const unsigned int error = storeChannel(server->second, delta.channel);
+			if (error != ERROR_ok)
+				return error;
+		}
+		return ERROR_ok;
+	}
+
+	unsigned int applyServerVariables(uint64 serverID, const std::vector<SnapshotVariable>& variables) override {
+		const auto server = m_servers.find(serverID);
+		if (server == m_servers.end())
+			return ERROR_server_invalid_id;
+		for (const SnapshotVariable& variable : variables) {
+			const auto known = std::find_if(server->second.variables.begin(), server->second.variables.end(),
+			                                [&](const SnapshotVariable& other) { return other.flag == variable.flag; });
+			if (known != server->second.variables.end())
+				*known = variable;
+			else
+				server->second.variables.push_back(variable);
+		}
+		return ERROR_ok;
+	}
+
+	/** @brief what measureLoad() reports for a hosted server */
+	void setLoad(uint64 serverID, const ShardLoad& load) { m_loads[serverID] = load; }
+
+	/** @brief create or edit a channel as a client would, the parent has to exist */
+	unsigned int setChannel(uint64 serverID, const ChannelSnapshot& channel) {
+		const auto server = m_servers.find(serverID);
+		if (server == m_servers.end())
+			return ERROR_server_invalid_id;
+		const bool created = findChannel(server->second, channel.channelID) == nullptr;
+		const unsigned int error = storeChannel(server->second, channel);
+		if (error == ERROR_ok)
+			record(serverID, ChannelDelta{created ? CHANNEL_DELTA_CREATED : CHANNEL_DELTA_EDITED, channel});
+		return error;
+	}
+
+	/** @brief delete a channel with its sub channels, one deletion is recorded per channel */
+	unsigned int removeChannel(uint64 serverID, uint64 channelID) {
+		const auto server = m_servers.find(serverID);
+		if (server == m_servers.end())
+			return ERROR_server_invalid_id;
+		std::vector<uint64> removed;
+		eraseChannel(server->second, channelID, &removed);
+		if (removed.empty())
+			return ERROR_channel_invalid_id;
+		for (uint64 id : removed) {
+			ChannelDelta delta;
+			delta.type = CHANNEL_DELTA_DELETED;
+			delta.channel.channelID = id;
+			record(serverID, delta);
+		}
+		return ERROR_ok;
+	}
+
+	/** @brief make hostVirtualServer() fail with error until called with ERROR_ok, to exercise rollbacks */
+	void failHosting(unsigned int error) { m_hostError = error; }
+
+	std::vector<uint64> servers() const {
+		std::vector<uint64> ids;
+		for (const auto& server : m_servers)
+			ids.push_back(server.first);
+		return ids;
+	}
+
+private:
+	static ChannelSnapshot* findChannel(VirtualServerSnapshot& server, uint64 channelID) {
+		for (ChannelSnapshot& channel : server.channels) {
+			if (channel.channelID == channelID)
+				return &channel;
+		}
+		return nullptr;
+	}
+
+	/*new channels go last, so parents stay before their sub channels*/
+	static unsigned int storeChannel(VirtualServerSnapshot& server, const ChannelSnapshot& channel) {
+		if (channel.parentChannelID != 0 && findChannel(server, channel.parentChannelID) == nullptr)
+			return ERROR_channel_invalid_id;
+		if (ChannelSnapshot* known = findChannel(server, channel.channelID))
+			*known = channel;
+		else
+			server.channels.push_back(channel);
+		return ERROR_ok;
+	}
+
+	/*sub channels first, an unknown channel is no error*/
+	static void eraseChannel(VirtualServerSnapshot& server, uint64 channelID, std::vector<uint64>* removed) {
+		if (findChannel(server, channelID) == nullptr)
+			return;
+		std::vector<uint64> children;
+		for (const ChannelSnapshot& channel : server.channels) {
+			if (channel.parentChannelID == channelID)
+				children.push_back(channel.channelID);
+		}
+		for (uint64 child : children)
+			eraseChannel(server, child, removed);
+		server.channels.erase(std::remove_if(server.channels.begin(), server.channels.end(),
+		                                     [&](const ChannelSnapshot& channel) { return channel.channelID == channelID; }),
+		                      server.channels.end());
+		if (removed != nullptr)
+			removed->push_back(channelID);
+	}
+
+	void record(uint64 serverID, const ChannelDelta& delta) {
+		const auto pending = m_deltas.find(serverID);
+		if (pending != m_deltas.end())
+			pending->second.push_back(delta);
+	}
+
+	std::map<uint64, VirtualServerSnapshot>               m_servers;
+	std::unordered_map<uint64, ShardLoad>                 m_loads;
+	std::unordered_map<uint64, std::vector<ChannelDelta>> m_deltas; ///< recorded changes of replicated servers
+	unsigned int                                          m_hostError = ERROR_ok;
+};
+
+struct ShardCoordinatorOptions {
+	unsigned int firstPort = 9987;
+	unsigned int lastPort = 10986;
+	std::string  ip = "0.0.0.0";
+	unsigned int virtualNodes = 64;        ///< points per shard on the hash ring
+	double       bytesPerClient = 16000;   ///< bandwidth that weighs as much as one connected client
+	double       imbalanceTolerance = 0.2; ///< a shard above the mean by this fraction sheds servers
+	unsigned int maxMigrations = 2;        ///< per rebalance() call, every migration disconnects the clients of one server
+};
+
+struct ShardReport {
+	std::string shard;
+	size_t      servers = 0;
+	uint64      clientsOnline = 0;
+	uint64      bandwidth = 0;
+	double      score = 0; ///< clients plus weighted bandwidth, what rebalance() compares
+};
+
+/**
+ * @brief places virtual servers on shards and moves them to balance load
+ *
+ * Not thread safe, drive it from one control thread. Nodes are not owned and must outlive the coordinator.
+*/
+class ShardCoordinator {
+public:
+	explicit ShardCoordinator(const ShardCoordinatorOptions& options = ShardCoordinatorOptions()) : m_options(options) {}
+
+	ShardCoordinator(const ShardCoordinator&) = delete;
+	ShardCoordinator& operator=(const ShardCoordinator&) = delete;
+
+	void addShard(const std::string& name, ShardNode& node) {
+		m_shards[name] = &node;
+		for (unsigned int i = 0; i < m_options.virtualNodes; ++i)
+			m_ring[hash(name + '#' + std::to_string(i))] = name;
+	}
+
+	/** @brief ring position of a server, where it is placed unless load moved it elsewhere */
+	std::string homeShard(uint64 serverID) const {
+		if (m_ring.empty())
+			return std::string();
+		auto point = m_ring.lower_bound(hash(std::to_string(serverID)));
+		if (point == m_ring.end())
+			point = m_ring.begin();
+		return point->second;
+	}
+
+	/**
+	 * @brief start a server on its home shard
+	 *
+	 * A snapshot without port gets the lowest free port of the range, the ip defaults to the option. Restoring a fleet
+	 * after a restart passes the stored snapshots, which keep their ports, as does bringing back a lostServer().
+	*/
+	unsigned int createServer(VirtualServerSnapshot snapshot) {
+		if (m_placements.count(snapshot.serverID) != 0)
+			return ERROR_server_duplicate_running;
+		const std::string shard = homeShard(snapshot.serverID);
+		if (shard.empty())
+			return ERROR_server_invalid_id;
+		if (snapshot.port == 0 && (snapshot.port = freePort()) == 0)
+			return ERROR_no_network_port_available;
+		const auto lost = m_lost.find(snapshot.serverID);
+		const bool ownPort = lost != m_lost.end() && lost->second.port == snapshot.port;
+		if (!ownPort && portTaken(snapshot.port))
+			return ERROR_port_already_in_use;
+		if (snapshot.ip.empty())
+			snapshot.ip = m_options.ip;
+		const unsigned int error = m_shards[shard]->hostVirtualServer(snapshot);
+		if (error == ERROR_ok) {
+			m_placements[snapshot.serverID] = Placement{shard, snapshot.port};
+			if (lost != m_lost.end())
+				m_lost.erase(lost);
+		}
+		return error;
+	}
+
+	/** @brief stops a placed server, or gives up a lost one and frees its port */
+	unsigned int removeServer(uint64 serverID) {
+		if (m_lost.erase(serverID) != 0)
+			return ERROR_ok;
+		const auto placement = m_placements.find(serverID);
+		if (placement == m_placements.end())
+			return ERROR_server_invalid_id;
+		const unsigned int error = m_shards[placement->second.shard]->stopVirtualServer(serverID);
+		if (error == ERROR_ok)
+			m_placements.erase(placement);
+		return error;
+	}
+
+	/**
+	 * @brief move a server by snapshot, its clients reconnect to the same port
+	 *
+	 * A target that cannot take the server's IDs, e.g. a LocalShardNode that hosted it before, is refused before the source
+	 * stops. If the target still cannot start the server it is restarted on the source from the same snapshot. If that
+	 * fails too, as it always does for a LocalShardNode source, the server runs nowhere: its placement is dropped, the
+	 * snapshot and port are kept as lostServer() for createServer().
+	*/
+	unsigned int migrate(uint64 serverID, const std::string& target) {
+		const auto placement = m_placements.find(serverID);
+		const auto targetNode = m_shards.find(target);
+		if (placement == m_placements.end() || targetNode == m_shards.end())
+			return ERROR_server_invalid_id;
+		if (placement->second.shard == target)
+			return ERROR_ok_no_update;
+		ShardNode* source = m_shards[placement->second.shard];
+		VirtualServerSnapshot snapshot;
+		unsigned int error = source->exportVirtualServer(serverID, snapshot);
+		if (error != ERROR_ok)
+			return error;
+		if ((error = targetNode->second->canHost(snapshot)) != ERROR_ok)
+			return error;
+		if ((error = source->stopVirtualServer(serverID)) != ERROR_ok)
+			return error;
+		if ((error = targetNode->second->hostVirtualServer(snapshot)) != ERROR_ok) {
+			if (source->hostVirtualServer(snapshot) != ERROR_ok) {
+				m_placements.erase(placement);
+				m_lost[serverID] = snapshot;
+			}
+			return error;
+		}
+		placement->second.shard = target;
+		return ERROR_ok;
+	}
+
+	/**
+	 * @brief move servers off shards loaded above the mean by more than imbalanceTolerance
+	 *
+	 * Each step moves one server from the most to the least loaded shard, preferring a server whose home shard is the
+	 * target, then the server whose load best closes the gap. Only moves that reduce the larger of the two loads are made.
+	 * @return migrations done
+	*/
+	unsigned int rebalance() {
+		if (m_shards.size() < 2)
+			return 0;
+		std::unordered_map<uint64, double> serverScores;
+		std::unordered_map<std::string, double> shardScores;
+		for (const auto& shard : m_shards)
+			shardScores[shard.first] = 0;
+		for (const auto& placement : m_placements) {
+			ShardLoad load;
+			if (m_shards[placement.second.shard]->measureLoad(placement.first, load) != ERROR_ok)
+				continue;
+			serverScores[placement.first] = score(load);
+			shardScores[placement.second.shard] += score(load);
+		}
+
+		unsigned int migrations = 0;
+		while (migrations < m_options.maxMigrations) {
+			double total = 0;
+			auto busiest = shardScores.begin(), idlest = shardScores.begin();
+			for (auto it = shardScores.begin(); it != shardScores.end(); ++it) {
+				total += it->second;
+				if (it->second > busiest->second)
+					busiest = it;
+				if (it->second < idlest->second)
+					idlest = it;
+			}
+			const double mean = total / shardScores.size();
+			if (busiest->second <= mean * (1 + m_options.imbalanceTolerance))
+				break;
+			const double gap = (busiest->second - idlest->second) / 2;
+			uint64 candidate = 0;
+			double candidateScore = 0;
+			bool candidateHome = false;
+			for (const auto& placement : m_placements) {
+				if (placement.second.shard != busiest->first || serverScores.count(placement.first) == 0)
+					continue;
+				const double load = serverScores[placement.first];
+				if (load <= 0 || idlest->second + load >= busiest->second)
+					continue;
+				const bool home = homeShard(placement.first) == idlest->first;
+				if (candidate == 0 || (home && !candidateHome) ||
+				    (home == candidateHome && std::abs(load - gap) < std::abs(candidateScore - gap))) {
+					candidate = placement.first;
+					candidateScore = load;
+					candidateHome = home;
+				}
+			}
+			if (candidate == 0 || migrate(candidate, idlest->first) != ERROR_ok)
+				break;
+			busiest->second -= candidateScore;
+			idlest->second += candidateScore;
+			++migrations;
+		}
+		return migrations;
+	}
+
+	/** @brief empty string if the server is not placed */
+	std::string shardOf(uint64 serverID) const {
+		const auto placement = m_placements.find(serverID);
+		return placement == m_placements.end() ? std::string() : placement->second.shard;
+	}
+
+	unsigned int portOf(uint64 serverID) const {
+		const auto placement = m_placements.find(serverID);
+		return placement == m_placements.end() ? 0 : placement->second.port;
+	}
+
+	/** @brief last snapshot of a server a failed migrate() left running nowhere, nullptr if it is not lost */
+	const VirtualServerSnapshot* lostServer(uint64 serverID) const {
+		const auto lost = m_lost.find(serverID);
+		return lost == m_lost.end() ? nullptr : &lost->second;
+	}
+
+	std::vector<uint64> lostServers() const {
+		std::vector<uint64> ids;
+		for (const auto& lost : m_lost)
+			ids.push_back(lost.first);
+		return ids;
+	}
+
+	/** @brief nullptr for unknown names */
+	ShardNode* node(const std::string& shard) const {
+		const auto it = m_shards.find(shard);
+		return it == m_shards.end() ? nullptr : it->second;
+	}
+
+	/** @brief take a port out of the range without placing a server, e.g. for the staging copy of a live migration. 0 if exhausted. */
+	unsigned int reservePort() {
+		const unsigned int port = freePort();
+		if (port != 0)
+			m_reservedPorts.push_back(port);
+		return port;
+	}
+
+	void releasePort(unsigned int port) { m_reservedPorts.erase(std::remove(m_reservedPorts.begin(), m_reservedPorts.end(), port), m_reservedPorts.end()); }
+
+	/** @brief record a server moved outside of migrate(), e.g. by a LiveMigration. A reserved port is taken over. */
+	unsigned int relocate(uint64 serverID, const std::string& shard, unsigned int port) {
+		const auto placement = m_placements.find(serverID);
+		if (placement == m_placements.end() || m_shards.count(shard) == 0)
+			return ERROR_server_invalid_id;
+		releasePort(port);
+		placement->second = Placement{shard, port};
+		return ERROR_ok;
+	}
+
+	std::vector<ShardReport> report() {
+		std::map<std::string, ShardReport> rows;
+		for (const auto& shard : m_shards)
+			rows[shard.first].shard = shard.first;
+		for (const auto& placement : m_placements) {
+			ShardReport& row = rows[placement.second.shard];
+			++row.servers;
+			ShardLoad load;
+			if (m_shards[placement.second.shard]->measureLoad(placement.first, load) != ERROR_ok)
+				continue;
+			row.clientsOnline += load.clientsOnline;
+			row.bandwidth += load.bandwidth;
+			row.score += score(load);
+		}
+		std::vector<ShardReport> result;
+		for (const auto& row : rows)
+			result.push_back(row.second);
+		return result;
+	}
+
+private:
+	struct Placement {
+		std::string  shard;
+		unsigned int port;
+	};
+
+	/*FNV-1a followed by a 64 bit finalizer, so neighbouring names land far apart on the ring*/
+	static uint64 hash(const std::string& text) {
+		uint64 value = 1469598103934665603ull;
+		for (unsigned char c : text) {
+			value ^= c;
+			value *= 1099511628211ull;
+		}
+		value ^= value >> 33;
+		value *= 0xff51afd7ed558ccdull;
+		value ^= value >> 33;
+		return value;
+	}
+
+	double score(const ShardLoad& load) const {
+		return load.clientsOnline + (m_options.bytesPerClient > 0 ? load.bandwidth / m_options.bytesPerClient : 0);
+	}
+
+	bool portTaken(unsigned int port) const {
+		if (std::find(m_reservedPorts.begin(), m_reservedPorts.end(), port) != m_reservedPorts.end())
+			return true;
+		for (const auto& lost : m_lost) {
+			if (lost.second.port == port)
+				return true;
+		}
+		for (const auto& placement : m_placements) {
+			if (placement.second.port == port)
+				return true;
+		}
+		return false;
+	}
+
+	/*0 if the range is exhausted*/
+	unsigned int freePort() const {
+		for (unsigned int port = m_options.firstPort; port <= m_options.lastPort; ++port) {
+			if (!portTaken(port))
+				return port;
+		}
+		return 0;
+	}
+
+	const ShardCoordinatorOptions           m_options;
+	std::map<std::string, ShardNode*>       m_shards;
+	std::map<uint64, std::string>           m_ring; ///< hash ring, points of all shards
+	std::unordered_map<uint64, Placement>   m_placements;
+	std::vector<unsigned int>               m_reservedPorts;
+	std::map<uint64, VirtualServerSnapshot> m_lost; ///< dropped placements, see lostServer()
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_SHARD_COORDINATOR_H
@@ -0,0 +1,320 @@
+/*
+ * Dynamic file transfer speed limits. The client library enforces min(instance, server connection handler, transfer)
+ * limits, this header periodically measures the running transfers and redistributes the per transfer limits with
+ * weighted max-min fairness: transfers that cannot use their share give the rest to the others, and while anybody
+ * talks on a connection a reserve is held back from the budget so voice is not starved by bulk transfers.
+ */
+
+#ifndef TEAMSPEAK_EXT_SPEED_LIMIT_ALLOCATOR_H
+#define TEAMSPEAK_EXT_SPEED_LIMIT_ALLOCATOR_H
+
+//system
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+//own
+#include "teamspeak/clientlib.h"
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak_ext/flat_hash_map.h"
+
+namespace ts3ext {
+
+/** @brief smallest limit accepted by the ts3client_set*SpeedLimit functions, in bytes per second */
+static const uint64 MIN_TRANSFER_SPEED_LIMIT = 5120;
+
+struct SpeedLimitOptions {
+	uint64       uploadCapacity = 1024 * 1024;        ///< usable uplink in bytes per second
+	uint64       downloadCapacity = 8 * 1024 * 1024;  ///< usable downlink in bytes per second
+	uint64       voiceReserveUp = 16 * 1024;          ///< held back per connection while somebody talks on it
+	uint64       voiceReserveDown = 32 * 1024;
+	float        saturation = 0.9f;                   ///< a transfer reaching this fraction of its limit wants more
+	float        growth = 1.5f;                       ///< demand of an unsaturated transfer relative to its current speed
+	unsigned int hysteresisPercent = 10;              ///< limits changing less than this are not reapplied
+};
+
+/**
+ * @brief redistributes file transfer speed limits.
+ *
+ * Register transfers with track(), forward onFileTransferStatusEvent, onTalkStatusChangeEvent and
+ * onConnectStatusChangeEvent, and call rebalance() periodically, e.g. every second.
+*/
+class SpeedLimitAllocator {
+public:
+	explicit SpeedLimitAllocator(const SpeedLimitOptions& options = SpeedLimitOptions()) : m_options(options) {}
+
+	SpeedLimitAllocator(const SpeedLimitAllocator&) = delete;
+	SpeedLimitAllocator& operator=(const SpeedLimitAllocator&) = delete;
+
+	/**
+	 * @brief include a running transfer in the allocation
+	 *
+	 * @param weight relative share of the transfer, higher priority transfers should use larger weights
+	 * @return An Error code from the @ref Ts3ErrorType enum, fails if the transfer is unknown to the client library
+	*/
+	unsigned int track(anyID transferID, uint64 serverConnectionHandlerID, unsigned int weight = 1) {
+		int sender = 0;
+		const unsigned int error = ts3client_isTransferSender(transferID, &sender);
+		if (error != ERROR_ok)
+			return error;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Transfer& transfer = m_transfers[transferID];
+		transfer.serverConnectionHandlerID = serverConnectionHandlerID;
+		transfer.weight = std::max(weight, 1u);
+		transfer.upload = sender != 0;
+		transfer.appliedLimit = 0;
+		return ERROR_ok;
+	}
+
+	void untrack(anyID transferID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_transfers.erase(transferID);
+	}
+
+	/**
+	 * @brief measure all tracked transfers and apply new limits
+	 *
+	 * Must not be called from within a client library callback.
+	*/
+	void rebalance() {
+		std::lock_guard<std::mutex> rebalanceLock(m_rebalanceMutex);
+		std::vector<Demand> up, down;
+		uint64 talkingConnections = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_transfers.forEach([&](anyID transferID, const Transfer& transfer) {
+				Demand demand{transferID, transfer.serverConnectionHandlerID, transfer.weight, transfer.appliedLimit, 0.0, 0};
+				(transfer.upload ? up : down).push_back(demand);
+			});
+			talkingConnections = m_talkersPerConnection.size();
+			for (uint64 serverConnectionHandlerID : m_disconnected) {
+				m_appliedConnectionUp.erase(serverConnectionHandlerID);
+				m_appliedConnectionDown.erase(serverConnectionHandlerID);
+			}
+			m_disconnected.clear();
+		}
+		measure(up);
+		measure(down);
+		const uint64 upBudget = budget(m_options.uploadCapacity, m_options.voiceReserveUp * talkingConnections);
+		const uint64 downBudget = budget(m_options.downloadCapacity, m_options.voiceReserveDown * talkingConnections);
+		allocate(up, upBudget);
+		allocate(down, downBudget);
+
+		if (upBudget != m_appliedInstanceUp) {
+			ts3client_setInstanceSpeedLimitUp(upBudget);
+			m_appliedInstanceUp = upBudget;
+		}
+		if (downBudget != m_appliedInstanceDown) {
+			ts3client_setInstanceSpeedLimitDown(downBudget);
+			m_appliedInstanceDown = downBudget;
+		}
+		applyConnectionLimits(up, true);
+		applyConnectionLimits(down, false);
+
+		std::vector<anyID> finished;
+		applyTransferLimits(up, finished);
+		applyTransferLimits(down, finished);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (const Demand& demand : up)
+			storeApplied(demand);
+		for (const Demand& demand : down)
+			storeApplied(demand);
+		for (anyID transferID : finished)
+			m_transfers.erase(transferID);
+	}
+
+	size_t trackedCount() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_transfers.size();
+	}
+
+	void onFileTransferStatusEvent(anyID transferID, unsigned int /*status*/, const char* /*statusMessage*/, uint64 /*remotefileSize*/, uint64 /*serverConnectionHandlerID*/) {
+		untrack(transferID);
+	}
+
+	void onTalkStatusChangeEvent(uint64 serverConnectionHandlerID, int status, int /*isReceivedWhisper*/, anyID clientID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const uint64 key = talkerKey(serverConnectionHandlerID, clientID);
+		if (status == STATUS_TALKING) {
+			if (!m_talkers.contains(key)) {
+				m_talkers[key] = true;
+				++m_talkersPerConnection[serverConnectionHandlerID];
+			}
+		} else if (m_talkers.erase(key)) {
+			unsigned int* count = m_talkersPerConnection.find(serverConnectionHandlerID);
+			if (count != nullptr && --*count == 0)
+				m_talkersPerConnection.erase(serverConnectionHandlerID);
+		}
+	}
+
+	void onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int /*errorNumber*/) {
+		if (newStatus != STATUS_DISCONNECTED)
+			return;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<uint64> talkers;
+		m_talkers.forEach([&](uint64 key, bool) {
+			if ((key >> 16) == serverConnectionHandlerID)
+				talkers.push_back(key);
+		});
+		for (uint64 key : talkers)
+			m_talkers.erase(key);
+		m_talkersPerConnection.erase(serverConnectionHandlerID);
+		std::vector<anyID> transfers;
+		m_transfers.forEach([&](anyID transferID, const Transfer& transfer) {
+			if (transfer.serverConnectionHandlerID == serverConnectionHandlerID)
+				transfers.push_back(transferID);
+		});
+		for (anyID transferID : transfers)
+			m_transfers.erase(transferID);
+		m_disconnected.push_back(serverConnectionHandlerID);
+	}
+
+private:
+	struct Transfer {
+		uint64       serverConnectionHandlerID = 0;
+		unsigned int weight = 1;
+		bool         upload = false;
+		uint64       appliedLimit = 0; ///< 0 if not set by this allocator yet
+	};
+
+	struct ConnectionLimit {
+		uint64 applied = 0;
+		uint64 original = 0; ///< limit before this allocator set one, restored once the connection has no transfers
+	};
+
+	struct Demand {
+		anyID        transferID;
+		uint64       serverConnectionHandlerID;
+		unsigned int weight;
+		uint64       appliedLimit;
+		double       want;       ///< bytes per second the transfer could use
+		uint64       allocation;
+	};
+
+	static uint64 talkerKey(uint64 serverConnectionHandlerID, anyID clientID) { return serverConnectionHandlerID << 16 | clientID; }
+
+	static uint64 budget(uint64 capacity, uint64 reserve) {
+		return std::max(capacity > reserve ? capacity - reserve : 0, MIN_TRANSFER_SPEED_LIMIT);
+	}
+
+	/*transfers below their limit only get a bit more than they use, saturated ones compete for everything*/
+	void measure(std::vector<Demand>& demands) const {
+		for (Demand& demand : demands) {
+			float current = 0;
+			if (ts3client_getCurrentTransferSpeed(demand.transferID, &current) != ERROR_ok) {
+				demand.want = -1; //finished in the meantime
+				continue;
+			}
+			const bool saturated = demand.appliedLimit == 0 || current >= m_options.saturation * demand.appliedLimit;
+			demand.want = saturated ? 1e18 : std::max<double>(current * m_options.growth, MIN_TRANSFER_SPEED_LIMIT);
+		}
+	}
+
+	/*weighted water filling: satisfy the smallest demands per weight first, split the rest by weight*/
+	static void allocate(std::vector<Demand>& demands, uint64 capacity) {
+		std::sort(demands.begin(), demands.end(), [](const Demand& a, const Demand& b) { return a.want / a.weight < b.want / b.weight; });
+		double remaining = static_cast<double>(capacity);
+		double remainingWeight = 0;
+		for (const Demand& demand : demands) {
+			if (demand.want >= 0)
+				remainingWeight += demand.weight;
+		}
+		for (Demand& demand : demands) {
+			if (demand.want < 0)
+				continue;
+			const double share = remaining * demand.weight / remainingWeight;
+			const double granted = std::min(demand.want, share);
+			demand.allocation = std::max(static_cast<uint64>(granted), MIN_TRANSFER_SPEED_LIMIT);
+			remaining = std::max(remaining - granted, 0.0);
+			remainingWeight -= demand.weight;
+		}
+	}
+
+	bool changed(uint64 applied, uint64 wanted) const {
+		if (applied == 0)
+			return true;
+		const uint64 difference = applied > wanted ? applied - wanted : wanted - applied;
+		return difference * 100 > applied * m_options.hysteresisPercent;
+	}
+
+	/*server connection handler limit is the sum of its transfers, so one connection cannot take the share of another*/
+	void applyConnectionLimits(const std::vector<Demand>& demands, bool upload) {
+		FlatHashMap<uint64, uint64> sums;
+		for (const Demand& demand : demands) {
+			if (demand.want >= 0)
+				sums[demand.serverConnectionHandlerID] += demand.allocation;
+		}
+		FlatHashMap<uint64, ConnectionLimit>& applied = upload ? m_appliedConnectionUp : m_appliedConnectionDown;
+		sums.forEach([&](uint64 serverConnectionHandlerID, uint64 sum) {
+			ConnectionLimit* current = applied.find(serverConnectionHandlerID);
+			if (current == nullptr) {
+				current = &applied[serverConnectionHandlerID];
+				current->original = originalConnectionLimit(serverConnectionHandlerID, upload);
+			}
+			if (!changed(current->applied, sum))
+				return;
+			if (setConnectionLimit(serverConnectionHandlerID, upload, sum) == ERROR_ok)
+				current->applied = sum;
+		});
+		//connections without transfers left would keep the last, possibly minimal, sum
+		std::vector<uint64> idle;
+		applied.forEach([&](uint64 serverConnectionHandlerID, const ConnectionLimit&) {
+			if (!sums.contains(serverConnectionHandlerID))
+				idle.push_back(serverConnectionHandlerID);
+		});
+		for (uint64 serverConnectionHandlerID : idle) {
+			setConnectionLimit(serverConnectionHandlerID, upload, applied.find(serverConnectionHandlerID)->original);
+			applied.erase(serverConnectionHandlerID);
+		}
+	}
+
+	/*the library limits cannot be unset, an unreadable limit is replaced by the whole capacity, which never binds*/
+	uint64 originalConnectionLimit(uint64 serverConnectionHandlerID, bool upload) const {
+		uint64 limit = 0;
+		const unsigned int error = upload ? ts3client_getServerConnectionHandlerSpeedLimitUp(serverConnectionHandlerID, &limit)
+		                                  : ts3client_getServerConnectionHandlerSpeedLimitDown(serverConnectionHandlerID, &limit);
+		if (error != ERROR_ok || limit < MIN_TRANSFER_SPEED_LIMIT)
+			limit = std::max(upload ? m_options.uploadCapacity : m_options.downloadCapacity, MIN_TRANSFER_SPEED_LIMIT);
+		return limit;
+	}
+
+	static unsigned int setConnectionLimit(uint64 serverConnectionHandlerID, bool upload, uint64 limit) {
+		return upload ? ts3client_setServerConnectionHandlerSpeedLimitUp(serverConnectionHandlerID, limit)
+		              : ts3client_setServerConnectionHandlerSpeedLimitDown(serverConnectionHandlerID, limit);
+	}
+
+	void applyTransferLimits(std::vector<Demand>& demands, std::vector<anyID>& finished) const {
+		for (Demand& demand : demands) {
+			if (demand.want < 0) {
+				finished.push_back(demand.transferID);
+				continue;
+			}
+			if (!changed(demand.appliedLimit, demand.allocation))
+				continue;
+			if (ts3client_setTransferSpeedLimit(demand.transferID, demand.allocation) == ERROR_ok)
+				demand.appliedLimit = demand.allocation;
+		}
+	}
+
+	void storeApplied(const Demand& demand) {
+		if (Transfer* transfer = m_transfers.find(demand.transferID))
+			transfer->appliedLimit = demand.appliedLimit;
+	}
+
+	const SpeedLimitOptions              m_options;
+	mutable std::mutex                   m_mutex;          ///< guards m_transfers and the talker maps
+	std::mutex                           m_rebalanceMutex; ///< serializes rebalance(), guards the applied limits
+	FlatHashMap<anyID, Transfer>         m_transfers;
+	FlatHashMap<uint64, bool>            m_talkers;        ///< talkerKey() of everybody currently talking
+	FlatHashMap<uint64, unsigned int>    m_talkersPerConnection;
+	std::vector<uint64>                  m_disconnected;   ///< applied limits to forget on the next rebalance()
+	FlatHashMap<uint64, ConnectionLimit> m_appliedConnectionUp;
+	FlatHashMap<uint64, ConnectionLimit> m_appliedConnectionDown;
+	uint64                               m_appliedInstanceUp = 0;
+	uint64                               m_appliedInstanceDown = 0;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_SPEED_LIMIT_ALLOCATOR_H
@@ -0,0 +1,323 @@
+/*
+ * Demand driven channel subscriptions. Instead of ts3client_requestChannelSubscribeAll, which makes the server push
+ * every client of every channel, consumers declare which channels they are actually observing (watched channels and
+ * the channels visible in a viewport). The manager diffs that demand against the current subscriptions and issues
+ * batched ts3client_requestChannelSubscribe / ts3client_requestChannelUnsubscribe calls, with a linger period so
+ * channels scrolling in and out of view do not cause subscription churn.
+ */
+
+#ifndef TEAMSPEAK_EXT_SUBSCRIPTION_MANAGER_H
+#define TEAMSPEAK_EXT_SUBSCRIPTION_MANAGER_H
+
+//system
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//own
+#include "teamspeak/clientlib.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak_ext/async_request.h"
+#include "teamspeak_ext/flat_hash_map.h"
+
+namespace ts3ext {
+
+struct SubscriptionOptions {
+	size_t                    maxBatchSize = 64;                       ///< channels per subscribe / unsubscribe request
+	unsigned int              maxBatchesInFlight = 4;                  ///< per connection and direction
+	std::chrono::milliseconds linger = std::chrono::seconds(5);        ///< how long a channel stays subscribed after the last consumer lost interest
+	std::chrono::milliseconds requestTimeout = std::chrono::seconds(15);
+};
+
+struct SubscriptionStats {
+	uint64                    subscribeRequests = 0;   ///< ts3client_requestChannelSubscribe calls issued
+	uint64                    unsubscribeRequests = 0; ///< ts3client_requestChannelUnsubscribe calls issued
+	uint64                    failedRequests = 0;
+	size_t                    subscribedChannels = 0;  ///< currently subscribed across all connections
+	std::chrono::microseconds lastSyncDuration{0};     ///< request to onChannelSubscribeFinishedEvent of the last subscribe batch
+};
+
+/**
+ * @brief subscribes lazily to the channels consumers observe.
+ *
+ * Forward onChannelSubscribeEvent, onChannelSubscribeFinishedEvent, onChannelUnsubscribeEvent, onDelChannelEvent
+ * and onConnectStatusChangeEvent, and call flush() periodically (or right after changing the demand). The request
+ * results are correlated through the given AsyncRequests instance, which must outlive the manager.
+*/
+class SubscriptionManager {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	explicit SubscriptionManager(AsyncRequests& requests, const SubscriptionOptions& options = SubscriptionOptions())
+	    : m_requests(requests), m_options(options) {}
+
+	SubscriptionManager(const SubscriptionManager&) = delete;
+	SubscriptionManager& operator=(const SubscriptionManager&) = delete;
+
+	/** @brief keep a channel subscribed until unwatch() is called the same number of times */
+	void watch(uint64 serverConnectionHandlerID, uint64 channelID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		addDemand(connection(serverConnectionHandlerID), channelID, 1);
+	}
+
+	void unwatch(uint64 serverConnectionHandlerID, uint64 channelID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		addDemand(connection(serverConnectionHandlerID), channelID, -1);
+	}
+
+	/**
+	 * @brief replace the set of channels visible in a viewport
+	 *
+	 * @param viewID caller chosen id, allows several independent views per connection
+	 * @param channels the channels currently on screen
+	 * @param count number of entries in channels
+	*/
+	void setViewport(uint64 serverConnectionHandlerID, unsigned int viewID, const uint64* channels, size_t count) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Connection& conn = connection(serverConnectionHandlerID);
+		std::vector<uint64>& view = conn.views[viewID];
+		for (uint64 channelID : view)
+			addDemand(conn, channelID, -1);
+		view.assign(channels, channels + count);
+		for (uint64 channelID : view)
+			addDemand(conn, channelID, 1);
+	}
+
+	/**
+	 * @brief issue the subscribe / unsubscribe batches needed to match the current demand
+	 *
+	 * @return number of requests issued
+	*/
+	unsigned int flush(Clock::time_point now = Clock::now()) {
+		std::vector<std::unique_ptr<Batch>> batches;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_connections.forEach([&](uint64 serverConnectionHandlerID, Connection& conn) { plan(serverConnectionHandlerID, conn, now, batches); });
+		}
+		//submit outside the lock, completions may run synchronously and take it again
+		unsigned int issued = 0;
+		for (std::unique_ptr<Batch>& batch : batches) {
+			Batch* raw = batch.release();
+			const uint64 serverConnectionHandlerID = raw->serverConnectionHandlerID;
+			const uint64* channels = raw->channels.data();
+			const bool subscribe = raw->subscribe;
+			const unsigned int error = m_requests.submit(serverConnectionHandlerID, [=](const char* returnCode) {
+				return subscribe ? ts3client_requestChannelSubscribe(serverConnectionHandlerID, channels, returnCode)
+				                 : ts3client_requestChannelUnsubscribe(serverConnectionHandlerID, channels, returnCode);
+			}, &SubscriptionManager::onBatchComplete, raw, m_options.requestTimeout);
+			if (error != ERROR_ok) {
+				onBatchComplete(raw, RequestResult{error, false, std::chrono::nanoseconds::zero(), std::string()});
+				continue;
+			}
+			++issued;
+		}
+		return issued;
+	}
+
+	/** @brief whether the server confirmed the subscription of a channel */
+	bool isSubscribed(uint64 serverConnectionHandlerID, uint64 channelID) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const Connection* conn = m_connections.find(serverConnectionHandlerID);
+		const ChannelState* channel = conn != nullptr ? conn->channels.find(channelID) : nullptr;
+		return channel != nullptr && channel->state == STATE_SUBSCRIBED;
+	}
+
+	SubscriptionStats stats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	void onChannelSubscribeEvent(uint64 serverConnectionHandlerID, uint64 channelID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		setState(connection(serverConnectionHandlerID), channelID, STATE_SUBSCRIBED);
+	}
+
+	void onChannelSubscribeFinishedEvent(uint64 serverConnectionHandlerID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Connection* conn = m_connections.find(serverConnectionHandlerID);
+		if (conn == nullptr || conn->subscribeStarted.empty())
+			return;
+		m_stats.lastSyncDuration = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - conn->subscribeStarted.front());
+		conn->subscribeStarted.pop_front();
+	}
+
+	void onChannelUnsubscribeEvent(uint64 serverConnectionHandlerID, uint64 channelID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		setState(connection(serverConnectionHandlerID), channelID, STATE_UNSUBSCRIBED);
+	}
+
+	void onDelChannelEvent(uint64 serverConnectionHandlerID, uint64 channelID, anyID, const char*, const char*) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (Connection* conn = m_connections.find(serverConnectionHandlerID)) {
+			if (ChannelState* channel = conn->channels.find(channelID)) {
+				if (channel->state == STATE_SUBSCRIBED)
+					--m_stats.subscribedChannels;
+				conn->channels.erase(channelID);
+			}
+		}
+	}
+
+	void onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int /*errorNumber*/) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Connection* conn = m_connections.find(serverConnectionHandlerID);
+		if (conn == nullptr)
+			return;
+		if (newStatus == STATUS_DISCONNECTED) {
+			//keep the demand, a reconnect resubscribes everything that is still observed
+			conn->channels.forEach([&](uint64, ChannelState& channel) {
+				if (channel.state == STATE_SUBSCRIBED)
+					--m_stats.subscribedChannels;
+				channel.state = STATE_UNSUBSCRIBED;
+			});
+			conn->subscribeStarted.clear();
+			conn->connected = false;
+		} else if (newStatus == STATUS_CONNECTION_ESTABLISHED) {
+			conn->connected = true;
+		}
+	}
+
+private:
+	enum SubscriptionState {
+		STATE_UNSUBSCRIBED = 0,
+		STATE_SUBSCRIBING,
+		STATE_SUBSCRIBED,
+		STATE_UNSUBSCRIBING,
+	};
+
+	struct ChannelState {
+		int               demand = 0; ///< number of watchers and viewports containing the channel
+		SubscriptionState state = STATE_UNSUBSCRIBED;
+		Clock::time_point idleSince;  ///< when demand dropped to 0
+	};
+
+	struct Connection {
+		FlatHashMap<uint64, ChannelState>              channels;
+		FlatHashMap<unsigned int, std::vector<uint64>> views;
+		std::deque<Clock::time_point>                  subscribeStarted; ///< one entry per subscribe batch awaiting onChannelSubscribeFinishedEvent
+		unsigned int                                   subscribesInFlight = 0;
+		unsigned int                                   unsubscribesInFlight = 0;
+		bool                                           connected = true;
+	};
+
+	struct Batch {
+		SubscriptionManager* owner;
+		uint64               serverConnectionHandlerID;
+		bool                 subscribe;
+		std::vector<uint64>  channels; ///< 0 terminated, as expected by the client library
+		Clock::time_point    started;  ///< its entry in Connection::subscribeStarted, removed again if the batch fails
+	};
+
+	Connection& connection(uint64 serverConnectionHandlerID) { return m_connections[serverConnectionHandlerID]; }
+
+	void addDemand(Connection& conn, uint64 channelID, int delta) {
+		ChannelState& channel = conn.channels[channelID];
+		channel.demand += delta;
+		if (channel.demand <= 0) {
+			channel.demand = 0;
+			channel.idleSince = Clock::now();
+		}
+	}
+
+	void setState(Connection& conn, uint64 channelID, SubscriptionState state) {
+		ChannelState& channel = conn.channels[channelID];
+		if (channel.state == STATE_SUBSCRIBED && state != STATE_SUBSCRIBED)
+			--m_stats.subscribedChannels;
+		else if (channel.state != STATE_SUBSCRIBED && state == STATE_SUBSCRIBED)
+			++m_stats.subscribedChannels;
+		channel.state = state;
+	}
+
+	void plan(uint64 serverConnectionHandlerID, Connection& conn, Clock::time_point now, std::vector<std::unique_ptr<Batch>>& batches) {
+		if (!conn.connected)
+			return;
+		std::unique_ptr<Batch> subscribe;
+		std::unique_ptr<Batch> unsubscribe;
+		conn.channels.forEach([&](uint64 channelID, ChannelState& channel) {
+			if (channel.demand > 0 && channel.state == STATE_UNSUBSCRIBED) {
+				if (appendTo(subscribe, serverConnectionHandlerID, true, conn.subscribesInFlight, conn, batches, channelID))
+					channel.state = STATE_SUBSCRIBING;
+			} else if (channel.demand == 0 && channel.state == STATE_SUBSCRIBED && now - channel.idleSince >= m_options.linger) {
+				if (appendTo(unsubscribe, serverConnectionHandlerID, false, conn.unsubscribesInFlight, conn, batches, channelID)) {
+					channel.state = STATE_UNSUBSCRIBING;
+					--m_stats.subscribedChannels;
+				}
+			}
+		});
+		closeBatch(subscribe, conn, batches);
+		closeBatch(unsubscribe, conn, batches);
+	}
+
+	bool appendTo(std::unique_ptr<Batch>& batch, uint64 serverConnectionHandlerID, bool subscribe, unsigned int& inFlight, Connection& conn,
+	              std::vector<std::unique_ptr<Batch>>& batches, uint64 channelID) {
+		if (batch && batch->channels.size() >= m_options.maxBatchSize)
+			closeBatch(batch, conn, batches);
+		if (!batch) {
+			if (inFlight >= m_options.maxBatchesInFlight)
+				return false;
+			++inFlight;
+			batch.reset(new Batch{this, serverConnectionHandlerID, subscribe, std::vector<uint64>(), Clock::time_point()});
+			batch->channels.reserve(m_options.maxBatchSize + 1);
+		}
+		batch->channels.push_back(channelID);
+		return true;
+	}
+
+	void closeBatch(std::unique_ptr<Batch>& batch, Connection& conn, std::vector<std::unique_ptr<Batch>>& batches) {
+		if (!batch)
+			return;
+		batch->channels.push_back(0);
+		if (batch->subscribe) {
+			batch->started = Clock::now();
+			conn.subscribeStarted.push_back(batch->started);
+			++m_stats.subscribeRequests;
+		} else {
+			++m_stats.unsubscribeRequests;
+		}
+		batches.push_back(std::move(batch));
+	}
+
+	static void onBatchComplete(void* context, const RequestResult& result) {
+		std::unique_ptr<Batch> batch(static_cast<Batch*>(context));
+		SubscriptionManager& self = *batch->owner;
+		std::lock_guard<std::mutex> lock(self.m_mutex);
+		Connection* conn = self.m_connections.find(batch->serverConnectionHandlerID);
+		if (conn == nullptr)
+			return;
+		if (batch->subscribe)
+			--conn->subscribesInFlight;
+		else
+			--conn->unsubscribesInFlight;
+		const bool failed = result.error != ERROR_ok && result.error != ERROR_ok_no_update && result.error != ERROR_client_already_subscribed &&
+		                    result.error != ERROR_client_not_subscribed;
+		if (failed) {
+			++self.m_stats.failedRequests;
+			//later batches may have been planned meanwhile, drop this batch's own entry and not the newest
+			if (batch->subscribe) {
+				const auto started = std::find(conn->subscribeStarted.begin(), conn->subscribeStarted.end(), batch->started);
+				if (started != conn->subscribeStarted.end())
+					conn->subscribeStarted.erase(started);
+			}
+		}
+		//channels without a (un)subscribe event fall back to the state the server answered with
+		const SubscriptionState pending = batch->subscribe ? STATE_SUBSCRIBING : STATE_UNSUBSCRIBING;
+		const SubscriptionState outcome = (batch->subscribe != failed) ? STATE_SUBSCRIBED : STATE_UNSUBSCRIBED;
+		for (uint64 channelID : batch->channels) {
+			ChannelState* channel = channelID != 0 ? conn->channels.find(channelID) : nullptr;
+			if (channel != nullptr && channel->state == pending)
+				self.setState(*conn, channelID, outcome);
+		}
+	}
+
+	AsyncRequests&                  m_requests;
+	const SubscriptionOptions       m_options;
+	mutable std::mutex              m_mutex;
+	FlatHashMap<uint64, Connection> m_connections;
+	SubscriptionStats               m_stats;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_SUBSCRIPTION_MANAGER_H
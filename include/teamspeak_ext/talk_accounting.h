@@ -0,0 +1,382 @@
+/*
+ * Talk time accounting from talk start / stop edges: per client and per channel talk time, crosstalk (time with more
+ * than one speaker in a channel) and speaker turns. Per client state lives in a fixed array indexed by anyID, and
+ * aggregates are added to rings of time buckets when an edge arrives, so queries over the last minute or hour sum at
+ * most 60 buckets instead of scanning raw events.
+ */
+
+#ifndef TEAMSPEAK_EXT_TALK_ACCOUNTING_H
+#define TEAMSPEAK_EXT_TALK_ACCOUNTING_H
+
+//system
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//own
+#include "teamspeak/clientlib.h"
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+#include "teamspeak_ext/flat_hash_map.h"
+
+namespace ts3ext {
+
+struct TalkCounters {
+	uint64 talkMs = 0;      ///< client: own talk time. channel / server: time with at least one speaker
+	uint64 crosstalkMs = 0; ///< channel / server: time with at least two speakers in the same channel
+	uint64 turns = 0;       ///< talk starts by a different speaker than the previous one in the channel
+
+	TalkCounters& operator+=(const TalkCounters& other) {
+		talkMs += other.talkMs;
+		crosstalkMs += other.crosstalkMs;
+		turns += other.turns;
+		return *this;
+	}
+};
+
+/**
+ * @brief ring of SLOTS time buckets of widthMs each
+*/
+template <size_t SLOTS>
+class TalkBuckets {
+public:
+	explicit TalkBuckets(int64_t widthMs) : m_widthMs(widthMs) {}
+
+	/** @brief spread the interval [startMs, endMs) over the buckets it covers */
+	void addInterval(int64_t startMs, int64_t endMs, uint64 TalkCounters::*field) {
+		while (startMs < endMs) {
+			const int64_t bucketEnd = (startMs / m_widthMs + 1) * m_widthMs;
+			const int64_t end = bucketEnd < endMs ? bucketEnd : endMs;
+			if (TalkCounters* slot = bucket(startMs))
+				slot->*field += static_cast<uint64>(end - startMs);
+			startMs = end;
+		}
+	}
+
+	void addTurn(int64_t atMs) {
+		if (TalkCounters* slot = bucket(atMs))
+			++slot->turns;
+	}
+
+	/** @brief sum of the buckets overlapping [nowMs - windowMs, nowMs], windowMs is rounded up to whole buckets */
+	TalkCounters sum(int64_t nowMs, int64_t windowMs) const {
+		TalkCounters total;
+		const int64_t newest = nowMs / m_widthMs;
+		int64_t count = (windowMs + m_widthMs - 1) / m_widthMs;
+		if (count > static_cast<int64_t>(SLOTS))
+			count = SLOTS;
+		for (int64_t index = newest - count + 1; index <= newest; ++index) {
+			const Slot& slot = m_slots[static_cast<size_t>(index) % SLOTS];
+			if (slot.index == index)
+				total += slot.counters;
+		}
+		return total;
+	}
+
+	int64_t span() const { return m_widthMs * static_cast<int64_t>(SLOTS); }
+
+private:
+	struct Slot {
+		int64_t      index = -1;
+		TalkCounters counters;
+	};
+
+	/*bucket for a point in time, recycled if it still holds an older period. nullptr if the time is too old.*/
+	TalkCounters* bucket(int64_t atMs) {
+		const int64_t index = atMs / m_widthMs;
+		Slot& slot = m_slots[static_cast<size_t>(index) % SLOTS];
+		if (slot.index > index)
+			return nullptr;
+		if (slot.index != index) {
+			slot.index = index;
+			slot.counters = TalkCounters();
+		}
+		return &slot.counters;
+	}
+
+	int64_t m_widthMs;
+	Slot    m_slots[SLOTS];
+};
+
+/** @brief last minute in seconds and last hour in minutes */
+struct TalkWindows {
+	TalkBuckets<60> seconds{1000};
+	TalkBuckets<60> minutes{60000};
+
+	void addInterval(int64_t startMs, int64_t endMs, uint64 TalkCounters::*field) {
+		seconds.addInterval(startMs, endMs, field);
+		minutes.addInterval(startMs, endMs, field);
+	}
+
+	void addTurn(int64_t atMs) {
+		seconds.addTurn(atMs);
+		minutes.addTurn(atMs);
+	}
+
+	TalkCounters sum(int64_t nowMs, int64_t windowMs) const {
+		return windowMs <= seconds.span() ? seconds.sum(nowMs, windowMs) : minutes.sum(nowMs, windowMs);
+	}
+};
+
+/**
+ * @brief talk statistics of one or more servers (server side) or server connections (client side)
+ *
+ * Server: forward onClientStartTalkingEvent, onClientStopTalkingEvent, onClientMoved and onClientDisconnected.
+ * Client: forward onTalkStatusChangeEvent and onConnectStatusChangeEvent, a move is noticed on the next talk edge.
+ * startTalking() and stopTalking() can also be fed directly, e.g. to replay recorded edges with a custom clock.
+*/
+class TalkAccounting {
+public:
+	/** @brief milliseconds of a monotonic clock */
+	typedef int64_t (*Clock)();
+
+	explicit TalkAccounting(Clock clock = &steadyMs) : m_clock(clock) {}
+
+	TalkAccounting(const TalkAccounting&) = delete;
+	TalkAccounting& operator=(const TalkAccounting&) = delete;
+
+	void startTalking(uint64 scopeID, anyID clientID, uint64 channelID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Scope& scope = scopeFor(scopeID);
+		ClientState& client = scope.clients[clientID];
+		const int64_t now = m_clock();
+		if (client.talkStartMs != NOT_TALKING) {
+			if (client.channelID == channelID)
+				return;
+			stop(scope, clientID, client, now);
+		}
+		start(scope, clientID, client, channelID, now);
+	}
+
+	void stopTalking(uint64 scopeID, anyID clientID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::unique_ptr<Scope>* scope = m_scopes.find(scopeID);
+		if (scope == nullptr)
+			return;
+		ClientState& client = (*scope)->clients[clientID];
+		if (client.talkStartMs != NOT_TALKING)
+			stop(**scope, clientID, client, m_clock());
+	}
+
+	/** @brief totals since the scope was first seen, including talking still in progress */
+	TalkCounters clientTotals(uint64 scopeID, anyID clientID) const { return query(scopeID, clientID, 0, QUERY_CLIENT, -1); }
+	TalkCounters channelTotals(uint64 scopeID, uint64 channelID) const { return query(scopeID, 0, channelID, QUERY_CHANNEL, -1); }
+	TalkCounters serverTotals(uint64 scopeID) const { return query(scopeID, 0, 0, QUERY_SCOPE, -1); }
+
+	/** @brief counters of the last window, up to one hour. Windows above a minute have minute granularity. */
+	TalkCounters clientRecent(uint64 scopeID, anyID clientID, std::chrono::milliseconds window) const {
+		return query(scopeID, clientID, 0, QUERY_CLIENT, window.count());
+	}
+	TalkCounters channelRecent(uint64 scopeID, uint64 channelID, std::chrono::milliseconds window) const {
+		return query(scopeID, 0, channelID, QUERY_CHANNEL, window.count());
+	}
+	TalkCounters serverRecent(uint64 scopeID, std::chrono::milliseconds window) const { return query(scopeID, 0, 0, QUERY_SCOPE, window.count()); }
+
+	void forgetScope(uint64 scopeID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_scopes.erase(scopeID);
+	}
+
+	//server library callbacks
+	void onClientStartTalkingEvent(uint64 serverID, anyID clientID) {
+		uint64 channelID = 0;
+		if (ts3server_getChannelOfClient(serverID, clientID, &channelID) == ERROR_ok)
+			startTalking(serverID, clientID, channelID);
+	}
+
+	void onClientStopTalkingEvent(uint64 serverID, anyID clientID) { stopTalking(serverID, clientID); }
+
+	void onClientMoved(uint64 serverID, anyID clientID, uint64 /*oldChannelID*/, uint64 newChannelID) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::unique_ptr<Scope>* scope = m_scopes.find(serverID);
+		if (scope == nullptr)
+			return;
+		ClientState& client = (*scope)->clients[clientID];
+		if (client.talkStartMs == NOT_TALKING)
+			return;
+		const int64_t now = m_clock();
+		stop(**scope, clientID, client, now);
+		start(**scope, clientID, client, newChannelID, now);
+	}
+
+	void onClientDisconnected(uint64 serverID, anyID clientID, uint64 /*channelID*/) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::unique_ptr<Scope>* scope = m_scopes.find(serverID);
+		if (scope == nullptr)
+			return;
+		ClientState& client = (*scope)->clients[clientID];
+		if (client.talkStartMs != NOT_TALKING)
+			stop(**scope, clientID, client, m_clock());
+		//the id is reused by the next client
+		client = ClientState();
+		(*scope)->clientWindows.erase(clientID);
+	}
+
+	//client library callbacks
+	void onTalkStatusChangeEvent(uint64 serverConnectionHandlerID, int status, int isReceivedWhisper, anyID clientID) {
+		if (status == STATUS_TALKING && isReceivedWhisper == 0) {
+			uint64 channelID = 0;
+			if (ts3client_getChannelOfClient(serverConnectionHandlerID, clientID, &channelID) == ERROR_ok)
+				startTalking(serverConnectionHandlerID, clientID, channelID);
+		} else if (status == STATUS_NOT_TALKING) {
+			stopTalking(serverConnectionHandlerID, clientID);
+		}
+	}
+
+	void onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int /*errorNumber*/) {
+		if (newStatus == STATUS_DISCONNECTED)
+			forgetScope(serverConnectionHandlerID);
+	}
+
+private:
+	static const int64_t NOT_TALKING = INT64_MIN;
+	static const size_t  CLIENT_SLOTS = 65536; ///< one per anyID value
+
+	enum QueryKind { QUERY_CLIENT, QUERY_CHANNEL, QUERY_SCOPE };
+
+	struct ClientState {
+		int64_t      talkStartMs = NOT_TALKING;
+		uint64       channelID = 0;
+		TalkCounters totals;
+	};
+
+	struct ChannelState {
+		unsigned int speakers = 0;
+		int64_t      talkStartMs = 0;
+		int64_t      crosstalkStartMs = 0;
+		anyID        lastSpeaker = 0;
+		TalkCounters totals;
+		TalkWindows  windows;
+	};
+
+	struct Scope {
+		std::vector<ClientState>                          clients = std::vector<ClientState>(CLIENT_SLOTS);
+		FlatHashMap<anyID, std::unique_ptr<TalkWindows>>  clientWindows; ///< only for clients that talked
+		FlatHashMap<uint64, std::unique_ptr<ChannelState>> channels;
+		unsigned int                                      speakers = 0;
+		int64_t                                           talkStartMs = 0;
+		TalkCounters                                      totals;
+		TalkWindows                                       windows;
+	};
+
+	static int64_t steadyMs() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	Scope& scopeFor(uint64 scopeID) {
+		std::unique_ptr<Scope>& scope = m_scopes[scopeID];
+		if (!scope)
+			scope.reset(new Scope());
+		return *scope;
+	}
+
+	static ChannelState& channelFor(Scope& scope, uint64 channelID) {
+		std::unique_ptr<ChannelState>& channel = scope.channels[channelID];
+		if (!channel)
+			channel.reset(new ChannelState());
+		return *channel;
+	}
+
+	static TalkWindows& clientWindowsFor(Scope& scope, anyID clientID) {
+		std::unique_ptr<TalkWindows>& windows = scope.clientWindows[clientID];
+		if (!windows)
+			windows.reset(new TalkWindows());
+		return *windows;
+	}
+
+	/*called with the lock held*/
+	static void start(Scope& scope, anyID clientID, ClientState& client, uint64 channelID, int64_t nowMs) {
+		client.talkStartMs = nowMs;
+		client.channelID = channelID;
+		ChannelState& channel = channelFor(scope, channelID);
+		if (channel.lastSpeaker != clientID) {
+			channel.lastSpeaker = clientID;
+			channel.windows.addTurn(nowMs);
+			channel.totals.turns++;
+			scope.windows.addTurn(nowMs);
+			scope.totals.turns++;
+			clientWindowsFor(scope, clientID).addTurn(nowMs);
+			client.totals.turns++;
+		}
+		if (channel.speakers++ == 0)
+			channel.talkStartMs = nowMs;
+		else if (channel.speakers == 2)
+			channel.crosstalkStartMs = nowMs;
+		if (scope.speakers++ == 0)
+			scope.talkStartMs = nowMs;
+	}
+
+	/*called with the lock held, closes the intervals the client was part of*/
+	static void stop(Scope& scope, anyID clientID, ClientState& client, int64_t nowMs) {
+		const int64_t startMs = client.talkStartMs;
+		client.talkStartMs = NOT_TALKING;
+		client.totals.talkMs += static_cast<uint64>(nowMs - startMs);
+		clientWindowsFor(scope, clientID).addInterval(startMs, nowMs, &TalkCounters::talkMs);
+
+		ChannelState& channel = channelFor(scope, client.channelID);
+		if (channel.speakers == 2) {
+			channel.totals.crosstalkMs += static_cast<uint64>(nowMs - channel.crosstalkStartMs);
+			channel.windows.addInterval(channel.crosstalkStartMs, nowMs, &TalkCounters::crosstalkMs);
+			scope.totals.crosstalkMs += static_cast<uint64>(nowMs - channel.crosstalkStartMs);
+			scope.windows.addInterval(channel.crosstalkStartMs, nowMs, &TalkCounters::crosstalkMs);
+		}
+		if (--channel.speakers == 0) {
+			channel.totals.talkMs += static_cast<uint64>(nowMs - channel.talkStartMs);
+			channel.windows.addInterval(channel.talkStartMs, nowMs, &TalkCounters::talkMs);
+		}
+		if (--scope.speakers == 0) {
+			scope.totals.talkMs += static_cast<uint64>(nowMs - scope.talkStartMs);
+			scope.windows.addInterval(scope.talkStartMs, nowMs, &TalkCounters::talkMs);
+		}
+	}
+
+	/*closed intervals come from the buckets, the open interval of a running talk is added on top. windowMs < 0 for totals.*/
+	TalkCounters query(uint64 scopeID, anyID clientID, uint64 channelID, QueryKind kind, int64_t windowMs) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		TalkCounters result;
+		const std::unique_ptr<Scope>* scope = m_scopes.find(scopeID);
+		if (scope == nullptr)
+			return result;
+		const int64_t now = m_clock();
+		const int64_t windowStart = windowMs < 0 ? INT64_MIN : now - windowMs;
+		auto open = [&](int64_t startMs) { return static_cast<uint64>(now - (startMs > windowStart ? startMs : windowStart)); };
+		if (kind == QUERY_CLIENT) {
+			const ClientState& client = (*scope)->clients[clientID];
+			const std::unique_ptr<TalkWindows>* windows = (*scope)->clientWindows.find(clientID);
+			result = windowMs < 0 ? client.totals : windows != nullptr ? (*windows)->sum(now, windowMs) : TalkCounters();
+			if (client.talkStartMs != NOT_TALKING)
+				result.talkMs += open(client.talkStartMs);
+		} else if (kind == QUERY_CHANNEL) {
+			const std::unique_ptr<ChannelState>* channel = (*scope)->channels.find(channelID);
+			if (channel == nullptr)
+				return result;
+			const ChannelState& state = **channel;
+			result = windowMs < 0 ? state.totals : state.windows.sum(now, windowMs);
+			if (state.speakers > 0)
+				result.talkMs += open(state.talkStartMs);
+			if (state.speakers > 1)
+				result.crosstalkMs += open(state.crosstalkStartMs);
+		} else {
+			const Scope& state = **scope;
+			result = windowMs < 0 ? state.totals : state.windows.sum(now, windowMs);
+			if (state.speakers > 0)
+				result.talkMs += open(state.talkStartMs);
+			state.channels.forEach([&](uint64, const std::unique_ptr<ChannelState>& channel) {
+				if (channel->speakers > 1)
+					result.crosstalkMs += open(channel->crosstalkStartMs);
+			});
+		}
+		return result;
+	}
+
+	const Clock                                m_clock;
+	mutable std::mutex                         m_mutex;
+	FlatHashMap<uint64, std::unique_ptr<Scope>> m_scopes; ///< by serverID or serverConnectionHandlerID
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_TALK_ACCOUNTING_H
@@ -0,0 +1,418 @@
+/*
+ * Text message pipeline for onServerTextMessageEvent and onChannelTextMessageEvent. The callback only copies the
+ * message into a pooled slab and hands it to a bounded queue; filter stages (moderation) and sink stages (archive,
+ * search index, webhooks) run on their own worker threads. Stages are connected by bounded queues that block the stage
+ * before them when full, and the callback never blocks: if the first queue or the slab budget is exhausted the message
+ * is dropped and counted, so a chat burst in a crowded channel cannot stall the server.
+ */
+
+#ifndef TEAMSPEAK_EXT_TEXT_MESSAGE_PIPELINE_H
+#define TEAMSPEAK_EXT_TEXT_MESSAGE_PIPELINE_H
+
+//system
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+
+namespace ts3ext {
+
+struct TextMessage {
+	uint64       serverID = 0;
+	uint64       channelID = 0;  ///< 0 for server messages
+	anyID        invokerClientID = 0;
+	int64_t      receivedMs = 0; ///< system clock, milliseconds since the epoch
+	uint64       sequence = 0;   ///< in order of arrival over all servers
+	const char*  text = nullptr; ///< nul terminated utf8, valid while the stage handles the message
+	size_t       length = 0;     ///< at most TS3_MAX_SIZE_TEXTMESSAGE
+	unsigned int flags = 0;      ///< free for filters to mark messages for later stages
+};
+
+struct TextPipelineOptions {
+	size_t slabSize = 256 * 1024;  ///< messages are carved from slabs of this size, at least one maximum size message fits
+	size_t maxSlabs = 64;          ///< memory budget, messages arriving while all slabs are in use are dropped
+	size_t ingressCapacity = 4096; ///< queue in front of the first stage, full means drop
+};
+
+struct TextStageOptions {
+	size_t       capacity = 1024; ///< queue in front of the stage, the stage before it waits while it is full
+	unsigned int threads = 1;     ///< more than one handles messages out of order
+};
+
+struct TextStageStats {
+	std::string name;
+	uint64      handled = 0;
+	uint64      rejected = 0; ///< filters: messages not passed on
+	size_t      backlog = 0;  ///< messages waiting in the queue of the stage
+};
+
+struct TextPipelineStats {
+	uint64                      received = 0;
+	uint64                      dropped = 0; ///< ingress queue full or no slab free
+	size_t                      slabsInUse = 0;
+	std::vector<TextStageStats> stages;      ///< filters first, in the order they were added
+};
+
+/**
+ * @brief copies text messages off the callback thread and runs them through filter and sink stages
+ *
+ * Add filters and sinks, start(), and forward the two text message callbacks. Filters run one after the other and may
+ * change flags; a message a filter rejects reaches no later stage. Every message passing all filters is handed to every
+ * sink. The server library has delivered a message before the callback runs, filters cannot stop delivery; reject
+ * messages synchronously in permSendTextMessage for that.
+*/
+class TextMessagePipeline {
+public:
+	/** @brief false stops the message */
+	typedef std::function<bool(TextMessage& message)> Filter;
+	typedef std::function<void(const TextMessage& message)> Sink;
+
+	explicit TextMessagePipeline(const TextPipelineOptions& options = TextPipelineOptions())
+	    : m_options(options), m_slabSize(std::max(options.slabSize, nodeSize(TS3_MAX_SIZE_TEXTMESSAGE))), m_ingress(options.ingressCapacity) {}
+
+	~TextMessagePipeline() { stop(); }
+
+	TextMessagePipeline(const TextMessagePipeline&) = delete;
+	TextMessagePipeline& operator=(const TextMessagePipeline&) = delete;
+
+	/** @brief only before start() */
+	void addFilter(const std::string& name, Filter filter, const TextStageOptions& options = TextStageOptions()) {
+		m_filters.emplace_back(new Stage(name, options));
+		m_filters.back()->filter = std::move(filter);
+	}
+
+	/** @brief only before start() */
+	void addSink(const std::string& name, Sink sink, const TextStageOptions& options = TextStageOptions()) {
+		m_sinks.emplace_back(new Stage(name, options));
+		m_sinks.back()->sink = std::move(sink);
+	}
+
+	void start() {
+		if (m_started)
+			return;
+		m_started = true;
+		for (size_t i = 0; i < m_filters.size(); ++i) {
+			Queue& input = i == 0 ? m_ingress : m_filters[i]->queue;
+			for (unsigned int t = 0; t < std::max(m_filters[i]->options.threads, 1u); ++t)
+				m_filters[i]->workers.emplace_back([this, i, &input] { filterLoop(i, input); });
+		}
+		if (m_filters.empty())
+			m_router = std::thread([this] { routeLoop(); });
+		for (size_t i = 0; i < m_sinks.size(); ++i) {
+			for (unsigned int t = 0; t < std::max(m_sinks[i]->options.threads, 1u); ++t)
+				m_sinks[i]->workers.emplace_back([this, i] { sinkLoop(i); });
+		}
+	}
+
+	/** @brief finish the messages already accepted and join the workers */
+	void stop() {
+		if (!m_started || m_stopped)
+			return;
+		m_stopped = true;
+		//stage by stage, so everything a stage passes on is still taken by the next one
+		m_ingress.close();
+		if (m_router.joinable())
+			m_router.join();
+		for (size_t i = 0; i < m_filters.size(); ++i) {
+			if (i != 0)
+				m_filters[i]->queue.close();
+			joinWorkers(*m_filters[i]);
+		}
+		for (auto& sink : m_sinks) {
+			sink->queue.close();
+			joinWorkers(*sink);
+		}
+	}
+
+	void onServerTextMessageEvent(uint64 serverID, anyID invokerClientID, const char* textMessage) { submit(serverID, 0, invokerClientID, textMessage); }
+
+	void onChannelTextMessageEvent(uint64 serverID, anyID invokerClientID, uint64 targetChannelID, const char* textMessage) {
+		submit(serverID, targetChannelID, invokerClientID, textMessage);
+	}
+
+	TextPipelineStats stats() const {
+		TextPipelineStats stats;
+		stats.received = m_received;
+		stats.dropped = m_dropped;
+		{
+			std::lock_guard<std::mutex> lock(m_slabMutex);
+			stats.slabsInUse = m_slabs.size() - m_freeSlabs.size();
+		}
+		for (size_t i = 0; i < m_filters.size(); ++i)
+			stats.stages.push_back(stageStats(*m_filters[i], i == 0 ? m_ingress : m_filters[i]->queue));
+		for (const auto& sink : m_sinks)
+			stats.stages.push_back(stageStats(*sink, sink->queue));
+		return stats;
+	}
+
+private:
+	struct Slab {
+		std::unique_ptr<char[]> data;
+		size_t                  used = 0;
+		std::atomic<size_t>     refs{0}; ///< messages carved from it, plus one while it is the slab being carved
+	};
+
+	/*header of a message inside a slab, the text follows it*/
+	struct Node {
+		TextMessage         message;
+		Slab*               slab;
+		std::atomic<size_t> pending; ///< stages still holding the message
+	};
+
+	/*bounded multi producer multi consumer queue*/
+	class Queue {
+	public:
+		explicit Queue(size_t capacity) : m_capacity(std::max<size_t>(capacity, 1)) {}
+
+		bool tryPush(Node* node) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_closed || m_nodes.size() >= m_capacity)
+				return false;
+			m_nodes.push_back(node);
+			m_notEmpty.notify_one();
+			return true;
+		}
+
+		/*waits while full*/
+		bool push(Node* node) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_notFull.wait(lock, [this] { return m_closed || m_nodes.size() < m_capacity; });
+			if (m_closed)
+				return false;
+			m_nodes.push_back(node);
+			m_notEmpty.notify_one();
+			return true;
+		}
+
+		/*false once closed and drained*/
+		bool pop(Node*& node) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_notEmpty.wait(lock, [this] { return m_closed || !m_nodes.empty(); });
+			if (m_nodes.empty())
+				return false;
+			node = m_nodes.front();
+			m_nodes.pop_front();
+			m_notFull.notify_one();
+			return true;
+		}
+
+		void close() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closed = true;
+			m_notEmpty.notify_all();
+			m_notFull.notify_all();
+		}
+
+		size_t size() const {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_nodes.size();
+		}
+
+	private:
+		const size_t            m_capacity;
+		mutable std::mutex      m_mutex;
+		std::condition_variable m_notEmpty;
+		std::condition_variable m_notFull;
+		std::deque<Node*>       m_nodes;
+		bool                    m_closed = false;
+	};
+
+	struct Stage {
+		Stage(const std::string& stageName, const TextStageOptions& stageOptions) : name(stageName), options(stageOptions), queue(stageOptions.capacity) {}
+
+		const std::string        name;
+		const TextStageOptions   options;
+		Queue                    queue; ///< unused by the first filter, it reads the ingress queue
+		Filter                   filter;
+		Sink                     sink;
+		std::vector<std::thread> workers;
+		std::atomic<uint64>      handled{0};
+		std::atomic<uint64>      rejected{0};
+	};
+
+	static size_t alignUp(size_t size) {
+		const size_t alignment = alignof(std::max_align_t);
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	static size_t nodeSize(size_t length) { return alignUp(sizeof(Node) + length + 1); }
+
+	static TextStageStats stageStats(const Stage& stage, const Queue& queue) {
+		TextStageStats stats;
+		stats.name = stage.name;
+		stats.handled = stage.handled;
+		stats.rejected = stage.rejected;
+		stats.backlog = queue.size();
+		return stats;
+	}
+
+	static void joinWorkers(Stage& stage) {
+		for (std::thread& worker : stage.workers)
+			worker.join();
+		stage.workers.clear();
+	}
+
+	void submit(uint64 serverID, uint64 channelID, anyID invokerClientID, const char* text) {
+		++m_received;
+		size_t length = text != nullptr ? std::strlen(text) : 0;
+		if (length > TS3_MAX_SIZE_TEXTMESSAGE)
+			length = TS3_MAX_SIZE_TEXTMESSAGE;
+		Node* node = allocate(length);
+		if (node == nullptr) {
+			++m_dropped;
+			return;
+		}
+		char* copy = reinterpret_cast<char*>(node + 1);
+		if (length != 0)
+			std::memcpy(copy, text, length);
+		copy[length] = '\0';
+		TextMessage& message = node->message;
+		message.serverID = serverID;
+		message.channelID = channelID;
+		message.invokerClientID = invokerClientID;
+		message.receivedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		message.sequence = m_sequence++;
+		message.text = copy;
+		message.length = length;
+		if (!m_started || m_stopped || !m_ingress.tryPush(node)) {
+			++m_dropped;
+			release(node);
+		}
+	}
+
+	/*carves a node from the open slab, nullptr if the slab budget is used up*/
+	Node* allocate(size_t length) {
+		const size_t size = nodeSize(length);
+		Slab* slab;
+		size_t offset;
+		{
+			std::lock_guard<std::mutex> lock(m_slabMutex);
+			if (m_open == nullptr || m_open->used + size > m_slabSize) {
+				if (m_open != nullptr) {
+					Slab* retired = m_open;
+					m_open = nullptr;
+					releaseLocked(retired);
+				}
+				if (!m_freeSlabs.empty()) {
+					m_open = m_freeSlabs.back();
+					m_freeSlabs.pop_back();
+				} else if (m_slabs.size() < std::max<size_t>(m_options.maxSlabs, 1)) {
+					m_slabs.emplace_back(new Slab());
+					m_open = m_slabs.back().get();
+					m_open->data.reset(new char[m_slabSize]);
+				} else {
+					return nullptr;
+				}
+				m_open->used = 0;
+				m_open->refs = 1;
+			}
+			slab = m_open;
+			offset = slab->used;
+			slab->used += size;
+			++slab->refs;
+		}
+		Node* node = new (slab->data.get() + offset) Node();
+		node->slab = slab;
+		node->pending = 1;
+		return node;
+	}
+
+	/*a stage is done with the node, the last one returns its space*/
+	void release(Node* node) {
+		if (--node->pending != 0)
+			return;
+		Slab* slab = node->slab;
+		node->~Node();
+		if (--slab->refs == 0) {
+			std::lock_guard<std::mutex> lock(m_slabMutex);
+			m_freeSlabs.push_back(slab);
+		}
+	}
+
+	/*called with the slab lock held*/
+	void releaseLocked(Slab* slab) {
+		if (--slab->refs == 0)
+			m_freeSlabs.push_back(slab);
+	}
+
+	/*hand a node that passed all filters to every sink*/
+	void fanOut(Node* node) {
+		if (m_sinks.empty()) {
+			release(node);
+			return;
+		}
+		node->pending = m_sinks.size();
+		for (auto& sink : m_sinks) {
+			if (!sink->queue.push(node))
+				release(node);
+		}
+	}
+
+	void filterLoop(size_t index, Queue& input) {
+		Stage& stage = *m_filters[index];
+		Node* node = nullptr;
+		while (input.pop(node)) {
+			const bool passed = stage.filter(node->message);
+			++stage.handled;
+			if (!passed) {
+				++stage.rejected;
+				release(node);
+			} else if (index + 1 < m_filters.size()) {
+				if (!m_filters[index + 1]->queue.push(node))
+					release(node);
+			} else {
+				fanOut(node);
+			}
+		}
+	}
+
+	/*moves messages from the ingress queue to the sinks when there are no filters*/
+	void routeLoop() {
+		Node* node = nullptr;
+		while (m_ingress.pop(node))
+			fanOut(node);
+	}
+
+	void sinkLoop(size_t index) {
+		Stage& stage = *m_sinks[index];
+		Node* node = nullptr;
+		while (stage.queue.pop(node)) {
+			stage.sink(node->message);
+			++stage.handled;
+			release(node);
+		}
+	}
+
+	const TextPipelineOptions           m_options;
+	const size_t                        m_slabSize;
+	Queue                               m_ingress;
+	std::vector<std::unique_ptr<Stage>> m_filters;
+	std::vector<std::unique_ptr<Stage>> m_sinks;
+	std::thread                         m_router;
+	std::atomic<bool>                   m_started{false};
+	std::atomic<bool>                   m_stopped{false};
+	std::atomic<uint64>                 m_sequence{0};
+	std::atomic<uint64>                 m_received{0};
+	std::atomic<uint64>                 m_dropped{0};
+	mutable std::mutex                  m_slabMutex;
+	std::vector<std::unique_ptr<Slab>>  m_slabs;
+	std::vector<Slab*>                  m_freeSlabs;
+	Slab*                               m_open = nullptr; ///< slab new messages are carved from
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_TEXT_MESSAGE_PIPELINE_H
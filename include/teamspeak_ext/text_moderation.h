@@ -0,0 +1,387 @@
+/*
+ * Multi pattern matcher for blocking text messages in permSendTextMessage. Banned phrases are compiled into an
+ * Aho-Corasick automaton that is turned into a full DFA over byte classes, so a message is scanned in one pass with one
+ * table load per byte, independent of the number of patterns. Patterns and messages are case folded (ASCII, Latin-1,
+ * Latin Extended-A, Greek and Cyrillic); folding keeps the UTF-8 length, so match offsets refer to the original text.
+ * Compiled sets are immutable and swapped atomically while callbacks are scanning.
+ */
+
+#ifndef TEAMSPEAK_EXT_TEXT_MODERATION_H
+#define TEAMSPEAK_EXT_TEXT_MODERATION_H
+
+//system
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+
+namespace ts3ext {
+
+struct ModerationPattern {
+	std::string text;              ///< utf8, matched case insensitively
+	uint32_t    id = 0;            ///< reported with matches, e.g. a category
+	bool        wholeWord = false; ///< only match if not preceded or followed by a letter or digit
+};
+
+struct PatternMatch {
+	uint32_t id = 0;
+	size_t   offset = 0; ///< byte offset in the scanned text
+	size_t   length = 0; ///< in bytes
+};
+
+struct PatternBenchmark {
+	std::chrono::microseconds compile{0};
+	size_t                    states = 0;
+	size_t                    memoryBytes = 0;
+	double                    nsPerMessage = 0; ///< full scan, no early exit
+};
+
+/**
+ * @brief compiled, immutable set of patterns
+*/
+class PatternSet {
+public:
+	explicit PatternSet(const std::vector<ModerationPattern>& patterns) { compile(patterns); }
+
+	PatternSet(const PatternSet&) = delete;
+	PatternSet& operator=(const PatternSet&) = delete;
+
+	size_t states() const { return m_terminal.size(); }
+	size_t memoryBytes() const { return m_next.size() * sizeof(uint32_t) + m_terminal.size() * 2 * sizeof(int32_t) + m_patterns.size() * sizeof(Pattern); }
+
+	/** @brief first match in the text, the one ending first */
+	bool findFirst(const char* text, size_t length, PatternMatch* match = nullptr) const {
+		bool found = false;
+		scan(text, length, [&](const PatternMatch& hit) {
+			if (match != nullptr)
+				*match = hit;
+			found = true;
+			return false;
+		});
+		return found;
+	}
+
+	/** @brief every match in order of its end, visit(const PatternMatch&) returns false to stop */
+	template <typename Visit>
+	void findAll(const char* text, size_t length, Visit&& visit) const {
+		scan(text, length, visit);
+	}
+
+	/** @brief the text as patterns and messages are compared, foldCodePoint applied to every code point */
+	static std::string fold(const std::string& text) {
+		std::string folded(text);
+		unsigned char* bytes = reinterpret_cast<unsigned char*>(&folded[0]);
+		for (size_t i = 0; i < folded.size();) {
+			if (bytes[i] < 0x80) {
+				bytes[i] = static_cast<unsigned char>(foldCodePoint(bytes[i]));
+				++i;
+				continue;
+			}
+			uint32_t cp = 0;
+			const size_t size = decode(bytes, i, folded.size(), cp);
+			if (size == 0) {
+				++i;
+				continue;
+			}
+			const uint32_t lower = foldCodePoint(cp);
+			if (lower != cp)
+				encode2(lower, bytes + i);
+			i += size;
+		}
+		return folded;
+	}
+
+	/** @brief simple case folding of one code point, keeps the UTF-8 length */
+	static uint32_t foldCodePoint(uint32_t cp) {
+		if (cp < 0x80)
+			return cp >= 'A' && cp <= 'Z' ? cp + 0x20 : cp;
+		if (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7)
+			return cp + 0x20;
+		if (cp >= 0x100 && cp <= 0x17F) {
+			if (cp == 0x178)
+				return 0xFF;
+			if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E))
+				return cp % 2 == 1 ? cp + 1 : cp;
+			if (cp == 0x130 || cp == 0x131 || cp == 0x138 || cp == 0x149 || cp == 0x17F)
+				return cp;
+			return cp % 2 == 0 ? cp + 1 : cp;
+		}
+		if (cp >= 0x391 && cp <= 0x3A9 && cp != 0x3A2)
+			return cp + 0x20;
+		if (cp >= 0x410 && cp <= 0x42F)
+			return cp + 0x20;
+		if (cp >= 0x400 && cp <= 0x40F)
+			return cp + 0x50;
+		return cp;
+	}
+
+	/**
+	 * @brief compile patternCount random patterns and scan random messages of messageBytes
+	 *
+	 * @param measureFor minimum scanning time, at least one message is always scanned
+	*/
+	static PatternBenchmark benchmark(size_t patternCount = 10000, size_t messageBytes = TS3_MAX_SIZE_TEXTMESSAGE,
+	                                  std::chrono::milliseconds measureFor = std::chrono::milliseconds(200)) {
+		std::mt19937 random(42);
+		std::uniform_int_distribution<int> letter('a', 'z');
+		std::vector<ModerationPattern> patterns(patternCount);
+		for (size_t i = 0; i < patternCount; ++i) {
+			const size_t size = 5 + random() % 11;
+			for (size_t c = 0; c < size; ++c)
+				patterns[i].text.push_back(static_cast<char>(letter(random)));
+			patterns[i].id = static_cast<uint32_t>(i);
+		}
+		std::string message;
+		while (message.size() < messageBytes)
+			message.push_back(random() % 6 == 0 ? ' ' : static_cast<char>(random() % 4 == 0 ? letter(random) - 0x20 : letter(random)));
+
+		PatternBenchmark result;
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		const PatternSet set(patterns);
+		result.compile = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+		result.states = set.states();
+		result.memoryBytes = set.memoryBytes();
+
+		unsigned long long count = 0, matches = 0;
+		std::chrono::steady_clock::duration elapsed;
+		started = std::chrono::steady_clock::now();
+		do {
+			set.findAll(message.data(), message.size(), [&](const PatternMatch&) { return ++matches != 0; });
+			++count;
+			elapsed = std::chrono::steady_clock::now() - started;
+		} while (elapsed < measureFor);
+		result.nsPerMessage = std::chrono::duration<double, std::nano>(elapsed).count() / count;
+		return result;
+	}
+
+private:
+	static const uint32_t REPORTS = 0x80000000u; ///< flag in m_next, the target state ends at least one pattern
+
+	struct Pattern {
+		uint32_t id;
+		uint32_t length;
+		bool     wholeWord;
+	};
+
+	/*decodes the code point starting at text[i], 0 on invalid or truncated sequences*/
+	static size_t decode(const unsigned char* text, size_t i, size_t length, uint32_t& cp) {
+		const unsigned char lead = text[i];
+		const size_t size = lead >= 0xF8 ? 0 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 0;
+		if (size == 0 || i + size > length)
+			return 0;
+		cp = lead & (0x7F >> size);
+		for (size_t k = 1; k < size; ++k) {
+			if ((text[i + k] & 0xC0) != 0x80)
+				return 0;
+			cp = cp << 6 | (text[i + k] & 0x3F);
+		}
+		return size;
+	}
+
+	/*only called for code points below 0x800 that folding changed, they stay two bytes*/
+	static void encode2(uint32_t cp, unsigned char* out) {
+		out[0] = static_cast<unsigned char>(0xC0 | cp >> 6);
+		out[1] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+	}
+
+	static bool wordByte(unsigned char c) { return c >= 0x80 || (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '_'; }
+
+	void compile(const std::vector<ModerationPattern>& patterns) {
+		std::vector<std::string> folded;
+		bool used[256] = {false};
+		for (const ModerationPattern& pattern : patterns) {
+			if (pattern.text.empty())
+				continue;
+			folded.push_back(fold(pattern.text));
+			m_patterns.push_back(Pattern{pattern.id, static_cast<uint32_t>(pattern.text.size()), pattern.wholeWord});
+			for (unsigned char c : folded.back())
+				used[c] = true;
+		}
+		//class 0 is every byte no pattern contains, from any state it leads back to the root
+		m_classes = 1;
+		uint16_t classOf[256] = {0};
+		for (int c = 0; c < 256; ++c) {
+			if (used[c])
+				classOf[c] = static_cast<uint16_t>(m_classes++);
+		}
+		for (int c = 0; c < 256; ++c)
+			m_rawClass[c] = classOf[c < 0x80 ? foldCodePoint(c) : c];
+
+		//trie with sparse children, then breadth first fail links that fill in the dense table
+		std::vector<std::vector<std::pair<uint16_t, uint32_t>>> children(1);
+		m_terminal.assign(1, -1);
+		for (size_t p = 0; p < folded.size(); ++p) {
+			uint32_t state = 0;
+			for (unsigned char c : folded[p]) {
+				const uint16_t cls = classOf[c];
+				uint32_t next = 0;
+				for (const auto& child : children[state]) {
+					if (child.first == cls)
+						next = child.second;
+				}
+				if (next == 0) {
+					next = static_cast<uint32_t>(children.size());
+					children[state].emplace_back(cls, next);
+					children.emplace_back();
+					m_terminal.push_back(-1);
+				}
+				state = next;
+			}
+			//of duplicate phrases the first one wins
+			if (m_terminal[state] < 0)
+				m_terminal[state] = static_cast<int32_t>(p);
+		}
+
+		const size_t states = children.size();
+		m_next.assign(states * m_classes, 0);
+		m_dictionary.assign(states, -1);
+		std::vector<uint32_t> fail(states, 0);
+		std::deque<uint32_t> queue;
+		for (const auto& child : children[0]) {
+			m_next[child.first] = child.second;
+			queue.push_back(child.second);
+		}
+		while (!queue.empty()) {
+			const uint32_t state = queue.front();
+			queue.pop_front();
+			const uint32_t* failRow = &m_next[fail[state] * m_classes];
+			uint32_t* row = &m_next[state * m_classes];
+			for (size_t cls = 0; cls < m_classes; ++cls)
+				row[cls] = failRow[cls];
+			for (const auto& child : children[state]) {
+				row[child.first] = child.second;
+				fail[child.second] = failRow[child.first];
+				queue.push_back(child.second);
+			}
+			//nearest state on the fail chain that ends a pattern, so every match is reported
+			const uint32_t suffix = fail[state];
+			m_dictionary[state] = m_terminal[suffix] >= 0 ? static_cast<int32_t>(suffix) : m_dictionary[suffix];
+		}
+		//transitions hold the row of the target and whether it reports, the scan loop needs no other lookup
+		for (uint32_t& target : m_next)
+			target = static_cast<uint32_t>(target * m_classes) | (m_terminal[target] >= 0 || m_dictionary[target] >= 0 ? REPORTS : 0);
+	}
+
+	/*report every pattern ending at end in state, false once visit wants to stop*/
+	template <typename Visit>
+	bool report(const unsigned char* text, size_t length, size_t end, uint32_t state, Visit& visit) const {
+		for (int32_t s = m_terminal[state] >= 0 ? static_cast<int32_t>(state) : m_dictionary[state]; s >= 0; s = m_dictionary[s]) {
+			const Pattern& pattern = m_patterns[m_terminal[s]];
+			const size_t offset = end - pattern.length;
+			if (pattern.wholeWord && ((offset > 0 && wordByte(text[offset - 1])) || (end < length && wordByte(text[end]))))
+				continue;
+			if (!visit(PatternMatch{pattern.id, offset, pattern.length}))
+				return false;
+		}
+		return true;
+	}
+
+	template <typename Visit>
+	void scan(const char* input, size_t length, Visit&& visit) const {
+		if (m_patterns.empty())
+			return;
+		const unsigned char* text = reinterpret_cast<const unsigned char*>(input);
+		const uint32_t* next = m_next.data();
+		const size_t classes = m_classes;
+		uint32_t row = 0;
+		for (size_t i = 0; i < length;) {
+			unsigned char folded[4];
+			const unsigned char* bytes = text + i;
+			size_t size = 1;
+			if (text[i] >= 0x80) {
+				uint32_t cp = 0;
+				size = decode(text, i, length, cp);
+				if (size == 0) {
+					size = 1;
+				} else {
+					const uint32_t lower = foldCodePoint(cp);
+					if (lower != cp) {
+						encode2(lower, folded);
+						bytes = folded;
+					}
+				}
+			}
+			for (size_t k = 0; k < size; ++k) {
+				const uint32_t target = next[row + m_rawClass[bytes[k]]];
+				row = target & ~REPORTS;
+				if ((target & REPORTS) != 0 && !report(text, length, i + k + 1, static_cast<uint32_t>(row / classes), visit))
+					return;
+			}
+			i += size;
+		}
+	}
+
+	std::vector<Pattern>  m_patterns;
+	size_t                m_classes = 1;
+	uint16_t              m_rawClass[256] = {0}; ///< byte class of a text byte, ASCII folded in
+	std::vector<uint32_t> m_next;                ///< dense transitions, m_classes per state: row of the target | REPORTS
+	std::vector<int32_t>  m_terminal;            ///< pattern ending in the state, -1 if none
+	std::vector<int32_t>  m_dictionary;          ///< next state on the fail chain that ends a pattern, -1 if none
+};
+
+struct TextModerationStats {
+	uint64 scanned = 0;
+	uint64 blocked = 0;
+	uint64 swaps = 0;
+};
+
+/**
+ * @brief blocks text messages containing a pattern, with atomically replaceable pattern sets
+*/
+class TextModerator {
+public:
+	explicit TextModerator(unsigned int rejectError = ERROR_permissions) : m_rejectError(rejectError) {}
+
+	TextModerator(const TextModerator&) = delete;
+	TextModerator& operator=(const TextModerator&) = delete;
+
+	/** @brief compile outside the callbacks and swap in, scans already running finish on the old set */
+	void setPatterns(const std::vector<ModerationPattern>& patterns) { swap(std::make_shared<const PatternSet>(patterns)); }
+
+	void swap(std::shared_ptr<const PatternSet> patterns) {
+		std::atomic_store(&m_patterns, std::move(patterns));
+		++m_swaps;
+	}
+
+	std::shared_ptr<const PatternSet> patterns() const { return std::atomic_load(&m_patterns); }
+
+	unsigned int permSendTextMessage(uint64 /*serverID*/, const struct ClientMiniExport* /*client*/, anyID /*targetMode*/,
+	                                 uint64 /*targetClientOrChannel*/, const char* textMessage) {
+		const std::shared_ptr<const PatternSet> patterns = std::atomic_load(&m_patterns);
+		if (!patterns || textMessage == nullptr)
+			return ERROR_ok;
+		++m_scanned;
+		if (!patterns->findFirst(textMessage, std::strlen(textMessage)))
+			return ERROR_ok;
+		++m_blocked;
+		return m_rejectError;
+	}
+
+	TextModerationStats stats() const {
+		TextModerationStats stats;
+		stats.scanned = m_scanned;
+		stats.blocked = m_blocked;
+		stats.swaps = m_swaps;
+		return stats;
+	}
+
+private:
+	const unsigned int                m_rejectError;
+	std::shared_ptr<const PatternSet> m_patterns; ///< only accessed through std::atomic_load / std::atomic_store
+	std::atomic<uint64>               m_scanned{0};
+	std::atomic<uint64>               m_blocked{0};
+	std::atomic<uint64>               m_swaps{0};
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_TEXT_MODERATION_H
@@ -0,0 +1,96 @@
+/*
+ * Per thread pool of reusable objects. Objects go back to a small free list of the thread that releases them and keep
+ * their capacity, so scratch structures rebuilt in every callback stop allocating once each thread has warmed up,
+ * without any locking between threads.
+ */
+
+#ifndef TEAMSPEAK_EXT_THREAD_LOCAL_POOL_H
+#define TEAMSPEAK_EXT_THREAD_LOCAL_POOL_H
+
+//system
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace ts3ext {
+
+/**
+ * @brief hands out T objects cleared with T::clear(), at most MAX_CACHED idle objects are kept per thread
+ *
+ * Nested acquisitions on one thread get distinct objects. A lease may be released on another thread, the object then
+ * joins that thread's free list.
+*/
+template <typename T, size_t MAX_CACHED = 4>
+class ThreadLocalPool {
+public:
+	/** @brief owns the object until destroyed, then returns it to the pool */
+	class Lease {
+	public:
+		Lease(Lease&& other) noexcept : m_object(other.m_object) { other.m_object = nullptr; }
+
+		Lease& operator=(Lease&& other) noexcept {
+			if (this != &other) {
+				reset();
+				m_object = other.m_object;
+				other.m_object = nullptr;
+			}
+			return *this;
+		}
+
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+
+		~Lease() { reset(); }
+
+		T& operator*() const { return *m_object; }
+		T* operator->() const { return m_object; }
+
+	private:
+		friend class ThreadLocalPool;
+
+		explicit Lease(T* object) : m_object(object) {}
+
+		void reset() {
+			if (m_object != nullptr)
+				release(m_object);
+			m_object = nullptr;
+		}
+
+		T* m_object;
+	};
+
+	static Lease acquire() {
+		std::vector<std::unique_ptr<T>>& idle = freeList();
+		if (idle.empty())
+			return Lease(new T());
+		T* object = idle.back().release();
+		idle.pop_back();
+		object->clear();
+		return Lease(object);
+	}
+
+	/** @brief idle objects of the calling thread */
+	static size_t cached() { return freeList().size(); }
+
+private:
+	static std::vector<std::unique_ptr<T>>& freeList() {
+		thread_local std::vector<std::unique_ptr<T>> idle = [] {
+			std::vector<std::unique_ptr<T>> list;
+			list.reserve(MAX_CACHED);
+			return list;
+		}();
+		return idle;
+	}
+
+	static void release(T* object) {
+		std::vector<std::unique_ptr<T>>& idle = freeList();
+		if (idle.size() < MAX_CACHED)
+			idle.emplace_back(object);
+		else
+			delete object;
+	}
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_THREAD_LOCAL_POOL_H
@@ -0,0 +1,109 @@
+/*
+ * Hierarchical timer wheel. Four levels of 64 slots each cover 2^24 ticks; a timer is placed on the level that
+ * matches its distance and cascades one level down whenever the lower level wraps around, timers further out go round
+ * the top level again. Scheduling is O(1), and advancing costs O(1) per tick plus O(1) per timer that expires or
+ * cascades, independent of how many timers are pending.
+ */
+
+#ifndef TEAMSPEAK_EXT_TIMER_WHEEL_H
+#define TEAMSPEAK_EXT_TIMER_WHEEL_H
+
+//system
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ts3ext {
+
+/**
+ * @brief timers identified by a caller chosen 64 bit id, with deadlines in ticks
+ *
+ * Timers cannot be cancelled: callers keep the current deadline next to the id and ignore expirations that no longer
+ * match, which also makes pushing a deadline back free until the old timer fires. Not thread safe.
+*/
+class TimerWheel {
+public:
+	static const unsigned int LEVELS = 4;
+	static const unsigned int SLOT_BITS = 6;
+	static const uint64_t     SLOTS = uint64_t(1) << SLOT_BITS;
+	static const uint64_t     RANGE = uint64_t(1) << (SLOT_BITS * LEVELS); ///< ticks covered by one round of the top level
+
+	explicit TimerWheel(uint64_t now = 0) : m_now(now) {}
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	/** @brief a deadline that is not in the future fires on the next tick */
+	void schedule(uint64_t deadline, uint64_t id) {
+		if (deadline <= m_now)
+			deadline = m_now + 1;
+		place(Timer{deadline, id});
+		++m_size;
+	}
+
+	/**
+	 * @brief run all ticks up to and including now, calling expire(id, deadline) for every timer due
+	 *
+	 * expire may schedule new timers.
+	*/
+	template <typename Expire>
+	void advance(uint64_t now, Expire&& expire) {
+		while (m_now < now) {
+			if (m_size == 0) {
+				m_now = now;
+				return;
+			}
+			++m_now;
+			unsigned int top = 0;
+			while (top + 1 < LEVELS && (m_now & ((uint64_t(1) << (SLOT_BITS * (top + 1))) - 1)) == 0)
+				++top;
+			for (unsigned int level = top; level > 0; --level)
+				cascade(level);
+
+			std::vector<Timer> due;
+			due.swap(m_slots[0][m_now & (SLOTS - 1)]);
+			for (const Timer& timer : due) {
+				if (timer.deadline > m_now) {
+					place(timer);
+					continue;
+				}
+				--m_size;
+				expire(timer.id, timer.deadline);
+			}
+		}
+	}
+
+	uint64_t now() const { return m_now; }
+	size_t   size() const { return m_size; }
+
+private:
+	struct Timer {
+		uint64_t deadline;
+		uint64_t id;
+	};
+
+	/*a timer beyond RANGE waits in the farthest slot and is placed again when it comes down*/
+	void place(const Timer& timer) {
+		const uint64_t distance = timer.deadline - m_now < RANGE ? timer.deadline - m_now : RANGE - 1;
+		unsigned int level = 0;
+		while (level + 1 < LEVELS && distance >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+			++level;
+		m_slots[level][((m_now + distance) >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(timer);
+	}
+
+	/*the slot of this level that starts at m_now moves to the levels below*/
+	void cascade(unsigned int level) {
+		std::vector<Timer> moving;
+		moving.swap(m_slots[level][(m_now >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+		for (const Timer& timer : moving)
+			place(timer);
+	}
+
+	std::vector<Timer> m_slots[LEVELS][SLOTS];
+	uint64_t           m_now;      ///< last tick that was run
+	size_t             m_size = 0;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_TIMER_WHEEL_H
@@ -0,0 +1,374 @@
+/*
+ * Parallel file transfer manager on top of ts3client_sendFile and ts3client_requestFile. Transfers are queued by
+ * priority and started as long as the per server connection and per channel concurrency limits allow, so many files
+ * are in flight at the same time and total sync time is bound by bandwidth instead of round trips. Completion is
+ * driven by the onFileTransferStatusEvent callback, interrupted transfers are restarted with the resume flag set.
+ */
+
+#ifndef TEAMSPEAK_EXT_TRANSFER_MANAGER_H
+#define TEAMSPEAK_EXT_TRANSFER_MANAGER_H
+
+//system
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+//own
+#include "teamspeak/clientlib.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak_ext/async_request.h"
+#include "teamspeak_ext/flat_hash_map.h"
+
+namespace ts3ext {
+
+enum TransferDirection {
+	TRANSFER_UPLOAD = 0, ///< ts3client_sendFile
+	TRANSFER_DOWNLOAD,   ///< ts3client_requestFile
+};
+
+struct TransferResult {
+	uint64                   jobID;
+	unsigned int             error;     ///< ERROR_file_transfer_complete on success, otherwise the failure reason from the @ref Ts3ErrorType enum
+	unsigned int             attempts;  ///< number of times the transfer was started
+	uint64                   fileSize;  ///< remote file size as reported by the last status event
+	std::chrono::nanoseconds duration;  ///< from the first start to completion
+};
+
+struct TransferJob {
+	uint64            serverConnectionHandlerID = 0;
+	uint64            channelID = 0;
+	std::string       channelPassword;  ///< empty if the channel has no password
+	std::string       file;             ///< file name on the server, e.g. "/textures/stone.png"
+	std::string       localDirectory;   ///< absolute source (upload) or destination (download) directory
+	TransferDirection direction = TRANSFER_DOWNLOAD;
+	bool              overwrite = true;
+	int               priority = 0;     ///< higher values start first
+	std::function<void(const TransferResult&)> onComplete; ///< optional, called on the thread that completed the job
+};
+
+struct TransferLimits {
+	unsigned int              maxPerConnection = 8; ///< concurrent transfers per server connection handler
+	unsigned int              maxPerChannel = 4;    ///< concurrent transfers per channel
+	unsigned int              maxAttempts = 5;      ///< starts per job, including resumed restarts
+	std::chrono::milliseconds retryDelay = std::chrono::milliseconds(500); ///< doubled after every failed attempt
+};
+
+/**
+ * @brief queues file transfers and runs them with bounded concurrency.
+ *
+ * Forward onFileTransferStatusEvent to the method of the same name. Call pump() to start queued transfers, e.g. from
+ * a worker thread using waitForChange(), or use runUntilIdle() to process a whole batch.
+*/
+class TransferManager {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	explicit TransferManager(AsyncRequests& requests, const TransferLimits& limits = TransferLimits())
+	    : m_requests(requests), m_limits(limits) {}
+
+	TransferManager(const TransferManager&) = delete;
+	TransferManager& operator=(const TransferManager&) = delete;
+
+	/** @return id identifying the job in its TransferResult */
+	uint64 enqueue(TransferJob job) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const uint64 jobID = ++m_lastJobID;
+		Job& entry = m_jobs[jobID];
+		entry.spec = std::move(job);
+		m_queue.push(QueueEntry{entry.spec.priority, jobID, Clock::time_point()});
+		m_changed.notify_all();
+		return jobID;
+	}
+
+	/**
+	 * @brief start as many queued transfers as the limits allow
+	 *
+	 * @return number of transfers started
+	*/
+	unsigned int pump() {
+		std::vector<uint64> toStart;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const Clock::time_point now = Clock::now();
+			std::vector<QueueEntry> blocked;
+			while (!m_queue.empty()) {
+				QueueEntry next = m_queue.top();
+				m_queue.pop();
+				Job* job = m_jobs.find(next.jobID);
+				if (job == nullptr)
+					continue;
+				if (next.notBefore > now || !reserveSlot(job->spec)) {
+					blocked.push_back(next);
+					continue;
+				}
+				toStart.push_back(next.jobID);
+			}
+			for (const QueueEntry& entry : blocked)
+				m_queue.push(entry);
+		}
+		unsigned int started = 0;
+		for (uint64 jobID : toStart)
+			started += start(jobID) ? 1 : 0;
+		return started;
+	}
+
+	/** @brief block until a transfer finished or a job was queued, or the timeout passed */
+	void waitForChange(std::chrono::milliseconds timeout) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		const uint64 generation = m_generation;
+		m_changed.wait_for(lock, timeout, [&] { return m_generation != generation; });
+	}
+
+	/** @brief pump until every queued and running job completed */
+	void runUntilIdle() {
+		for (;;) {
+			pump();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_jobs.empty())
+					return;
+			}
+			waitForChange(m_limits.retryDelay);
+		}
+	}
+
+	size_t queuedCount() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_queue.size();
+	}
+
+	size_t runningCount() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_byTransferID.size();
+	}
+
+	/**
+	 * @brief sum of bytes done and total bytes of all running transfers
+	 *
+	 * Reads the local transfer state of the client library, does not cause network traffic.
+	*/
+	void progress(uint64* bytesDone, uint64* bytesTotal) const {
+		*bytesDone = 0;
+		*bytesTotal = 0;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_byTransferID.forEach([&](anyID transferID, uint64) {
+			uint64 done = 0, total = 0;
+			if (ts3client_getTransferFileSizeDone(transferID, &done) == ERROR_ok && ts3client_getTransferFileSize(transferID, &total) == ERROR_ok) {
+				*bytesDone += done;
+				*bytesTotal += total;
+			}
+		});
+	}
+
+	void onFileTransferStatusEvent(anyID transferID, unsigned int status, const char* /*statusMessage*/, uint64 remotefileSize, uint64 /*serverConnectionHandlerID*/) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		const uint64* jobID = m_byTransferID.find(transferID);
+		if (jobID == nullptr) {
+			//may overtake the registration in start() for very small files, picked up there
+			if (m_starting > 0)
+				m_earlyStatus[transferID] = EarlyStatus{status, remotefileSize};
+			return;
+		}
+		const uint64 id = *jobID;
+		m_byTransferID.erase(transferID);
+		Job* job = m_jobs.find(id);
+		if (job == nullptr)
+			return;
+		job->fileSize = remotefileSize;
+		job->transferID = 0;
+		finishAttempt(id, *job, status, lock);
+	}
+
+private:
+	struct Job {
+		TransferJob       spec;
+		unsigned int      attempts = 0;
+		anyID             transferID = 0;
+		uint64            fileSize = 0;
+		unsigned int      finishedAttempt = 0; ///< last attempt that ended, answers and registrations of it are stale
+		bool              resume = false;
+		Clock::time_point firstStart;
+	};
+
+	struct QueueEntry {
+		int               priority;
+		uint64            jobID;
+		Clock::time_point notBefore;
+
+		bool operator<(const QueueEntry& other) const {
+			//max heap on priority, FIFO (lower job id first) within a priority
+			return priority != other.priority ? priority < other.priority : jobID > other.jobID;
+		}
+	};
+
+	struct EarlyStatus {
+		unsigned int status;
+		uint64       remotefileSize;
+	};
+
+	struct StartContext {
+		TransferManager* owner;
+		uint64           jobID;
+		unsigned int     attempt;
+	};
+
+	bool reserveSlot(const TransferJob& spec) {
+		unsigned int& perConnection = m_runningPerConnection[spec.serverConnectionHandlerID];
+		unsigned int& perChannel = m_runningPerChannel[channelKey(spec)];
+		if (perConnection >= m_limits.maxPerConnection || perChannel >= m_limits.maxPerChannel)
+			return false;
+		++perConnection;
+		++perChannel;
+		return true;
+	}
+
+	void releaseSlot(const TransferJob& spec) {
+		if (unsigned int* perConnection = m_runningPerConnection.find(spec.serverConnectionHandlerID)) {
+			if (--*perConnection == 0)
+				m_runningPerConnection.erase(spec.serverConnectionHandlerID);
+		}
+		if (unsigned int* perChannel = m_runningPerChannel.find(channelKey(spec))) {
+			if (--*perChannel == 0)
+				m_runningPerChannel.erase(channelKey(spec));
+		}
+	}
+
+	static uint64 channelKey(const TransferJob& spec) { return spec.channelID * 0x9E3779B97F4A7C15ULL ^ spec.serverConnectionHandlerID; }
+
+	bool start(uint64 jobID) {
+		TransferJob spec;
+		bool resume;
+		unsigned int attempt;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			Job* job = m_jobs.find(jobID);
+			if (job == nullptr)
+				return false;
+			if (job->attempts++ == 0)
+				job->firstStart = Clock::now();
+			attempt = job->attempts;
+			spec = job->spec;
+			resume = job->resume;
+			++m_starting;
+		}
+		anyID transferID = 0;
+		StartContext* context = new StartContext{this, jobID, attempt};
+		const unsigned int error = m_requests.submit(spec.serverConnectionHandlerID, [&](const char* returnCode) {
+			const int overwrite = resume ? 0 : (spec.overwrite ? 1 : 0);
+			if (spec.direction == TRANSFER_UPLOAD)
+				return ts3client_sendFile(spec.serverConnectionHandlerID, spec.channelID, spec.channelPassword.c_str(), spec.file.c_str(), overwrite,
+				                          resume ? 1 : 0, spec.localDirectory.c_str(), &transferID, returnCode);
+			return ts3client_requestFile(spec.serverConnectionHandlerID, spec.channelID, spec.channelPassword.c_str(), spec.file.c_str(), overwrite,
+			                             resume ? 1 : 0, spec.localDirectory.c_str(), &transferID, returnCode);
+		}, &TransferManager::onStartAnswered, context);
+		std::unique_lock<std::mutex> lock(m_mutex);
+		const EarlyStatus early = takeEarlyStatus(transferID);
+		//the answer may already have ended this attempt and requeued the job for the next one
+		Job* job = m_jobs.find(jobID);
+		const bool current = job != nullptr && job->attempts == attempt && job->finishedAttempt != attempt;
+		if (error != ERROR_ok) {
+			delete context;
+			if (current)
+				finishAttempt(jobID, *job, error, lock);
+			return false;
+		}
+		if (current && transferID != 0 && job->transferID == 0) {
+			if (early.status != ERROR_ok) {
+				job->fileSize = early.remotefileSize;
+				finishAttempt(jobID, *job, early.status, lock);
+				return true;
+			}
+			job->transferID = transferID;
+			m_byTransferID[transferID] = jobID;
+		}
+		return true;
+	}
+
+	/*called with the lock held when a start finished registering*/
+	EarlyStatus takeEarlyStatus(anyID transferID) {
+		EarlyStatus early{ERROR_ok, 0};
+		if (const EarlyStatus* found = m_earlyStatus.find(transferID)) {
+			early = *found;
+			m_earlyStatus.erase(transferID);
+		}
+		if (--m_starting == 0)
+			m_earlyStatus.clear(); //status of transfers not started by this manager
+		return early;
+	}
+
+	/*answer to the sendFile / requestFile command. Only failures matter, success is reported through onFileTransferStatusEvent.
+	  Without an answer in time the attempt ends as a retryable timeout, otherwise its slot would never be released*/
+	static void onStartAnswered(void* context, const RequestResult& result) {
+		StartContext* start = static_cast<StartContext*>(context);
+		TransferManager& self = *start->owner;
+		const uint64 jobID = start->jobID;
+		const unsigned int attempt = start->attempt;
+		delete start;
+		if (result.error == ERROR_ok)
+			return;
+		std::unique_lock<std::mutex> lock(self.m_mutex);
+		Job* job = self.m_jobs.find(jobID);
+		if (job == nullptr || job->attempts != attempt || job->finishedAttempt == attempt)
+			return; //the attempt already ended through its status event
+		const anyID transferID = job->transferID;
+		const uint64 serverConnectionHandlerID = job->spec.serverConnectionHandlerID;
+		if (transferID != 0)
+			self.m_byTransferID.erase(transferID);
+		job->transferID = 0;
+		const unsigned int status = result.timedOut ? static_cast<unsigned int>(ERROR_file_transfer_connection_timeout) : result.error;
+		self.finishAttempt(jobID, *job, status, lock);
+		lock.unlock();
+		//a late start would race the retry for the same file; its status event is ignored now it is unregistered
+		if (result.timedOut && transferID != 0)
+			ts3client_haltTransfer(serverConnectionHandlerID, transferID, 0, nullptr);
+	}
+
+	static bool isRetryable(unsigned int error) {
+		return error == ERROR_file_connection_lost || error == ERROR_file_transfer_connection_timeout || error == ERROR_connection_lost ||
+		       error == ERROR_canceled;
+	}
+
+	/*called with the lock held for the current attempt, exactly once per attempt; releases the lock to run the completion callback*/
+	void finishAttempt(uint64 jobID, Job& job, unsigned int status, std::unique_lock<std::mutex>& lock) {
+		job.finishedAttempt = job.attempts;
+		releaseSlot(job.spec);
+		++m_generation;
+		m_changed.notify_all();
+		if (status != ERROR_file_transfer_complete && isRetryable(status) && job.attempts < m_limits.maxAttempts) {
+			job.resume = true;
+			const auto delay = m_limits.retryDelay * (1 << (job.attempts < 10 ? job.attempts - 1 : 9));
+			m_queue.push(QueueEntry{job.spec.priority, jobID, Clock::now() + delay});
+			return;
+		}
+		TransferResult result{jobID, status, job.attempts, job.fileSize, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - job.firstStart)};
+		std::function<void(const TransferResult&)> onComplete = std::move(job.spec.onComplete);
+		m_jobs.erase(jobID);
+		lock.unlock();
+		if (onComplete)
+			onComplete(result);
+		lock.lock();
+	}
+
+	AsyncRequests&                    m_requests;
+	const TransferLimits              m_limits;
+	mutable std::mutex                m_mutex;
+	std::condition_variable           m_changed;
+	uint64                            m_generation = 0;
+	uint64                            m_lastJobID = 0;
+	unsigned int                      m_starting = 0; ///< start() calls between submit and registration
+	FlatHashMap<uint64, Job>          m_jobs;
+	FlatHashMap<anyID, uint64>        m_byTransferID;
+	FlatHashMap<anyID, EarlyStatus>   m_earlyStatus;
+	FlatHashMap<uint64, unsigned int> m_runningPerConnection;
+	FlatHashMap<uint64, unsigned int> m_runningPerChannel;
+	std::priority_queue<QueueEntry>   m_queue;
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_TRANSFER_MANAGER_H
@@ -0,0 +1,349 @@
+/*
+ * Snapshot of a virtual server: its properties, encryption key pair and channel tree. A snapshot is captured through
+ * the server library getters, travels between processes in a line based text form and is recreated in one call with
+ * ts3server_createVirtualServer2, keeping server and channel IDs.
+ */
+
+#ifndef TEAMSPEAK_EXT_VIRTUAL_SERVER_SNAPSHOT_H
+#define TEAMSPEAK_EXT_VIRTUAL_SERVER_SNAPSHOT_H
+
+//system
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//own
+#include "teamspeak/public_definitions.h"
+#include "teamspeak/public_errors.h"
+#include "teamspeak/serverlib.h"
+
+namespace ts3ext {
+
+enum SnapshotValueType {
+	SNAPSHOT_INT = 0,
+	SNAPSHOT_UINT64,
+	SNAPSHOT_STRING,
+};
+
+struct SnapshotVariable {
+	int               flag = 0; ///< VirtualServerProperties or ChannelProperties value
+	SnapshotValueType type = SNAPSHOT_STRING;
+	std::string       value;    ///< numbers in decimal
+};
+
+struct ChannelSnapshot {
+	uint64                        channelID = 0;
+	uint64                        parentChannelID = 0;
+	std::vector<SnapshotVariable> variables;
+};
+
+struct VirtualServerSnapshot {
+	uint64                        serverID = 0;
+	unsigned int                  port = 0;
+	std::string                   ip;
+	std::string                   keyPair;
+	unsigned int                  maxClients = 0;
+	std::vector<SnapshotVariable> variables;
+	std::vector<ChannelSnapshot>  channels; ///< parents before their sub channels
+
+	/**
+	 * @brief read a running server. Port and ip are not readable through the server library and are taken as given.
+	 *
+	 * Passwords are read in their stored, encrypted form, restore() passes them on as such.
+	*/
+	unsigned int capture(uint64 id, unsigned int serverPort, const std::string& serverIp) {
+		serverID = id;
+		port = serverPort;
+		ip = serverIp;
+		variables.clear();
+		channels.clear();
+
+		char* key = nullptr;
+		unsigned int error = ts3server_getVirtualServerKeyPair(id, &key);
+		if (error != ERROR_ok)
+			return error;
+		keyPair = key;
+		ts3server_freeMemory(key);
+		uint64 clients = 0;
+		if ((error = ts3server_getVirtualServerVariableAsUInt64(id, VIRTUALSERVER_MAXCLIENTS, &clients)) != ERROR_ok)
+			return error;
+		maxClients = static_cast<unsigned int>(clients);
+
+		static const SnapshotVariable serverVariables[] = {
+		    {VIRTUALSERVER_NAME, SNAPSHOT_STRING, ""},
+		    {VIRTUALSERVER_WELCOMEMESSAGE, SNAPSHOT_STRING, ""},
+		    {VIRTUALSERVER_PASSWORD, SNAPSHOT_STRING, ""},
+		    {VIRTUALSERVER_CODEC_ENCRYPTION_MODE, SNAPSHOT_INT, ""},
+		    {VIRTUALSERVER_ENCRYPTION_CIPHERS, SNAPSHOT_STRING, ""},
+		    {VIRTUALSERVER_MAX_DOWNLOAD_TOTAL_BANDWIDTH, SNAPSHOT_UINT64, ""},
+		    {VIRTUALSERVER_MAX_UPLOAD_TOTAL_BANDWIDTH, SNAPSHOT_UINT64, ""},
+		    {VIRTUALSERVER_LOG_FILETRANSFER, SNAPSHOT_INT, ""},
+		};
+		for (const SnapshotVariable& wanted : serverVariables) {
+			SnapshotVariable variable = wanted;
+			if (readServerVariable(id, variable))
+				variables.push_back(variable);
+		}
+
+		uint64* channelList = nullptr;
+		if ((error = ts3server_getChannelList(id, &channelList)) != ERROR_ok)
+			return error;
+		std::vector<ChannelSnapshot> unordered;
+		for (uint64* channelID = channelList; *channelID != 0; ++channelID) {
+			ChannelSnapshot channel;
+			channel.channelID = *channelID;
+			if ((error = ts3server_getParentChannelOfChannel(id, *channelID, &channel.parentChannelID)) != ERROR_ok)
+				break;
+			for (const SnapshotVariable& wanted : channelVariables()) {
+				SnapshotVariable variable = wanted;
+				if (readChannelVariable(id, *channelID, variable))
+					channel.variables.push_back(variable);
+			}
+			unordered.push_back(std::move(channel));
+		}
+		ts3server_freeMemory(channelList);
+		if (error != ERROR_ok)
+			return error;
+		channels = parentsFirst(std::move(unordered));
+		return ERROR_ok;
+	}
+
+	/** @brief start the server in this process with ts3server_createVirtualServer2 */
+	unsigned int restore(uint64* result) const {
+		TS3VirtualServerCreationParams* params = nullptr;
+		unsigned int error = ts3server_makeVirtualServerCreationParams(&params);
+		if (error != ERROR_ok)
+			return error;
+		if ((error = ts3server_setVirtualServerCreationParams(params, port, ip.c_str(), keyPair.c_str(), maxClients,
+		                                                      static_cast<unsigned int>(channels.size()), serverID)) != ERROR_ok)
+			return error;
+		TS3Variables* serverVars = nullptr;
+		if ((error = ts3server_getVirtualServerCreationParamsVariables(params, &serverVars)) != ERROR_ok)
+			return error;
+		for (const SnapshotVariable& variable : variables) {
+			if ((error = writeVariable(serverVars, variable)) != ERROR_ok)
+				return error;
+		}
+		for (size_t i = 0; i < channels.size(); ++i) {
+			TS3ChannelCreationParams* channelParams = nullptr;
+			if ((error = ts3server_getVirtualServerCreationParamsChannelCreationParams(params, static_cast<unsigned int>(i), &channelParams)) != ERROR_ok)
+				return error;
+			if ((error = ts3server_setChannelCreationParams(channelParams, channels[i].parentChannelID, channels[i].channelID)) != ERROR_ok)
+				return error;
+			TS3Variables* channelVars = nullptr;
+			if ((error = ts3server_getChannelCreationParamsVariables(channelParams, &channelVars)) != ERROR_ok)
+				return error;
+			for (const SnapshotVariable& variable : channels[i].variables) {
+				if ((error = writeVariable(channelVars, variable)) != ERROR_ok)
+					return error;
+			}
+		}
+		return ts3server_createVirtualServer2(params, VIRTUALSERVER_CREATE_FLAG_PASSWORDS_ENCRYPTED, result);
+	}
+
+	/** @brief line based text form, one line per server field, variable and channel */
+	std::string serialize() const {
+		std::ostringstream out;
+		out << "server " << serverID << ' ' << port << ' ' << maxClients << ' ' << escape(ip) << ' ' << escape(keyPair) << '\n';
+		for (const SnapshotVariable& variable : variables)
+			out << "var " << variable.flag << ' ' << variable.type << ' ' << escape(variable.value) << '\n';
+		for (const ChannelSnapshot& channel : channels) {
+			out << "channel " << channel.channelID << ' ' << channel.parentChannelID << '\n';
+			for (const SnapshotVariable& variable : channel.variables)
+				out << "cvar " << variable.flag << ' ' << variable.type << ' ' << escape(variable.value) << '\n';
+		}
+		return out.str();
+	}
+
+	bool parse(const std::string& text) {
+		*this = VirtualServerSnapshot();
+		std::istringstream in(text);
+		std::string line;
+		bool haveServer = false;
+		while (std::getline(in, line)) {
+			std::istringstream fields(line);
+			std::string kind;
+			fields >> kind;
+			if (kind == "server") {
+				std::string escapedIp, escapedKey;
+				if (!(fields >> serverID >> port >> maxClients >> escapedIp >> escapedKey))
+					return false;
+				ip = unescape(escapedIp);
+				keyPair = unescape(escapedKey);
+				haveServer = true;
+			} else if (kind == "var" || kind == "cvar") {
+				SnapshotVariable variable;
+				int type = 0;
+				std::string escaped;
+				if (!(fields >> variable.flag >> type >> escaped) || type < SNAPSHOT_INT || type > SNAPSHOT_STRING)
+					return false;
+				variable.type = static_cast<SnapshotValueType>(type);
+				variable.value = unescape(escaped);
+				if (kind == "var")
+					variables.push_back(variable);
+				else if (!channels.empty())
+					channels.back().variables.push_back(variable);
+				else
+					return false;
+			} else if (kind == "channel") {
+				ChannelSnapshot channel;
+				if (!(fields >> channel.channelID >> channel.parentChannelID))
+					return false;
+				channels.push_back(channel);
+			} else if (!kind.empty()) {
+				return false;
+			}
+		}
+		return haveServer;
+	}
+
+	/** @brief channel properties captured and restored, shared with code that replicates channel changes */
+	static const std::vector<SnapshotVariable>& channelVariables() {
+		static const std::vector<SnapshotVariable> list = {
+		    {CHANNEL_NAME, SNAPSHOT_STRING, ""},
+		    {CHANNEL_TOPIC, SNAPSHOT_STRING, ""},
+		    {CHANNEL_DESCRIPTION, SNAPSHOT_STRING, ""},
+		    {CHANNEL_PASSWORD, SNAPSHOT_STRING, ""},
+		    {CHANNEL_CODEC, SNAPSHOT_INT, ""},
+		    {CHANNEL_CODEC_QUALITY, SNAPSHOT_INT, ""},
+		    {CHANNEL_MAXCLIENTS, SNAPSHOT_INT, ""},
+		    {CHANNEL_MAXFAMILYCLIENTS, SNAPSHOT_INT, ""},
+		    {CHANNEL_ORDER, SNAPSHOT_UINT64, ""},
+		    {CHANNEL_FLAG_PERMANENT, SNAPSHOT_INT, ""},
+		    {CHANNEL_FLAG_SEMI_PERMANENT, SNAPSHOT_INT, ""},
+		    {CHANNEL_FLAG_DEFAULT, SNAPSHOT_INT, ""},
+		    {CHANNEL_FLAG_PASSWORD, SNAPSHOT_INT, ""},
+		    {CHANNEL_CODEC_IS_UNENCRYPTED, SNAPSHOT_INT, ""},
+		    {CHANNEL_SECURITY_SALT, SNAPSHOT_STRING, ""},
+		    {CHANNEL_DELETE_DELAY, SNAPSHOT_UINT64, ""},
+		};
+		return list;
+	}
+
+	/** @brief fills variable.value, false if the property is not available */
+	static bool readChannelVariable(uint64 serverID, uint64 channelID, SnapshotVariable& variable) {
+		const ChannelProperties flag = static_cast<ChannelProperties>(variable.flag);
+		if (variable.type == SNAPSHOT_INT) {
+			int value = 0;
+			if (ts3server_getChannelVariableAsInt(serverID, channelID, flag, &value) != ERROR_ok)
+				return false;
+			variable.value = std::to_string(value);
+		} else if (variable.type == SNAPSHOT_UINT64) {
+			uint64 value = 0;
+			if (ts3server_getChannelVariableAsUInt64(serverID, channelID, flag, &value) != ERROR_ok)
+				return false;
+			variable.value = std::to_string(value);
+		} else {
+			char* value = nullptr;
+			if (ts3server_getChannelVariableAsString(serverID, channelID, flag, &value) != ERROR_ok)
+				return false;
+			variable.value = value;
+			ts3server_freeMemory(value);
+		}
+		return true;
+	}
+
+	static unsigned int writeVariable(TS3Variables* target, const SnapshotVariable& variable) {
+		if (variable.type == SNAPSHOT_INT)
+			return ts3server_setVariableAsInt(target, variable.flag, static_cast<int>(std::strtol(variable.value.c_str(), nullptr, 10)));
+		if (variable.type == SNAPSHOT_UINT64)
+			return ts3server_setVariableAsUInt64(target, variable.flag, std::strtoull(variable.value.c_str(), nullptr, 10));
+		return ts3server_setVariableAsString(target, variable.flag, variable.value.c_str());
+	}
+
+private:
+	static bool readServerVariable(uint64 serverID, SnapshotVariable& variable) {
+		const VirtualServerProperties flag = static_cast<VirtualServerProperties>(variable.flag);
+		if (variable.type == SNAPSHOT_INT) {
+			int value = 0;
+			if (ts3server_getVirtualServerVariableAsInt(serverID, flag, &value) != ERROR_ok)
+				return false;
+			variable.value = std::to_string(value);
+		} else if (variable.type == SNAPSHOT_UINT64) {
+			uint64 value = 0;
+			if (ts3server_getVirtualServerVariableAsUInt64(serverID, flag, &value) != ERROR_ok)
+				return false;
+			variable.value = std::to_string(value);
+		} else {
+			char* value = nullptr;
+			if (ts3server_getVirtualServerVariableAsString(serverID, flag, &value) != ERROR_ok)
+				return false;
+			variable.value = value;
+			ts3server_freeMemory(value);
+		}
+		return true;
+	}
+
+	/*the channel list has no defined order, sub channels must follow their parent in the creation parameters*/
+	static std::vector<ChannelSnapshot> parentsFirst(std::vector<ChannelSnapshot> channels) {
+		std::unordered_map<uint64, std::vector<size_t>> children;
+		std::unordered_set<uint64> known;
+		for (const ChannelSnapshot& channel : channels)
+			known.insert(channel.channelID);
+		std::vector<size_t> pending;
+		for (size_t i = 0; i < channels.size(); ++i) {
+			if (channels[i].parentChannelID == 0 || known.count(channels[i].parentChannelID) == 0)
+				pending.push_back(i);
+			else
+				children[channels[i].parentChannelID].push_back(i);
+		}
+		std::vector<ChannelSnapshot> ordered;
+		ordered.reserve(channels.size());
+		for (size_t next = 0; next < pending.size(); ++next) {
+			ChannelSnapshot& channel = channels[pending[next]];
+			const auto sub = children.find(channel.channelID);
+			if (sub != children.end())
+				pending.insert(pending.end(), sub->second.begin(), sub->second.end());
+			ordered.push_back(std::move(channel));
+		}
+		return ordered;
+	}
+
+	/*every character isspace() matches is escaped, parse() splits fields with operator>>*/
+	static std::string escape(const std::string& value) {
+		if (value.empty())
+			return "\\0";
+		std::string escaped;
+		for (char c : value) {
+			if (c == '\\')
+				escaped += "\\\\";
+			else if (c == ' ')
+				escaped += "\\s";
+			else if (c == '\n')
+				escaped += "\\n";
+			else if (c == '\r')
+				escaped += "\\r";
+			else if (c == '\t')
+				escaped += "\\t";
+			else if (c == '\v')
+				escaped += "\\v";
+			else if (c == '\f')
+				escaped += "\\f";
+			else
+				escaped += c;
+		}
+		return escaped;
+	}
+
+	static std::string unescape(const std::string& value) {
+		if (value == "\\0")
+			return std::string();
+		std::string plain;
+		for (size_t i = 0; i < value.size(); ++i) {
+			if (value[i] != '\\' || i + 1 == value.size()) {
+				plain += value[i];
+				continue;
+			}
+			const char c = value[++i];
+			plain += c == 's' ? ' ' : c == 'n' ? '\n' : c == 'r' ? '\r' : c == 't' ? '\t' : c == 'v' ? '\v' : c == 'f' ? '\f' : c;
+		}
+		return plain;
+	}
+};
+
+} // namespace ts3ext
+
+#endif //TEAMSPEAK_EXT_VIRTUAL_SERVER_SNAPSHOT_H